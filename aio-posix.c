@@ -17,6 +17,15 @@
 #include "block/block.h"
 #include "qemu/queue.h"
 #include "qemu/sockets.h"
+#include "qemu/timer.h"
+#include "qemu/atomic.h"
+#include "trace.h"
+#ifdef CONFIG_EPOLL
+#include <sys/epoll.h>
+#endif
+
+/* Busy-polling window used the first time polling pays off */
+#define AIO_POLL_GROW_START_NS 4000
 
 struct AioHandler
 {
@@ -24,12 +33,143 @@ struct AioHandler
     IOHandler *io_read;
     IOHandler *io_write;
     AioFlushHandler *io_flush;
+    AioPollFn *io_poll;
     int deleted;
     int pollfds_idx;
+    bool epoll_idle;    /* left out of epoll while io_flush returns 0 */
     void *opaque;
     QLIST_ENTRY(AioHandler) node;
 };
 
+#ifdef CONFIG_EPOLL
+
+/* Maximum number of ready handlers collected by one epoll_wait() */
+#define AIO_EPOLL_MAX_EVENTS 128
+
+/* Once a handler cannot be added to epoll (e.g. a regular file fd), the
+ * context goes back to rebuilding pollfds for good.
+ */
+static void aio_epoll_disable(AioContext *ctx)
+{
+    ctx->epoll_enabled = false;
+    close(ctx->epollfd);
+    ctx->epollfd = -1;
+}
+
+static void aio_epoll_update(AioContext *ctx, AioHandler *node, bool is_new)
+{
+    struct epoll_event event;
+    int r;
+
+    if (!ctx->epoll_enabled || node->epoll_idle) {
+        return;
+    }
+
+    /* GPollFD and epoll share the values of the POLL* flags */
+    event.data.ptr = node;
+    event.events = node->pfd.events;
+    if (node->deleted || !node->pfd.events) {
+        r = epoll_ctl(ctx->epollfd, EPOLL_CTL_DEL, node->pfd.fd, &event);
+    } else {
+        r = epoll_ctl(ctx->epollfd, is_new ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+                      node->pfd.fd, &event);
+    }
+    if (r < 0) {
+        aio_epoll_disable(ctx);
+    }
+}
+
+/*
+ * Handlers whose io_flush returns 0 have no requests in flight and are not
+ * polled, like with g_poll().  They are taken out of the epoll set, because
+ * epoll would keep reporting their events (EPOLLHUP even with no events).
+ */
+static void aio_epoll_set_idle(AioContext *ctx, AioHandler *node, bool idle)
+{
+    struct epoll_event event;
+    int r;
+
+    if (!ctx->epoll_enabled || node->epoll_idle == idle || node->deleted ||
+        !node->pfd.events) {
+        return;
+    }
+
+    event.data.ptr = node;
+    event.events = node->pfd.events;
+    r = epoll_ctl(ctx->epollfd, idle ? EPOLL_CTL_DEL : EPOLL_CTL_ADD,
+                  node->pfd.fd, &event);
+    if (r < 0) {
+        aio_epoll_disable(ctx);
+        return;
+    }
+    node->epoll_idle = idle;
+}
+
+static int aio_epoll(AioContext *ctx, bool blocking)
+{
+    struct epoll_event events[AIO_EPOLL_MAX_EVENTS];
+    AioHandler *node;
+    int i, ret;
+
+    do {
+        ret = epoll_wait(ctx->epollfd, events, ARRAY_SIZE(events),
+                         blocking ? -1 : 0);
+    } while (ret < 0 && errno == EINTR);
+
+    for (i = 0; i < ret; i++) {
+        node = events[i].data.ptr;
+        node->pfd.revents = events[i].events;
+    }
+    return ret;
+}
+
+void aio_context_setup(AioContext *ctx)
+{
+#ifdef CONFIG_EPOLL_CREATE1
+    ctx->epollfd = epoll_create1(EPOLL_CLOEXEC);
+#else
+    ctx->epollfd = epoll_create(AIO_EPOLL_MAX_EVENTS);
+    if (ctx->epollfd >= 0) {
+        qemu_set_cloexec(ctx->epollfd);
+    }
+#endif
+    ctx->epoll_enabled = ctx->epollfd >= 0;
+}
+
+void aio_context_destroy(AioContext *ctx)
+{
+    if (ctx->epoll_enabled) {
+        aio_epoll_disable(ctx);
+    }
+}
+
+#else
+
+static void aio_epoll_update(AioContext *ctx, AioHandler *node, bool is_new)
+{
+}
+
+static void aio_epoll_set_idle(AioContext *ctx, AioHandler *node, bool idle)
+{
+}
+
+static int aio_epoll(AioContext *ctx, bool blocking)
+{
+    abort();
+}
+
+void aio_context_setup(AioContext *ctx)
+{
+    ctx->epollfd = -1;
+    ctx->epoll_enabled = false;
+}
+
+void aio_context_destroy(AioContext *ctx)
+{
+}
+
+#endif
+
 static AioHandler *find_aio_handler(AioContext *ctx, int fd)
 {
     AioHandler *node;
@@ -51,6 +191,7 @@ void aio_set_fd_handler(AioContext *ctx,
                         void *opaque)
 {
     AioHandler *node;
+    bool is_new = false;
 
     node = find_aio_handler(ctx, fd);
 
@@ -63,11 +204,14 @@ void aio_set_fd_handler(AioContext *ctx,
             if (ctx->walking_handlers) {
                 node->deleted = 1;
                 node->pfd.revents = 0;
+                aio_epoll_update(ctx, node, false);
             } else {
                 /* Otherwise, delete it for real.  We can't just mark it as
                  * deleted because deleted nodes are only cleaned up after
                  * releasing the walking_handlers lock.
                  */
+                node->deleted = 1;
+                aio_epoll_update(ctx, node, false);
                 QLIST_REMOVE(node, node);
                 g_free(node);
             }
@@ -80,6 +224,7 @@ void aio_set_fd_handler(AioContext *ctx,
             QLIST_INSERT_HEAD(&ctx->aio_handlers, node, node);
 
             g_source_add_poll(&ctx->source, &node->pfd);
+            is_new = true;
         }
         /* Update handler with latest information */
         node->io_read = io_read;
@@ -90,6 +235,7 @@ void aio_set_fd_handler(AioContext *ctx,
 
         node->pfd.events = (io_read ? G_IO_IN | G_IO_HUP | G_IO_ERR : 0);
         node->pfd.events |= (io_write ? G_IO_OUT | G_IO_ERR : 0);
+        aio_epoll_update(ctx, node, is_new);
     }
 
     aio_notify(ctx);
@@ -105,6 +251,21 @@ void aio_set_event_notifier(AioContext *ctx,
                        (AioFlushHandler *)io_flush, notifier);
 }
 
+void aio_set_fd_poll(AioContext *ctx, int fd, AioPollFn *io_poll)
+{
+    AioHandler *node = find_aio_handler(ctx, fd);
+
+    assert(node);
+    node->io_poll = io_poll;
+}
+
+void aio_set_event_notifier_poll(AioContext *ctx,
+                                 EventNotifier *notifier,
+                                 AioPollFn *io_poll)
+{
+    aio_set_fd_poll(ctx, event_notifier_get_fd(notifier), io_poll);
+}
+
 bool aio_pending(AioContext *ctx)
 {
     AioHandler *node;
@@ -169,11 +330,80 @@ static bool aio_dispatch(AioContext *ctx)
     return progress;
 }
 
+/* Give every io_poll handler a chance to make progress without a syscall */
+static bool run_poll_handlers_once(AioContext *ctx)
+{
+    AioHandler *node;
+    bool progress = false;
+
+    ctx->walking_handlers++;
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+        if (!node->deleted && node->io_poll && node->io_poll(node->opaque)) {
+            progress = true;
+        }
+    }
+    ctx->walking_handlers--;
+
+    return progress;
+}
+
+/*
+ * Spin on the io_poll handlers for up to ctx->poll_ns before blocking.  The
+ * handlers check in-memory state such as a virtqueue avail index or the
+ * linux-aio completion ring, so an event that arrives within the window is
+ * picked up without a round trip through the kernel.
+ */
+static bool run_poll_handlers(AioContext *ctx)
+{
+    int64_t deadline = get_clock() + ctx->poll_ns;
+
+    do {
+        if (run_poll_handlers_once(ctx)) {
+            ctx->poll_hits++;
+            return true;
+        }
+        /* A bottom half or aio_notify() must not wait for the window to
+         * expire; ctx->notifier is readable and will be dispatched below */
+        if (atomic_read(&ctx->notified)) {
+            return false;
+        }
+    } while (get_clock() < deadline);
+
+    ctx->poll_misses++;
+    return false;
+}
+
+/*
+ * Adapt the polling window to how long aio_poll() had to block after a miss:
+ * if the event came shortly after the window expired, a longer window would
+ * have caught it; if it took longer than poll_max_ns, spinning was wasted.
+ */
+static void adjust_poll_ns(AioContext *ctx, int64_t block_ns)
+{
+    int64_t old = ctx->poll_ns;
+
+    if (block_ns <= ctx->poll_ns) {
+        return;
+    } else if (block_ns > ctx->poll_max_ns) {
+        ctx->poll_ns /= 2;
+        if (ctx->poll_ns < AIO_POLL_GROW_START_NS) {
+            ctx->poll_ns = 0;
+        }
+        trace_aio_poll_shrink(ctx, old, ctx->poll_ns);
+    } else if (ctx->poll_ns < ctx->poll_max_ns) {
+        ctx->poll_ns = ctx->poll_ns ? ctx->poll_ns * 2
+                                    : AIO_POLL_GROW_START_NS;
+        ctx->poll_ns = MIN(ctx->poll_ns, ctx->poll_max_ns);
+        trace_aio_poll_grow(ctx, old, ctx->poll_ns);
+    }
+}
+
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandler *node;
     int ret;
     bool busy, progress;
+    int64_t start = 0;
 
     progress = false;
 
@@ -197,7 +427,9 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     ctx->walking_handlers++;
 
-    g_array_set_size(ctx->pollfds, 0);
+    if (!ctx->epoll_enabled) {
+        g_array_set_size(ctx->pollfds, 0);
+    }
 
     /* fill pollfds */
     busy = false;
@@ -210,11 +442,13 @@ bool aio_poll(AioContext *ctx, bool blocking)
          */
         if (!node->deleted && node->io_flush) {
             if (node->io_flush(node->opaque) == 0) {
+                aio_epoll_set_idle(ctx, node, true);
                 continue;
             }
             busy = true;
         }
-        if (!node->deleted && node->pfd.events) {
+        aio_epoll_set_idle(ctx, node, false);
+        if (!ctx->epoll_enabled && !node->deleted && node->pfd.events) {
             GPollFD pfd = {
                 .fd = node->pfd.fd,
                 .events = node->pfd.events,
@@ -231,20 +465,37 @@ bool aio_poll(AioContext *ctx, bool blocking)
         return progress;
     }
 
+    if (blocking && ctx->poll_max_ns) {
+        if (ctx->poll_ns && run_poll_handlers(ctx)) {
+            return true;
+        }
+        start = get_clock();
+    }
+
     /* wait until next event */
-    ret = g_poll((GPollFD *)ctx->pollfds->data,
-                 ctx->pollfds->len,
-                 blocking ? -1 : 0);
+    if (ctx->epoll_enabled) {
+        ret = aio_epoll(ctx, blocking);
+    } else {
+        ret = g_poll((GPollFD *)ctx->pollfds->data,
+                     ctx->pollfds->len,
+                     blocking ? -1 : 0);
+        if (ret > 0) {
+            QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+                if (node->pollfds_idx != -1) {
+                    GPollFD *pfd = &g_array_index(ctx->pollfds, GPollFD,
+                                                  node->pollfds_idx);
+                    node->pfd.revents = pfd->revents;
+                }
+            }
+        }
+    }
+
+    if (start) {
+        adjust_poll_ns(ctx, get_clock() - start);
+    }
 
     /* if we have any readable fds, dispatch event */
     if (ret > 0) {
-        QLIST_FOREACH(node, &ctx->aio_handlers, node) {
-            if (node->pollfds_idx != -1) {
-                GPollFD *pfd = &g_array_index(ctx->pollfds, GPollFD,
-                                              node->pollfds_idx);
-                node->pfd.revents = pfd->revents;
-            }
-        }
         if (aio_dispatch(ctx)) {
             progress = true;
         }
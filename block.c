@@ -92,6 +92,11 @@ static bool bdrv_exceed_iops_limits(BlockDriverState *bs, bool is_write,
         double elapsed_time, uint64_t *wait);
 static bool bdrv_exceed_io_limits(BlockDriverState *bs, int nb_sectors,
         bool is_write, int64_t *wait);
+static void bdrv_set_named_dirty_bitmaps(BlockDriverState *bs,
+                                         int64_t cur_sector, int nr_sectors);
+static void bdrv_release_all_dirty_bitmaps(BlockDriverState *bs);
+static void bdrv_resize_dirty_bitmaps(BlockDriverState *bs,
+                                      int64_t old_nb_sectors);
 
 static QTAILQ_HEAD(, BlockDriverState) bdrv_states =
     QTAILQ_HEAD_INITIALIZER(bdrv_states);
@@ -142,8 +147,12 @@ void bdrv_io_limits_disable(BlockDriverState *bs)
 static void bdrv_block_timer(void *opaque)
 {
     BlockDriverState *bs = opaque;
+    AioContext *aio_context = bdrv_get_aio_context(bs);
 
+    /* The timer runs in the main loop even if bs has its own AioContext */
+    aio_context_acquire(aio_context);
     qemu_co_enter_next(&bs->throttled_reqs);
+    aio_context_release(aio_context);
 }
 
 void bdrv_io_limits_enable(BlockDriverState *bs)
@@ -306,6 +315,8 @@ BlockDriverState *bdrv_new(const char *device_name)
     bdrv_iostatus_disable(bs);
     notifier_list_init(&bs->close_notifiers);
     notifier_with_return_list_init(&bs->before_write_notifiers);
+    QLIST_INIT(&bs->dirty_bitmaps);
+    bs->aio_context = qemu_get_aio_context();
 
     return bs;
 }
@@ -1386,6 +1397,7 @@ void bdrv_close(BlockDriverState *bs)
             bs->backing_hd = NULL;
         }
         bs->drv->bdrv_close(bs);
+        bdrv_release_all_dirty_bitmaps(bs);
         g_free(bs->opaque);
 #ifdef _WIN32
         if (bs->is_temporary) {
@@ -1424,7 +1436,11 @@ void bdrv_close_all(void)
     BlockDriverState *bs;
 
     QTAILQ_FOREACH(bs, &bdrv_states, list) {
+        AioContext *aio_context = bdrv_get_aio_context(bs);
+
+        aio_context_acquire(aio_context);
         bdrv_close(bs);
+        aio_context_release(aio_context);
     }
 }
 
@@ -1452,9 +1468,23 @@ void bdrv_drain_all(void)
          * a busy wait.
          */
         QTAILQ_FOREACH(bs, &bdrv_states, list) {
+            AioContext *aio_context = bdrv_get_aio_context(bs);
+
+            aio_context_acquire(aio_context);
             while (qemu_co_enter_next(&bs->throttled_reqs)) {
                 busy = true;
             }
+
+            /* Requests of devices with their own event loop complete
+             * there.  While we hold the AioContext its thread is not
+             * polling, so do it on its behalf.
+             */
+            if (aio_context != qemu_get_aio_context() &&
+                !QLIST_EMPTY(&bs->tracked_requests)) {
+                aio_poll(aio_context, true);
+                busy = true;
+            }
+            aio_context_release(aio_context);
         }
     } while (busy);
 
@@ -1516,6 +1546,7 @@ static void bdrv_move_feature_fields(BlockDriverState *bs_dest,
 
     /* dirty bitmap */
     bs_dest->dirty_bitmap       = bs_src->dirty_bitmap;
+    bs_dest->dirty_bitmaps      = bs_src->dirty_bitmaps;
 
     /* job */
     bs_dest->in_use             = bs_src->in_use;
@@ -1546,6 +1577,7 @@ void bdrv_swap(BlockDriverState *bs_new, BlockDriverState *bs_old)
     /* bs_new must be anonymous and shouldn't have anything fancy enabled */
     assert(bs_new->device_name[0] == '\0');
     assert(bs_new->dirty_bitmap == NULL);
+    assert(QLIST_EMPTY(&bs_new->dirty_bitmaps));
     assert(bs_new->job == NULL);
     assert(bs_new->dev == NULL);
     assert(bs_new->in_use == 0);
@@ -2226,7 +2258,7 @@ static int bdrv_rwv_co(BlockDriverState *bs, int64_t sector_num,
         co = qemu_coroutine_create(bdrv_rw_co_entry);
         qemu_coroutine_enter(co, &rwco);
         while (rwco.ret == NOT_DONE) {
-            qemu_aio_wait();
+            aio_poll(bdrv_get_aio_context(bs), true);
         }
     }
     return rwco.ret;
@@ -2653,9 +2685,7 @@ static int coroutine_fn bdrv_co_do_writev(BlockDriverState *bs,
         ret = bdrv_co_flush(bs);
     }
 
-    if (bs->dirty_bitmap) {
-        bdrv_set_dirty(bs, sector_num, nb_sectors);
-    }
+    bdrv_set_dirty(bs, sector_num, nb_sectors);
 
     if (bs->wr_highest_sector < sector_num + nb_sectors - 1) {
         bs->wr_highest_sector = sector_num + nb_sectors - 1;
@@ -2689,6 +2719,7 @@ int coroutine_fn bdrv_co_write_zeroes(BlockDriverState *bs,
 int bdrv_truncate(BlockDriverState *bs, int64_t offset)
 {
     BlockDriver *drv = bs->drv;
+    int64_t old_nb_sectors;
     int ret;
     if (!drv)
         return -ENOMEDIUM;
@@ -2698,9 +2729,11 @@ int bdrv_truncate(BlockDriverState *bs, int64_t offset)
         return -EACCES;
     if (bdrv_in_use(bs))
         return -EBUSY;
+    old_nb_sectors = bs->total_sectors;
     ret = drv->bdrv_truncate(bs, offset);
     if (ret == 0) {
         ret = refresh_total_sectors(bs, offset >> BDRV_SECTOR_BITS);
+        bdrv_resize_dirty_bitmaps(bs, old_nb_sectors);
         bdrv_dev_resize_cb(bs);
     }
     return ret;
@@ -2936,7 +2969,12 @@ int bdrv_flush_all(void)
     int result = 0;
 
     QTAILQ_FOREACH(bs, &bdrv_states, list) {
-        int ret = bdrv_flush(bs);
+        AioContext *aio_context = bdrv_get_aio_context(bs);
+        int ret;
+
+        aio_context_acquire(aio_context);
+        ret = bdrv_flush(bs);
+        aio_context_release(aio_context);
         if (ret < 0 && !result) {
             result = ret;
         }
@@ -3041,7 +3079,7 @@ int bdrv_is_allocated(BlockDriverState *bs, int64_t sector_num, int nb_sectors,
     co = qemu_coroutine_create(bdrv_is_allocated_co_entry);
     qemu_coroutine_enter(co, &data);
     while (!data.done) {
-        qemu_aio_wait();
+        aio_poll(bdrv_get_aio_context(bs), true);
     }
     return data.ret;
 }
@@ -3130,7 +3168,7 @@ int bdrv_is_allocated_above(BlockDriverState *top, BlockDriverState *base,
     co = qemu_coroutine_create(bdrv_is_allocated_above_co_entry);
     qemu_coroutine_enter(co, &data);
     while (!data.done) {
-        qemu_aio_wait();
+        aio_poll(bdrv_get_aio_context(top), true);
     }
     return data.ret;
 }
@@ -3163,6 +3201,7 @@ int bdrv_write_compressed(BlockDriverState *bs, int64_t sector_num,
         return -EIO;
 
     assert(!bs->dirty_bitmap);
+    bdrv_set_dirty(bs, sector_num, nb_sectors);
 
     return drv->bdrv_write_compressed(bs, sector_num, buf, nb_sectors);
 }
@@ -3553,6 +3592,7 @@ int bdrv_aio_multiwrite(BlockDriverState *bs, BlockRequest *reqs, int num_reqs)
 
     // Check for mergable requests
     num_reqs = multiwrite_merge(bs, reqs, num_reqs, mcb);
+    bdrv_acct_merge_done(bs, BDRV_ACCT_WRITE, mcb->num_callbacks - num_reqs);
 
     trace_bdrv_aio_multiwrite(mcb, mcb->num_callbacks, num_reqs);
 
@@ -3789,7 +3829,7 @@ static BlockDriverAIOCB *bdrv_aio_rw_vector(BlockDriverState *bs,
     acb->is_write = is_write;
     acb->qiov = qiov;
     acb->bounce = qemu_blockalign(bs, qiov->size);
-    acb->bh = qemu_bh_new(bdrv_aio_bh_cb, acb);
+    acb->bh = aio_bh_new(bdrv_get_aio_context(bs), bdrv_aio_bh_cb, acb);
 
     if (is_write) {
         qemu_iovec_to_buf(acb->qiov, 0, acb->bounce, qiov->size);
@@ -3834,7 +3874,7 @@ static void bdrv_aio_co_cancel_em(BlockDriverAIOCB *blockacb)
 
     acb->done = &done;
     while (!done) {
-        qemu_aio_wait();
+        aio_poll(bdrv_get_aio_context(blockacb->bs), true);
     }
 }
 
@@ -3871,7 +3911,7 @@ static void coroutine_fn bdrv_co_do_rw(void *opaque)
             acb->req.nb_sectors, acb->req.qiov, 0);
     }
 
-    acb->bh = qemu_bh_new(bdrv_co_em_bh, acb);
+    acb->bh = aio_bh_new(bdrv_get_aio_context(bs), bdrv_co_em_bh, acb);
     qemu_bh_schedule(acb->bh);
 }
 
@@ -3905,7 +3945,7 @@ static void coroutine_fn bdrv_aio_flush_co_entry(void *opaque)
     BlockDriverState *bs = acb->common.bs;
 
     acb->req.error = bdrv_co_flush(bs);
-    acb->bh = qemu_bh_new(bdrv_co_em_bh, acb);
+    acb->bh = aio_bh_new(bdrv_get_aio_context(bs), bdrv_co_em_bh, acb);
     qemu_bh_schedule(acb->bh);
 }
 
@@ -3932,7 +3972,7 @@ static void coroutine_fn bdrv_aio_discard_co_entry(void *opaque)
     BlockDriverState *bs = acb->common.bs;
 
     acb->req.error = bdrv_co_discard(bs, acb->req.sector, acb->req.nb_sectors);
-    acb->bh = qemu_bh_new(bdrv_co_em_bh, acb);
+    acb->bh = aio_bh_new(bdrv_get_aio_context(bs), bdrv_co_em_bh, acb);
     qemu_bh_schedule(acb->bh);
 }
 
@@ -4136,6 +4176,19 @@ void bdrv_clear_incoming_migration_all(void)
     }
 }
 
+/*
+ * Called on the migration source once the destination has taken over the
+ * images, so that closing them no longer writes back metadata.
+ */
+void bdrv_set_incoming_migration_all(void)
+{
+    BlockDriverState *bs;
+
+    QTAILQ_FOREACH(bs, &bdrv_states, list) {
+        bs->open_flags |= BDRV_O_INCOMING;
+    }
+}
+
 int bdrv_flush(BlockDriverState *bs)
 {
     Coroutine *co;
@@ -4151,7 +4204,7 @@ int bdrv_flush(BlockDriverState *bs)
         co = qemu_coroutine_create(bdrv_flush_co_entry);
         qemu_coroutine_enter(co, &rwco);
         while (rwco.ret == NOT_DONE) {
-            qemu_aio_wait();
+            aio_poll(bdrv_get_aio_context(bs), true);
         }
     }
 
@@ -4180,6 +4233,9 @@ int coroutine_fn bdrv_co_discard(BlockDriverState *bs, int64_t sector_num,
         bdrv_reset_dirty(bs, sector_num, nb_sectors);
     }
 
+    /* Named bitmaps track guest-visible changes, which discard may cause */
+    bdrv_set_named_dirty_bitmaps(bs, sector_num, nb_sectors);
+
     /* Do nothing if disabled.  */
     if (!(bs->open_flags & BDRV_O_UNMAP)) {
         return 0;
@@ -4223,7 +4279,7 @@ int bdrv_discard(BlockDriverState *bs, int64_t sector_num, int nb_sectors)
         co = qemu_coroutine_create(bdrv_discard_co_entry);
         qemu_coroutine_enter(co, &rwco);
         while (rwco.ret == NOT_DONE) {
-            qemu_aio_wait();
+            aio_poll(bdrv_get_aio_context(bs), true);
         }
     }
 
@@ -4373,10 +4429,23 @@ void bdrv_dirty_iter_init(BlockDriverState *bs, HBitmapIter *hbi)
     hbitmap_iter_init(hbi, bs->dirty_bitmap, 0);
 }
 
+static void bdrv_set_named_dirty_bitmaps(BlockDriverState *bs,
+                                         int64_t cur_sector, int nr_sectors)
+{
+    BdrvDirtyBitmap *bitmap;
+
+    QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+        hbitmap_set(bitmap->bitmap, cur_sector, nr_sectors);
+    }
+}
+
 void bdrv_set_dirty(BlockDriverState *bs, int64_t cur_sector,
                     int nr_sectors)
 {
-    hbitmap_set(bs->dirty_bitmap, cur_sector, nr_sectors);
+    if (bs->dirty_bitmap) {
+        hbitmap_set(bs->dirty_bitmap, cur_sector, nr_sectors);
+    }
+    bdrv_set_named_dirty_bitmaps(bs, cur_sector, nr_sectors);
 }
 
 void bdrv_reset_dirty(BlockDriverState *bs, int64_t cur_sector,
@@ -4394,6 +4463,232 @@ int64_t bdrv_get_dirty_count(BlockDriverState *bs)
     }
 }
 
+static HBitmap *bdrv_alloc_dirty_hbitmap(BlockDriverState *bs,
+                                         int64_t granularity)
+{
+    int64_t bitmap_size = bdrv_getlength(bs) >> BDRV_SECTOR_BITS;
+
+    granularity >>= BDRV_SECTOR_BITS;
+    return hbitmap_alloc(bitmap_size, ctz64(granularity));
+}
+
+/* Set all bits of @src in @dest, which must have the same granularity */
+static void bdrv_merge_dirty_hbitmap(HBitmap *dest, const HBitmap *src,
+                                     int64_t nb_sectors)
+{
+    HBitmapIter hbi;
+    int64_t sector;
+
+    assert(hbitmap_granularity(dest) == hbitmap_granularity(src));
+
+    hbitmap_iter_init(&hbi, src, 0);
+    while ((sector = hbitmap_iter_next(&hbi)) >= 0 && sector < nb_sectors) {
+        hbitmap_set(dest, sector, 1);
+    }
+}
+
+/*
+ * Named dirty bitmaps record every write to @bs until they are released,
+ * independently of the anonymous bitmap used by block migration and mirroring.
+ * @granularity is in bytes and must be a power of two of at least 512.
+ */
+BdrvDirtyBitmap *bdrv_create_dirty_bitmap(BlockDriverState *bs,
+                                          int64_t granularity,
+                                          const char *name, Error **errp)
+{
+    BdrvDirtyBitmap *bitmap;
+
+    assert((granularity & (granularity - 1)) == 0);
+    assert(granularity >= BDRV_SECTOR_SIZE);
+
+    if (!bs->drv) {
+        error_set(errp, QERR_DEVICE_HAS_NO_MEDIUM, bs->device_name);
+        return NULL;
+    }
+    if (bdrv_find_dirty_bitmap(bs, name)) {
+        error_setg(errp, "Dirty bitmap '%s' already exists", name);
+        return NULL;
+    }
+
+    bitmap = g_malloc0(sizeof(*bitmap));
+    bitmap->name = g_strdup(name);
+    bitmap->bitmap = bdrv_alloc_dirty_hbitmap(bs, granularity);
+    QLIST_INSERT_HEAD(&bs->dirty_bitmaps, bitmap, list);
+
+    return bitmap;
+}
+
+BdrvDirtyBitmap *bdrv_find_dirty_bitmap(BlockDriverState *bs,
+                                        const char *name)
+{
+    BdrvDirtyBitmap *bitmap;
+
+    QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+        if (!strcmp(bitmap->name, name)) {
+            return bitmap;
+        }
+    }
+    return NULL;
+}
+
+int64_t bdrv_dirty_bitmap_granularity(BdrvDirtyBitmap *bitmap)
+{
+    return (int64_t) BDRV_SECTOR_SIZE << hbitmap_granularity(bitmap->bitmap);
+}
+
+/*
+ * Ask the image format to keep @bitmap across restarts.  Its contents are
+ * written to the image when @bs is closed.
+ */
+void bdrv_dirty_bitmap_make_persistent(BlockDriverState *bs,
+                                       BdrvDirtyBitmap *bitmap, Error **errp)
+{
+    int ret;
+
+    if (bitmap->persistent) {
+        return;
+    }
+    if (!bs->drv->bdrv_update_dirty_bitmaps) {
+        error_set(errp, QERR_BLOCK_FORMAT_FEATURE_NOT_SUPPORTED,
+                  bs->drv->format_name, bs->device_name,
+                  "persistent dirty bitmaps");
+        return;
+    }
+    if (bs->read_only) {
+        error_set(errp, QERR_DEVICE_IS_READ_ONLY, bs->device_name);
+        return;
+    }
+
+    bitmap->persistent = true;
+    ret = bs->drv->bdrv_update_dirty_bitmaps(bs);
+    if (ret < 0) {
+        bitmap->persistent = false;
+        error_setg_errno(errp, -ret, "Could not store dirty bitmap '%s'",
+                         bitmap->name);
+    }
+}
+
+static void bdrv_free_dirty_bitmap(BdrvDirtyBitmap *bitmap)
+{
+    QLIST_REMOVE(bitmap, list);
+    hbitmap_free(bitmap->bitmap);
+    g_free(bitmap->name);
+    g_free(bitmap);
+}
+
+void bdrv_release_dirty_bitmap(BlockDriverState *bs, BdrvDirtyBitmap *bitmap)
+{
+    bool persistent = bitmap->persistent;
+
+    assert(!bitmap->frozen);
+    bdrv_free_dirty_bitmap(bitmap);
+
+    /* If the image cannot be updated, the bitmap comes back as completely
+     * dirty the next time it is opened, which is safe */
+    if (persistent && bs->drv && bs->drv->bdrv_update_dirty_bitmaps) {
+        bs->drv->bdrv_update_dirty_bitmaps(bs);
+    }
+}
+
+static void bdrv_release_all_dirty_bitmaps(BlockDriverState *bs)
+{
+    BdrvDirtyBitmap *bitmap;
+
+    while ((bitmap = QLIST_FIRST(&bs->dirty_bitmaps)) != NULL) {
+        assert(!bitmap->frozen);
+        bdrv_free_dirty_bitmap(bitmap);
+    }
+}
+
+void bdrv_clear_dirty_bitmap(BlockDriverState *bs, BdrvDirtyBitmap *bitmap)
+{
+    assert(!bitmap->frozen);
+    hbitmap_reset(bitmap->bitmap, 0, bdrv_getlength(bs) >> BDRV_SECTOR_BITS);
+}
+
+/* Everything past the old end of the image counts as changed */
+static void bdrv_resize_dirty_bitmaps(BlockDriverState *bs,
+                                      int64_t old_nb_sectors)
+{
+    BdrvDirtyBitmap *bitmap;
+    int64_t nb_sectors = bdrv_getlength(bs) >> BDRV_SECTOR_BITS;
+
+    QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+        HBitmap *old = bitmap->bitmap;
+
+        bitmap->bitmap = bdrv_alloc_dirty_hbitmap(bs,
+                                bdrv_dirty_bitmap_granularity(bitmap));
+        bdrv_merge_dirty_hbitmap(bitmap->bitmap, old, nb_sectors);
+        if (nb_sectors > old_nb_sectors) {
+            hbitmap_set(bitmap->bitmap, old_nb_sectors,
+                        nb_sectors - old_nb_sectors);
+        }
+        hbitmap_free(old);
+    }
+}
+
+/*
+ * Hand the bits recorded so far in @bitmap over to the caller and restart
+ * recording from a clean state.  The bitmap can neither be released nor
+ * cleared until bdrv_thaw_dirty_bitmap() is called.
+ */
+HBitmap *bdrv_freeze_dirty_bitmap(BlockDriverState *bs,
+                                  BdrvDirtyBitmap *bitmap)
+{
+    HBitmap *frozen = bitmap->bitmap;
+
+    assert(!bitmap->frozen);
+    bitmap->bitmap = bdrv_alloc_dirty_hbitmap(bs,
+                                bdrv_dirty_bitmap_granularity(bitmap));
+    bitmap->frozen = true;
+    return frozen;
+}
+
+/*
+ * Give back the part of a frozen generation that was not consumed, for
+ * example because the backup job that used it failed.  @unused may be NULL
+ * and is freed.
+ */
+void bdrv_thaw_dirty_bitmap(BlockDriverState *bs, BdrvDirtyBitmap *bitmap,
+                            HBitmap *unused)
+{
+    assert(bitmap->frozen);
+    if (unused) {
+        bdrv_merge_dirty_hbitmap(bitmap->bitmap, unused,
+                                 bdrv_getlength(bs) >> BDRV_SECTOR_BITS);
+        hbitmap_free(unused);
+    }
+    bitmap->frozen = false;
+}
+
+/*
+ * Let the driver hold back the requests that follow until bdrv_io_unplug(),
+ * so that a device model can submit everything it found in its queue with
+ * one system call.  Formats without their own queue pass this down to the
+ * protocol.
+ */
+void bdrv_io_plug(BlockDriverState *bs)
+{
+    BlockDriver *drv = bs->drv;
+
+    if (drv && drv->bdrv_io_plug) {
+        drv->bdrv_io_plug(bs);
+    } else if (bs->file) {
+        bdrv_io_plug(bs->file);
+    }
+}
+
+void bdrv_io_unplug(BlockDriverState *bs)
+{
+    BlockDriver *drv = bs->drv;
+
+    if (drv && drv->bdrv_io_unplug) {
+        drv->bdrv_io_unplug(bs);
+    } else if (bs->file) {
+        bdrv_io_unplug(bs->file);
+    }
+}
+
 void bdrv_set_in_use(BlockDriverState *bs, int in_use)
 {
     assert(bs->in_use != in_use);
@@ -4466,6 +4761,14 @@ bdrv_acct_done(BlockDriverState *bs, BlockAcctCookie *cookie)
     bs->total_time_ns[cookie->type] += get_clock() - cookie->start_time_ns;
 }
 
+void bdrv_acct_merge_done(BlockDriverState *bs, enum BlockAcctType type,
+                          int num_requests)
+{
+    assert(type < BDRV_MAX_IOTYPE);
+
+    bs->nr_merged[type] += num_requests;
+}
+
 void bdrv_img_create(const char *filename, const char *fmt,
                      const char *base_filename, const char *base_fmt,
                      char *options, uint64_t img_size, int flags,
@@ -4613,8 +4916,84 @@ out:
 
 AioContext *bdrv_get_aio_context(BlockDriverState *bs)
 {
-    /* Currently BlockDriverState always uses the main loop AioContext */
-    return qemu_get_aio_context();
+    return bs->aio_context;
+}
+
+static void bdrv_detach_aio_context(BlockDriverState *bs)
+{
+    if (!bs->drv) {
+        return;
+    }
+
+    if (bs->drv->bdrv_detach_aio_context) {
+        bs->drv->bdrv_detach_aio_context(bs);
+    }
+    if (bs->file) {
+        bdrv_detach_aio_context(bs->file);
+    }
+    if (bs->backing_hd) {
+        bdrv_detach_aio_context(bs->backing_hd);
+    }
+
+    bs->aio_context = NULL;
+}
+
+static void bdrv_attach_aio_context(BlockDriverState *bs,
+                                    AioContext *new_context)
+{
+    bs->aio_context = new_context;
+
+    if (!bs->drv) {
+        return;
+    }
+
+    if (bs->backing_hd) {
+        bdrv_attach_aio_context(bs->backing_hd, new_context);
+    }
+    if (bs->file) {
+        bdrv_attach_aio_context(bs->file, new_context);
+    }
+    if (bs->drv->bdrv_attach_aio_context) {
+        bs->drv->bdrv_attach_aio_context(bs, new_context);
+    }
+}
+
+bool bdrv_can_set_aio_context(BlockDriverState *bs)
+{
+    if (!bs->drv) {
+        return true;
+    }
+
+    /* Protocol drivers own file descriptors that are registered with an
+     * AioContext, so they must be able to move them.  Format drivers only
+     * go through bs->file and bs->backing_hd.
+     */
+    if (bs->drv->bdrv_file_open && !bs->drv->bdrv_attach_aio_context) {
+        return false;
+    }
+    if (bs->file && !bdrv_can_set_aio_context(bs->file)) {
+        return false;
+    }
+    if (bs->backing_hd && !bdrv_can_set_aio_context(bs->backing_hd)) {
+        return false;
+    }
+    return true;
+}
+
+void bdrv_set_aio_context(BlockDriverState *bs, AioContext *new_context)
+{
+    assert(bdrv_can_set_aio_context(bs));
+
+    bdrv_drain_all(); /* ensure there are no in-flight requests */
+
+    bdrv_detach_aio_context(bs);
+
+    /* This function executes in the old AioContext so acquire the new one in
+     * case it runs in a different thread.
+     */
+    aio_context_acquire(new_context);
+    bdrv_attach_aio_context(bs, new_context);
+    aio_context_release(new_context);
 }
 
 void bdrv_add_before_write_notifier(BlockDriverState *bs,
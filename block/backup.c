@@ -44,6 +44,10 @@ typedef struct BackupBlockJob {
     CoRwlock flush_rwlock;
     uint64_t sectors_read;
     HBitmap *bitmap;
+    /* MIRROR_SYNC_MODE_INCREMENTAL: the user's bitmap and the generation of
+     * it that this job copies */
+    BdrvDirtyBitmap *sync_bitmap;
+    HBitmap *copy_bitmap;
     QLIST_HEAD(, CowRequest) inflight_reqs;
 } BackupBlockJob;
 
@@ -84,6 +88,40 @@ static void cow_request_end(CowRequest *req)
     qemu_co_queue_restart_all(&req->wait_queue);
 }
 
+/* Does the frozen generation of the sync bitmap cover @cluster? */
+static bool backup_cluster_is_dirty(BackupBlockJob *job, int64_t cluster)
+{
+    int64_t sector = cluster * BACKUP_SECTORS_PER_CLUSTER;
+    int64_t end = MIN(sector + BACKUP_SECTORS_PER_CLUSTER,
+                      job->common.len / BDRV_SECTOR_SIZE);
+    int64_t step = MIN(1LL << hbitmap_granularity(job->copy_bitmap),
+                       BACKUP_SECTORS_PER_CLUSTER);
+
+    for (; sector < end; sector += step) {
+        if (hbitmap_get(job->copy_bitmap, sector)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Return the first sector at or after @sector that lies in a dirty chunk of
+ * the frozen generation, or -1 if there is none.
+ */
+static int64_t backup_next_dirty_sector(BackupBlockJob *job, int64_t sector)
+{
+    HBitmapIter hbi;
+    int64_t next;
+
+    if (sector >= job->common.len / BDRV_SECTOR_SIZE) {
+        return -1;
+    }
+
+    hbitmap_iter_init(&hbi, job->copy_bitmap, sector);
+    next = hbitmap_iter_next(&hbi);
+    return next < 0 ? -1 : MAX(next, sector);
+}
+
 static int coroutine_fn backup_do_cow(BlockDriverState *bs,
                                       int64_t sector_num, int nb_sectors,
                                       bool *error_is_read)
@@ -112,6 +150,10 @@ static int coroutine_fn backup_do_cow(BlockDriverState *bs,
             trace_backup_do_cow_skip(job, start);
             continue; /* already copied */
         }
+        if (job->copy_bitmap && !backup_cluster_is_dirty(job, start)) {
+            trace_backup_do_cow_skip(job, start);
+            continue; /* not changed since the last incremental backup */
+        }
 
         trace_backup_do_cow_process(job, start);
 
@@ -246,6 +288,24 @@ static void coroutine_fn backup_run(void *opaque)
     bdrv_set_on_error(target, on_target_error, on_target_error);
     bdrv_iostatus_enable(target);
 
+    if (job->sync_mode == MIRROR_SYNC_MODE_INCREMENTAL) {
+        int64_t sector, dirty = 0;
+
+        /* Clusters that are clean in the bitmap are never visited, account
+         * for them upfront so that progress still ends at len. */
+        sector = backup_next_dirty_sector(job, 0);
+        while (sector != -1) {
+            start = sector / BACKUP_SECTORS_PER_CLUSTER;
+            dirty += MIN(BACKUP_SECTORS_PER_CLUSTER,
+                         job->common.len / BDRV_SECTOR_SIZE -
+                         start * BACKUP_SECTORS_PER_CLUSTER);
+            sector = backup_next_dirty_sector(job,
+                    (start + 1) * BACKUP_SECTORS_PER_CLUSTER);
+        }
+        job->common.offset = job->common.len - dirty * BDRV_SECTOR_SIZE;
+        start = 0;
+    }
+
     bdrv_add_before_write_notifier(bs, &before_write);
 
     if (job->sync_mode == MIRROR_SYNC_MODE_NONE) {
@@ -256,6 +316,46 @@ static void coroutine_fn backup_run(void *opaque)
             qemu_coroutine_yield();
             job->common.busy = true;
         }
+    } else if (job->sync_mode == MIRROR_SYNC_MODE_INCREMENTAL) {
+        int64_t sector = backup_next_dirty_sector(job, 0);
+
+        while (sector != -1) {
+            bool error_is_read;
+
+            if (block_job_is_cancelled(&job->common)) {
+                break;
+            }
+
+            if (job->common.speed) {
+                uint64_t delay_ns = ratelimit_calculate_delay(
+                        &job->limit, job->sectors_read);
+                job->sectors_read = 0;
+                block_job_sleep_ns(&job->common, rt_clock, delay_ns);
+            } else {
+                block_job_sleep_ns(&job->common, rt_clock, 0);
+            }
+
+            if (block_job_is_cancelled(&job->common)) {
+                break;
+            }
+
+            start = sector / BACKUP_SECTORS_PER_CLUSTER;
+            ret = backup_do_cow(bs, start * BACKUP_SECTORS_PER_CLUSTER,
+                    BACKUP_SECTORS_PER_CLUSTER, &error_is_read);
+            if (ret < 0) {
+                /* Depending on error action, fail now or retry cluster */
+                BlockErrorAction action =
+                    backup_error_action(job, error_is_read, -ret);
+                if (action == BDRV_ACTION_REPORT) {
+                    break;
+                } else {
+                    continue;
+                }
+            }
+
+            sector = backup_next_dirty_sector(job,
+                    (start + 1) * BACKUP_SECTORS_PER_CLUSTER);
+        }
     } else {
         /* Both FULL and TOP SYNC_MODE's require copying.. */
         for (; start < end; start++) {
@@ -337,6 +437,17 @@ static void coroutine_fn backup_run(void *opaque)
 
     hbitmap_free(job->bitmap);
 
+    if (job->sync_bitmap) {
+        if (ret == 0 && !block_job_is_cancelled(&job->common)) {
+            bdrv_thaw_dirty_bitmap(bs, job->sync_bitmap, NULL);
+            hbitmap_free(job->copy_bitmap);
+        } else {
+            /* The target is incomplete, so the next incremental backup must
+             * copy these clusters again. */
+            bdrv_thaw_dirty_bitmap(bs, job->sync_bitmap, job->copy_bitmap);
+        }
+    }
+
     bdrv_iostatus_disable(target);
     bdrv_delete(target);
 
@@ -345,6 +456,7 @@ static void coroutine_fn backup_run(void *opaque)
 
 void backup_start(BlockDriverState *bs, BlockDriverState *target,
                   int64_t speed, MirrorSyncMode sync_mode,
+                  BdrvDirtyBitmap *sync_bitmap,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   BlockDriverCompletionFunc *cb, void *opaque,
@@ -355,6 +467,7 @@ void backup_start(BlockDriverState *bs, BlockDriverState *target,
     assert(bs);
     assert(target);
     assert(cb);
+    assert((sync_mode == MIRROR_SYNC_MODE_INCREMENTAL) == !!sync_bitmap);
 
     if ((on_source_error == BLOCKDEV_ON_ERROR_STOP ||
          on_source_error == BLOCKDEV_ON_ERROR_ENOSPC) &&
@@ -380,6 +493,12 @@ void backup_start(BlockDriverState *bs, BlockDriverState *target,
     job->on_target_error = on_target_error;
     job->target = target;
     job->sync_mode = sync_mode;
+    if (sync_bitmap) {
+        /* Writes from now on go to a new generation of the bitmap, they are
+         * left for the next incremental backup. */
+        job->sync_bitmap = sync_bitmap;
+        job->copy_bitmap = bdrv_freeze_dirty_bitmap(bs, sync_bitmap);
+    }
     job->common.len = len;
     job->common.co = qemu_coroutine_create(backup_run);
     qemu_coroutine_enter(job->common.co, job);
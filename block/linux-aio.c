@@ -12,6 +12,8 @@
 #include "qemu/queue.h"
 #include "block/raw-aio.h"
 #include "qemu/event_notifier.h"
+#include "qemu/atomic.h"
+#include "qemu/timer.h"
 
 #include <libaio.h>
 
@@ -25,6 +27,32 @@
  */
 #define MAX_EVENTS 128
 
+/* Maximum number of requests that are queued while the device is plugged */
+#define MAX_QUEUED_IO 128
+
+/* Initial and smallest busy-poll window */
+#define LAIO_POLL_START_NS 4000
+#define LAIO_POLL_MIN_NS   1000
+
+/*
+ * The kernel maps the completion ring at the address of the AIO context.
+ * As long as it carries this magic and no incompatible features, events
+ * can be consumed without entering the kernel.
+ */
+#define AIO_RING_MAGIC 0xa10a10a1
+
+struct aio_ring {
+    unsigned id;
+    unsigned nr;
+    unsigned head;
+    unsigned tail;
+    unsigned magic;
+    unsigned compat_features;
+    unsigned incompat_features;
+    unsigned header_length;
+    struct io_event io_events[0];
+};
+
 struct qemu_laiocb {
     BlockDriverAIOCB common;
     struct qemu_laio_state *ctx;
@@ -36,10 +64,23 @@ struct qemu_laiocb {
     QLIST_ENTRY(qemu_laiocb) node;
 };
 
+typedef struct {
+    struct iocb *iocbs[MAX_QUEUED_IO];
+    int plugged;
+    unsigned int idx;
+} LaioQueue;
+
 struct qemu_laio_state {
     io_context_t ctx;
     EventNotifier e;
     int count;
+
+    /* requests held back while plugged, submitted with one io_submit */
+    LaioQueue io_q;
+
+    /* adaptive busy-polling of the completion ring, 0 if disabled */
+    int64_t poll_max_ns;
+    int64_t poll_ns;
 };
 
 static inline ssize_t io_event_ret(struct io_event *ev)
@@ -77,19 +118,61 @@ static void qemu_laio_process_completion(struct qemu_laio_state *s,
     qemu_aio_release(laiocb);
 }
 
-static void qemu_laio_completion_cb(EventNotifier *e)
+static bool qemu_laio_has_ring(struct qemu_laio_state *s)
 {
-    struct qemu_laio_state *s = container_of(e, struct qemu_laio_state, e);
+    struct aio_ring *ring = (struct aio_ring *)s->ctx;
 
-    while (event_notifier_test_and_clear(&s->e)) {
-        struct io_event events[MAX_EVENTS];
-        struct timespec ts = { 0 };
-        int nevents, i;
+    return ring->magic == AIO_RING_MAGIC && ring->incompat_features == 0;
+}
+
+/*
+ * Copy up to @max completed events into @events, from the shared ring if
+ * possible and with io_getevents otherwise.
+ */
+static int qemu_laio_get_events(struct qemu_laio_state *s,
+                                struct io_event *events, int max)
+{
+    struct aio_ring *ring = (struct aio_ring *)s->ctx;
+    struct timespec ts = { 0 };
+    unsigned head, tail;
+    int nevents = 0;
 
+    if (!qemu_laio_has_ring(s)) {
         do {
-            nevents = io_getevents(s->ctx, MAX_EVENTS, MAX_EVENTS, events, &ts);
+            nevents = io_getevents(s->ctx, max, max, events, &ts);
         } while (nevents == -EINTR);
+        return nevents;
+    }
+
+    head = ring->head;
+    tail = atomic_read(&ring->tail);
+    smp_rmb();
+    while (head != tail && nevents < max) {
+        events[nevents++] = ring->io_events[head];
+        head = (head + 1) % ring->nr;
+    }
+
+    /* Hand the slots back to the kernel only after copying them */
+    smp_mb();
+    ring->head = head;
+    return nevents;
+}
+
+static bool qemu_laio_ring_is_empty(struct qemu_laio_state *s)
+{
+    struct aio_ring *ring = (struct aio_ring *)s->ctx;
+
+    return ring->head == atomic_read(&ring->tail);
+}
+
+/* Returns the number of requests completed */
+static int qemu_laio_reap(struct qemu_laio_state *s)
+{
+    struct io_event events[MAX_EVENTS];
+    int nevents, i, done = 0;
 
+    do {
+        nevents = qemu_laio_get_events(s, events, MAX_EVENTS);
         for (i = 0; i < nevents; i++) {
             struct iocb *iocb = events[i].obj;
             struct qemu_laiocb *laiocb =
@@ -98,9 +181,62 @@ static void qemu_laio_completion_cb(EventNotifier *e)
             laiocb->ret = io_event_ret(&events[i]);
             qemu_laio_process_completion(s, laiocb);
         }
+        done += MAX(nevents, 0);
+    } while (nevents == MAX_EVENTS);
+
+    return done;
+}
+
+/*
+ * With requests still in flight, spin on the completion ring for a while
+ * before going back to the eventfd: on a fast device the next completion
+ * is often only a few microseconds away, much less than a trip through
+ * the main loop.  The window doubles whenever spinning finds a completion
+ * and halves when it times out, between LAIO_POLL_MIN_NS and poll_max_ns.
+ */
+static void qemu_laio_poll(struct qemu_laio_state *s)
+{
+    while (s->count > 0) {
+        int64_t deadline = get_clock() + s->poll_ns;
+
+        while (qemu_laio_ring_is_empty(s)) {
+            if (get_clock() >= deadline) {
+                s->poll_ns = MAX(s->poll_ns / 2,
+                                 MIN(LAIO_POLL_MIN_NS, s->poll_max_ns));
+                return;
+            }
+        }
+
+        qemu_laio_reap(s);
+        s->poll_ns = MIN(s->poll_ns * 2, s->poll_max_ns);
     }
 }
 
+static void qemu_laio_completion_cb(EventNotifier *e)
+{
+    struct qemu_laio_state *s = container_of(e, struct qemu_laio_state, e);
+
+    while (event_notifier_test_and_clear(&s->e)) {
+        qemu_laio_reap(s);
+    }
+
+    if (s->poll_max_ns) {
+        qemu_laio_poll(s);
+    }
+}
+
+/* Busy-polling callback for the AioContext, see aio_context_set_poll_params */
+static bool qemu_laio_poll_cb(void *opaque)
+{
+    EventNotifier *e = opaque;
+    struct qemu_laio_state *s = container_of(e, struct qemu_laio_state, e);
+
+    if (qemu_laio_ring_is_empty(s)) {
+        return false;
+    }
+    return qemu_laio_reap(s) > 0;
+}
+
 static int qemu_laio_flush_cb(EventNotifier *e)
 {
     struct qemu_laio_state *s = container_of(e, struct qemu_laio_state, e);
@@ -108,6 +244,58 @@ static int qemu_laio_flush_cb(EventNotifier *e)
     return (s->count > 0) ? 1 : 0;
 }
 
+static void ioq_init(LaioQueue *io_q)
+{
+    io_q->plugged = 0;
+    io_q->idx = 0;
+}
+
+/* Submit the plug queue, failing whatever the kernel does not accept */
+static void ioq_submit(struct qemu_laio_state *s)
+{
+    int len = s->io_q.idx;
+    int done = 0, retries = 0;
+    int ret = 0;
+
+    while (done < len) {
+        ret = io_submit(s->ctx, len - done, s->io_q.iocbs + done);
+        if (ret > 0) {
+            done += ret;
+        } else if (ret != -EAGAIN || retries++ == 3) {
+            break;
+        }
+    }
+
+    /* empty io queue */
+    s->io_q.idx = 0;
+
+    for (; done < len; done++) {
+        struct qemu_laiocb *laiocb =
+            container_of(s->io_q.iocbs[done], struct qemu_laiocb, iocb);
+
+        laiocb->ret = (ret < 0) ? ret : -EIO;
+        qemu_laio_process_completion(s, laiocb);
+    }
+}
+
+/* Drop a request that was never submitted, returns false if not queued */
+static bool ioq_cancel(struct qemu_laio_state *s, struct qemu_laiocb *laiocb)
+{
+    unsigned int i;
+
+    for (i = 0; i < s->io_q.idx; i++) {
+        if (s->io_q.iocbs[i] == &laiocb->iocb) {
+            memmove(&s->io_q.iocbs[i], &s->io_q.iocbs[i + 1],
+                    (s->io_q.idx - i - 1) * sizeof(s->io_q.iocbs[0]));
+            s->io_q.idx--;
+            laiocb->ret = -ECANCELED;
+            qemu_laio_process_completion(s, laiocb);
+            return true;
+        }
+    }
+    return false;
+}
+
 static void laio_cancel(BlockDriverAIOCB *blockacb)
 {
     struct qemu_laiocb *laiocb = (struct qemu_laiocb *)blockacb;
@@ -117,6 +305,11 @@ static void laio_cancel(BlockDriverAIOCB *blockacb)
     if (laiocb->ret != -EINPROGRESS)
         return;
 
+    /* The request may still sit in the plug queue */
+    if (ioq_cancel(laiocb->ctx, laiocb)) {
+        return;
+    }
+
     /*
      * Note that as of Linux 2.6.31 neither the block device code nor any
      * filesystem implements cancellation of AIO request.
@@ -179,6 +372,17 @@ BlockDriverAIOCB *laio_submit(BlockDriverState *bs, void *aio_ctx, int fd,
     io_set_eventfd(&laiocb->iocb, event_notifier_get_fd(&s->e));
     s->count++;
 
+    if (s->io_q.plugged) {
+        /* Flush a full queue before adding to it, so that this request is
+         * never completed before we return it.
+         */
+        if (s->io_q.idx == MAX_QUEUED_IO) {
+            ioq_submit(s);
+        }
+        s->io_q.iocbs[s->io_q.idx++] = iocbs;
+        return &laiocb->common;
+    }
+
     if (io_submit(s->ctx, 1, &iocbs) < 0)
         goto out_dec_count;
     return &laiocb->common;
@@ -190,6 +394,62 @@ out_free_aiocb:
     return NULL;
 }
 
+void laio_io_plug(BlockDriverState *bs, void *aio_ctx)
+{
+    struct qemu_laio_state *s = aio_ctx;
+
+    s->io_q.plugged++;
+}
+
+void laio_io_unplug(BlockDriverState *bs, void *aio_ctx)
+{
+    struct qemu_laio_state *s = aio_ctx;
+
+    assert(s->io_q.plugged > 0);
+    if (--s->io_q.plugged == 0 && s->io_q.idx > 0) {
+        ioq_submit(s);
+    }
+}
+
+void laio_set_poll_max_ns(void *aio_ctx, int64_t poll_max_ns)
+{
+    struct qemu_laio_state *s = aio_ctx;
+
+    /* Polling needs the ring, there is no point in spinning on syscalls */
+    if (!qemu_laio_has_ring(s)) {
+        poll_max_ns = 0;
+    }
+    s->poll_max_ns = poll_max_ns;
+    s->poll_ns = MIN(LAIO_POLL_START_NS, poll_max_ns);
+}
+
+void laio_detach_aio_context(void *s_, AioContext *old_context)
+{
+    struct qemu_laio_state *s = s_;
+
+    aio_set_event_notifier(old_context, &s->e, NULL, NULL);
+}
+
+void laio_attach_aio_context(void *s_, AioContext *new_context)
+{
+    struct qemu_laio_state *s = s_;
+
+    aio_set_event_notifier(new_context, &s->e, qemu_laio_completion_cb,
+                           qemu_laio_flush_cb);
+    if (qemu_laio_has_ring(s)) {
+        aio_set_event_notifier_poll(new_context, &s->e, qemu_laio_poll_cb);
+    }
+}
+
+void laio_cleanup(void *s_)
+{
+    struct qemu_laio_state *s = s_;
+
+    event_notifier_cleanup(&s->e);
+    io_destroy(s->ctx);
+    g_free(s);
+}
+
 void *laio_init(void)
 {
     struct qemu_laio_state *s;
@@ -203,8 +463,7 @@ void *laio_init(void)
         goto out_close_efd;
     }
 
-    qemu_aio_set_event_notifier(&s->e, qemu_laio_completion_cb,
-                                qemu_laio_flush_cb);
+    ioq_init(&s->io_q);
 
     return s;
 
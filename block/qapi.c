@@ -206,6 +206,28 @@ void bdrv_query_info(BlockDriverState *bs,
          ((int64_t) BDRV_SECTOR_SIZE << hbitmap_granularity(bs->dirty_bitmap));
     }
 
+    if (!QLIST_EMPTY(&bs->dirty_bitmaps)) {
+        BlockDirtyInfoList **p_next = &info->dirty_bitmaps;
+        BdrvDirtyBitmap *bitmap;
+
+        info->has_dirty_bitmaps = true;
+        QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+            BlockDirtyInfoList *entry = g_malloc0(sizeof(*entry));
+            BlockDirtyInfo *dirty = g_malloc0(sizeof(*dirty));
+
+            dirty->count = hbitmap_count(bitmap->bitmap) * BDRV_SECTOR_SIZE;
+            dirty->granularity = bdrv_dirty_bitmap_granularity(bitmap);
+            dirty->has_name = true;
+            dirty->name = g_strdup(bitmap->name);
+            dirty->has_persistent = true;
+            dirty->persistent = bitmap->persistent;
+
+            entry->value = dirty;
+            *p_next = entry;
+            p_next = &entry->next;
+        }
+    }
+
     if (bs->drv) {
         info->has_inserted = true;
         info->inserted = g_malloc0(sizeof(*info->inserted));
@@ -283,6 +305,8 @@ BlockStats *bdrv_query_stats(const BlockDriverState *bs)
     s->stats->wr_total_time_ns = bs->total_time_ns[BDRV_ACCT_WRITE];
     s->stats->rd_total_time_ns = bs->total_time_ns[BDRV_ACCT_READ];
     s->stats->flush_total_time_ns = bs->total_time_ns[BDRV_ACCT_FLUSH];
+    s->stats->rd_merged = bs->nr_merged[BDRV_ACCT_READ];
+    s->stats->wr_merged = bs->nr_merged[BDRV_ACCT_WRITE];
 
     if (bs->file) {
         s->has_parent = true;
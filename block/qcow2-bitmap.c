@@ -0,0 +1,437 @@
+/*
+ * Persistent dirty bitmaps for the QCOW version 2 format
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu-common.h"
+#include "block/block_int.h"
+#include "block/qcow2.h"
+#include "qemu/error-report.h"
+
+/*
+ * The dirty bitmaps header extension lists all persistent bitmaps of the
+ * image.  Their contents are only written when the image is closed; while
+ * it is open read-write they live in memory and the autoclear bit
+ * QCOW2_AUTOCLEAR_DIRTY_BITMAPS is clear, so that after a crash all bitmaps
+ * are loaded as completely dirty.
+ */
+typedef struct QEMU_PACKED Qcow2BitmapHeader {
+    /* entries are 8 byte aligned */
+    uint64_t bitmap_offset;
+    uint64_t bitmap_size;
+    uint32_t granularity_bits;
+    uint32_t name_size;
+    /* name follows, padded to a multiple of 8 bytes */
+} Qcow2BitmapHeader;
+
+#define QCOW2_MAX_BITMAP_NAME       1023
+#define QCOW2_MIN_BITMAP_GRANULARITY_BITS BDRV_SECTOR_BITS
+#define QCOW2_MAX_BITMAP_GRANULARITY_BITS 31
+
+void qcow2_free_bitmaps(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    int i;
+
+    for (i = 0; i < s->nb_bitmaps; i++) {
+        g_free(s->bitmaps[i].name);
+    }
+    g_free(s->bitmaps);
+    s->bitmaps = NULL;
+    s->nb_bitmaps = 0;
+}
+
+/* Number of bits needed to cover the image */
+static uint64_t bitmap_data_bits(BlockDriverState *bs, uint32_t granularity_bits)
+{
+    return DIV_ROUND_UP(bs->total_sectors,
+                        1ULL << (granularity_bits - BDRV_SECTOR_BITS));
+}
+
+/* Size in bytes of the stored contents of a bitmap */
+static uint64_t bitmap_data_size(BlockDriverState *bs, uint32_t granularity_bits)
+{
+    return DIV_ROUND_UP(bitmap_data_bits(bs, granularity_bits), 8);
+}
+
+int qcow2_read_bitmap_ext(BlockDriverState *bs, uint64_t offset, uint32_t len)
+{
+    BDRVQcowState *s = bs->opaque;
+    uint8_t *buf;
+    uint32_t pos;
+    int i, ret;
+
+    qcow2_free_bitmaps(bs);
+
+    buf = g_malloc(len);
+    ret = bdrv_pread(bs->file, offset, buf, len);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    pos = 0;
+    while (pos < len) {
+        Qcow2BitmapHeader h;
+        Qcow2Bitmap *bm;
+
+        if (len - pos < sizeof(h)) {
+            goto invalid;
+        }
+        memcpy(&h, buf + pos, sizeof(h));
+        pos += sizeof(h);
+
+        h.bitmap_offset = be64_to_cpu(h.bitmap_offset);
+        h.bitmap_size = be64_to_cpu(h.bitmap_size);
+        h.granularity_bits = be32_to_cpu(h.granularity_bits);
+        h.name_size = be32_to_cpu(h.name_size);
+
+        if (h.name_size == 0 || h.name_size > QCOW2_MAX_BITMAP_NAME ||
+            h.name_size > len - pos ||
+            h.granularity_bits < QCOW2_MIN_BITMAP_GRANULARITY_BITS ||
+            h.granularity_bits > QCOW2_MAX_BITMAP_GRANULARITY_BITS) {
+            goto invalid;
+        }
+
+        s->bitmaps = g_realloc(s->bitmaps,
+                               (s->nb_bitmaps + 1) * sizeof(*s->bitmaps));
+        bm = &s->bitmaps[s->nb_bitmaps++];
+        bm->name = g_strndup((char *) buf + pos, h.name_size);
+        bm->granularity_bits = h.granularity_bits;
+        bm->offset = h.bitmap_offset;
+        bm->size = h.bitmap_size;
+        pos += align_offset(h.name_size, 8);
+
+        for (i = 0; i < s->nb_bitmaps - 1; i++) {
+            if (!strcmp(s->bitmaps[i].name, bm->name)) {
+                goto invalid;
+            }
+        }
+
+        /* Contents that do not match the image are treated as lost */
+        if ((bm->offset & (s->cluster_size - 1)) ||
+            bm->size != bitmap_data_size(bs, bm->granularity_bits)) {
+            bm->offset = 0;
+        }
+    }
+
+    g_free(buf);
+    return 0;
+
+invalid:
+    error_report("Invalid dirty bitmaps header extension");
+    ret = -EINVAL;
+fail:
+    g_free(buf);
+    qcow2_free_bitmaps(bs);
+    return ret;
+}
+
+void *qcow2_build_bitmap_ext(BlockDriverState *bs, size_t *len)
+{
+    BDRVQcowState *s = bs->opaque;
+    uint8_t *buf;
+    size_t pos;
+    int i;
+
+    *len = 0;
+    for (i = 0; i < s->nb_bitmaps; i++) {
+        *len += sizeof(Qcow2BitmapHeader) +
+                align_offset(strlen(s->bitmaps[i].name), 8);
+    }
+
+    buf = g_malloc0(*len);
+    pos = 0;
+    for (i = 0; i < s->nb_bitmaps; i++) {
+        Qcow2Bitmap *bm = &s->bitmaps[i];
+        size_t name_size = strlen(bm->name);
+        Qcow2BitmapHeader h = {
+            .bitmap_offset      = cpu_to_be64(bm->offset),
+            .bitmap_size        = cpu_to_be64(bm->size),
+            .granularity_bits   = cpu_to_be32(bm->granularity_bits),
+            .name_size          = cpu_to_be32(name_size),
+        };
+
+        memcpy(buf + pos, &h, sizeof(h));
+        pos += sizeof(h);
+        memcpy(buf + pos, bm->name, name_size);
+        pos += align_offset(name_size, 8);
+    }
+
+    return buf;
+}
+
+/*
+ * Returns -EINVAL without touching @bitmap if bits past the end of the image
+ * are set, as the stored contents cannot be trusted then.
+ */
+static int read_bitmap_data(BlockDriverState *bs, Qcow2Bitmap *bm,
+                            BdrvDirtyBitmap *bitmap)
+{
+    int64_t sectors_per_bit = 1LL << (bm->granularity_bits - BDRV_SECTOR_BITS);
+    uint64_t nb_bits = bitmap_data_bits(bs, bm->granularity_bits);
+    uint8_t *buf;
+    uint64_t i;
+    int ret;
+
+    buf = g_malloc(bm->size);
+    ret = bdrv_pread(bs->file, bm->offset, buf, bm->size);
+    if (ret < 0) {
+        goto out;
+    }
+
+    if ((nb_bits % 8) && (buf[bm->size - 1] >> (nb_bits % 8))) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    for (i = 0; i < nb_bits; i++) {
+        if (buf[i / 8] == 0) {
+            i += 7;
+        } else if (buf[i / 8] & (1 << (i % 8))) {
+            hbitmap_set(bitmap->bitmap, i * sectors_per_bit, 1);
+        }
+    }
+    ret = 0;
+
+out:
+    g_free(buf);
+    return ret;
+}
+
+/*
+ * Creates the persistent dirty bitmaps listed in the image.  Bitmaps whose
+ * contents were not stored by a clean close start out completely dirty.
+ */
+int qcow2_load_dirty_bitmaps(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    bool stored = s->autoclear_features & QCOW2_AUTOCLEAR_DIRTY_BITMAPS;
+    Error *local_err = NULL;
+    int i, ret;
+
+    for (i = 0; i < s->nb_bitmaps; i++) {
+        Qcow2Bitmap *bm = &s->bitmaps[i];
+        BdrvDirtyBitmap *bitmap;
+
+        bitmap = bdrv_create_dirty_bitmap(bs, 1ULL << bm->granularity_bits,
+                                          bm->name, &local_err);
+        if (!bitmap) {
+            qerror_report_err(local_err);
+            error_free(local_err);
+            return -EINVAL;
+        }
+        bitmap->persistent = true;
+
+        if (!stored) {
+            /* The clusters may have been reused by now, don't touch them */
+            bm->offset = 0;
+        }
+
+        ret = bm->offset ? read_bitmap_data(bs, bm, bitmap) : -ENOENT;
+        if (ret == -EINVAL) {
+            error_report("Dirty bitmap '%s' has bits set past the end of the "
+                         "image, treating it as lost", bm->name);
+        } else if (ret < 0 && ret != -ENOENT) {
+            return ret;
+        }
+
+        if (ret < 0 && bs->total_sectors > 0) {
+            hbitmap_set(bitmap->bitmap, 0, bs->total_sectors);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Drops the persistent bitmaps of @bs without touching the image, if opening
+ * it fails or before it is opened again.
+ */
+void qcow2_release_dirty_bitmaps(BlockDriverState *bs)
+{
+    BdrvDirtyBitmap *bitmap, *next;
+
+    QLIST_FOREACH_SAFE(bitmap, &bs->dirty_bitmaps, list, next) {
+        if (bitmap->persistent) {
+            bitmap->persistent = false;
+            bdrv_release_dirty_bitmap(bs, bitmap);
+        }
+    }
+}
+
+/*
+ * Frees the clusters holding the stored bitmap contents once the image has
+ * become writable, i.e. after QCOW2_AUTOCLEAR_DIRTY_BITMAPS has been cleared
+ * on disk.  The in-memory bitmaps are the only valid copy from now on.
+ */
+int qcow2_discard_stored_bitmaps(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    int i, ret;
+
+    assert(!(s->autoclear_features & QCOW2_AUTOCLEAR_DIRTY_BITMAPS));
+
+    /* The clusters must not be reused while the header marks them valid */
+    ret = bdrv_flush(bs->file);
+    if (ret < 0) {
+        return ret;
+    }
+
+    for (i = 0; i < s->nb_bitmaps; i++) {
+        Qcow2Bitmap *bm = &s->bitmaps[i];
+
+        if (bm->offset) {
+            qcow2_free_clusters(bs, bm->offset, bm->size, QCOW2_DISCARD_OTHER);
+            bm->offset = 0;
+        }
+    }
+
+    return 0;
+}
+
+/* Rebuilds the bitmap list from the persistent bitmaps of @bs */
+static int sync_bitmap_list(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    BdrvDirtyBitmap *bitmap;
+
+    qcow2_free_bitmaps(bs);
+
+    QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+        Qcow2Bitmap *bm;
+
+        if (!bitmap->persistent) {
+            continue;
+        }
+        if (strlen(bitmap->name) > QCOW2_MAX_BITMAP_NAME) {
+            return -EINVAL;
+        }
+
+        s->bitmaps = g_realloc(s->bitmaps,
+                               (s->nb_bitmaps + 1) * sizeof(*s->bitmaps));
+        bm = &s->bitmaps[s->nb_bitmaps++];
+        bm->name = g_strdup(bitmap->name);
+        bm->granularity_bits = ctz64(bdrv_dirty_bitmap_granularity(bitmap));
+        bm->offset = 0;
+        bm->size = 0;
+    }
+
+    return 0;
+}
+
+int qcow2_update_dirty_bitmaps(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    int ret;
+
+    if (s->qcow_version < 3) {
+        return -ENOTSUP;
+    }
+    if (bs->read_only) {
+        return -EACCES;
+    }
+
+    ret = sync_bitmap_list(bs);
+    if (ret < 0) {
+        return ret;
+    }
+
+    return qcow2_update_header(bs);
+}
+
+static int write_bitmap_data(BlockDriverState *bs, Qcow2Bitmap *bm,
+                             BdrvDirtyBitmap *bitmap)
+{
+    int bit_shift = bm->granularity_bits - BDRV_SECTOR_BITS;
+    HBitmapIter hbi;
+    int64_t sector, offset;
+    uint8_t *buf;
+    int ret;
+
+    bm->size = bitmap_data_size(bs, bm->granularity_bits);
+    buf = g_malloc0(bm->size);
+
+    hbitmap_iter_init(&hbi, bitmap->bitmap, 0);
+    while ((sector = hbitmap_iter_next(&hbi)) >= 0) {
+        uint64_t bit = sector >> bit_shift;
+        buf[bit / 8] |= 1 << (bit % 8);
+    }
+
+    offset = qcow2_alloc_clusters(bs, bm->size);
+    if (offset < 0) {
+        ret = offset;
+        goto out;
+    }
+
+    ret = bdrv_pwrite(bs->file, offset, buf, bm->size);
+    if (ret < 0) {
+        qcow2_free_clusters(bs, offset, bm->size, QCOW2_DISCARD_ALWAYS);
+        goto out;
+    }
+
+    bm->offset = offset;
+    ret = 0;
+out:
+    g_free(buf);
+    return ret;
+}
+
+/*
+ * Writes the contents of all persistent bitmaps when the image is closed,
+ * then sets QCOW2_AUTOCLEAR_DIRTY_BITMAPS in the header.
+ */
+int qcow2_store_dirty_bitmaps(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    int i, ret;
+
+    if (bs->read_only || s->qcow_version < 3 || s->nb_bitmaps == 0) {
+        return 0;
+    }
+
+    ret = sync_bitmap_list(bs);
+    if (ret < 0) {
+        return ret;
+    }
+
+    for (i = 0; i < s->nb_bitmaps; i++) {
+        Qcow2Bitmap *bm = &s->bitmaps[i];
+
+        ret = write_bitmap_data(bs, bm,
+                                bdrv_find_dirty_bitmap(bs, bm->name));
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    /* The bitmaps and their refcounts must be on disk before the header
+     * declares them valid */
+    ret = qcow2_cache_flush(bs, s->refcount_block_cache);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = bdrv_flush(bs->file);
+    if (ret < 0) {
+        return ret;
+    }
+
+    s->autoclear_features |= QCOW2_AUTOCLEAR_DIRTY_BITMAPS;
+    return qcow2_update_header(bs);
+}
@@ -968,22 +968,41 @@ fail:
 
 
 
+/*
+ * Reference counts are rebuilt from the image metadata one window at a time,
+ * so that the memory needed for checking does not grow with the image size.
+ * A window covers a whole number of refcount blocks.
+ */
+#define QCOW2_CHECK_WINDOW_CLUSTERS (32 * 1024 * 1024)
+
+/* Number of L2 tables that are read concurrently while walking an L1 table */
+#define QCOW2_CHECK_WORKERS 8
+
+typedef struct Qcow2CheckWindow {
+    uint16_t *refcount_table;   /* rebuilt refcounts, indexed from start */
+    int64_t start;              /* first cluster covered by this window */
+    int64_t nb_clusters;        /* number of clusters in this window */
+    int64_t image_clusters;     /* number of clusters in the image file */
+} Qcow2CheckWindow;
+
 /*
  * Increases the refcount for a range of clusters in a given refcount table.
  * This is used to construct a temporary refcount table out of L1 and L2 tables
- * which can be compared the the refcount table saved in the image.
+ * which can be compared the the refcount table saved in the image. Clusters
+ * outside of the current window are ignored; problems that are not bound to a
+ * window are only reported if @report is true.
  *
  * Modifies the number of errors in res.
  */
 static void inc_refcounts(BlockDriverState *bs,
                           BdrvCheckResult *res,
-                          uint16_t *refcount_table,
-                          int refcount_table_size,
+                          Qcow2CheckWindow *win,
+                          bool report,
                           int64_t offset, int64_t size)
 {
     BDRVQcowState *s = bs->opaque;
     int64_t start, last, cluster_offset;
-    int k;
+    int64_t k;
 
     if (size <= 0)
         return;
@@ -994,16 +1013,20 @@ static void inc_refcounts(BlockDriverState *bs,
         cluster_offset += s->cluster_size) {
         k = cluster_offset >> s->cluster_bits;
         if (k < 0) {
-            fprintf(stderr, "ERROR: invalid cluster offset=0x%" PRIx64 "\n",
-                cluster_offset);
-            res->corruptions++;
-        } else if (k >= refcount_table_size) {
-            fprintf(stderr, "Warning: cluster offset=0x%" PRIx64 " is after "
-                "the end of the image file, can't properly check refcounts.\n",
-                cluster_offset);
-            res->check_errors++;
-        } else {
-            if (++refcount_table[k] == 0) {
+            if (report) {
+                fprintf(stderr, "ERROR: invalid cluster offset=0x%" PRIx64
+                    "\n", cluster_offset);
+                res->corruptions++;
+            }
+        } else if (k >= win->image_clusters) {
+            if (report) {
+                fprintf(stderr, "Warning: cluster offset=0x%" PRIx64 " is "
+                    "after the end of the image file, can't properly check "
+                    "refcounts.\n", cluster_offset);
+                res->check_errors++;
+            }
+        } else if (k >= win->start && k < win->start + win->nb_clusters) {
+            if (++win->refcount_table[k - win->start] == 0) {
                 fprintf(stderr, "ERROR: overflow cluster offset=0x%" PRIx64
                     "\n", cluster_offset);
                 res->corruptions++;
@@ -1016,6 +1039,7 @@ static void inc_refcounts(BlockDriverState *bs,
 enum {
     CHECK_OFLAG_COPIED = 0x1,   /* check QCOW_OFLAG_COPIED matches refcount */
     CHECK_FRAG_INFO = 0x2,      /* update BlockFragInfo counters */
+    CHECK_REPORT = 0x4,         /* report errors in L1 and L2 entries */
 };
 
 /*
@@ -1027,20 +1051,13 @@ enum {
  * error occurred.
  */
 static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
-    uint16_t *refcount_table, int refcount_table_size, int64_t l2_offset,
-    int flags)
+    Qcow2CheckWindow *win, uint64_t *l2_table, int flags)
 {
     BDRVQcowState *s = bs->opaque;
-    uint64_t *l2_table, l2_entry;
+    uint64_t l2_entry;
     uint64_t next_contiguous_offset = 0;
-    int i, l2_size, nb_csectors, refcount;
-
-    /* Read L2 table from disk */
-    l2_size = s->l2_size * sizeof(uint64_t);
-    l2_table = g_malloc(l2_size);
-
-    if (bdrv_pread(bs->file, l2_offset, l2_table, l2_size) != l2_size)
-        goto fail;
+    int i, nb_csectors, refcount;
+    bool report = flags & CHECK_REPORT;
 
     /* Do the actual checks */
     for(i = 0; i < s->l2_size; i++) {
@@ -1050,18 +1067,20 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
         case QCOW2_CLUSTER_COMPRESSED:
             /* Compressed clusters don't have QCOW_OFLAG_COPIED */
             if (l2_entry & QCOW_OFLAG_COPIED) {
-                fprintf(stderr, "ERROR: cluster %" PRId64 ": "
-                    "copied flag must never be set for compressed "
-                    "clusters\n", l2_entry >> s->cluster_bits);
+                if (report) {
+                    fprintf(stderr, "ERROR: cluster %" PRId64 ": "
+                        "copied flag must never be set for compressed "
+                        "clusters\n", l2_entry >> s->cluster_bits);
+                    res->corruptions++;
+                }
                 l2_entry &= ~QCOW_OFLAG_COPIED;
-                res->corruptions++;
             }
 
             /* Mark cluster as used */
             nb_csectors = ((l2_entry >> s->csize_shift) &
                            s->csize_mask) + 1;
             l2_entry &= s->cluster_offset_mask;
-            inc_refcounts(bs, res, refcount_table, refcount_table_size,
+            inc_refcounts(bs, res, win, report,
                 l2_entry & ~511, nb_csectors * 512);
 
             if (flags & CHECK_FRAG_INFO) {
@@ -1112,11 +1131,10 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
             }
 
             /* Mark cluster as used */
-            inc_refcounts(bs, res, refcount_table,refcount_table_size,
-                offset, s->cluster_size);
+            inc_refcounts(bs, res, win, report, offset, s->cluster_size);
 
             /* Correct offsets are cluster aligned */
-            if (offset & (s->cluster_size - 1)) {
+            if (report && (offset & (s->cluster_size - 1))) {
                 fprintf(stderr, "ERROR offset=%" PRIx64 ": Cluster is not "
                     "properly aligned; L2 entry corrupted.\n", offset);
                 res->corruptions++;
@@ -1132,15 +1150,124 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
         }
     }
 
-    g_free(l2_table);
     return 0;
 
 fail:
     fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
-    g_free(l2_table);
     return -EIO;
 }
 
+typedef struct Qcow2CheckL1State {
+    BlockDriverState *bs;
+    BdrvCheckResult *res;
+    Qcow2CheckWindow *win;
+    uint64_t *l1_table;
+    int l1_size;
+    int flags;
+
+    int next_read;      /* next L1 index to be claimed by a worker */
+    int next_process;   /* L1 index whose L2 table is to be processed next */
+    CoQueue process_queue;
+    int running_workers;
+    int ret;
+} Qcow2CheckL1State;
+
+/*
+ * Processes the L1 entry with index @i and the L2 table it points to, which
+ * has already been read into @l2_table.
+ */
+static int check_refcounts_l1_entry(Qcow2CheckL1State *st, int i,
+                                    uint64_t *l2_table)
+{
+    BlockDriverState *bs = st->bs;
+    BDRVQcowState *s = bs->opaque;
+    uint64_t l2_offset = st->l1_table[i];
+    int refcount;
+
+    /* QCOW_OFLAG_COPIED must be set iff refcount == 1 */
+    if (st->flags & CHECK_OFLAG_COPIED) {
+        refcount = get_refcount(bs, (l2_offset & ~QCOW_OFLAG_COPIED)
+            >> s->cluster_bits);
+        if (refcount < 0) {
+            fprintf(stderr, "Can't get refcount for l2_offset %"
+                PRIx64 ": %s\n", l2_offset, strerror(-refcount));
+            return -EIO;
+        }
+        if ((refcount == 1) != ((l2_offset & QCOW_OFLAG_COPIED) != 0)) {
+            fprintf(stderr, "ERROR OFLAG_COPIED: l2_offset=%" PRIx64
+                " refcount=%d\n", l2_offset, refcount);
+            st->res->corruptions++;
+        }
+    }
+
+    /* Mark L2 table as used */
+    l2_offset &= L1E_OFFSET_MASK;
+    inc_refcounts(bs, st->res, st->win, st->flags & CHECK_REPORT,
+        l2_offset, s->cluster_size);
+
+    /* L2 tables are cluster aligned */
+    if ((st->flags & CHECK_REPORT) && (l2_offset & (s->cluster_size - 1))) {
+        fprintf(stderr, "ERROR l2_offset=%" PRIx64 ": Table is not "
+            "cluster aligned; L1 entry corrupted\n", l2_offset);
+        st->res->corruptions++;
+    }
+
+    /* Process and check L2 entries */
+    return check_refcounts_l2(bs, st->res, st->win, l2_table, st->flags);
+}
+
+/*
+ * Each worker claims an L1 entry, reads the L2 table into its own buffer and
+ * then waits for its turn to process it.  L2 tables are processed strictly in
+ * L1 order, so that only one worker at a time uses the refcount block cache
+ * and errors are reported in a stable order, but up to QCOW2_CHECK_WORKERS
+ * L2 reads are in flight.
+ */
+static void coroutine_fn check_refcounts_l1_worker(void *opaque)
+{
+    Qcow2CheckL1State *st = opaque;
+    BlockDriverState *bs = st->bs;
+    BDRVQcowState *s = bs->opaque;
+    int l2_size = s->l2_size * sizeof(uint64_t);
+    uint64_t *l2_table;
+    uint64_t l2_offset;
+    int i, ret;
+
+    l2_table = g_malloc(l2_size);
+
+    while (st->ret == 0 && st->next_read < st->l1_size) {
+        i = st->next_read++;
+        l2_offset = st->l1_table[i] & L1E_OFFSET_MASK;
+
+        ret = 0;
+        if (l2_offset &&
+            bdrv_pread(bs->file, l2_offset, l2_table, l2_size) != l2_size) {
+            fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
+            ret = -EIO;
+        }
+
+        while (st->next_process != i) {
+            qemu_co_queue_wait(&st->process_queue);
+        }
+
+        if (st->ret == 0) {
+            if (ret == 0 && l2_offset) {
+                ret = check_refcounts_l1_entry(st, i, l2_table);
+            }
+            if (ret < 0) {
+                st->ret = ret;
+            }
+        }
+
+        st->next_process++;
+        qemu_co_queue_restart_all(&st->process_queue);
+    }
+
+    g_free(l2_table);
+    st->running_workers--;
+    qemu_co_queue_restart_all(&st->process_queue);
+}
+
 /*
  * Increases the refcount for the L1 table, its L2 tables and all referenced
  * clusters in the given refcount table. While doing so, performs some checks
@@ -1149,21 +1276,20 @@ fail:
  * Returns the number of errors found by the checks or -errno if an internal
  * error occurred.
  */
-static int check_refcounts_l1(BlockDriverState *bs,
+static int coroutine_fn check_refcounts_l1(BlockDriverState *bs,
                               BdrvCheckResult *res,
-                              uint16_t *refcount_table,
-                              int refcount_table_size,
+                              Qcow2CheckWindow *win,
                               int64_t l1_table_offset, int l1_size,
                               int flags)
 {
-    BDRVQcowState *s = bs->opaque;
-    uint64_t *l1_table, l2_offset, l1_size2;
-    int i, refcount, ret;
+    uint64_t *l1_table, l1_size2;
+    Qcow2CheckL1State st;
+    int i;
 
     l1_size2 = l1_size * sizeof(uint64_t);
 
     /* Mark L1 table as used */
-    inc_refcounts(bs, res, refcount_table, refcount_table_size,
+    inc_refcounts(bs, res, win, flags & CHECK_REPORT,
         l1_table_offset, l1_size2);
 
     /* Read L1 table entries from disk */
@@ -1179,45 +1305,30 @@ static int check_refcounts_l1(BlockDriverState *bs,
     }
 
     /* Do the actual checks */
-    for(i = 0; i < l1_size; i++) {
-        l2_offset = l1_table[i];
-        if (l2_offset) {
-            /* QCOW_OFLAG_COPIED must be set iff refcount == 1 */
-            if (flags & CHECK_OFLAG_COPIED) {
-                refcount = get_refcount(bs, (l2_offset & ~QCOW_OFLAG_COPIED)
-                    >> s->cluster_bits);
-                if (refcount < 0) {
-                    fprintf(stderr, "Can't get refcount for l2_offset %"
-                        PRIx64 ": %s\n", l2_offset, strerror(-refcount));
-                    goto fail;
-                }
-                if ((refcount == 1) != ((l2_offset & QCOW_OFLAG_COPIED) != 0)) {
-                    fprintf(stderr, "ERROR OFLAG_COPIED: l2_offset=%" PRIx64
-                        " refcount=%d\n", l2_offset, refcount);
-                    res->corruptions++;
-                }
-            }
+    st = (Qcow2CheckL1State) {
+        .bs         = bs,
+        .res        = res,
+        .win        = win,
+        .l1_table   = l1_table,
+        .l1_size    = l1_size,
+        .flags      = flags,
+    };
+    qemu_co_queue_init(&st.process_queue);
 
-            /* Mark L2 table as used */
-            l2_offset &= L1E_OFFSET_MASK;
-            inc_refcounts(bs, res, refcount_table, refcount_table_size,
-                l2_offset, s->cluster_size);
+    for (i = 0; i < QCOW2_CHECK_WORKERS && st.next_read < l1_size; i++) {
+        Coroutine *co = qemu_coroutine_create(check_refcounts_l1_worker);
 
-            /* L2 tables are cluster aligned */
-            if (l2_offset & (s->cluster_size - 1)) {
-                fprintf(stderr, "ERROR l2_offset=%" PRIx64 ": Table is not "
-                    "cluster aligned; L1 entry corrupted\n", l2_offset);
-                res->corruptions++;
-            }
+        st.running_workers++;
+        qemu_coroutine_enter(co, &st);
+    }
+    while (st.running_workers) {
+        qemu_co_queue_wait(&st.process_queue);
+    }
 
-            /* Process and check L2 entries */
-            ret = check_refcounts_l2(bs, res, refcount_table,
-                                     refcount_table_size, l2_offset, flags);
-            if (ret < 0) {
-                goto fail;
-            }
-        }
+    if (st.ret < 0) {
+        goto fail;
     }
+
     g_free(l1_table);
     return 0;
 
@@ -1229,54 +1340,57 @@ fail:
 }
 
 /*
- * Checks an image for refcount consistency.
- *
- * Returns 0 if no errors are found, the number of errors in case the image is
- * detected as corrupted, and -errno when an internal error occurred.
+ * Rebuilds the reference counts of all clusters in the window @win from the
+ * image metadata.  Errors that are not specific to the window are only
+ * reported if @first is true.
  */
-int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
-                          BdrvCheckMode fix)
+static int coroutine_fn check_refcounts_window(BlockDriverState *bs,
+                                               BdrvCheckResult *res,
+                                               Qcow2CheckWindow *win,
+                                               bool first)
 {
     BDRVQcowState *s = bs->opaque;
-    int64_t size, i, highest_cluster;
-    int nb_clusters, refcount1, refcount2;
+    int report = first ? CHECK_REPORT : 0;
     QCowSnapshot *sn;
-    uint16_t *refcount_table;
+    int64_t i;
     int ret;
 
-    size = bdrv_getlength(bs->file);
-    nb_clusters = size_to_clusters(s, size);
-    refcount_table = g_malloc0(nb_clusters * sizeof(uint16_t));
-
-    res->bfi.total_clusters =
-        size_to_clusters(s, bs->total_sectors * BDRV_SECTOR_SIZE);
-
     /* header */
-    inc_refcounts(bs, res, refcount_table, nb_clusters,
-        0, s->cluster_size);
+    inc_refcounts(bs, res, win, first, 0, s->cluster_size);
 
     /* current L1 table */
-    ret = check_refcounts_l1(bs, res, refcount_table, nb_clusters,
+    ret = check_refcounts_l1(bs, res, win,
                              s->l1_table_offset, s->l1_size,
-                             CHECK_OFLAG_COPIED | CHECK_FRAG_INFO);
+                             first ? CHECK_OFLAG_COPIED | CHECK_FRAG_INFO |
+                                     CHECK_REPORT : 0);
     if (ret < 0) {
-        goto fail;
+        return ret;
     }
 
     /* snapshots */
     for(i = 0; i < s->nb_snapshots; i++) {
         sn = s->snapshots + i;
-        ret = check_refcounts_l1(bs, res, refcount_table, nb_clusters,
-            sn->l1_table_offset, sn->l1_size, 0);
+        ret = check_refcounts_l1(bs, res, win,
+            sn->l1_table_offset, sn->l1_size, report);
         if (ret < 0) {
-            goto fail;
+            return ret;
         }
     }
-    inc_refcounts(bs, res, refcount_table, nb_clusters,
+    inc_refcounts(bs, res, win, first,
         s->snapshots_offset, s->snapshots_size);
 
+    /* stored dirty bitmaps */
+    if (s->autoclear_features & QCOW2_AUTOCLEAR_DIRTY_BITMAPS) {
+        for (i = 0; i < s->nb_bitmaps; i++) {
+            if (s->bitmaps[i].offset) {
+                inc_refcounts(bs, res, win, first,
+                    s->bitmaps[i].offset, s->bitmaps[i].size);
+            }
+        }
+    }
+
     /* refcount data */
-    inc_refcounts(bs, res, refcount_table, nb_clusters,
+    inc_refcounts(bs, res, win, first,
         s->refcount_table_offset,
         s->refcount_table_size * sizeof(uint64_t));
 
@@ -1287,33 +1401,55 @@ int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
 
         /* Refcount blocks are cluster aligned */
         if (offset & (s->cluster_size - 1)) {
-            fprintf(stderr, "ERROR refcount block %" PRId64 " is not "
-                "cluster aligned; refcount table entry corrupted\n", i);
-            res->corruptions++;
+            if (first) {
+                fprintf(stderr, "ERROR refcount block %" PRId64 " is not "
+                    "cluster aligned; refcount table entry corrupted\n", i);
+                res->corruptions++;
+            }
             continue;
         }
 
-        if (cluster >= nb_clusters) {
-            fprintf(stderr, "ERROR refcount block %" PRId64
-                    " is outside image\n", i);
-            res->corruptions++;
+        if (cluster >= win->image_clusters) {
+            if (first) {
+                fprintf(stderr, "ERROR refcount block %" PRId64
+                        " is outside image\n", i);
+                res->corruptions++;
+            }
             continue;
         }
 
         if (offset != 0) {
-            inc_refcounts(bs, res, refcount_table, nb_clusters,
-                offset, s->cluster_size);
-            if (refcount_table[cluster] != 1) {
+            inc_refcounts(bs, res, win, first, offset, s->cluster_size);
+            if (cluster >= win->start &&
+                cluster < win->start + win->nb_clusters &&
+                win->refcount_table[cluster - win->start] != 1) {
                 fprintf(stderr, "ERROR refcount block %" PRId64
                     " refcount=%d\n",
-                    i, refcount_table[cluster]);
+                    i, win->refcount_table[cluster - win->start]);
                 res->corruptions++;
             }
         }
     }
 
-    /* compare ref counts */
-    for (i = 0, highest_cluster = 0; i < nb_clusters; i++) {
+    return 0;
+}
+
+/*
+ * Compares the rebuilt reference counts in @win with the refcount blocks
+ * stored in the image and repairs mismatches as allowed by @fix.  Updates
+ * *highest_cluster with the last cluster in use.
+ */
+static void compare_refcounts_window(BlockDriverState *bs,
+                                     BdrvCheckResult *res,
+                                     Qcow2CheckWindow *win,
+                                     BdrvCheckMode fix,
+                                     int64_t *highest_cluster)
+{
+    BDRVQcowState *s = bs->opaque;
+    int64_t i;
+    int refcount1, refcount2, ret;
+
+    for (i = win->start; i < win->start + win->nb_clusters; i++) {
         refcount1 = get_refcount(bs, i);
         if (refcount1 < 0) {
             fprintf(stderr, "Can't get refcount for cluster %" PRId64 ": %s\n",
@@ -1322,10 +1458,10 @@ int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
             continue;
         }
 
-        refcount2 = refcount_table[i];
+        refcount2 = win->refcount_table[i - win->start];
 
         if (refcount1 > 0 || refcount2 > 0) {
-            highest_cluster = i;
+            *highest_cluster = i;
         }
 
         if (refcount1 != refcount2) {
@@ -1362,13 +1498,106 @@ int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
             }
         }
     }
+}
+
+/*
+ * Checks an image for refcount consistency.
+ *
+ * The expected refcounts are rebuilt for at most QCOW2_CHECK_WINDOW_CLUSTERS
+ * clusters at a time and then compared with the on-disk refcount blocks, so
+ * the memory needed is bounded even for very large images.  Each additional
+ * window costs another pass over the L1 and L2 tables.
+ *
+ * Returns 0 if no errors are found, the number of errors in case the image is
+ * detected as corrupted, and -errno when an internal error occurred.
+ */
+static int coroutine_fn check_refcounts_co(BlockDriverState *bs,
+                                           BdrvCheckResult *res,
+                                           BdrvCheckMode fix)
+{
+    BDRVQcowState *s = bs->opaque;
+    Qcow2CheckWindow win;
+    int64_t size, highest_cluster, window_clusters;
+    int ret;
+
+    size = bdrv_getlength(bs->file);
+    if (size < 0) {
+        res->check_errors++;
+        return size;
+    }
+
+    res->bfi.total_clusters =
+        size_to_clusters(s, bs->total_sectors * BDRV_SECTOR_SIZE);
+
+    win = (Qcow2CheckWindow) {
+        .image_clusters = (size + s->cluster_size - 1) >> s->cluster_bits,
+    };
+    window_clusters = MIN(win.image_clusters, QCOW2_CHECK_WINDOW_CLUSTERS);
+    win.refcount_table = g_malloc(window_clusters * sizeof(uint16_t));
+
+    highest_cluster = 0;
+    do {
+        win.nb_clusters = MIN(window_clusters,
+                              win.image_clusters - win.start);
+        memset(win.refcount_table, 0, win.nb_clusters * sizeof(uint16_t));
+
+        ret = check_refcounts_window(bs, res, &win, win.start == 0);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        compare_refcounts_window(bs, res, &win, fix, &highest_cluster);
+        win.start += win.nb_clusters;
+    } while (win.start < win.image_clusters);
 
     res->image_end_offset = (highest_cluster + 1) * s->cluster_size;
     ret = 0;
 
 fail:
-    g_free(refcount_table);
+    g_free(win.refcount_table);
 
     return ret;
 }
 
+typedef struct Qcow2CheckCo {
+    BlockDriverState *bs;
+    BdrvCheckResult *res;
+    BdrvCheckMode fix;
+    int ret;
+    bool done;
+} Qcow2CheckCo;
+
+static void coroutine_fn check_refcounts_entry(void *opaque)
+{
+    Qcow2CheckCo *cco = opaque;
+
+    cco->ret = check_refcounts_co(cco->bs, cco->res, cco->fix);
+    cco->done = true;
+}
+
+/*
+ * The check runs in a coroutine, so that the L2 tables of each L1 table can
+ * be read by several workers in parallel.
+ */
+int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
+                          BdrvCheckMode fix)
+{
+    Coroutine *co;
+    Qcow2CheckCo cco = {
+        .bs = bs,
+        .res = res,
+        .fix = fix,
+    };
+
+    if (qemu_in_coroutine()) {
+        /* Fast-path if already in coroutine context */
+        check_refcounts_entry(&cco);
+    } else {
+        co = qemu_coroutine_create(check_refcounts_entry);
+        qemu_coroutine_enter(co, &cco);
+        while (!cco.done) {
+            aio_poll(bdrv_get_aio_context(bs), true);
+        }
+    }
+    return cco.ret;
+}
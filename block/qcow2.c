@@ -57,6 +57,8 @@ typedef struct {
 #define  QCOW2_EXT_MAGIC_END 0
 #define  QCOW2_EXT_MAGIC_BACKING_FORMAT 0xE2792ACA
 #define  QCOW2_EXT_MAGIC_FEATURE_TABLE 0x6803f857
+#define  QCOW2_EXT_MAGIC_FREE_CLUSTER_HINT 0x23852875
+#define  QCOW2_EXT_MAGIC_DIRTY_BITMAPS 0x6dbcf8e4
 
 static int qcow2_probe(const uint8_t *buf, int buf_size, const char *filename)
 {
@@ -149,6 +151,28 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             }
             break;
 
+        case QCOW2_EXT_MAGIC_FREE_CLUSTER_HINT:
+            if (ext.len != sizeof(s->free_cluster_hint)) {
+                error_report("Invalid free cluster hint extension length");
+                return -EINVAL;
+            }
+            ret = bdrv_pread(bs->file, offset, &s->free_cluster_hint,
+                             ext.len);
+            if (ret < 0) {
+                return ret;
+            }
+            be64_to_cpus(&s->free_cluster_hint);
+            break;
+
+        case QCOW2_EXT_MAGIC_DIRTY_BITMAPS:
+            if (p_feature_table == NULL) {
+                ret = qcow2_read_bitmap_ext(bs, offset, ext.len);
+                if (ret < 0) {
+                    return ret;
+                }
+            }
+            break;
+
         default:
             /* unknown magic - save it in case we need to rewrite the header */
             {
@@ -272,6 +296,32 @@ static int qcow2_mark_clean(BlockDriverState *bs)
     return 0;
 }
 
+/*
+ * Records where cluster allocation should resume after the image is reopened.
+ * Only call this function when the image is being closed; the hint is not
+ * kept up to date while clusters are allocated and freed.
+ */
+static int qcow2_store_free_cluster_hint(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    int ret;
+
+    if (bs->read_only || s->qcow_version < 3 ||
+        (s->incompatible_features & QCOW2_INCOMPAT_DIRTY)) {
+        return 0;
+    }
+
+    /* The refcount blocks must be on disk before the hint refers to them */
+    ret = bdrv_flush(bs->file);
+    if (ret < 0) {
+        return ret;
+    }
+
+    s->free_cluster_hint = s->free_cluster_index;
+    s->autoclear_features |= QCOW2_AUTOCLEAR_FREE_HINT;
+    return qcow2_update_header(bs);
+}
+
 static int qcow2_check(BlockDriverState *bs, BdrvCheckResult *result,
                        BdrvCheckMode fix)
 {
@@ -315,6 +365,29 @@ static QemuOptsList qcow2_runtime_opts = {
     },
 };
 
+/*
+ * Clears the autoclear feature bits when the image is opened read-write.
+ * The metadata they describe goes stale with the first write; persistent
+ * dirty bitmaps are kept in memory until the image is closed again.
+ */
+static int qcow2_make_writable(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    int ret;
+
+    if (s->autoclear_features == 0) {
+        return 0;
+    }
+
+    s->autoclear_features = 0;
+    ret = qcow2_update_header(bs);
+    if (ret < 0) {
+        return ret;
+    }
+
+    return qcow2_discard_stored_bitmaps(bs);
+}
+
 static int qcow2_open(BlockDriverState *bs, QDict *options, int flags)
 {
     BDRVQcowState *s = bs->opaque;
@@ -513,10 +586,27 @@ static int qcow2_open(BlockDriverState *bs, QDict *options, int flags)
         goto fail;
     }
 
-    /* Clear unknown autoclear feature bits */
-    if (!bs->read_only && s->autoclear_features != 0) {
-        s->autoclear_features = 0;
-        ret = qcow2_update_header(bs);
+    /* Skip the refcount scan over clusters that were in use when the image
+     * was last closed; the hint goes stale as soon as we start allocating,
+     * which is why its autoclear bit is dropped below */
+    if (s->autoclear_features & QCOW2_AUTOCLEAR_FREE_HINT) {
+        int64_t file_size = bdrv_getlength(bs->file);
+
+        if (file_size >= 0 &&
+            s->free_cluster_hint <= (file_size >> s->cluster_bits)) {
+            s->free_cluster_index = s->free_cluster_hint;
+        }
+    }
+
+    ret = qcow2_load_dirty_bitmaps(bs);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    /* An incoming migration destination must not write to the image until
+     * the source has handed it over in qcow2_invalidate_cache() */
+    if (!bs->read_only && !(flags & BDRV_O_INCOMING)) {
+        ret = qcow2_make_writable(bs);
         if (ret < 0) {
             goto fail;
         }
@@ -526,7 +616,7 @@ static int qcow2_open(BlockDriverState *bs, QDict *options, int flags)
     qemu_co_mutex_init(&s->lock);
 
     /* Repair image if dirty */
-    if (!(flags & BDRV_O_CHECK) && !bs->read_only &&
+    if (!(flags & (BDRV_O_CHECK | BDRV_O_INCOMING)) && !bs->read_only &&
         (s->incompatible_features & QCOW2_INCOMPAT_DIRTY)) {
         BdrvCheckResult result = {0};
 
@@ -579,6 +669,8 @@ static int qcow2_open(BlockDriverState *bs, QDict *options, int flags)
  fail:
     g_free(s->unknown_header_fields);
     cleanup_unknown_header_ext(bs);
+    qcow2_release_dirty_bitmaps(bs);
+    qcow2_free_bitmaps(bs);
     qcow2_free_snapshots(bs);
     qcow2_refcount_close(bs);
     g_free(s->l1_table);
@@ -640,6 +732,18 @@ static int qcow2_reopen_prepare(BDRVReopenState *state,
     return 0;
 }
 
+static void qcow2_reopen_commit(BDRVReopenState *state)
+{
+    BlockDriverState *bs = state->bs;
+
+    /* bs->file has already been reopened at this point.  Bitmaps of an image
+     * that becomes read-only are not stored and come back completely dirty
+     * the next time it is opened. */
+    if (bs->read_only && (state->flags & BDRV_O_RDWR)) {
+        qcow2_make_writable(bs);
+    }
+}
+
 static int coroutine_fn qcow2_co_is_allocated(BlockDriverState *bs,
         int64_t sector_num, int nb_sectors, int *pnum)
 {
@@ -941,15 +1045,25 @@ fail:
     return ret;
 }
 
-static void qcow2_close(BlockDriverState *bs)
+/*
+ * Frees the in-memory state of the image.  If @write_back is false nothing is
+ * written to the image file, which is required when the metadata in memory
+ * may be older than what is on disk.
+ */
+static void qcow2_close_common(BlockDriverState *bs, bool write_back)
 {
     BDRVQcowState *s = bs->opaque;
     g_free(s->l1_table);
 
-    qcow2_cache_flush(bs, s->l2_table_cache);
-    qcow2_cache_flush(bs, s->refcount_block_cache);
+    if (write_back) {
+        qcow2_store_dirty_bitmaps(bs);
 
-    qcow2_mark_clean(bs);
+        qcow2_cache_flush(bs, s->l2_table_cache);
+        qcow2_cache_flush(bs, s->refcount_block_cache);
+
+        qcow2_mark_clean(bs);
+        qcow2_store_free_cluster_hint(bs);
+    }
 
     qcow2_cache_destroy(bs, s->l2_table_cache);
     qcow2_cache_destroy(bs, s->refcount_block_cache);
@@ -961,6 +1075,14 @@ static void qcow2_close(BlockDriverState *bs)
     qemu_vfree(s->cluster_data);
     qcow2_refcount_close(bs);
     qcow2_free_snapshots(bs);
+    qcow2_free_bitmaps(bs);
+}
+
+static void qcow2_close(BlockDriverState *bs)
+{
+    /* While an incoming migration is pending, the source owns the image */
+    qcow2_close_common(bs, !bs->read_only &&
+                           !(bs->open_flags & BDRV_O_INCOMING));
 }
 
 static void qcow2_invalidate_cache(BlockDriverState *bs)
@@ -983,14 +1105,18 @@ static void qcow2_invalidate_cache(BlockDriverState *bs)
         memcpy(&aes_decrypt_key, &s->aes_decrypt_key, sizeof(aes_decrypt_key));
     }
 
-    qcow2_close(bs);
+    /* The migration source has modified the image since it was opened, so
+     * our metadata is stale and must not be written back.
+     */
+    qcow2_close_common(bs, false);
+    qcow2_release_dirty_bitmaps(bs);
 
     options = qdict_new();
     qdict_put(options, QCOW2_OPT_LAZY_REFCOUNTS,
               qbool_from_int(s->use_lazy_refcounts));
 
     memset(s, 0, sizeof(BDRVQcowState));
-    qcow2_open(bs, options, flags);
+    qcow2_open(bs, options, flags & ~BDRV_O_INCOMING);
 
     QDECREF(options);
 
@@ -1132,6 +1258,16 @@ int qcow2_update_header(BlockDriverState *bs)
             .bit  = QCOW2_COMPAT_LAZY_REFCOUNTS_BITNR,
             .name = "lazy refcounts",
         },
+        {
+            .type = QCOW2_FEAT_TYPE_AUTOCLEAR,
+            .bit  = QCOW2_AUTOCLEAR_FREE_HINT_BITNR,
+            .name = "free cluster hint",
+        },
+        {
+            .type = QCOW2_FEAT_TYPE_AUTOCLEAR,
+            .bit  = QCOW2_AUTOCLEAR_DIRTY_BITMAPS_BITNR,
+            .name = "dirty bitmaps",
+        },
     };
 
     ret = header_ext_add(buf, QCOW2_EXT_MAGIC_FEATURE_TABLE,
@@ -1142,6 +1278,34 @@ int qcow2_update_header(BlockDriverState *bs)
     buf += ret;
     buflen -= ret;
 
+    /* Free cluster hint */
+    if (s->autoclear_features & QCOW2_AUTOCLEAR_FREE_HINT) {
+        uint64_t hint = cpu_to_be64(s->free_cluster_hint);
+
+        ret = header_ext_add(buf, QCOW2_EXT_MAGIC_FREE_CLUSTER_HINT,
+                             &hint, sizeof(hint), buflen);
+        if (ret < 0) {
+            goto fail;
+        }
+        buf += ret;
+        buflen -= ret;
+    }
+
+    /* Persistent dirty bitmaps */
+    if (s->nb_bitmaps > 0) {
+        size_t bitmap_ext_len;
+        void *bitmap_ext = qcow2_build_bitmap_ext(bs, &bitmap_ext_len);
+
+        ret = header_ext_add(buf, QCOW2_EXT_MAGIC_DIRTY_BITMAPS,
+                             bitmap_ext, bitmap_ext_len, buflen);
+        g_free(bitmap_ext);
+        if (ret < 0) {
+            goto fail;
+        }
+        buf += ret;
+        buflen -= ret;
+    }
+
     /* Keep unknown header extensions */
     QLIST_FOREACH(uext, &s->unknown_header_ext, next) {
         ret = header_ext_add(buf, uext->magic, uext->data, uext->len, buflen);
@@ -1786,8 +1950,10 @@ static BlockDriver bdrv_qcow2 = {
     .bdrv_open          = qcow2_open,
     .bdrv_close         = qcow2_close,
     .bdrv_reopen_prepare  = qcow2_reopen_prepare,
+    .bdrv_reopen_commit   = qcow2_reopen_commit,
     .bdrv_create        = qcow2_create,
     .bdrv_has_zero_init = bdrv_has_zero_init_1,
+    .bdrv_update_dirty_bitmaps = qcow2_update_dirty_bitmaps,
     .bdrv_co_is_allocated = qcow2_co_is_allocated,
     .bdrv_set_key       = qcow2_set_key,
     .bdrv_make_empty    = qcow2_make_empty,
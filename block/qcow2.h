@@ -100,6 +100,13 @@ typedef struct QCowSnapshot {
     uint64_t vm_clock_nsec;
 } QCowSnapshot;
 
+typedef struct Qcow2Bitmap {
+    char *name;
+    uint32_t granularity_bits;
+    uint64_t offset;    /* stored contents, only valid if size matches */
+    uint64_t size;
+} Qcow2Bitmap;
+
 struct Qcow2Cache;
 typedef struct Qcow2Cache Qcow2Cache;
 
@@ -132,6 +139,18 @@ enum {
     QCOW2_COMPAT_FEAT_MASK            = QCOW2_COMPAT_LAZY_REFCOUNTS,
 };
 
+/* Autoclear feature bits */
+enum {
+    QCOW2_AUTOCLEAR_FREE_HINT_BITNR     = 0,
+    QCOW2_AUTOCLEAR_FREE_HINT           = 1 << QCOW2_AUTOCLEAR_FREE_HINT_BITNR,
+    QCOW2_AUTOCLEAR_DIRTY_BITMAPS_BITNR = 1,
+    QCOW2_AUTOCLEAR_DIRTY_BITMAPS       =
+        1 << QCOW2_AUTOCLEAR_DIRTY_BITMAPS_BITNR,
+
+    QCOW2_AUTOCLEAR_MASK                = QCOW2_AUTOCLEAR_FREE_HINT
+                                        | QCOW2_AUTOCLEAR_DIRTY_BITMAPS,
+};
+
 enum qcow2_discard_type {
     QCOW2_DISCARD_NEVER = 0,
     QCOW2_DISCARD_ALWAYS,
@@ -181,6 +200,7 @@ typedef struct BDRVQcowState {
     uint32_t refcount_table_size;
     int64_t free_cluster_index;
     int64_t free_byte_offset;
+    uint64_t free_cluster_hint; /* from the header, see docs/specs/qcow2.txt */
 
     CoMutex lock;
 
@@ -193,6 +213,9 @@ typedef struct BDRVQcowState {
     int nb_snapshots;
     QCowSnapshot *snapshots;
 
+    int nb_bitmaps;
+    Qcow2Bitmap *bitmaps;
+
     int flags;
     int qcow_version;
     bool use_lazy_refcounts;
@@ -418,6 +441,16 @@ int qcow2_snapshot_load_tmp(BlockDriverState *bs, const char *snapshot_name);
 void qcow2_free_snapshots(BlockDriverState *bs);
 int qcow2_read_snapshots(BlockDriverState *bs);
 
+/* qcow2-bitmap.c functions */
+int qcow2_read_bitmap_ext(BlockDriverState *bs, uint64_t offset, uint32_t len);
+void *qcow2_build_bitmap_ext(BlockDriverState *bs, size_t *len);
+int qcow2_load_dirty_bitmaps(BlockDriverState *bs);
+int qcow2_discard_stored_bitmaps(BlockDriverState *bs);
+int qcow2_update_dirty_bitmaps(BlockDriverState *bs);
+int qcow2_store_dirty_bitmaps(BlockDriverState *bs);
+void qcow2_release_dirty_bitmaps(BlockDriverState *bs);
+void qcow2_free_bitmaps(BlockDriverState *bs);
+
 /* qcow2-cache.c functions */
 Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables);
 int qcow2_cache_destroy(BlockDriverState* bs, Qcow2Cache *c);
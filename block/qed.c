@@ -26,7 +26,7 @@ static void qed_aio_cancel(BlockDriverAIOCB *blockacb)
     /* Wait for the request to finish */
     acb->finished = &finished;
     while (!finished) {
-        qemu_aio_wait();
+        aio_poll(bdrv_get_aio_context(blockacb->bs), true);
     }
 }
 
@@ -337,6 +337,10 @@ static void qed_clear_need_check(void *opaque, int ret)
 static void qed_need_check_timer_cb(void *opaque)
 {
     BDRVQEDState *s = opaque;
+    AioContext *aio_context = bdrv_get_aio_context(s->bs);
+
+    /* The timer runs in the main loop even if bs has its own AioContext */
+    aio_context_acquire(aio_context);
 
     /* The timer should only fire when allocating writes have drained */
     assert(!QSIMPLEQ_FIRST(&s->allocating_write_reqs));
@@ -347,6 +351,7 @@ static void qed_need_check_timer_cb(void *opaque)
 
     /* Ensure writes are on disk before clearing flag */
     bdrv_aio_flush(s->bs, qed_clear_need_check, s);
+    aio_context_release(aio_context);
 }
 
 static void qed_start_need_check_timer(BDRVQEDState *s)
@@ -882,7 +887,8 @@ static void qed_aio_complete(QEDAIOCB *acb, int ret)
 
     /* Arrange for a bh to invoke the completion function */
     acb->bh_ret = ret;
-    acb->bh = qemu_bh_new(qed_aio_complete_bh, acb);
+    acb->bh = aio_bh_new(bdrv_get_aio_context(acb->common.bs),
+                         qed_aio_complete_bh, acb);
     qemu_bh_schedule(acb->bh);
 
     /* Start next allocating write request waiting behind this one.  Note that
@@ -1023,6 +1023,7 @@ static void drive_backup_prepare(BlkTransactionState *common, Error **errp)
                      backup->sync,
                      backup->has_mode, backup->mode,
                      backup->has_speed, backup->speed,
+                     backup->has_bitmap, backup->bitmap,
                      backup->has_on_source_error, backup->on_source_error,
                      backup->has_on_target_error, backup->on_target_error,
                      &local_err);
@@ -1268,6 +1269,7 @@ void qmp_block_set_io_throttle(const char *device, int64_t bps, int64_t bps_rd,
                                int64_t iops_wr, Error **errp)
 {
     BlockIOLimit io_limits;
+    AioContext *aio_context;
     BlockDriverState *bs;
 
     bs = bdrv_find(device);
@@ -1287,6 +1289,9 @@ void qmp_block_set_io_throttle(const char *device, int64_t bps, int64_t bps_rd,
         return;
     }
 
+    aio_context = bdrv_get_aio_context(bs);
+    aio_context_acquire(aio_context);
+
     bs->io_limits = io_limits;
 
     if (!bs->io_limits_enabled && bdrv_io_limits_enabled(bs)) {
@@ -1298,6 +1303,8 @@ void qmp_block_set_io_throttle(const char *device, int64_t bps, int64_t bps_rd,
             qemu_mod_timer(bs->block_timer, qemu_get_clock_ns(vm_clock));
         }
     }
+
+    aio_context_release(aio_context);
 }
 
 int do_drive_del(Monitor *mon, const QDict *qdict, QObject **ret_data)
@@ -1509,6 +1516,7 @@ void qmp_drive_backup(const char *device, const char *target,
                       enum MirrorSyncMode sync,
                       bool has_mode, enum NewImageMode mode,
                       bool has_speed, int64_t speed,
+                      bool has_bitmap, const char *bitmap,
                       bool has_on_source_error, BlockdevOnError on_source_error,
                       bool has_on_target_error, BlockdevOnError on_target_error,
                       Error **errp)
@@ -1516,6 +1524,7 @@ void qmp_drive_backup(const char *device, const char *target,
     BlockDriverState *bs;
     BlockDriverState *target_bs;
     BlockDriverState *source = NULL;
+    BdrvDirtyBitmap *sync_bitmap = NULL;
     BlockDriver *drv = NULL;
     Error *local_err = NULL;
     int flags;
@@ -1562,6 +1571,24 @@ void qmp_drive_backup(const char *device, const char *target,
         return;
     }
 
+    if ((sync == MIRROR_SYNC_MODE_INCREMENTAL) != has_bitmap) {
+        error_setg(errp, "A dirty bitmap must be given exactly if sync mode "
+                   "'incremental' is used");
+        return;
+    }
+    if (has_bitmap) {
+        sync_bitmap = bdrv_find_dirty_bitmap(bs, bitmap);
+        if (!sync_bitmap) {
+            error_setg(errp, "Dirty bitmap '%s' not found", bitmap);
+            return;
+        }
+        if (sync_bitmap->frozen) {
+            error_setg(errp, "Dirty bitmap '%s' is in use by another backup",
+                       bitmap);
+            return;
+        }
+    }
+
     flags = bs->open_flags | BDRV_O_RDWR;
 
     /* See if we have a backing HD we can use to create our new image
@@ -1607,7 +1634,8 @@ void qmp_drive_backup(const char *device, const char *target,
         return;
     }
 
-    backup_start(bs, target_bs, speed, sync, on_source_error, on_target_error,
+    backup_start(bs, target_bs, speed, sync, sync_bitmap,
+                 on_source_error, on_target_error,
                  block_job_cb, bs, &local_err);
     if (local_err != NULL) {
         bdrv_delete(target_bs);
@@ -1697,6 +1725,12 @@ void qmp_drive_mirror(const char *device, const char *target,
         return;
     }
 
+    if (sync == MIRROR_SYNC_MODE_INCREMENTAL) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "sync",
+                  "'top', 'full' or 'none'");
+        return;
+    }
+
     flags = bs->open_flags | BDRV_O_RDWR;
     source = bs->backing_hd;
     if (!source && sync == MIRROR_SYNC_MODE_TOP) {
@@ -1762,6 +1796,110 @@ void qmp_drive_mirror(const char *device, const char *target,
     drive_get_ref(drive_get_by_blockdev(bs));
 }
 
+static BdrvDirtyBitmap *find_dirty_bitmap(const char *device,
+                                          const char *name,
+                                          BlockDriverState **pbs,
+                                          Error **errp)
+{
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+
+    bs = bdrv_find(device);
+    if (!bs) {
+        error_set(errp, QERR_DEVICE_NOT_FOUND, device);
+        return NULL;
+    }
+
+    bitmap = bdrv_find_dirty_bitmap(bs, name);
+    if (!bitmap) {
+        error_setg(errp, "Dirty bitmap '%s' not found", name);
+        return NULL;
+    }
+    if (bitmap->frozen) {
+        error_setg(errp, "Dirty bitmap '%s' is in use by a backup job", name);
+        return NULL;
+    }
+
+    *pbs = bs;
+    return bitmap;
+}
+
+void qmp_block_dirty_bitmap_add(const char *device, const char *name,
+                                bool has_granularity, int64_t granularity,
+                                bool has_persistent, bool persistent,
+                                Error **errp)
+{
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+    BlockDriverInfo bdi;
+    Error *local_err = NULL;
+
+    bs = bdrv_find(device);
+    if (!bs) {
+        error_set(errp, QERR_DEVICE_NOT_FOUND, device);
+        return;
+    }
+
+    if (has_granularity) {
+        if (granularity < BDRV_SECTOR_SIZE || granularity > (64 << 20) ||
+            (granularity & (granularity - 1))) {
+            error_set(errp, QERR_INVALID_PARAMETER, "granularity");
+            return;
+        }
+    } else {
+        /* Default to the cluster size, so that a bit covers one allocation
+         * unit of the image. */
+        if (bdrv_get_info(bs, &bdi) >= 0 && bdi.cluster_size >= 4096 &&
+            bdi.cluster_size <= (64 << 20)) {
+            granularity = bdi.cluster_size;
+        } else {
+            granularity = 65536;
+        }
+    }
+
+    bitmap = bdrv_create_dirty_bitmap(bs, granularity, name, &local_err);
+    if (error_is_set(&local_err)) {
+        error_propagate(errp, local_err);
+        return;
+    }
+
+    if (has_persistent && persistent) {
+        bdrv_dirty_bitmap_make_persistent(bs, bitmap, &local_err);
+        if (error_is_set(&local_err)) {
+            bdrv_release_dirty_bitmap(bs, bitmap);
+            error_propagate(errp, local_err);
+        }
+    }
+}
+
+void qmp_block_dirty_bitmap_remove(const char *device, const char *name,
+                                   Error **errp)
+{
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+
+    bitmap = find_dirty_bitmap(device, name, &bs, errp);
+    if (!bitmap) {
+        return;
+    }
+
+    bdrv_release_dirty_bitmap(bs, bitmap);
+}
+
+void qmp_block_dirty_bitmap_clear(const char *device, const char *name,
+                                  Error **errp)
+{
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+
+    bitmap = find_dirty_bitmap(device, name, &bs, errp);
+    if (!bitmap) {
+        return;
+    }
+
+    bdrv_clear_dirty_bitmap(bs, bitmap);
+}
+
 static BlockJob *find_block_job(const char *device)
 {
     BlockDriverState *bs;
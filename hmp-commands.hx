@@ -1615,6 +1615,8 @@ show block device statistics
 show the cpu registers
 @item info cpus
 show infos for each CPU
+@item info iothreads
+show iothreads
 @item info history
 show the command line history
 @item info irq
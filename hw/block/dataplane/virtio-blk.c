@@ -12,84 +12,177 @@
  *
  */
 
+#include <sys/timerfd.h>
 #include "trace.h"
 #include "qemu/iov.h"
-#include "qemu/thread.h"
 #include "qemu/error-report.h"
 #include "hw/virtio/dataplane/vring.h"
-#include "ioq.h"
 #include "block/block.h"
 #include "hw/virtio/virtio-blk.h"
 #include "virtio-blk.h"
 #include "block/aio.h"
 #include "hw/virtio/virtio-bus.h"
+#include "sysemu/iothread.h"
 
 enum {
     SEG_MAX = 126,                  /* maximum number of I/O segments */
     VRING_MAX = SEG_MAX + 2,        /* maximum number of vring descriptors */
-    REQ_MAX = VRING_MAX,            /* maximum number of requests in the vring,
-                                     * is VRING_MAX / 2 with traditional and
-                                     * VRING_MAX with indirect descriptors */
 };
 
+/* Per-virtqueue state.  All queues of a device share the device's IOThread
+ * because the BlockDriverState can only live in one AioContext.
+ */
+typedef struct {
+    VirtIOBlockDataPlane *s;
+    unsigned int index;             /* virtqueue number */
+    Vring vring;                    /* virtqueue vring */
+    EventNotifier *guest_notifier;  /* irq */
+    bool notify_pending;            /* completions not yet signalled */
+
+    /* Interrupt moderation, the timer runs in the IOThread */
+    int irq_timer_fd;               /* timerfd, or -1 if not moderated */
+    bool irq_timer_armed;
+    unsigned int irq_pending;       /* completions since the last irq */
+
+    /* Note that this EventNotifier is assigned by value.  This is fine as
+     * long as you do not call event_notifier_cleanup on it (because you
+     * don't own the file descriptor or handle; you just use it).
+     */
+    EventNotifier host_notifier;    /* doorbell */
+} VirtIOBlockQueue;
+
 typedef struct {
-    struct iocb iocb;               /* Linux AIO control block */
+    VirtIOBlockQueue *q;
     QEMUIOVector *inhdr;            /* iovecs for virtio_blk_inhdr */
     unsigned int head;              /* vring descriptor index */
-    struct iovec *bounce_iov;       /* used if guest buffers are unaligned */
-    QEMUIOVector *read_qiov;        /* for read completion /w bounce buffer */
+    QEMUIOVector qiov;              /* guest buffers, valid until completion */
 } VirtIOBlockRequest;
 
 struct VirtIOBlockDataPlane {
     bool started;
     bool stopping;
-    QEMUBH *start_bh;
-    QemuThread thread;
 
     VirtIOBlkConf *blk;
-    int fd;                         /* image file descriptor */
 
     VirtIODevice *vdev;
-    Vring vring;                    /* virtqueue vring */
-    EventNotifier *guest_notifier;  /* irq */
+    unsigned int num_queues;
+    VirtIOBlockQueue *queues;
+    QEMUBH *notify_guest_bh;        /* batches completion interrupts */
 
-    /* Note that these EventNotifiers are assigned by value.  This is
-     * fine as long as you do not call event_notifier_cleanup on them
-     * (because you don't own the file descriptor or handle; you just
-     * use it).
-     */
+    IOThread *iothread;             /* shared, or private to this device */
     AioContext *ctx;
-    EventNotifier io_notifier;      /* Linux AIO completion */
-    EventNotifier host_notifier;    /* doorbell */
-
-    IOQueue ioqueue;                /* Linux AIO queue (should really be per
-                                       dataplane thread) */
-    VirtIOBlockRequest requests[REQ_MAX]; /* pool of requests, managed by the
-                                             queue */
 
     unsigned int num_reqs;
 };
 
 /* Raise an interrupt to signal guest, if necessary */
-static void notify_guest(VirtIOBlockDataPlane *s)
+static void send_irq(VirtIOBlockQueue *q)
 {
-    if (!vring_should_notify(s->vdev, &s->vring)) {
+    q->irq_pending = 0;
+
+    if (!vring_should_notify(q->s->vdev, &q->vring)) {
+        return;
+    }
+
+    event_notifier_set(q->guest_notifier);
+    virtio_queue_inc_irq_count(virtio_get_queue(q->s->vdev, q->index));
+}
+
+static void irq_timer_set(VirtIOBlockQueue *q, uint32_t usecs)
+{
+    struct itimerspec its = {
+        .it_value = {
+            .tv_sec = usecs / 1000000,
+            .tv_nsec = (usecs % 1000000) * 1000,
+        },
+    };
+
+    timerfd_settime(q->irq_timer_fd, 0, &its, NULL);
+    q->irq_timer_armed = usecs != 0;
+}
+
+static void handle_irq_timer(void *opaque)
+{
+    VirtIOBlockQueue *q = opaque;
+    uint64_t expirations;
+
+    if (read(q->irq_timer_fd, &expirations, sizeof(expirations)) < 0) {
+        return; /* spurious wakeup */
+    }
+
+    q->irq_timer_armed = false;
+    if (q->irq_pending) {
+        send_irq(q);
+    }
+}
+
+/* Send an interrupt now or leave it to the moderation timer */
+static void notify_guest(VirtIOBlockQueue *q)
+{
+    uint32_t max_frames = q->s->blk->irq_max_frames;
+
+    q->notify_pending = false;
+
+    if (q->irq_timer_fd < 0) {
+        send_irq(q);
         return;
     }
 
-    event_notifier_set(s->guest_notifier);
+    if (max_frames && q->irq_pending >= max_frames) {
+        if (q->irq_timer_armed) {
+            irq_timer_set(q, 0);
+        }
+        send_irq(q);
+    } else if (!q->irq_timer_armed) {
+        irq_timer_set(q, q->s->blk->irq_max_usecs);
+    }
 }
 
-static void complete_request(struct iocb *iocb, ssize_t ret, void *opaque)
+/* Deliver a held back interrupt right away */
+static void flush_irq(VirtIOBlockQueue *q)
+{
+    if (q->irq_timer_armed) {
+        irq_timer_set(q, 0);
+    }
+    if (q->irq_pending) {
+        send_irq(q);
+    }
+}
+
+static void notify_guest_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
-    VirtIOBlockRequest *req = container_of(iocb, VirtIOBlockRequest, iocb);
+    unsigned int i;
+
+    for (i = 0; i < s->num_queues; i++) {
+        VirtIOBlockQueue *q = &s->queues[i];
+
+        if (!q->notify_pending) {
+            continue;
+        }
+        notify_guest(q);
+
+        /* If there were more requests than iovecs, the vring will not be
+         * empty yet so check again.  There should now be enough resources to
+         * process more requests.
+         */
+        if (unlikely(vring_more_avail(&q->vring))) {
+            event_notifier_set(&q->host_notifier);
+        }
+    }
+}
+
+static void complete_request(void *opaque, int ret)
+{
+    VirtIOBlockRequest *req = opaque;
+    VirtIOBlockQueue *q = req->q;
+    VirtIOBlockDataPlane *s = q->s;
     struct virtio_blk_inhdr hdr;
     int len;
 
-    if (likely(ret >= 0)) {
+    if (likely(ret == 0)) {
         hdr.status = VIRTIO_BLK_S_OK;
-        len = ret;
+        len = req->qiov.size;
     } else {
         hdr.status = VIRTIO_BLK_S_IOERR;
         len = 0;
@@ -97,18 +190,6 @@ static void complete_request(struct iocb *iocb, ssize_t ret, void *opaque)
 
     trace_virtio_blk_data_plane_complete_request(s, req->head, ret);
 
-    if (req->read_qiov) {
-        assert(req->bounce_iov);
-        qemu_iovec_from_buf(req->read_qiov, 0, req->bounce_iov->iov_base, len);
-        qemu_iovec_destroy(req->read_qiov);
-        g_slice_free(QEMUIOVector, req->read_qiov);
-    }
-
-    if (req->bounce_iov) {
-        qemu_vfree(req->bounce_iov->iov_base);
-        g_slice_free(struct iovec, req->bounce_iov);
-    }
-
     qemu_iovec_from_buf(req->inhdr, 0, &hdr, sizeof(hdr));
     qemu_iovec_destroy(req->inhdr);
     g_slice_free(QEMUIOVector, req->inhdr);
@@ -117,12 +198,18 @@ static void complete_request(struct iocb *iocb, ssize_t ret, void *opaque)
      * written to, but for virtio-blk it seems to be the number of bytes
      * transferred plus the status bytes.
      */
-    vring_push(&s->vring, req->head, len + sizeof(hdr));
+    vring_push(&q->vring, req->head, len + sizeof(hdr));
+
+    qemu_iovec_destroy(&req->qiov);
+    g_slice_free(VirtIOBlockRequest, req);
 
     s->num_reqs--;
+    q->irq_pending++;
+    q->notify_pending = true;
+    qemu_bh_schedule(s->notify_guest_bh);
 }
 
-static void complete_request_early(VirtIOBlockDataPlane *s, unsigned int head,
+static void complete_request_early(VirtIOBlockQueue *q, unsigned int head,
                                    QEMUIOVector *inhdr, unsigned char status)
 {
     struct virtio_blk_inhdr hdr = {
@@ -133,70 +220,104 @@ static void complete_request_early(VirtIOBlockDataPlane *s, unsigned int head,
     qemu_iovec_destroy(inhdr);
     g_slice_free(QEMUIOVector, inhdr);
 
-    vring_push(&s->vring, head, sizeof(hdr));
-    notify_guest(s);
+    vring_push(&q->vring, head, sizeof(hdr));
+    q->irq_pending++;
+    notify_guest(q);
 }
 
 /* Get disk serial number */
-static void do_get_id_cmd(VirtIOBlockDataPlane *s,
+static void do_get_id_cmd(VirtIOBlockQueue *q,
                           struct iovec *iov, unsigned int iov_cnt,
                           unsigned int head, QEMUIOVector *inhdr)
 {
+    VirtIOBlockDataPlane *s = q->s;
     char id[VIRTIO_BLK_ID_BYTES];
 
     /* Serial number not NUL-terminated when shorter than buffer */
     strncpy(id, s->blk->serial ? s->blk->serial : "", sizeof(id));
     iov_from_buf(iov, iov_cnt, 0, id, sizeof(id));
-    complete_request_early(s, head, inhdr, VIRTIO_BLK_S_OK);
+    complete_request_early(q, head, inhdr, VIRTIO_BLK_S_OK);
 }
 
-static int do_rdwr_cmd(VirtIOBlockDataPlane *s, bool read,
-                       struct iovec *iov, unsigned int iov_cnt,
-                       long long offset, unsigned int head,
-                       QEMUIOVector *inhdr)
+static VirtIOBlockRequest *alloc_request(VirtIOBlockQueue *q,
+                                         unsigned int head,
+                                         QEMUIOVector *inhdr)
 {
-    struct iocb *iocb;
-    QEMUIOVector qiov;
-    struct iovec *bounce_iov = NULL;
-    QEMUIOVector *read_qiov = NULL;
-
-    qemu_iovec_init_external(&qiov, iov, iov_cnt);
-    if (!bdrv_qiov_is_aligned(s->blk->conf.bs, &qiov)) {
-        void *bounce_buffer = qemu_blockalign(s->blk->conf.bs, qiov.size);
-
-        if (read) {
-            /* Need to copy back from bounce buffer on completion */
-            read_qiov = g_slice_new(QEMUIOVector);
-            qemu_iovec_init(read_qiov, iov_cnt);
-            qemu_iovec_concat_iov(read_qiov, iov, iov_cnt, 0, qiov.size);
-        } else {
-            qemu_iovec_to_buf(&qiov, 0, bounce_buffer, qiov.size);
-        }
+    VirtIOBlockRequest *req = g_slice_new(VirtIOBlockRequest);
+
+    req->q = q;
+    req->head = head;
+    req->inhdr = inhdr;
+    q->s->num_reqs++;
+    return req;
+}
+
+/* Same checks as the non-dataplane path, which fails such requests with
+ * -EIO; the length must not be truncated to whole sectors silently.
+ */
+static bool rdwr_request_valid(VirtIOBlockDataPlane *s, uint64_t sector_num,
+                               size_t size)
+{
+    BlockConf *conf = &s->blk->conf;
+    uint64_t sector_mask = conf->logical_block_size / BDRV_SECTOR_SIZE - 1;
+    int64_t total_sectors;
+    uint64_t nb_sectors = size / BDRV_SECTOR_SIZE;
+
+    if ((sector_num & sector_mask) || size % conf->logical_block_size) {
+        return false;
+    }
+    total_sectors = bdrv_getlength(conf->bs);
+    if (total_sectors < 0) {
+        return false;
+    }
+    total_sectors >>= BDRV_SECTOR_BITS;
+    return sector_num <= total_sectors &&
+           nb_sectors <= total_sectors - sector_num;
+}
+
+static void do_rdwr_cmd(VirtIOBlockQueue *q, bool read,
+                        struct iovec *iov, unsigned int iov_cnt,
+                        uint64_t sector_num, unsigned int head,
+                        QEMUIOVector *inhdr)
+{
+    VirtIOBlockRequest *req;
+    BlockDriverState *bs = q->s->blk->conf.bs;
+    int nb_sectors;
 
-        /* Redirect I/O to aligned bounce buffer */
-        bounce_iov = g_slice_new(struct iovec);
-        bounce_iov->iov_base = bounce_buffer;
-        bounce_iov->iov_len = qiov.size;
-        iov = bounce_iov;
-        iov_cnt = 1;
+    if (!rdwr_request_valid(q->s, sector_num, iov_size(iov, iov_cnt))) {
+        complete_request_early(q, head, inhdr, VIRTIO_BLK_S_IOERR);
+        return;
     }
 
-    iocb = ioq_rdwr(&s->ioqueue, read, iov, iov_cnt, offset);
+    req = alloc_request(q, head, inhdr);
 
-    /* Fill in virtio block metadata needed for completion */
-    VirtIOBlockRequest *req = container_of(iocb, VirtIOBlockRequest, iocb);
-    req->head = head;
-    req->inhdr = inhdr;
-    req->bounce_iov = bounce_iov;
-    req->read_qiov = read_qiov;
-    return 0;
+    /* The iovecs only live until handle_notify() returns, keep a copy */
+    qemu_iovec_init(&req->qiov, iov_cnt);
+    qemu_iovec_concat_iov(&req->qiov, iov, iov_cnt, 0, iov_size(iov, iov_cnt));
+    nb_sectors = req->qiov.size / BDRV_SECTOR_SIZE;
+
+    if (read) {
+        bdrv_aio_readv(bs, sector_num, &req->qiov, nb_sectors,
+                       complete_request, req);
+    } else {
+        bdrv_aio_writev(bs, sector_num, &req->qiov, nb_sectors,
+                        complete_request, req);
+    }
 }
 
-static int process_request(IOQueue *ioq, struct iovec iov[],
+static void do_flush_cmd(VirtIOBlockQueue *q, unsigned int head,
+                         QEMUIOVector *inhdr)
+{
+    VirtIOBlockRequest *req = alloc_request(q, head, inhdr);
+
+    qemu_iovec_init(&req->qiov, 0);
+    bdrv_aio_flush(q->s->blk->conf.bs, complete_request, req);
+}
+
+static int process_request(VirtIOBlockQueue *q, struct iovec iov[],
                            unsigned int out_num, unsigned int in_num,
                            unsigned int head)
 {
-    VirtIOBlockDataPlane *s = container_of(ioq, VirtIOBlockDataPlane, ioqueue);
     struct iovec *in_iov = &iov[out_num];
     struct virtio_blk_outhdr outhdr;
     QEMUIOVector *inhdr;
@@ -228,29 +349,24 @@ static int process_request(IOQueue *ioq, struct iovec iov[],
 
     switch (outhdr.type) {
     case VIRTIO_BLK_T_IN:
-        do_rdwr_cmd(s, true, in_iov, in_num, outhdr.sector * 512, head, inhdr);
+        do_rdwr_cmd(q, true, in_iov, in_num, outhdr.sector, head, inhdr);
         return 0;
 
     case VIRTIO_BLK_T_OUT:
-        do_rdwr_cmd(s, false, iov, out_num, outhdr.sector * 512, head, inhdr);
+        do_rdwr_cmd(q, false, iov, out_num, outhdr.sector, head, inhdr);
         return 0;
 
     case VIRTIO_BLK_T_SCSI_CMD:
         /* TODO support SCSI commands */
-        complete_request_early(s, head, inhdr, VIRTIO_BLK_S_UNSUPP);
+        complete_request_early(q, head, inhdr, VIRTIO_BLK_S_UNSUPP);
         return 0;
 
     case VIRTIO_BLK_T_FLUSH:
-        /* TODO fdsync not supported by Linux AIO, do it synchronously here! */
-        if (qemu_fdatasync(s->fd) < 0) {
-            complete_request_early(s, head, inhdr, VIRTIO_BLK_S_IOERR);
-        } else {
-            complete_request_early(s, head, inhdr, VIRTIO_BLK_S_OK);
-        }
+        do_flush_cmd(q, head, inhdr);
         return 0;
 
     case VIRTIO_BLK_T_GET_ID:
-        do_get_id_cmd(s, in_iov, in_num, head, inhdr);
+        do_get_id_cmd(q, in_iov, in_num, head, inhdr);
         return 0;
 
     default:
@@ -268,18 +384,14 @@ static int flush_true(EventNotifier *e)
 
 static void handle_notify(EventNotifier *e)
 {
-    VirtIOBlockDataPlane *s = container_of(e, VirtIOBlockDataPlane,
-                                           host_notifier);
+    VirtIOBlockQueue *q = container_of(e, VirtIOBlockQueue, host_notifier);
+    VirtIOBlockDataPlane *s = q->s;
 
     /* There is one array of iovecs into which all new requests are extracted
      * from the vring.  Requests are read from the vring and the translated
      * descriptors are written to the iovecs array.  The iovecs do not have to
-     * persist across handle_notify() calls because the kernel copies the
-     * iovecs on io_submit().
-     *
-     * Handling io_submit() EAGAIN may require storing the requests across
-     * handle_notify() calls until the kernel has sufficient resources to
-     * accept more I/O.  This is not implemented yet.
+     * persist across handle_notify() calls because each request copies them
+     * into its own QEMUIOVector.
      */
     struct iovec iovec[VRING_MAX];
     struct iovec *end = &iovec[VRING_MAX];
@@ -294,15 +406,15 @@ static void handle_notify(EventNotifier *e)
      */
     int head;
     unsigned int out_num = 0, in_num = 0;
-    unsigned int num_queued;
 
-    event_notifier_test_and_clear(&s->host_notifier);
+    event_notifier_test_and_clear(&q->host_notifier);
+    bdrv_io_plug(s->blk->conf.bs);
     for (;;) {
         /* Disable guest->host notifies to avoid unnecessary vmexits */
-        vring_disable_notification(s->vdev, &s->vring);
+        vring_disable_notification(s->vdev, &q->vring);
 
         for (;;) {
-            head = vring_pop(s->vdev, &s->vring, iov, end, &out_num, &in_num);
+            head = vring_pop(s->vdev, &q->vring, iov, end, &out_num, &in_num);
             if (head < 0) {
                 break; /* no more requests */
             }
@@ -310,8 +422,8 @@ static void handle_notify(EventNotifier *e)
             trace_virtio_blk_data_plane_process_request(s, out_num, in_num,
                                                         head);
 
-            if (process_request(&s->ioqueue, iov, out_num, in_num, head) < 0) {
-                vring_set_broken(&s->vring);
+            if (process_request(q, iov, out_num, in_num, head) < 0) {
+                vring_set_broken(&q->vring);
                 break;
             }
             iov += out_num + in_num;
@@ -321,86 +433,43 @@ static void handle_notify(EventNotifier *e)
             /* Re-enable guest->host notifies and stop processing the vring.
              * But if the guest has snuck in more descriptors, keep processing.
              */
-            if (vring_enable_notification(s->vdev, &s->vring)) {
+            if (vring_enable_notification(s->vdev, &q->vring)) {
                 break;
             }
         } else { /* head == -ENOBUFS or fatal error, iovecs[] is depleted */
             /* Since there are no iovecs[] left, stop processing for now.  Do
-             * not re-enable guest->host notifies since the I/O completion
-             * handler knows to check for more vring descriptors anyway.
+             * not re-enable guest->host notifies since notify_guest_bh()
+             * knows to check for more vring descriptors anyway.
              */
             break;
         }
     }
 
-    num_queued = ioq_num_queued(&s->ioqueue);
-    if (num_queued > 0) {
-        s->num_reqs += num_queued;
-
-        int rc = ioq_submit(&s->ioqueue);
-        if (unlikely(rc < 0)) {
-            fprintf(stderr, "ioq_submit failed %d\n", rc);
-            exit(1);
-        }
-    }
+    bdrv_io_unplug(s->blk->conf.bs);
 }
 
-static int flush_io(EventNotifier *e)
+/* Busy-polling callback: pick up new requests without waiting for a kick */
+static bool poll_notify(void *opaque)
 {
-    VirtIOBlockDataPlane *s = container_of(e, VirtIOBlockDataPlane,
-                                           io_notifier);
+    VirtIOBlockQueue *q = container_of(opaque, VirtIOBlockQueue,
+                                       host_notifier);
 
-    return s->num_reqs > 0;
-}
-
-static void handle_io(EventNotifier *e)
-{
-    VirtIOBlockDataPlane *s = container_of(e, VirtIOBlockDataPlane,
-                                           io_notifier);
-
-    event_notifier_test_and_clear(&s->io_notifier);
-    if (ioq_run_completion(&s->ioqueue, complete_request, s) > 0) {
-        notify_guest(s);
-    }
-
-    /* If there were more requests than iovecs, the vring will not be empty yet
-     * so check again.  There should now be enough resources to process more
-     * requests.
-     */
-    if (unlikely(vring_more_avail(&s->vring))) {
-        handle_notify(&s->host_notifier);
+    if (q->vring.broken || !vring_more_avail(&q->vring)) {
+        return false;
     }
-}
-
-static void *data_plane_thread(void *opaque)
-{
-    VirtIOBlockDataPlane *s = opaque;
-
-    do {
-        aio_poll(s->ctx, true);
-    } while (!s->stopping || s->num_reqs > 0);
-    return NULL;
-}
-
-static void start_data_plane_bh(void *opaque)
-{
-    VirtIOBlockDataPlane *s = opaque;
-
-    qemu_bh_delete(s->start_bh);
-    s->start_bh = NULL;
-    qemu_thread_create(&s->thread, data_plane_thread,
-                       s, QEMU_THREAD_JOINABLE);
+    handle_notify(&q->host_notifier);
+    return true;
 }
 
 bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *blk,
                                   VirtIOBlockDataPlane **dataplane)
 {
     VirtIOBlockDataPlane *s;
-    int fd;
+    unsigned int i;
 
     *dataplane = NULL;
 
-    if (!blk->data_plane) {
+    if (!blk->data_plane && !blk->iothread) {
         return true;
     }
 
@@ -423,18 +492,33 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *blk,
         return false;
     }
 
-    fd = raw_get_aio_fd(blk->conf.bs);
-    if (fd < 0) {
+    if (!bdrv_can_set_aio_context(blk->conf.bs)) {
         error_report("drive is incompatible with x-data-plane, "
-                     "use format=raw,cache=none,aio=native");
+                     "its protocol cannot run outside the main loop");
         return false;
     }
 
     s = g_new0(VirtIOBlockDataPlane, 1);
     s->vdev = vdev;
-    s->fd = fd;
     s->blk = blk;
 
+    s->num_queues = blk->num_queues;
+    s->queues = g_new0(VirtIOBlockQueue, s->num_queues);
+    for (i = 0; i < s->num_queues; i++) {
+        s->queues[i].s = s;
+        s->queues[i].index = i;
+        s->queues[i].irq_timer_fd = -1;
+    }
+
+    if (blk->iothread) {
+        s->iothread = blk->iothread;
+        object_ref(OBJECT(s->iothread));
+    } else {
+        /* Create per-device IOThread if none specified */
+        s->iothread = IOTHREAD(object_new(TYPE_IOTHREAD));
+    }
+    s->ctx = iothread_get_aio_context(s->iothread);
+
     /* Prevent block operations that conflict with data plane thread */
     bdrv_set_in_use(blk->conf.bs, 1);
 
@@ -450,6 +534,8 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 
     virtio_blk_data_plane_stop(s);
     bdrv_set_in_use(s->blk->conf.bs, 0);
+    object_unref(OBJECT(s->iothread));
+    g_free(s->queues);
     g_free(s);
 }
 
@@ -457,86 +543,137 @@ void virtio_blk_data_plane_start(VirtIOBlockDataPlane *s)
 {
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(s->vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
-    VirtQueue *vq;
-    int i;
+    unsigned int i;
 
     if (s->started) {
         return;
     }
 
-    vq = virtio_get_queue(s->vdev, 0);
-    if (!vring_setup(&s->vring, s->vdev, 0)) {
-        return;
+    for (i = 0; i < s->num_queues; i++) {
+        if (!vring_setup(&s->queues[i].vring, s->vdev, i)) {
+            while (i-- > 0) {
+                vring_teardown(&s->queues[i].vring, s->vdev, i);
+            }
+            return;
+        }
     }
 
-    s->ctx = aio_context_new();
+    s->notify_guest_bh = aio_bh_new(s->ctx, notify_guest_bh, s);
 
-    /* Set up guest notifier (irq) */
-    if (k->set_guest_notifiers(qbus->parent, 1, true) != 0) {
+    /* Set up guest notifiers (irq), one per virtqueue */
+    if (k->set_guest_notifiers(qbus->parent, s->num_queues, true) != 0) {
         fprintf(stderr, "virtio-blk failed to set guest notifier, "
                 "ensure -enable-kvm is set\n");
         exit(1);
     }
-    s->guest_notifier = virtio_queue_get_guest_notifier(vq);
 
     /* Set up virtqueue notify */
-    if (k->set_host_notifier(qbus->parent, 0, true) != 0) {
-        fprintf(stderr, "virtio-blk failed to set host notifier\n");
-        exit(1);
-    }
-    s->host_notifier = *virtio_queue_get_host_notifier(vq);
-    aio_set_event_notifier(s->ctx, &s->host_notifier, handle_notify, flush_true);
+    for (i = 0; i < s->num_queues; i++) {
+        VirtIOBlockQueue *q = &s->queues[i];
+        VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-    /* Set up ioqueue */
-    ioq_init(&s->ioqueue, s->fd, REQ_MAX);
-    for (i = 0; i < ARRAY_SIZE(s->requests); i++) {
-        ioq_put_iocb(&s->ioqueue, &s->requests[i].iocb);
+        q->guest_notifier = virtio_queue_get_guest_notifier(vq);
+        if (k->set_host_notifier(qbus->parent, i, true) != 0) {
+            fprintf(stderr, "virtio-blk failed to set host notifier\n");
+            exit(1);
+        }
+        q->host_notifier = *virtio_queue_get_host_notifier(vq);
+
+        q->irq_pending = 0;
+        q->irq_timer_armed = false;
+        if (s->blk->irq_max_usecs) {
+            q->irq_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                             TFD_NONBLOCK | TFD_CLOEXEC);
+            if (q->irq_timer_fd < 0) {
+                error_report("virtio-blk: no interrupt moderation for queue "
+                             "%u: %s", i, strerror(errno));
+            }
+        }
     }
-    s->io_notifier = *ioq_get_notifier(&s->ioqueue);
-    aio_set_event_notifier(s->ctx, &s->io_notifier, handle_io, flush_io);
+
+    /* From now on the image is only accessed from the IOThread or with its
+     * AioContext acquired.
+     */
+    bdrv_set_aio_context(s->blk->conf.bs, s->ctx);
 
     s->started = true;
     trace_virtio_blk_data_plane_start(s);
 
-    /* Kick right away to begin processing requests already in vring */
-    event_notifier_set(virtio_queue_get_host_notifier(vq));
+    /* The IOThread may already be serving other devices */
+    aio_context_acquire(s->ctx);
+    for (i = 0; i < s->num_queues; i++) {
+        VirtIOBlockQueue *q = &s->queues[i];
+
+        aio_set_event_notifier(s->ctx, &q->host_notifier,
+                               handle_notify, flush_true);
+        aio_set_event_notifier_poll(s->ctx, &q->host_notifier, poll_notify);
+        if (q->irq_timer_fd >= 0) {
+            aio_set_fd_handler(s->ctx, q->irq_timer_fd, handle_irq_timer,
+                               NULL, NULL, q);
+        }
+    }
+    aio_context_release(s->ctx);
 
-    /* Spawn thread in BH so it inherits iothread cpusets */
-    s->start_bh = qemu_bh_new(start_data_plane_bh, s);
-    qemu_bh_schedule(s->start_bh);
+    /* Kick right away to begin processing requests already in vring */
+    for (i = 0; i < s->num_queues; i++) {
+        event_notifier_set(&s->queues[i].host_notifier);
+    }
 }
 
 void virtio_blk_data_plane_stop(VirtIOBlockDataPlane *s)
 {
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(s->vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned int i;
+
     if (!s->started || s->stopping) {
         return;
     }
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
-    /* Stop thread or cancel pending thread creation BH */
-    if (s->start_bh) {
-        qemu_bh_delete(s->start_bh);
-        s->start_bh = NULL;
-    } else {
-        aio_notify(s->ctx);
-        qemu_thread_join(&s->thread);
+    aio_context_acquire(s->ctx);
+
+    /* Stop notifications for new requests from guest */
+    for (i = 0; i < s->num_queues; i++) {
+        aio_set_event_notifier(s->ctx, &s->queues[i].host_notifier,
+                               NULL, NULL);
     }
 
-    aio_set_event_notifier(s->ctx, &s->io_notifier, NULL, NULL);
-    ioq_cleanup(&s->ioqueue);
+    /* Complete pending requests and hand the image back to the main loop */
+    bdrv_set_aio_context(s->blk->conf.bs, qemu_get_aio_context());
+
+    /* Interrupt for requests that completed while draining, without
+     * waiting for moderation timers
+     */
+    qemu_bh_cancel(s->notify_guest_bh);
+    for (i = 0; i < s->num_queues; i++) {
+        VirtIOBlockQueue *q = &s->queues[i];
+
+        if (q->irq_timer_fd >= 0) {
+            aio_set_fd_handler(s->ctx, q->irq_timer_fd, NULL, NULL, NULL, NULL);
+            flush_irq(q);
+            close(q->irq_timer_fd);
+            q->irq_timer_fd = -1;
+        } else {
+            send_irq(q);
+        }
+        q->notify_pending = false;
+    }
+    qemu_bh_delete(s->notify_guest_bh);
 
-    aio_set_event_notifier(s->ctx, &s->host_notifier, NULL, NULL);
-    k->set_host_notifier(qbus->parent, 0, false);
+    aio_context_release(s->ctx);
 
-    aio_context_unref(s->ctx);
+    for (i = 0; i < s->num_queues; i++) {
+        k->set_host_notifier(qbus->parent, i, false);
+    }
 
-    /* Clean up guest notifier (irq) */
-    k->set_guest_notifiers(qbus->parent, 1, false);
+    /* Clean up guest notifiers (irq) */
+    k->set_guest_notifiers(qbus->parent, s->num_queues, false);
 
-    vring_teardown(&s->vring, s->vdev, 0);
+    for (i = 0; i < s->num_queues; i++) {
+        vring_teardown(&s->queues[i].vring, s->vdev, i);
+    }
     s->started = false;
     s->stopping = false;
 }
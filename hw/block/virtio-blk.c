@@ -14,6 +14,7 @@
 #include "qemu-common.h"
 #include "qemu/error-report.h"
 #include "trace.h"
+#include "block/coroutine.h"
 #include "hw/block/block.h"
 #include "sysemu/blockdev.h"
 #include "hw/virtio/virtio-blk.h"
@@ -27,9 +28,15 @@
 #endif
 #include "hw/virtio/virtio-bus.h"
 
+/* Each request embeds a VirtQueueElement of several tens of kilobytes, so
+ * only an eighth of the 128 ring entries is cached per queue.
+ */
+#define VIRTIO_BLK_FREE_REQS_PER_QUEUE (128 / 8)
+
 typedef struct VirtIOBlockReq
 {
     VirtIOBlock *dev;
+    VirtQueue *vq;
     VirtQueueElement elem;
     struct virtio_blk_inhdr *in;
     struct virtio_blk_outhdr *out;
@@ -39,6 +46,39 @@ typedef struct VirtIOBlockReq
     BlockAcctCookie acct;
 } VirtIOBlockReq;
 
+static VirtIOBlockReq *virtio_blk_alloc_request(VirtIOBlock *s, VirtQueue *vq)
+{
+    VirtIOBlockReq *req = s->free_reqs;
+
+    if (req) {
+        s->free_reqs = req->next;
+        s->num_free_reqs--;
+    } else {
+        req = g_malloc(sizeof(*req));
+    }
+    req->dev = s;
+    req->vq = vq;
+    req->qiov.size = 0;
+    req->next = NULL;
+    return req;
+}
+
+/* Keep a few requests per queue around for reuse; anything beyond that
+ * is freed on completion so a burst does not pin memory for good.
+ */
+static void virtio_blk_free_request(VirtIOBlockReq *req)
+{
+    VirtIOBlock *s = req->dev;
+
+    if (s->num_free_reqs < s->max_free_reqs) {
+        req->next = s->free_reqs;
+        s->free_reqs = req;
+        s->num_free_reqs++;
+    } else {
+        g_free(req);
+    }
+}
+
 static void virtio_blk_req_complete(VirtIOBlockReq *req, int status)
 {
     VirtIOBlock *s = req->dev;
@@ -47,8 +87,8 @@ static void virtio_blk_req_complete(VirtIOBlockReq *req, int status)
     trace_virtio_blk_req_complete(req, status);
 
     stb_p(&req->in->status, status);
-    virtqueue_push(s->vq, &req->elem, req->qiov.size + sizeof(*req->in));
-    virtio_notify(vdev, s->vq);
+    virtqueue_push(req->vq, &req->elem, req->qiov.size + sizeof(*req->in));
+    virtio_notify(vdev, req->vq);
 }
 
 static int virtio_blk_handle_rw_error(VirtIOBlockReq *req, int error,
@@ -63,7 +103,7 @@ static int virtio_blk_handle_rw_error(VirtIOBlockReq *req, int error,
     } else if (action == BDRV_ACTION_REPORT) {
         virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
         bdrv_acct_done(s->bs, &req->acct);
-        g_free(req);
+        virtio_blk_free_request(req);
     }
 
     bdrv_error_action(s->bs, action, is_read, error);
@@ -84,7 +124,7 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
 
     virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
     bdrv_acct_done(req->dev->bs, &req->acct);
-    g_free(req);
+    virtio_blk_free_request(req);
 }
 
 static void virtio_blk_flush_complete(void *opaque, int ret)
@@ -99,25 +139,16 @@ static void virtio_blk_flush_complete(void *opaque, int ret)
 
     virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
     bdrv_acct_done(req->dev->bs, &req->acct);
-    g_free(req);
-}
-
-static VirtIOBlockReq *virtio_blk_alloc_request(VirtIOBlock *s)
-{
-    VirtIOBlockReq *req = g_malloc(sizeof(*req));
-    req->dev = s;
-    req->qiov.size = 0;
-    req->next = NULL;
-    return req;
+    virtio_blk_free_request(req);
 }
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s)
+static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
 {
-    VirtIOBlockReq *req = virtio_blk_alloc_request(s);
+    VirtIOBlockReq *req = virtio_blk_alloc_request(s, vq);
 
     if (req != NULL) {
-        if (!virtqueue_pop(s->vq, &req->elem)) {
-            g_free(req);
+        if (!virtqueue_pop(vq, &req->elem)) {
+            virtio_blk_free_request(req);
             return NULL;
         }
     }
@@ -142,7 +173,7 @@ static void virtio_blk_handle_scsi(VirtIOBlockReq *req)
      */
     if (req->elem.out_num < 2 || req->elem.in_num < 3) {
         virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
-        g_free(req);
+        virtio_blk_free_request(req);
         return;
     }
 
@@ -232,7 +263,7 @@ static void virtio_blk_handle_scsi(VirtIOBlockReq *req)
     stl_p(&req->scsi->data_len, hdr.dxfer_len);
 
     virtio_blk_req_complete(req, status);
-    g_free(req);
+    virtio_blk_free_request(req);
     return;
 #else
     abort();
@@ -242,14 +273,80 @@ fail:
     /* Just put anything nonzero so that the ioctl fails in the guest.  */
     stl_p(&req->scsi->errors, 255);
     virtio_blk_req_complete(req, status);
-    g_free(req);
+    virtio_blk_free_request(req);
 }
 
 typedef struct MultiReqBuffer {
     BlockRequest        blkreq[32];
     unsigned int        num_writes;
+
+    /* Contiguous reads waiting to be submitted as one request */
+    VirtIOBlockReq      *reads[32];
+    unsigned int        num_reads;
+    uint64_t            read_sector;
+    uint64_t            read_bytes;
+    int                 read_niov;
 } MultiReqBuffer;
 
+typedef struct MergedRead {
+    QEMUIOVector        qiov;
+    unsigned int        num_reqs;
+    VirtIOBlockReq      *reqs[];
+} MergedRead;
+
+static void virtio_blk_merged_read_complete(void *opaque, int ret)
+{
+    MergedRead *mr = opaque;
+    unsigned int i;
+
+    for (i = 0; i < mr->num_reqs; i++) {
+        virtio_blk_rw_complete(mr->reqs[i], ret);
+    }
+
+    qemu_iovec_destroy(&mr->qiov);
+    g_free(mr);
+}
+
+static void virtio_submit_reads(BlockDriverState *bs, MultiReqBuffer *mrb)
+{
+    VirtIOBlockReq *req;
+    MergedRead *mr;
+    unsigned int i;
+
+    if (!mrb->num_reads) {
+        return;
+    }
+
+    if (mrb->num_reads == 1) {
+        req = mrb->reads[0];
+        bdrv_aio_readv(bs, mrb->read_sector, &req->qiov,
+                       req->qiov.size / BDRV_SECTOR_SIZE,
+                       virtio_blk_rw_complete, req);
+        mrb->num_reads = 0;
+        return;
+    }
+
+    mr = g_malloc(sizeof(*mr) + mrb->num_reads * sizeof(mr->reqs[0]));
+    mr->num_reqs = mrb->num_reads;
+    qemu_iovec_init(&mr->qiov, mrb->read_niov);
+    for (i = 0; i < mrb->num_reads; i++) {
+        req = mrb->reads[i];
+        mr->reqs[i] = req;
+        qemu_iovec_concat(&mr->qiov, &req->qiov, 0, req->qiov.size);
+    }
+
+    trace_virtio_blk_submit_merged_read(mr, mrb->read_sector,
+                                        mr->qiov.size / BDRV_SECTOR_SIZE,
+                                        mr->num_reqs);
+
+    bdrv_acct_merge_done(bs, BDRV_ACCT_READ, mr->num_reqs - 1);
+    bdrv_aio_readv(bs, mrb->read_sector, &mr->qiov,
+                   mr->qiov.size / BDRV_SECTOR_SIZE,
+                   virtio_blk_merged_read_complete, mr);
+
+    mrb->num_reads = 0;
+}
+
 static void virtio_submit_multiwrite(BlockDriverState *bs, MultiReqBuffer *mrb)
 {
     int i, ret;
@@ -316,8 +413,9 @@ static void virtio_blk_handle_write(VirtIOBlockReq *req, MultiReqBuffer *mrb)
     mrb->num_writes++;
 }
 
-static void virtio_blk_handle_read(VirtIOBlockReq *req)
+static void virtio_blk_handle_read(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 {
+    uint32_t merge_max = req->dev->blk.read_merge_max;
     uint64_t sector;
 
     sector = ldq_p(&req->out->sector);
@@ -334,9 +432,24 @@ static void virtio_blk_handle_read(VirtIOBlockReq *req)
         virtio_blk_rw_complete(req, -EIO);
         return;
     }
-    bdrv_aio_readv(req->dev->bs, sector, &req->qiov,
-                   req->qiov.size / BDRV_SECTOR_SIZE,
-                   virtio_blk_rw_complete, req);
+
+    /* Only extend the pending read if this one starts where it ends */
+    if (mrb->num_reads &&
+        (mrb->num_reads == ARRAY_SIZE(mrb->reads) ||
+         sector != mrb->read_sector + mrb->read_bytes / BDRV_SECTOR_SIZE ||
+         mrb->read_bytes + req->qiov.size > merge_max ||
+         mrb->read_niov + req->qiov.niov > IOV_MAX)) {
+        virtio_submit_reads(req->dev->bs, mrb);
+    }
+
+    if (!mrb->num_reads) {
+        mrb->read_sector = sector;
+        mrb->read_bytes = 0;
+        mrb->read_niov = 0;
+    }
+    mrb->reads[mrb->num_reads++] = req;
+    mrb->read_bytes += req->qiov.size;
+    mrb->read_niov += req->qiov.niov;
 }
 
 static void virtio_blk_handle_request(VirtIOBlockReq *req,
@@ -375,7 +488,7 @@ static void virtio_blk_handle_request(VirtIOBlockReq *req,
                 s->blk.serial ? s->blk.serial : "",
                 MIN(req->elem.in_sg[0].iov_len, VIRTIO_BLK_ID_BYTES));
         virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
-        g_free(req);
+        virtio_blk_free_request(req);
     } else if (type & VIRTIO_BLK_T_OUT) {
         qemu_iovec_init_external(&req->qiov, &req->elem.out_sg[1],
                                  req->elem.out_num - 1);
@@ -384,10 +497,10 @@ static void virtio_blk_handle_request(VirtIOBlockReq *req,
         /* VIRTIO_BLK_T_IN is 0, so we can't just & it. */
         qemu_iovec_init_external(&req->qiov, &req->elem.in_sg[0],
                                  req->elem.in_num - 1);
-        virtio_blk_handle_read(req);
+        virtio_blk_handle_read(req, mrb);
     } else {
         virtio_blk_req_complete(req, VIRTIO_BLK_S_UNSUPP);
-        g_free(req);
+        virtio_blk_free_request(req);
     }
 }
 
@@ -409,11 +522,19 @@ static void virtio_blk_handle_output(VirtIODevice *vdev, VirtQueue *vq)
     }
 #endif
 
-    while ((req = virtio_blk_get_request(s))) {
+    /* Submit everything the guest queued with as few system calls as
+     * the backend allows.
+     */
+    bdrv_io_plug(s->bs);
+
+    while ((req = virtio_blk_get_request(s, vq))) {
         virtio_blk_handle_request(req, &mrb);
     }
 
     virtio_submit_multiwrite(s->bs, &mrb);
+    virtio_submit_reads(s->bs, &mrb);
+
+    bdrv_io_unplug(s->bs);
 
     /*
      * FIXME: Want to check for completions before returning to guest mode,
@@ -441,6 +562,7 @@ static void virtio_blk_dma_restart_bh(void *opaque)
     }
 
     virtio_submit_multiwrite(s->bs, &mrb);
+    virtio_submit_reads(s->bs, &mrb);
 }
 
 static void virtio_blk_dma_restart_cb(void *opaque, int running,
@@ -514,7 +636,8 @@ static void virtio_blk_update_config(VirtIODevice *vdev, uint8_t *config)
     blkcfg.physical_block_exp = get_physical_block_exp(s->conf);
     blkcfg.alignment_offset = 0;
     blkcfg.wce = bdrv_enable_write_cache(s->bs);
-    memcpy(config, &blkcfg, sizeof(struct virtio_blk_config));
+    stw_raw(&blkcfg.num_queues, s->blk.num_queues);
+    memcpy(config, &blkcfg, vdev->config_len);
 }
 
 static void virtio_blk_set_config(VirtIODevice *vdev, const uint8_t *config)
@@ -522,7 +645,7 @@ static void virtio_blk_set_config(VirtIODevice *vdev, const uint8_t *config)
     VirtIOBlock *s = VIRTIO_BLK(vdev);
     struct virtio_blk_config blkcfg;
 
-    memcpy(&blkcfg, config, sizeof(blkcfg));
+    memcpy(&blkcfg, config, vdev->config_len);
     bdrv_set_enable_write_cache(s->bs, blkcfg.wce != 0);
 }
 
@@ -536,6 +659,9 @@ static uint32_t virtio_blk_get_features(VirtIODevice *vdev, uint32_t features)
     features |= (1 << VIRTIO_BLK_F_BLK_SIZE);
     features |= (1 << VIRTIO_BLK_F_SCSI);
 
+    if (s->blk.num_queues > 1) {
+        features |= (1 << VIRTIO_BLK_F_MQ);
+    }
     if (s->blk.config_wce) {
         features |= (1 << VIRTIO_BLK_F_CONFIG_WCE);
     }
@@ -597,6 +723,9 @@ static void virtio_blk_save(QEMUFile *f, void *opaque)
     while (req) {
         qemu_put_sbyte(f, 1);
         qemu_put_buffer(f, (unsigned char*)&req->elem, sizeof(req->elem));
+        if (s->blk.num_queues > 1) {
+            qemu_put_be32(f, virtio_get_queue_index(req->vq));
+        }
         req = req->next;
     }
     qemu_put_sbyte(f, 0);
@@ -617,8 +746,20 @@ static int virtio_blk_load(QEMUFile *f, void *opaque, int version_id)
     }
 
     while (qemu_get_sbyte(f)) {
-        VirtIOBlockReq *req = virtio_blk_alloc_request(s);
+        unsigned int vq_idx = 0;
+        VirtIOBlockReq *req;
+
+        req = virtio_blk_alloc_request(s, NULL);
         qemu_get_buffer(f, (unsigned char*)&req->elem, sizeof(req->elem));
+        if (s->blk.num_queues > 1) {
+            vq_idx = qemu_get_be32(f);
+            if (vq_idx >= s->blk.num_queues) {
+                error_report("Invalid virtqueue index %u in request", vq_idx);
+                virtio_blk_free_request(req);
+                return -EINVAL;
+            }
+        }
+        req->vq = virtio_get_queue(vdev, vq_idx);
         req->next = s->rq;
         s->rq = req;
 
@@ -682,6 +823,8 @@ static int virtio_blk_device_init(VirtIODevice *vdev)
     VirtIOBlock *s = VIRTIO_BLK(vdev);
     VirtIOBlkConf *blk = &(s->blk);
     static int virtio_blk_id;
+    size_t config_size;
+    int i;
 
     if (!blk->conf.bs) {
         error_report("drive property not set");
@@ -697,9 +840,25 @@ static int virtio_blk_device_init(VirtIODevice *vdev)
     if (blkconf_geometry(&blk->conf, NULL, 65535, 255, 255) < 0) {
         return -1;
     }
+    if (blk->num_queues < 1 || blk->num_queues > VIRTIO_PCI_QUEUE_MAX) {
+        error_report("num-queues property must be between 1 and %d",
+                     VIRTIO_PCI_QUEUE_MAX);
+        return -1;
+    }
 
-    virtio_init(vdev, "virtio-blk", VIRTIO_ID_BLOCK,
-                sizeof(struct virtio_blk_config));
+    /* Only expose num_queues to guests that may negotiate VIRTIO_BLK_F_MQ,
+     * so that the single-queue config space stays migration compatible.
+     */
+    config_size = sizeof(struct virtio_blk_config);
+    if (blk->num_queues == 1) {
+        config_size = offsetof(struct virtio_blk_config, unused);
+    }
+    virtio_init(vdev, "virtio-blk", VIRTIO_ID_BLOCK, config_size);
+    if (virtio_set_irq_moderation(vdev, blk->irq_max_usecs,
+                                  blk->irq_max_frames) < 0) {
+        virtio_cleanup(vdev);
+        return -1;
+    }
 
     s->bs = blk->conf.bs;
     s->conf = &blk->conf;
@@ -707,7 +866,12 @@ static int virtio_blk_device_init(VirtIODevice *vdev)
     s->rq = NULL;
     s->sector_mask = (s->conf->logical_block_size / BDRV_SECTOR_SIZE) - 1;
 
-    s->vq = virtio_add_queue(vdev, 128, virtio_blk_handle_output);
+    for (i = 0; i < blk->num_queues; i++) {
+        virtio_add_queue(vdev, 128, virtio_blk_handle_output);
+    }
+    s->free_reqs = NULL;
+    s->num_free_reqs = 0;
+    s->max_free_reqs = blk->num_queues * VIRTIO_BLK_FREE_REQS_PER_QUEUE;
 #ifdef CONFIG_VIRTIO_BLK_DATA_PLANE
     if (!virtio_blk_data_plane_create(vdev, blk, &s->dataplane)) {
         virtio_cleanup(vdev);
@@ -717,6 +881,8 @@ static int virtio_blk_device_init(VirtIODevice *vdev)
     add_migration_state_change_notifier(&s->migration_state_notifier);
 #endif
 
+    /* Recycled requests are backed by coroutines, keep as many around */
+    qemu_coroutine_adjust_pool_size(s->max_free_reqs);
     s->change = qemu_add_vm_change_state_handler(virtio_blk_dma_restart_cb, s);
     register_savevm(qdev, "virtio-blk", virtio_blk_id++, 2,
                     virtio_blk_save, virtio_blk_load, s);
@@ -733,14 +899,20 @@ static int virtio_blk_device_exit(DeviceState *dev)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOBlock *s = VIRTIO_BLK(dev);
+    VirtIOBlockReq *req;
 #ifdef CONFIG_VIRTIO_BLK_DATA_PLANE
     remove_migration_state_change_notifier(&s->migration_state_notifier);
     virtio_blk_data_plane_destroy(s->dataplane);
     s->dataplane = NULL;
 #endif
     qemu_del_vm_change_state_handler(s->change);
+    qemu_coroutine_adjust_pool_size(-(int)s->max_free_reqs);
     unregister_savevm(dev, "virtio-blk", s);
     blockdev_mark_auto_del(s->bs);
+    while ((req = s->free_reqs)) {
+        s->free_reqs = req->next;
+        g_free(req);
+    }
     virtio_cleanup(vdev);
     return 0;
 }
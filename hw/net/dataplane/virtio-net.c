@@ -0,0 +1,587 @@
+/*
+ * Dedicated threads for virtio-net packet processing
+ *
+ * Each queue pair is served by its own IOThread, which moves packets between
+ * the vrings and the tap file descriptor without taking the global mutex.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "trace.h"
+#include "qemu/iov.h"
+#include "qemu/error-report.h"
+#include "hw/virtio/dataplane/vring.h"
+#include "hw/virtio/virtio-net.h"
+#include "hw/virtio/virtio-bus.h"
+#include "net/net.h"
+#include "net/tap.h"
+#include "block/aio.h"
+#include "sysemu/iothread.h"
+#include "virtio-net.h"
+
+enum {
+    /* Packets handled per wakeup before giving the other direction a turn */
+    RX_PACKETS_MAX = 256,
+    TX_PACKETS_MAX = 256,
+
+    /* Receive buffers a mergeable packet may span */
+    RX_MERGE_MAX = 64,
+};
+
+typedef struct {
+    VirtIONetDataPlane *s;
+    unsigned int index;             /* queue pair number */
+    IOThread *iothread;
+    AioContext *ctx;
+
+    NetClientState *peer;           /* tap backend */
+    int tap_fd;
+
+    Vring rx_vring;
+    Vring tx_vring;
+    EventNotifier *rx_guest_notifier;
+    EventNotifier *tx_guest_notifier;
+
+    /* Note that these EventNotifiers are assigned by value.  This is fine as
+     * long as you do not call event_notifier_cleanup on them (because you
+     * don't own the file descriptor or handle; you just use it).
+     */
+    EventNotifier rx_host_notifier;
+    EventNotifier tx_host_notifier;
+
+    bool rx_waiting;                /* no rx buffers, tap reads suspended */
+
+    /* A tx packet the tap device did not accept yet, or -1 */
+    int tx_head;
+    unsigned int tx_out_num;
+
+    struct iovec tx_iov[VIRTQUEUE_MAX_SIZE];
+    struct iovec rx_iov[VIRTQUEUE_MAX_SIZE + 1];
+    struct iovec rx_merge_iov[VIRTQUEUE_MAX_SIZE];
+    uint8_t rx_spill[NET_BUFSIZE];  /* packet data past the first buffer */
+} VirtIONetDataPlaneQueue;
+
+struct VirtIONetDataPlane {
+    bool started;
+    bool stopping;
+
+    VirtIONet *n;
+    VirtIODevice *vdev;
+    unsigned int max_queue_pairs;
+    unsigned int num_queue_pairs;   /* queue pairs being served */
+    VirtIONetDataPlaneQueue *queues;
+};
+
+static void process_tx(VirtIONetDataPlaneQueue *q);
+
+/* Raise an interrupt to signal guest, if necessary */
+static void notify_guest(VirtIONetDataPlaneQueue *q, Vring *vring,
+                         EventNotifier *notifier, unsigned int vq_index)
+{
+    if (!vring_should_notify(q->s->vdev, vring)) {
+        return;
+    }
+
+    event_notifier_set(notifier);
+    virtio_queue_inc_irq_count(virtio_get_queue(q->s->vdev, vq_index));
+}
+
+static int flush_true(EventNotifier *e)
+{
+    return true;
+}
+
+static void handle_tap_read(void *opaque);
+static void handle_tap_write(void *opaque);
+
+static void update_tap_handler(VirtIONetDataPlaneQueue *q)
+{
+    aio_set_fd_handler(q->ctx, q->tap_fd,
+                       q->rx_waiting ? NULL : handle_tap_read,
+                       q->tx_head >= 0 ? handle_tap_write : NULL,
+                       NULL, q);
+}
+
+/* Returns false if the tap device cannot take the packet right now */
+static bool send_packet(VirtIONetDataPlaneQueue *q, unsigned int out_num)
+{
+    ssize_t len;
+
+    do {
+        len = writev(q->tap_fd, q->tx_iov, out_num);
+    } while (len == -1 && errno == EINTR);
+
+    /* Other errors drop the packet, as tap_write_packet() does */
+    return !(len == -1 && errno == EAGAIN);
+}
+
+static void handle_tap_write(void *opaque)
+{
+    VirtIONetDataPlaneQueue *q = opaque;
+
+    if (!send_packet(q, q->tx_out_num)) {
+        return;
+    }
+
+    vring_push(&q->tx_vring, q->tx_head, 0);
+    notify_guest(q, &q->tx_vring, q->tx_guest_notifier, q->index * 2 + 1);
+    q->tx_head = -1;
+    update_tap_handler(q);
+
+    process_tx(q);
+}
+
+static void process_tx(VirtIONetDataPlaneQueue *q)
+{
+    VirtIODevice *vdev = q->s->vdev;
+    struct iovec *end = &q->tx_iov[ARRAY_SIZE(q->tx_iov)];
+    unsigned int out_num, in_num;
+    unsigned int packets = 0;
+    int head;
+
+    if (q->tx_head >= 0) {
+        return; /* handle_tap_write() resumes once tap is writable */
+    }
+
+    for (;;) {
+        /* Disable guest->host notifies to avoid unnecessary vmexits */
+        vring_disable_notification(vdev, &q->tx_vring);
+
+        while (packets < TX_PACKETS_MAX) {
+            head = vring_pop(vdev, &q->tx_vring, q->tx_iov, end,
+                             &out_num, &in_num);
+            if (head < 0) {
+                break;
+            }
+
+            if (!send_packet(q, out_num)) {
+                q->tx_head = head;
+                q->tx_out_num = out_num;
+                update_tap_handler(q);
+                goto out;
+            }
+            vring_push(&q->tx_vring, head, 0);
+            packets++;
+        }
+
+        if (packets >= TX_PACKETS_MAX) {
+            /* Come back after the rx side had a chance to run */
+            event_notifier_set(&q->tx_host_notifier);
+            break;
+        }
+        if (head != -EAGAIN) {
+            vring_set_broken(&q->tx_vring);
+            break;
+        }
+
+        /* Re-enable guest->host notifies and stop processing the vring.
+         * But if the guest has snuck in more descriptors, keep processing.
+         */
+        if (vring_enable_notification(vdev, &q->tx_vring)) {
+            break;
+        }
+    }
+
+out:
+    if (packets) {
+        notify_guest(q, &q->tx_vring, q->tx_guest_notifier, q->index * 2 + 1);
+    }
+}
+
+static void handle_tx_notify(EventNotifier *e)
+{
+    VirtIONetDataPlaneQueue *q = container_of(e, VirtIONetDataPlaneQueue,
+                                              tx_host_notifier);
+
+    event_notifier_test_and_clear(e);
+    process_tx(q);
+}
+
+/* Spread the part of a packet that did not fit in the first buffer over
+ * further buffers.  Returns the number of extra buffers used, or -1 if the
+ * guest did not provide enough of them.
+ */
+static int rx_merge(VirtIONetDataPlaneQueue *q, unsigned int heads[],
+                    size_t lens[], size_t spill)
+{
+    VirtIODevice *vdev = q->s->vdev;
+    struct iovec *iov = q->rx_merge_iov;
+    struct iovec *end = &q->rx_merge_iov[ARRAY_SIZE(q->rx_merge_iov)];
+    unsigned int out_num, in_num;
+    size_t offset = 0;
+    int i;
+
+    for (i = 1; offset < spill; i++) {
+        int head;
+
+        if (i == RX_MERGE_MAX) {
+            vring_unpop(&q->rx_vring, i - 1);
+            return -1;
+        }
+
+        head = vring_pop(vdev, &q->rx_vring, iov, end, &out_num, &in_num);
+        if (head < 0) {
+            vring_unpop(&q->rx_vring, i - 1);
+            return -1;
+        }
+
+        heads[i] = head;
+        lens[i] = iov_from_buf(iov + out_num, in_num, 0,
+                               q->rx_spill + offset, spill - offset);
+        offset += lens[i];
+    }
+    return i - 1;
+}
+
+/* Returns false if there is nothing more to do until the next wakeup */
+static bool receive_packet(VirtIONetDataPlaneQueue *q)
+{
+    VirtIONet *n = q->s->n;
+    VirtIODevice *vdev = q->s->vdev;
+    struct iovec *end = &q->rx_iov[ARRAY_SIZE(q->rx_iov) - 1];
+    struct virtio_net_hdr_mrg_rxbuf mhdr;
+    unsigned int heads[RX_MERGE_MAX];
+    size_t lens[RX_MERGE_MAX];
+    unsigned int out_num, in_num;
+    uint8_t head_buf[64] = { };
+    size_t buf_len;
+    ssize_t len;
+    int head, i, extra = 0;
+
+    head = vring_pop(vdev, &q->rx_vring, q->rx_iov, end, &out_num, &in_num);
+    if (head == -EAGAIN) {
+        /* Wait for the guest to add buffers, unless it just did */
+        if (vring_enable_notification(vdev, &q->rx_vring)) {
+            q->rx_waiting = true;
+            update_tap_handler(q);
+            return false;
+        }
+        vring_disable_notification(vdev, &q->rx_vring);
+        return true;
+    }
+    if (head < 0) {
+        vring_set_broken(&q->rx_vring);
+        q->rx_waiting = true;
+        update_tap_handler(q);
+        return false;
+    }
+
+    /* Whatever does not fit in the buffer spills into rx_spill */
+    in_num = MIN(in_num, IOV_MAX - 1);
+    buf_len = iov_size(q->rx_iov + out_num, in_num);
+    q->rx_iov[out_num + in_num].iov_base = q->rx_spill;
+    q->rx_iov[out_num + in_num].iov_len = sizeof(q->rx_spill);
+
+    do {
+        len = readv(q->tap_fd, q->rx_iov + out_num, in_num + 1);
+    } while (len == -1 && errno == EINTR);
+
+    if (len <= 0) {
+        vring_unpop(&q->rx_vring, 1);
+        return false;
+    }
+
+    iov_to_buf(q->rx_iov + out_num, in_num, 0, head_buf,
+               MIN(sizeof(head_buf), MIN(buf_len, len)));
+    if (!virtio_net_receive_filter(n, head_buf, len)) {
+        vring_unpop(&q->rx_vring, 1);
+        return true;
+    }
+
+    heads[0] = head;
+    lens[0] = MIN(buf_len, len);
+    if (len > buf_len) {
+        extra = -1;
+        if (n->mergeable_rx_bufs) {
+            extra = rx_merge(q, heads, lens, len - buf_len);
+        }
+        if (extra < 0) {
+            /* Drop it, as virtio_net_receive() does */
+            vring_unpop(&q->rx_vring, 1);
+            return true;
+        }
+    }
+
+    if (n->mergeable_rx_bufs) {
+        stw_p(&mhdr.num_buffers, extra + 1);
+        iov_from_buf(q->rx_iov + out_num, in_num,
+                     offsetof(struct virtio_net_hdr_mrg_rxbuf, num_buffers),
+                     &mhdr.num_buffers, sizeof(mhdr.num_buffers));
+    }
+
+    for (i = 0; i <= extra; i++) {
+        vring_fill(&q->rx_vring, heads[i], lens[i], i);
+    }
+    vring_flush(&q->rx_vring, extra + 1);
+    return true;
+}
+
+static void process_rx(VirtIONetDataPlaneQueue *q)
+{
+    unsigned int used = q->rx_vring.last_used_idx;
+    unsigned int packets = 0;
+
+    while (!q->rx_waiting && packets++ < RX_PACKETS_MAX && receive_packet(q)) {
+        /* keep going */
+    }
+
+    if (q->rx_vring.last_used_idx != used) {
+        notify_guest(q, &q->rx_vring, q->rx_guest_notifier, q->index * 2);
+    }
+}
+
+static void handle_tap_read(void *opaque)
+{
+    process_rx(opaque);
+}
+
+static void handle_rx_notify(EventNotifier *e)
+{
+    VirtIONetDataPlaneQueue *q = container_of(e, VirtIONetDataPlaneQueue,
+                                              rx_host_notifier);
+
+    event_notifier_test_and_clear(e);
+    if (q->rx_waiting) {
+        vring_disable_notification(q->s->vdev, &q->rx_vring);
+        q->rx_waiting = false;
+        update_tap_handler(q);
+    }
+}
+
+bool virtio_net_data_plane_create(VirtIONet *n, VirtIONetDataPlane **dataplane)
+{
+    VirtIONetDataPlane *s;
+    unsigned int i;
+
+    *dataplane = NULL;
+
+    if (!n->net_conf.data_plane) {
+        return true;
+    }
+
+    for (i = 0; i < n->max_queues; i++) {
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+
+        if (!peer || peer->info->type != NET_CLIENT_OPTIONS_KIND_TAP) {
+            error_report("device is incompatible with x-data-plane, "
+                         "use a tap netdev");
+            return false;
+        }
+        if (tap_get_vhost_net(peer)) {
+            error_report("device is incompatible with x-data-plane, "
+                         "use vhost=off");
+            return false;
+        }
+    }
+
+    s = g_new0(VirtIONetDataPlane, 1);
+    s->n = n;
+    s->vdev = VIRTIO_DEVICE(n);
+    s->max_queue_pairs = n->max_queues;
+    s->queues = g_new0(VirtIONetDataPlaneQueue, s->max_queue_pairs);
+    for (i = 0; i < s->max_queue_pairs; i++) {
+        VirtIONetDataPlaneQueue *q = &s->queues[i];
+
+        q->s = s;
+        q->index = i;
+        q->tap_fd = -1;
+        q->tx_head = -1;
+        q->iothread = IOTHREAD(object_new(TYPE_IOTHREAD));
+        q->ctx = iothread_get_aio_context(q->iothread);
+    }
+
+    *dataplane = s;
+    return true;
+}
+
+void virtio_net_data_plane_destroy(VirtIONetDataPlane *s)
+{
+    unsigned int i;
+
+    if (!s) {
+        return;
+    }
+
+    virtio_net_data_plane_stop(s);
+    for (i = 0; i < s->max_queue_pairs; i++) {
+        object_unref(OBJECT(s->queues[i].iothread));
+    }
+    g_free(s->queues);
+    g_free(s);
+}
+
+/* Take all queue pairs away from their threads, e.g. while the receive
+ * filter is updated
+ */
+void virtio_net_data_plane_acquire(VirtIONetDataPlane *s)
+{
+    unsigned int i;
+
+    for (i = 0; i < s->max_queue_pairs; i++) {
+        aio_context_acquire(s->queues[i].ctx);
+    }
+}
+
+void virtio_net_data_plane_release(VirtIONetDataPlane *s)
+{
+    unsigned int i;
+
+    for (i = s->max_queue_pairs; i-- > 0; ) {
+        aio_context_release(s->queues[i].ctx);
+    }
+}
+
+bool virtio_net_data_plane_start(VirtIONetDataPlane *s,
+                                 unsigned int num_queue_pairs)
+{
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(s->vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    VirtIONet *n = s->n;
+    unsigned int i;
+
+    if (s->started) {
+        return true;
+    }
+
+    /* Packets are passed through unmodified, so the tap device must produce
+     * and consume exactly the header the guest uses.
+     */
+    if (!n->has_vnet_hdr || n->host_hdr_len != n->guest_hdr_len) {
+        return false;
+    }
+
+    assert(num_queue_pairs <= s->max_queue_pairs);
+    for (i = 0; i < num_queue_pairs; i++) {
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+
+        if (!peer || peer->info->type != NET_CLIENT_OPTIONS_KIND_TAP) {
+            return false;
+        }
+        s->queues[i].peer = peer;
+        s->queues[i].tap_fd = tap_get_fd(peer);
+    }
+
+    for (i = 0; i < num_queue_pairs * 2; i++) {
+        VirtIONetDataPlaneQueue *q = &s->queues[i / 2];
+
+        if (!vring_setup(i % 2 ? &q->tx_vring : &q->rx_vring, s->vdev, i)) {
+            while (i-- > 0) {
+                q = &s->queues[i / 2];
+                vring_teardown(i % 2 ? &q->tx_vring : &q->rx_vring,
+                               s->vdev, i);
+            }
+            return false;
+        }
+    }
+
+    /* Set up guest notifiers (irq), one per virtqueue */
+    if (k->set_guest_notifiers(qbus->parent, num_queue_pairs * 2, true) != 0) {
+        fprintf(stderr, "virtio-net failed to set guest notifier, "
+                "ensure -enable-kvm is set\n");
+        exit(1);
+    }
+
+    /* Set up virtqueue notify */
+    for (i = 0; i < num_queue_pairs; i++) {
+        VirtIONetDataPlaneQueue *q = &s->queues[i];
+        VirtQueue *rx_vq = virtio_get_queue(s->vdev, i * 2);
+        VirtQueue *tx_vq = virtio_get_queue(s->vdev, i * 2 + 1);
+
+        q->rx_guest_notifier = virtio_queue_get_guest_notifier(rx_vq);
+        q->tx_guest_notifier = virtio_queue_get_guest_notifier(tx_vq);
+        if (k->set_host_notifier(qbus->parent, i * 2, true) != 0 ||
+            k->set_host_notifier(qbus->parent, i * 2 + 1, true) != 0) {
+            fprintf(stderr, "virtio-net failed to set host notifier\n");
+            exit(1);
+        }
+        q->rx_host_notifier = *virtio_queue_get_host_notifier(rx_vq);
+        q->tx_host_notifier = *virtio_queue_get_host_notifier(tx_vq);
+        q->rx_waiting = false;
+        q->tx_head = -1;
+        vring_disable_notification(s->vdev, &q->rx_vring);
+
+        /* From now on only the IOThread touches the tap device */
+        q->peer->info->poll(q->peer, false);
+    }
+
+    s->num_queue_pairs = num_queue_pairs;
+    s->started = true;
+    trace_virtio_net_data_plane_start(s);
+
+    for (i = 0; i < num_queue_pairs; i++) {
+        VirtIONetDataPlaneQueue *q = &s->queues[i];
+
+        aio_context_acquire(q->ctx);
+        aio_set_event_notifier(q->ctx, &q->rx_host_notifier,
+                               handle_rx_notify, flush_true);
+        aio_set_event_notifier(q->ctx, &q->tx_host_notifier,
+                               handle_tx_notify, flush_true);
+        update_tap_handler(q);
+        aio_context_release(q->ctx);
+
+        /* Kick right away to begin processing packets already in vring */
+        event_notifier_set(&q->tx_host_notifier);
+    }
+    return true;
+}
+
+void virtio_net_data_plane_stop(VirtIONetDataPlane *s)
+{
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(s->vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned int i;
+
+    if (!s->started || s->stopping) {
+        return;
+    }
+    s->stopping = true;
+    trace_virtio_net_data_plane_stop(s);
+
+    for (i = 0; i < s->num_queue_pairs; i++) {
+        VirtIONetDataPlaneQueue *q = &s->queues[i];
+
+        aio_context_acquire(q->ctx);
+
+        /* Stop notifications for new packets from guest and tap */
+        aio_set_event_notifier(q->ctx, &q->rx_host_notifier, NULL, NULL);
+        aio_set_event_notifier(q->ctx, &q->tx_host_notifier, NULL, NULL);
+        aio_set_fd_handler(q->ctx, q->tap_fd, NULL, NULL, NULL, NULL);
+
+        /* A packet the tap device did not take goes back to the ring, the
+         * main loop will send it again
+         */
+        if (q->tx_head >= 0) {
+            vring_unpop(&q->tx_vring, 1);
+            q->tx_head = -1;
+        }
+
+        notify_guest(q, &q->rx_vring, q->rx_guest_notifier, i * 2);
+        notify_guest(q, &q->tx_vring, q->tx_guest_notifier, i * 2 + 1);
+
+        aio_context_release(q->ctx);
+
+        k->set_host_notifier(qbus->parent, i * 2, false);
+        k->set_host_notifier(qbus->parent, i * 2 + 1, false);
+        q->peer->info->poll(q->peer, true);
+    }
+
+    /* Clean up guest notifiers (irq) */
+    k->set_guest_notifiers(qbus->parent, s->num_queue_pairs * 2, false);
+
+    for (i = 0; i < s->num_queue_pairs; i++) {
+        VirtIONetDataPlaneQueue *q = &s->queues[i];
+
+        vring_teardown(&q->rx_vring, s->vdev, i * 2);
+        vring_teardown(&q->tx_vring, s->vdev, i * 2 + 1);
+    }
+    s->num_queue_pairs = 0;
+    s->started = false;
+    s->stopping = false;
+}
+
+unsigned int virtio_net_data_plane_queue_pairs(VirtIONetDataPlane *s)
+{
+    return s->started ? s->num_queue_pairs : 0;
+}
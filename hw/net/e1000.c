@@ -59,6 +59,14 @@ static int debugflags = DBGBIT(TXERR) | DBGBIT(GENERAL);
 #define PNPMMIO_SIZE      0x20000
 #define MIN_BUF_SIZE      60 /* Min. octets in an ethernet frame sans FCS */
 
+/* Descriptors fetched with a single DMA read */
+#define E1000_TX_PREFETCH 32
+#define E1000_RX_PREFETCH 32
+
+/* Units of the interrupt delay registers */
+#define E1000_DELAY_UNIT_NS 1024
+#define E1000_ITR_UNIT_NS   256
+
 /* this is the size past which hardware will drop packets when setting LPE=0 */
 #define MAXIMUM_ETHERNET_VLAN_SIZE 1522
 /* this is the size past which hardware will drop packets when setting LPE=1 */
@@ -135,9 +143,33 @@ typedef struct E1000State_st {
 
     QEMUTimer *autoneg_timer;
 
+    /* Interrupt mitigation */
+    QEMUTimer *mit_rx_timer;    /* RDTR/RADV */
+    QEMUTimer *mit_tx_timer;    /* TIDV/TADV */
+    QEMUTimer *mit_itr_timer;   /* ITR */
+    int64_t mit_rx_deadline;    /* RADV expiry, 0 if not running */
+    int64_t mit_tx_deadline;    /* TADV expiry, 0 if not running */
+    uint32_t mit_delayed;       /* causes waiting for a delay timer */
+    uint8_t mit_itr_on;         /* interrupt assertion is throttled */
+    uint8_t mit_irq_level;
+
+    /* Receive descriptors fetched ahead of RDH; they belong to the device
+     * until it moves RDH past them, so the guest must not change them.
+     * rx_desc_cache[rx_cache_next] is the descriptor at RDH, and the
+     * rx_wb_num entries before it still have to be written back.
+     */
+    struct e1000_rx_desc rx_desc_cache[E1000_RX_PREFETCH];
+    uint32_t rx_cache_base;     /* ring index of rx_desc_cache[0] */
+    uint32_t rx_cache_next;
+    uint32_t rx_cache_num;
+    uint32_t rx_wb_num;
+
 /* Compatibility flags for migration to/from qemu 1.3.0 and older */
 #define E1000_FLAG_AUTONEG_BIT 0
 #define E1000_FLAG_AUTONEG (1 << E1000_FLAG_AUTONEG_BIT)
+/* Honour the interrupt delay and throttling registers */
+#define E1000_FLAG_MIT_BIT 1
+#define E1000_FLAG_MIT (1 << E1000_FLAG_MIT_BIT)
     uint32_t compat_flags;
 } E1000State;
 
@@ -158,7 +190,8 @@ enum {
     defreg(TORH),	defreg(TORL),	defreg(TOTH),	defreg(TOTL),
     defreg(TPR),	defreg(TPT),	defreg(TXDCTL),	defreg(WUFC),
     defreg(RA),		defreg(MTA),	defreg(CRCERRS),defreg(VFTA),
-    defreg(VET),
+    defreg(VET),	defreg(ITR),	defreg(RDTR),	defreg(RADV),
+    defreg(TIDV),	defreg(TADV),
 };
 
 static void
@@ -249,6 +282,7 @@ static void
 set_interrupt_cause(E1000State *s, int index, uint32_t val)
 {
     PCIDevice *d = PCI_DEVICE(s);
+    uint32_t pending_ints;
 
     if (val && (E1000_DEVID >= E1000_DEV_ID_82547EI_MOBILE)) {
         /* Only for 8257x */
@@ -266,7 +300,21 @@ set_interrupt_cause(E1000State *s, int index, uint32_t val)
      */
     s->mac_reg[ICS] = val;
 
-    qemu_set_irq(d->irq[0], (s->mac_reg[IMS] & s->mac_reg[ICR]) != 0);
+    pending_ints = s->mac_reg[IMS] & s->mac_reg[ICR];
+    if (pending_ints && !s->mit_irq_level &&
+        (s->compat_flags & E1000_FLAG_MIT)) {
+        if (s->mit_itr_on) {
+            return;     /* e1000_mit_itr_timer() raises it */
+        }
+        if (s->mac_reg[ITR]) {
+            s->mit_itr_on = 1;
+            qemu_mod_timer(s->mit_itr_timer, qemu_get_clock_ns(vm_clock) +
+                           s->mac_reg[ITR] * E1000_ITR_UNIT_NS);
+        }
+    }
+
+    s->mit_irq_level = (pending_ints != 0);
+    qemu_set_irq(d->irq[0], s->mit_irq_level);
 }
 
 static void
@@ -277,6 +325,69 @@ set_ics(E1000State *s, int index, uint32_t val)
     set_interrupt_cause(s, 0, val | s->mac_reg[ICR]);
 }
 
+/* ITR: no interrupt is raised for ITR * 256ns after the previous one */
+static void
+e1000_mit_itr_timer(void *opaque)
+{
+    E1000State *s = opaque;
+
+    s->mit_itr_on = 0;
+    set_interrupt_cause(s, 0, s->mac_reg[ICR]);
+}
+
+/* Post @cause after @delay, restarted by every call, but no later than
+ * @abs_delay after the first call (both in 1.024us units)
+ */
+static void
+mit_delay_cause(E1000State *s, QEMUTimer *timer, int64_t *deadline,
+                uint32_t cause, uint32_t delay, uint32_t abs_delay)
+{
+    int64_t now = qemu_get_clock_ns(vm_clock);
+    int64_t expire = now + (int64_t)delay * E1000_DELAY_UNIT_NS;
+
+    if (abs_delay) {
+        if (!*deadline) {
+            *deadline = now + (int64_t)abs_delay * E1000_DELAY_UNIT_NS;
+        }
+        expire = MIN(expire, *deadline);
+    }
+    s->mit_delayed |= cause;
+    qemu_mod_timer(timer, expire);
+}
+
+static void
+e1000_mit_rx_timer(void *opaque)
+{
+    E1000State *s = opaque;
+
+    s->mit_rx_deadline = 0;
+    s->mit_delayed &= ~E1000_ICS_RXT0;
+    set_ics(s, 0, E1000_ICS_RXT0);
+}
+
+static void
+e1000_mit_tx_timer(void *opaque)
+{
+    E1000State *s = opaque;
+
+    s->mit_tx_deadline = 0;
+    s->mit_delayed &= ~E1000_ICS_TXDW;
+    set_ics(s, 0, E1000_ICS_TXDW);
+}
+
+static void
+e1000_mit_reset(E1000State *s)
+{
+    qemu_del_timer(s->mit_rx_timer);
+    qemu_del_timer(s->mit_tx_timer);
+    qemu_del_timer(s->mit_itr_timer);
+    s->mit_rx_deadline = 0;
+    s->mit_tx_deadline = 0;
+    s->mit_delayed = 0;
+    s->mit_itr_on = 0;
+    s->mit_irq_level = 0;
+}
+
 static int
 rxbufsize(uint32_t v)
 {
@@ -307,6 +418,8 @@ static void e1000_reset(void *opaque)
     int i;
 
     qemu_del_timer(d->autoneg_timer);
+    e1000_mit_reset(d);
+    d->rx_cache_next = d->rx_cache_num = d->rx_wb_num = 0;
     memset(d->phy_reg, 0, sizeof d->phy_reg);
     memmove(d->phy_reg, phy_reg_init, sizeof phy_reg_init);
     memset(d->mac_reg, 0, sizeof d->mac_reg);
@@ -655,10 +768,10 @@ process_tx_desc(E1000State *s, struct e1000_tx_desc *dp)
     tp->cptse = 0;
 }
 
+/* Update the status of @dp; the caller writes it back to the guest */
 static uint32_t
-txdesc_writeback(E1000State *s, dma_addr_t base, struct e1000_tx_desc *dp)
+txdesc_writeback(E1000State *s, struct e1000_tx_desc *dp)
 {
-    PCIDevice *d = PCI_DEVICE(s);
     uint32_t txd_upper, txd_lower = le32_to_cpu(dp->lower.data);
 
     if (!(txd_lower & (E1000_TXD_CMD_RS|E1000_TXD_CMD_RPS)))
@@ -666,8 +779,6 @@ txdesc_writeback(E1000State *s, dma_addr_t base, struct e1000_tx_desc *dp)
     txd_upper = (le32_to_cpu(dp->upper.data) | E1000_TXD_STAT_DD) &
                 ~(E1000_TXD_STAT_EC | E1000_TXD_STAT_LC | E1000_TXD_STAT_TU);
     dp->upper.data = cpu_to_le32(txd_upper);
-    pci_dma_write(d, base + ((char *)&dp->upper - (char *)dp),
-                  &dp->upper, sizeof(dp->upper));
     return E1000_ICR_TXDW;
 }
 
@@ -679,44 +790,94 @@ static uint64_t tx_desc_base(E1000State *s)
     return (bah << 32) + bal;
 }
 
+/* Number of descriptors that can be fetched in one go starting at @head:
+ * up to @tail or the end of the ring (@ring_len bytes), whichever comes first
+ */
+static unsigned int
+desc_prefetch_count(uint32_t head, uint32_t tail, uint32_t ring_len,
+                    unsigned int max)
+{
+    uint32_t end = ring_len / sizeof(struct e1000_tx_desc);
+
+    if (head >= end || head == tail) {
+        return 1;   /* bogus registers, go one descriptor at a time */
+    }
+    if (tail > head && tail < end) {
+        end = tail;
+    }
+    return MIN(end - head, max);
+}
+
 static void
 start_xmit(E1000State *s)
 {
     PCIDevice *d = PCI_DEVICE(s);
     dma_addr_t base;
-    struct e1000_tx_desc desc;
+    struct e1000_tx_desc descs[E1000_TX_PREFETCH], *desc;
     uint32_t tdh_start = s->mac_reg[TDH], cause = E1000_ICS_TXQE;
+    unsigned int i, num, wb_first, wb_last;
+    bool ide = false, wrapped = false;
 
     if (!(s->mac_reg[TCTL] & E1000_TCTL_EN)) {
         DBGOUT(TX, "tx disabled\n");
         return;
     }
 
-    while (s->mac_reg[TDH] != s->mac_reg[TDT]) {
+    while (s->mac_reg[TDH] != s->mac_reg[TDT] && !wrapped) {
+        num = desc_prefetch_count(s->mac_reg[TDH], s->mac_reg[TDT],
+                                  s->mac_reg[TDLEN], E1000_TX_PREFETCH);
         base = tx_desc_base(s) +
                sizeof(struct e1000_tx_desc) * s->mac_reg[TDH];
-        pci_dma_read(d, base, &desc, sizeof(desc));
-
-        DBGOUT(TX, "index %d: %p : %x %x\n", s->mac_reg[TDH],
-               (void *)(intptr_t)desc.buffer_addr, desc.lower.data,
-               desc.upper.data);
+        pci_dma_read(d, base, descs, num * sizeof(descs[0]));
+
+        wb_first = num;
+        wb_last = 0;
+        for (i = 0; i < num; i++) {
+            desc = &descs[i];
+
+            DBGOUT(TX, "index %d: %p : %x %x\n", s->mac_reg[TDH],
+                   (void *)(intptr_t)desc->buffer_addr, desc->lower.data,
+                   desc->upper.data);
+
+            process_tx_desc(s, desc);
+            if (txdesc_writeback(s, desc)) {
+                cause |= E1000_ICR_TXDW;
+                ide |= !!(le32_to_cpu(desc->lower.data) & E1000_TXD_CMD_IDE);
+                wb_first = MIN(wb_first, i);
+                wb_last = i;
+            }
 
-        process_tx_desc(s, &desc);
-        cause |= txdesc_writeback(s, base, &desc);
+            if (++s->mac_reg[TDH] * sizeof(*desc) >= s->mac_reg[TDLEN])
+                s->mac_reg[TDH] = 0;
+            /*
+             * the following could happen only if guest sw assigns
+             * bogus values to TDT/TDLEN.
+             * there's nothing too intelligent we could do about this.
+             */
+            if (s->mac_reg[TDH] == tdh_start) {
+                DBGOUT(TXERR, "TDH wraparound @%x, TDT %x, TDLEN %x\n",
+                       tdh_start, s->mac_reg[TDT], s->mac_reg[TDLEN]);
+                wrapped = true;
+                break;
+            }
+        }
 
-        if (++s->mac_reg[TDH] * sizeof(desc) >= s->mac_reg[TDLEN])
-            s->mac_reg[TDH] = 0;
-        /*
-         * the following could happen only if guest sw assigns
-         * bogus values to TDT/TDLEN.
-         * there's nothing too intelligent we could do about this.
+        /* Descriptors in between are written back unchanged; they still
+         * belong to the device, so the guest cannot have modified them.
          */
-        if (s->mac_reg[TDH] == tdh_start) {
-            DBGOUT(TXERR, "TDH wraparound @%x, TDT %x, TDLEN %x\n",
-                   tdh_start, s->mac_reg[TDT], s->mac_reg[TDLEN]);
-            break;
+        if (wb_first < num) {
+            pci_dma_write(d, base + wb_first * sizeof(descs[0]),
+                          &descs[wb_first],
+                          (wb_last - wb_first + 1) * sizeof(descs[0]));
         }
     }
+
+    if ((cause & E1000_ICR_TXDW) && ide &&
+        (s->compat_flags & E1000_FLAG_MIT) && s->mac_reg[TIDV]) {
+        cause &= ~E1000_ICR_TXDW;
+        mit_delay_cause(s, s->mit_tx_timer, &s->mit_tx_deadline,
+                        E1000_ICR_TXDW, s->mac_reg[TIDV], s->mac_reg[TADV]);
+    }
     set_ics(s, 0, cause);
 }
 
@@ -824,13 +985,63 @@ static uint64_t rx_desc_base(E1000State *s)
     return (bah << 32) + bal;
 }
 
+static void
+rx_desc_writeback(E1000State *s)
+{
+    PCIDevice *d = PCI_DEVICE(s);
+    uint32_t first = s->rx_cache_next - s->rx_wb_num;
+
+    if (!s->rx_wb_num) {
+        return;
+    }
+    pci_dma_write(d, rx_desc_base(s) +
+                  sizeof(struct e1000_rx_desc) * (s->rx_cache_base + first),
+                  &s->rx_desc_cache[first],
+                  s->rx_wb_num * sizeof(struct e1000_rx_desc));
+    s->rx_wb_num = 0;
+}
+
+/* Read the descriptor at RDH, fetching the following ones with it */
+static void
+rx_desc_fetch(E1000State *s, struct e1000_rx_desc *desc)
+{
+    PCIDevice *d = PCI_DEVICE(s);
+    uint32_t rdh = s->mac_reg[RDH];
+
+    if (s->rx_cache_next >= s->rx_cache_num) {
+        rx_desc_writeback(s);
+        s->rx_cache_base = rdh;
+        s->rx_cache_next = 0;
+        s->rx_cache_num = desc_prefetch_count(rdh, s->mac_reg[RDT],
+                                              s->mac_reg[RDLEN],
+                                              E1000_RX_PREFETCH);
+        pci_dma_read(d, rx_desc_base(s) + sizeof(*desc) * rdh,
+                     s->rx_desc_cache, s->rx_cache_num * sizeof(*desc));
+    }
+    *desc = s->rx_desc_cache[s->rx_cache_next];
+}
+
+/* Complete the descriptor at RDH; the caller advances RDH */
+static void
+rx_desc_store(E1000State *s, const struct e1000_rx_desc *desc)
+{
+    s->rx_desc_cache[s->rx_cache_next++] = *desc;
+    s->rx_wb_num++;
+}
+
+static void
+rx_desc_invalidate(E1000State *s)
+{
+    s->rx_cache_next = s->rx_cache_num = 0;
+    s->rx_wb_num = 0;
+}
+
 static ssize_t
 e1000_receive(NetClientState *nc, const uint8_t *buf, size_t size)
 {
     E1000State *s = qemu_get_nic_opaque(nc);
     PCIDevice *d = PCI_DEVICE(s);
     struct e1000_rx_desc desc;
-    dma_addr_t base;
     unsigned int n, rdt;
     uint32_t rdh_start;
     uint16_t vlan_special = 0;
@@ -887,8 +1098,7 @@ e1000_receive(NetClientState *nc, const uint8_t *buf, size_t size)
         if (desc_size > s->rxbuf_size) {
             desc_size = s->rxbuf_size;
         }
-        base = rx_desc_base(s) + sizeof(desc) * s->mac_reg[RDH];
-        pci_dma_read(d, base, &desc, sizeof(desc));
+        rx_desc_fetch(s, &desc);
         desc.special = vlan_special;
         desc.status |= (vlan_status | E1000_RXD_STAT_DD);
         if (desc.buffer_addr) {
@@ -912,7 +1122,7 @@ e1000_receive(NetClientState *nc, const uint8_t *buf, size_t size)
         } else { // as per intel docs; skip descriptors with null buf addr
             DBGOUT(RX, "Null RX descriptor!!\n");
         }
-        pci_dma_write(d, base, &desc, sizeof(desc));
+        rx_desc_store(s, &desc);
 
         if (++s->mac_reg[RDH] * sizeof(desc) >= s->mac_reg[RDLEN])
             s->mac_reg[RDH] = 0;
@@ -920,10 +1130,12 @@ e1000_receive(NetClientState *nc, const uint8_t *buf, size_t size)
         if (s->mac_reg[RDH] == rdh_start) {
             DBGOUT(RXERR, "RDH wraparound @%x, RDT %x, RDLEN %x\n",
                    rdh_start, s->mac_reg[RDT], s->mac_reg[RDLEN]);
+            rx_desc_writeback(s);
             set_ics(s, 0, E1000_ICS_RXO);
             return -1;
         }
     } while (desc_offset < total_size);
+    rx_desc_writeback(s);
 
     s->mac_reg[GPRC]++;
     s->mac_reg[TPR]++;
@@ -943,6 +1155,11 @@ e1000_receive(NetClientState *nc, const uint8_t *buf, size_t size)
         s->rxbuf_min_shift)
         n |= E1000_ICS_RXDMT0;
 
+    if ((s->compat_flags & E1000_FLAG_MIT) && s->mac_reg[RDTR]) {
+        n &= ~E1000_ICS_RXT0;
+        mit_delay_cause(s, s->mit_rx_timer, &s->mit_rx_deadline,
+                        E1000_ICS_RXT0, s->mac_reg[RDTR], s->mac_reg[RADV]);
+    }
     set_ics(s, 0, n);
 
     return size;
@@ -1010,6 +1227,40 @@ set_dlen(E1000State *s, int index, uint32_t val)
     s->mac_reg[index] = val & 0xfff80;
 }
 
+/* Moving the receive ring drops the prefetched descriptors */
+static void
+set_rx_ring(E1000State *s, int index, uint32_t val)
+{
+    rx_desc_invalidate(s);
+    if (index == RDLEN) {
+        set_dlen(s, index, val);
+    } else if (index == RDH) {
+        set_16bit(s, index, val);
+    } else {
+        s->mac_reg[index] = val;
+    }
+}
+
+static void
+set_rdtr(E1000State *s, int index, uint32_t val)
+{
+    s->mac_reg[index] = val & E1000_RDT_DELAY;
+    if ((val & E1000_RDT_FPDB) && (s->mit_delayed & E1000_ICS_RXT0)) {
+        qemu_del_timer(s->mit_rx_timer);
+        e1000_mit_rx_timer(s);
+    }
+}
+
+static void
+set_tidv(E1000State *s, int index, uint32_t val)
+{
+    s->mac_reg[index] = val & 0xffff;
+    if ((val & E1000_TIDV_FPD) && (s->mit_delayed & E1000_ICS_TXDW)) {
+        qemu_del_timer(s->mit_tx_timer);
+        e1000_mit_tx_timer(s);
+    }
+}
+
 static void
 set_tctl(E1000State *s, int index, uint32_t val)
 {
@@ -1047,7 +1298,8 @@ static uint32_t (*macreg_readops[])(E1000State *, int) = {
     getreg(TORL),	getreg(TOTL),	getreg(IMS),	getreg(TCTL),
     getreg(RDH),	getreg(RDT),	getreg(VET),	getreg(ICS),
     getreg(TDBAL),	getreg(TDBAH),	getreg(RDBAH),	getreg(RDBAL),
-    getreg(TDLEN),	getreg(RDLEN),
+    getreg(TDLEN),	getreg(RDLEN),	getreg(ITR),	getreg(RDTR),
+    getreg(RADV),	getreg(TIDV),	getreg(TADV),
 
     [TOTH] = mac_read_clr8,	[TORH] = mac_read_clr8,	[GPRC] = mac_read_clr4,
     [GPTC] = mac_read_clr4,	[TPR] = mac_read_clr4,	[TPT] = mac_read_clr4,
@@ -1062,11 +1314,13 @@ enum { NREADOPS = ARRAY_SIZE(macreg_readops) };
 #define putreg(x)	[x] = mac_writereg
 static void (*macreg_writeops[])(E1000State *, int, uint32_t) = {
     putreg(PBA),	putreg(EERD),	putreg(SWSM),	putreg(WUFC),
-    putreg(TDBAL),	putreg(TDBAH),	putreg(TXDCTL),	putreg(RDBAH),
-    putreg(RDBAL),	putreg(LEDCTL), putreg(VET),
-    [TDLEN] = set_dlen,	[RDLEN] = set_dlen,	[TCTL] = set_tctl,
+    putreg(TDBAL),	putreg(TDBAH),	putreg(TXDCTL),	[RDBAH] = set_rx_ring,
+    [RDBAL] = set_rx_ring, putreg(LEDCTL), putreg(VET),
+    [TDLEN] = set_dlen,	[RDLEN] = set_rx_ring,	[TCTL] = set_tctl,
     [TDT] = set_tctl,	[MDIC] = set_mdic,	[ICS] = set_ics,
-    [TDH] = set_16bit,	[RDH] = set_16bit,	[RDT] = set_rdt,
+    [TDH] = set_16bit,	[RDH] = set_rx_ring,	[RDT] = set_rdt,
+    [ITR] = set_16bit,	[RADV] = set_16bit,	[TADV] = set_16bit,
+    [RDTR] = set_rdtr,	[TIDV] = set_tidv,
     [IMC] = set_imc,	[IMS] = set_ims,	[ICR] = set_icr,
     [EECD] = set_eecd,	[RCTL] = set_rx_control, [CTRL] = set_ctrl,
     [RA ... RA+31] = &mac_writereg,
@@ -1176,6 +1430,23 @@ static int e1000_post_load(void *opaque, int version_id)
      * Alternatively, restart link negotiation if it was in progress. */
     nc->link_down = (s->mac_reg[STATUS] & E1000_STATUS_LU) == 0;
 
+    rx_desc_invalidate(s);
+
+    /* Delay timers are not migrated; post the delayed causes right away */
+    if (s->compat_flags & E1000_FLAG_MIT) {
+        int64_t now = qemu_get_clock_ns(vm_clock);
+
+        if (s->mit_delayed & E1000_ICS_RXT0) {
+            qemu_mod_timer(s->mit_rx_timer, now);
+        }
+        if (s->mit_delayed & E1000_ICS_TXDW) {
+            qemu_mod_timer(s->mit_tx_timer, now);
+        }
+        if (s->mit_itr_on) {
+            qemu_mod_timer(s->mit_itr_timer, now);
+        }
+    }
+
     if (!(s->compat_flags & E1000_FLAG_AUTONEG)) {
         return 0;
     }
@@ -1190,6 +1461,31 @@ static int e1000_post_load(void *opaque, int version_id)
     return 0;
 }
 
+static bool e1000_mit_state_needed(void *opaque)
+{
+    E1000State *s = opaque;
+
+    return s->compat_flags & E1000_FLAG_MIT;
+}
+
+static const VMStateDescription vmstate_e1000_mit_state = {
+    .name = "e1000/mit_state",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(mac_reg[RDTR], E1000State),
+        VMSTATE_UINT32(mac_reg[RADV], E1000State),
+        VMSTATE_UINT32(mac_reg[TIDV], E1000State),
+        VMSTATE_UINT32(mac_reg[TADV], E1000State),
+        VMSTATE_UINT32(mac_reg[ITR], E1000State),
+        VMSTATE_UINT32(mit_delayed, E1000State),
+        VMSTATE_UINT8(mit_itr_on, E1000State),
+        VMSTATE_UINT8(mit_irq_level, E1000State),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription vmstate_e1000 = {
     .name = "e1000",
     .version_id = 2,
@@ -1267,6 +1563,14 @@ static const VMStateDescription vmstate_e1000 = {
         VMSTATE_UINT32_SUB_ARRAY(mac_reg, E1000State, MTA, 128),
         VMSTATE_UINT32_SUB_ARRAY(mac_reg, E1000State, VFTA, 128),
         VMSTATE_END_OF_LIST()
+    },
+    .subsections = (VMStateSubsection[]) {
+        {
+            .vmsd = &vmstate_e1000_mit_state,
+            .needed = e1000_mit_state_needed,
+        } , {
+            /* empty */
+        }
     }
 };
 
@@ -1316,6 +1620,12 @@ pci_e1000_uninit(PCIDevice *dev)
 
     qemu_del_timer(d->autoneg_timer);
     qemu_free_timer(d->autoneg_timer);
+    qemu_del_timer(d->mit_rx_timer);
+    qemu_free_timer(d->mit_rx_timer);
+    qemu_del_timer(d->mit_tx_timer);
+    qemu_free_timer(d->mit_tx_timer);
+    qemu_del_timer(d->mit_itr_timer);
+    qemu_free_timer(d->mit_itr_timer);
     memory_region_destroy(&d->mmio);
     memory_region_destroy(&d->io);
     qemu_del_nic(d->nic);
@@ -1371,6 +1681,9 @@ static int pci_e1000_init(PCIDevice *pci_dev)
     add_boot_device_path(d->conf.bootindex, dev, "/ethernet-phy@0");
 
     d->autoneg_timer = qemu_new_timer_ms(vm_clock, e1000_autoneg_timer, d);
+    d->mit_rx_timer = qemu_new_timer_ns(vm_clock, e1000_mit_rx_timer, d);
+    d->mit_tx_timer = qemu_new_timer_ns(vm_clock, e1000_mit_tx_timer, d);
+    d->mit_itr_timer = qemu_new_timer_ns(vm_clock, e1000_mit_itr_timer, d);
 
     return 0;
 }
@@ -1385,6 +1698,8 @@ static Property e1000_properties[] = {
     DEFINE_NIC_PROPERTIES(E1000State, conf),
     DEFINE_PROP_BIT("autonegotiation", E1000State,
                     compat_flags, E1000_FLAG_AUTONEG_BIT, true),
+    DEFINE_PROP_BIT("mitigation", E1000State,
+                    compat_flags, E1000_FLAG_MIT_BIT, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -378,6 +378,12 @@
 #define MII_SR_100X_FD_CAPS      0x4000	/* 100X  Full Duplex Capable */
 #define MII_SR_100T4_CAPS        0x8000	/* 100T4 Capable */
 
+/* Interrupt delay timers: RDTR/RADV/TIDV/TADV count in 1.024us units,
+ * ITR in 256ns units */
+#define E1000_RDT_DELAY          0x0000FFFF /* Delay timer (1=1024us) */
+#define E1000_RDT_FPDB           0x80000000 /* Flush descriptor block */
+#define E1000_TIDV_FPD           0x80000000 /* Flush partial descriptor block */
+
 /* Interrupt Cause Read */
 #define E1000_ICR_TXDW          0x00000001 /* Transmit desc written back */
 #define E1000_ICR_TXQE          0x00000002 /* Transmit Queue empty */
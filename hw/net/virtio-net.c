@@ -23,6 +23,10 @@
 #include "hw/virtio/virtio-bus.h"
 #include "qapi/qmp/qjson.h"
 #include "monitor/monitor.h"
+#include "migration/migration.h"
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+#include "dataplane/virtio-net.h"
+#endif
 
 #define VIRTIO_NET_VM_VERSION    11
 
@@ -138,6 +142,90 @@ static void virtio_net_vhost_status(VirtIONet *n, uint8_t status)
     }
 }
 
+/* Flush the tx queue once the current mitigation delay has passed */
+static void virtio_net_tx_schedule(VirtIONetQueue *q)
+{
+    if (q->tx_bh && (!q->tx_timer || !q->tx_delay)) {
+        qemu_bh_schedule(q->tx_bh);
+    } else {
+        qemu_mod_timer(q->tx_timer, qemu_get_clock_ns(vm_clock) + q->tx_delay);
+    }
+}
+
+static void virtio_net_tx_cancel(VirtIONetQueue *q)
+{
+    if (q->tx_timer) {
+        qemu_del_timer(q->tx_timer);
+    }
+    if (q->tx_bh) {
+        qemu_bh_cancel(q->tx_bh);
+    }
+}
+
+static bool virtio_net_data_plane_started(VirtIONet *n)
+{
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    return n->dataplane && virtio_net_data_plane_queue_pairs(n->dataplane);
+#else
+    return false;
+#endif
+}
+
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+static void virtio_net_data_plane_status(VirtIONet *n, uint8_t status)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    NetClientState *nc = qemu_get_queue(n->nic);
+    unsigned int queues = n->multiqueue ? n->curr_queues : 1;
+    unsigned int i;
+
+    if (!n->dataplane || !nc->peer || n->vhost_started) {
+        return;
+    }
+
+    if (!virtio_net_started(n, status) || nc->peer->link_down ||
+        n->dataplane_migrating) {
+        if (!virtio_net_data_plane_queue_pairs(n->dataplane)) {
+            return;
+        }
+        virtio_net_data_plane_stop(n->dataplane);
+
+        /* Let the main loop pick up whatever the guest queued meanwhile */
+        for (i = 0; i < queues; i++) {
+            n->vqs[i].tx_waiting = 1;
+        }
+        return;
+    }
+    if (virtio_net_data_plane_queue_pairs(n->dataplane) == queues) {
+        return;
+    }
+
+    /* The queue count changed, restart with the new set of queues */
+    virtio_net_data_plane_stop(n->dataplane);
+
+    /* Hand the queues over from the main loop: packets still queued towards
+     * the backend are dropped and their buffers returned to the guest.
+     */
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        qemu_purge_queued_packets(qemu_get_subqueue(n->nic, i));
+        if (q->async_tx.elem.out_num) {
+            virtqueue_push(q->tx_vq, &q->async_tx.elem, 0);
+            virtio_notify(vdev, q->tx_vq);
+            q->async_tx.elem.out_num = q->async_tx.len = 0;
+        }
+        virtio_net_tx_cancel(q);
+        q->tx_waiting = 0;
+    }
+
+    if (!virtio_net_data_plane_start(n->dataplane, queues)) {
+        error_report("virtio-net: data plane needs a tap backend with a "
+                     "matching vnet header, falling back on the main loop");
+    }
+}
+#endif
+
 static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -146,6 +234,9 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
     uint8_t queue_status;
 
     virtio_net_vhost_status(n, status);
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    virtio_net_data_plane_status(n, status);
+#endif
 
     for (i = 0; i < n->max_queues; i++) {
         q = &n->vqs[i];
@@ -160,23 +251,38 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
             continue;
         }
 
-        if (virtio_net_started(n, queue_status) && !n->vhost_started) {
-            if (q->tx_timer) {
-                qemu_mod_timer(q->tx_timer,
-                               qemu_get_clock_ns(vm_clock) + n->tx_timeout);
-            } else {
-                qemu_bh_schedule(q->tx_bh);
-            }
+        if (virtio_net_started(n, queue_status) && !n->vhost_started &&
+            !virtio_net_data_plane_started(n)) {
+            virtio_net_tx_schedule(q);
         } else {
-            if (q->tx_timer) {
-                qemu_del_timer(q->tx_timer);
-            } else {
-                qemu_bh_cancel(q->tx_bh);
-            }
+            virtio_net_tx_cancel(q);
         }
     }
 }
 
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+/* Disable the data plane during live migration, since its writes to guest
+ * memory do not update the dirty memory bitmap.
+ */
+static void virtio_net_migration_state_changed(Notifier *notifier, void *data)
+{
+    VirtIONet *n = container_of(notifier, VirtIONet,
+                                migration_state_notifier);
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    MigrationState *mig = data;
+
+    if (migration_in_setup(mig)) {
+        n->dataplane_migrating = true;
+    } else if (migration_has_finished(mig) ||
+               migration_has_failed(mig)) {
+        n->dataplane_migrating = false;
+    } else {
+        return;
+    }
+    virtio_net_set_status(vdev, vdev->status);
+}
+#endif
+
 static void virtio_net_set_link_status(NetClientState *nc)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
@@ -293,6 +399,52 @@ static RxFilterInfo *virtio_net_query_rxfilter(NetClientState *nc)
     return info;
 }
 
+static TxQueueStats *virtio_net_query_tx_stats(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    TxQueueStats *info;
+
+    info = g_malloc0(sizeof(*info));
+    info->name = g_strdup(nc->name);
+    info->queue_index = nc->queue_index;
+    info->mode = n->tx_mode;
+    info->packets = q->tx_packets;
+    info->notifications = q->tx_kicks;
+    info->flushes = q->tx_flushes;
+    info->packet_rate = q->tx_rate;
+    info->delay = q->tx_delay;
+    info->burst = q->tx_burst;
+
+    return info;
+}
+
+/* Hand over whatever receive coalescing holds before the offloads it
+ * relies on change; frames the guest has no room for are dropped. */
+static void virtio_net_gro_flush(VirtIONet *n)
+{
+    int i;
+
+    for (i = 0; i < n->max_queues; i++) {
+        NetGRO *gro = n->vqs[i].rx_gro;
+
+        if (gro && !net_gro_flush(gro)) {
+            net_gro_reset(gro);
+        }
+    }
+}
+
+static void virtio_net_gro_reset(VirtIONet *n)
+{
+    int i;
+
+    for (i = 0; i < n->max_queues; i++) {
+        if (n->vqs[i].rx_gro) {
+            net_gro_reset(n->vqs[i].rx_gro);
+        }
+    }
+}
+
 static void virtio_net_reset(VirtIODevice *vdev)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -315,6 +467,8 @@ static void virtio_net_reset(VirtIODevice *vdev)
     memset(n->mac_table.macs, 0, MAC_TABLE_ENTRIES * ETH_ALEN);
     memcpy(&n->mac[0], &n->nic->conf->macaddr, sizeof(n->mac));
     memset(n->vlans, 0, MAX_VLAN >> 3);
+
+    virtio_net_gro_reset(n);
 }
 
 static void peer_test_vnet_hdr(VirtIONet *n)
@@ -425,8 +579,12 @@ static uint32_t virtio_net_get_features(VirtIODevice *vdev, uint32_t features)
         features &= ~(0x1 << VIRTIO_NET_F_HOST_TSO6);
         features &= ~(0x1 << VIRTIO_NET_F_HOST_ECN);
 
-        features &= ~(0x1 << VIRTIO_NET_F_GUEST_CSUM);
-        features &= ~(0x1 << VIRTIO_NET_F_GUEST_TSO4);
+        /* With coalescing we build checksum-offloaded TSO frames
+         * ourselves, see virtio_net_gro_active() */
+        if (!n->net_conf.gro) {
+            features &= ~(0x1 << VIRTIO_NET_F_GUEST_CSUM);
+            features &= ~(0x1 << VIRTIO_NET_F_GUEST_TSO4);
+        }
         features &= ~(0x1 << VIRTIO_NET_F_GUEST_TSO6);
         features &= ~(0x1 << VIRTIO_NET_F_GUEST_ECN);
     }
@@ -501,6 +659,10 @@ static void virtio_net_set_features(VirtIODevice *vdev, uint32_t features)
         n->curr_guest_offloads =
             virtio_net_guest_offloads_by_features(features);
         virtio_net_apply_guest_offloads(n);
+    } else if (n->net_conf.gro) {
+        virtio_net_gro_flush(n);
+        n->curr_guest_offloads =
+            virtio_net_guest_offloads_by_features(features);
     }
 
     for (i = 0;  i < n->max_queues; i++) {
@@ -568,7 +730,7 @@ static int virtio_net_handle_offloads(VirtIONet *n, uint8_t cmd,
     if (cmd == VIRTIO_NET_CTRL_GUEST_OFFLOADS_SET) {
         uint64_t supported_offloads;
 
-        if (!n->has_vnet_hdr) {
+        if (!n->has_vnet_hdr && !n->net_conf.gro) {
             return VIRTIO_NET_ERR;
         }
 
@@ -577,8 +739,13 @@ static int virtio_net_handle_offloads(VirtIONet *n, uint8_t cmd,
             return VIRTIO_NET_ERR;
         }
 
-        n->curr_guest_offloads = offloads;
-        virtio_net_apply_guest_offloads(n);
+        if (n->has_vnet_hdr) {
+            n->curr_guest_offloads = offloads;
+            virtio_net_apply_guest_offloads(n);
+        } else {
+            virtio_net_gro_flush(n);
+            n->curr_guest_offloads = offloads;
+        }
 
         return VIRTIO_NET_OK;
     } else {
@@ -747,6 +914,13 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
     struct iovec *iov;
     unsigned int iov_cnt;
 
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    /* The data plane threads read the receive filter state */
+    if (n->dataplane) {
+        virtio_net_data_plane_acquire(n->dataplane);
+    }
+#endif
+
     while (virtqueue_pop(vq, &elem)) {
         if (iov_size(elem.in_sg, elem.in_num) < sizeof(status) ||
             iov_size(elem.out_sg, elem.out_num) < sizeof(ctrl)) {
@@ -778,6 +952,12 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         virtqueue_push(vq, &elem, sizeof(status));
         virtio_notify(vdev, vq);
     }
+
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    if (n->dataplane) {
+        virtio_net_data_plane_release(n->dataplane);
+    }
+#endif
 }
 
 /* RX */
@@ -786,7 +966,11 @@ static void virtio_net_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     int queue_index = vq2q(virtio_get_queue_index(vq));
+    VirtIONetQueue *q = &n->vqs[queue_index];
 
+    if (q->rx_gro) {
+        net_gro_flush(q->rx_gro);
+    }
     qemu_flush_queued_packets(qemu_get_subqueue(n->nic, queue_index));
 }
 
@@ -804,6 +988,11 @@ static int virtio_net_can_receive(NetClientState *nc)
         return 0;
     }
 
+    /* The data plane reads from the backend itself */
+    if (virtio_net_data_plane_started(n)) {
+        return 0;
+    }
+
     if (!virtio_queue_ready(q->rx_vq) ||
         !(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return 0;
@@ -863,9 +1052,12 @@ static void work_around_broken_dhclient(struct virtio_net_hdr *hdr,
 }
 
 static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
+                           const struct virtio_net_hdr *hdr,
                            const void *buf, size_t size)
 {
-    if (n->has_vnet_hdr) {
+    if (hdr) {
+        iov_from_buf(iov, iov_cnt, 0, hdr, sizeof(*hdr));
+    } else if (n->has_vnet_hdr) {
         /* FIXME this cast is evil */
         void *wbuf = (void *)buf;
         work_around_broken_dhclient(wbuf, wbuf + n->host_hdr_len,
@@ -880,7 +1072,7 @@ static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
     }
 }
 
-static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
+int virtio_net_receive_filter(VirtIONet *n, const uint8_t *buf, int size)
 {
     static const uint8_t bcast[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
     static const uint8_t vlan[] = {0x81, 0x00};
@@ -931,28 +1123,25 @@ static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
     return 0;
 }
 
-static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t size)
+/* Copy one frame into the rx ring.  @hdr, if not NULL, replaces the
+ * vnet header; it is only passed by receive coalescing, whose backends
+ * have no vnet header of their own. */
+static ssize_t virtio_net_receive_hdr(VirtIONetQueue *q,
+                                      const struct virtio_net_hdr *hdr,
+                                      const uint8_t *buf, size_t size)
 {
-    VirtIONet *n = qemu_get_nic_opaque(nc);
-    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     struct iovec mhdr_sg[VIRTQUEUE_MAX_SIZE];
     struct virtio_net_hdr_mrg_rxbuf mhdr;
     unsigned mhdr_cnt = 0;
     size_t offset, i, guest_offset;
 
-    if (!virtio_net_can_receive(nc)) {
-        return -1;
-    }
-
     /* hdr_len refers to the header we supply to the guest */
     if (!virtio_net_has_buffers(q, size + n->guest_hdr_len - n->host_hdr_len)) {
         return 0;
     }
 
-    if (!receive_filter(n, buf, size))
-        return size;
-
     offset = i = 0;
 
     while (offset < size) {
@@ -987,7 +1176,7 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t
                                     sizeof(mhdr.num_buffers));
             }
 
-            receive_header(n, sg, elem.in_num, buf, size);
+            receive_header(n, sg, elem.in_num, hdr, buf, size);
             offset = n->host_hdr_len;
             total += n->guest_hdr_len;
             guest_offset = n->guest_hdr_len;
@@ -1031,6 +1220,155 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t
     return size;
 }
 
+/* Coalescing runs for backends without a vnet header once the guest
+ * accepts checksum-offloaded TSO frames. */
+static bool virtio_net_gro_active(VirtIONet *n)
+{
+    static const uint64_t offloads = (1ULL << VIRTIO_NET_F_GUEST_CSUM) |
+                                     (1ULL << VIRTIO_NET_F_GUEST_TSO4);
+
+    return n->net_conf.gro && !n->has_vnet_hdr &&
+           (n->curr_guest_offloads & offloads) == offloads;
+}
+
+static ssize_t virtio_net_gro_deliver(void *opaque,
+                                      const struct virtio_net_hdr *hdr,
+                                      const uint8_t *buf, size_t size)
+{
+    VirtIONetQueue *q = opaque;
+    VirtIONet *n = q->n;
+
+    /* Keep the frame until the guest can take it again */
+    if (!virtio_net_can_receive(qemu_get_subqueue(n->nic, q - n->vqs))) {
+        return 0;
+    }
+    return virtio_net_receive_hdr(q, hdr, buf, size);
+}
+
+/* Held segments go out once the backend is done for this main loop
+ * iteration, so coalescing adds no latency of its own. */
+static void virtio_net_rx_gro_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    net_gro_flush(q->rx_gro);
+}
+
+static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t size)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    ssize_t ret;
+
+    if (!virtio_net_can_receive(nc)) {
+        return -1;
+    }
+
+    if (!virtio_net_receive_filter(n, buf, size))
+        return size;
+
+    if (!virtio_net_gro_active(n)) {
+        return virtio_net_receive_hdr(q, NULL, buf, size);
+    }
+
+    ret = net_gro_receive(q->rx_gro, buf, size);
+    if (net_gro_pending(q->rx_gro)) {
+        qemu_bh_schedule(q->rx_gro_bh);
+    }
+    return ret;
+}
+
+/* Zero-copy receive: the backend reads the next packet straight into a
+ * single rx buffer.  Only offered when the backend's vnet header matches
+ * what the guest expects, so the packet needs no rewriting.
+ */
+static int virtio_net_rx_buf_get(NetClientState *nc, struct iovec *iov,
+                                 int iovcnt)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    VirtQueueElement *elem = &q->rx_lent.elem;
+    int cnt;
+
+    assert(!q->rx_lent.active);
+
+    if (!virtio_net_can_receive(nc) || !n->has_vnet_hdr ||
+        n->host_hdr_len != n->guest_hdr_len) {
+        return 0;
+    }
+
+    if (!virtio_net_has_buffers(q, n->guest_hdr_len + ETH_ALEN)) {
+        return 0;
+    }
+
+    if (virtqueue_pop(q->rx_vq, elem) == 0) {
+        return 0;
+    }
+
+    cnt = iov_copy(iov, iovcnt, elem->in_sg, elem->in_num, 0, -1);
+    if (cnt == 0) {
+        virtqueue_discard(q->rx_vq, elem, 0);
+        return 0;
+    }
+
+    q->rx_lent.len = iov_size(iov, cnt);
+    q->rx_lent.active = true;
+    return cnt;
+}
+
+static ssize_t virtio_net_rx_buf_put(NetClientState *nc, size_t size,
+                                     uint8_t *buf, size_t buf_size)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    VirtQueueElement *elem = &q->rx_lent.elem;
+    struct virtio_net_hdr_mrg_rxbuf mhdr;
+    uint8_t head[64] = { };
+    struct virtio_net_hdr *hdr = (struct virtio_net_hdr *)head;
+    size_t head_len;
+
+    assert(q->rx_lent.active);
+    q->rx_lent.active = false;
+
+    if (size == 0) {
+        virtqueue_discard(q->rx_vq, elem, 0);
+        return 0;
+    }
+
+    head_len = MIN(size, q->rx_lent.len);
+    iov_to_buf(elem->in_sg, elem->in_num, 0, head, MIN(head_len, sizeof(head)));
+
+    /* Packets spilling past the buffer, and those that may need the dhclient
+     * workaround, take the copying path.
+     */
+    if (size > q->rx_lent.len ||
+        ((hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) &&
+         size - n->host_hdr_len < 1500)) {
+        memmove(buf + head_len, buf, size - head_len);
+        iov_to_buf(elem->in_sg, elem->in_num, 0, buf, head_len);
+        virtqueue_discard(q->rx_vq, elem, 0);
+        return 0;
+    }
+
+    if (!virtio_net_receive_filter(n, head, size)) {
+        virtqueue_discard(q->rx_vq, elem, 0);
+        return size;
+    }
+
+    if (n->mergeable_rx_bufs) {
+        stw_p(&mhdr.num_buffers, 1);
+        iov_from_buf(elem->in_sg, elem->in_num,
+                     offsetof(typeof(mhdr), num_buffers),
+                     &mhdr.num_buffers, sizeof mhdr.num_buffers);
+    }
+
+    virtqueue_push(q->rx_vq, elem, size);
+    virtio_notify(vdev, q->rx_vq);
+
+    return size;
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q);
 
 static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
@@ -1043,6 +1381,7 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     virtio_notify(vdev, q->tx_vq);
 
     q->async_tx.elem.out_num = q->async_tx.len = 0;
+    q->tx_packets++;
 
     virtio_queue_set_notification(q->tx_vq, 1);
     virtio_net_flush_tx(q);
@@ -1053,7 +1392,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
-    VirtQueueElement elem;
+    NetPacketIOV pkts[VIRTIO_NET_TX_BATCH];
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
@@ -1067,62 +1406,147 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         return num_packets;
     }
 
-    while (virtqueue_pop(q->tx_vq, &elem)) {
-        ssize_t ret, len;
-        unsigned int out_num = elem.out_num;
-        struct iovec *out_sg = &elem.out_sg[0];
-        struct iovec sg[VIRTQUEUE_MAX_SIZE];
+    /* Delivering a batch can flush the peer's queue, whose sent callbacks
+     * flush again; the outer call is still using q->tx_batch and keeps
+     * going anyway */
+    if (q->tx_flushing) {
+        return num_packets;
+    }
 
-        if (out_num < 1) {
-            error_report("virtio-net header not in first element");
-            exit(1);
+    q->tx_flushes++;
+    q->tx_max_pending = MAX(q->tx_max_pending,
+                            virtio_queue_pending(q->tx_vq));
+
+    while (num_packets < q->tx_burst) {
+        int budget = MIN(VIRTIO_NET_TX_BATCH, q->tx_burst - num_packets);
+        int i, num = 0, sent;
+
+        while (num < budget &&
+               virtqueue_pop(q->tx_vq, &q->tx_batch[num].elem)) {
+            VirtQueueElement *elem = &q->tx_batch[num].elem;
+            unsigned int out_num = elem->out_num;
+            struct iovec *out_sg = &elem->out_sg[0];
+
+            if (out_num < 1) {
+                error_report("virtio-net header not in first element");
+                exit(1);
+            }
+
+            /*
+             * If host wants to see the guest header as is, we can
+             * pass it on unchanged. Otherwise, copy just the parts
+             * that host is interested in.
+             */
+            assert(n->host_hdr_len <= n->guest_hdr_len);
+            if (n->host_hdr_len != n->guest_hdr_len) {
+                struct iovec *sg = q->tx_batch[num].sg;
+                unsigned sg_num = iov_copy(sg, VIRTQUEUE_MAX_SIZE,
+                                           out_sg, out_num,
+                                           0, n->host_hdr_len);
+                sg_num += iov_copy(sg + sg_num, VIRTQUEUE_MAX_SIZE - sg_num,
+                                 out_sg, out_num,
+                                 n->guest_hdr_len, -1);
+                out_num = sg_num;
+                out_sg = sg;
+            }
+
+            pkts[num].iov = out_sg;
+            pkts[num].iovcnt = out_num;
+            num++;
         }
 
-        /*
-         * If host wants to see the guest header as is, we can
-         * pass it on unchanged. Otherwise, copy just the parts
-         * that host is interested in.
-         */
-        assert(n->host_hdr_len <= n->guest_hdr_len);
-        if (n->host_hdr_len != n->guest_hdr_len) {
-            unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
-                                       out_sg, out_num,
-                                       0, n->host_hdr_len);
-            sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
-                             out_sg, out_num,
-                             n->guest_hdr_len, -1);
-            out_num = sg_num;
-            out_sg = sg;
+        if (num == 0) {
+            break;
         }
 
-        len = n->guest_hdr_len;
+        q->tx_flushing = true;
+        sent = qemu_sendv_packet_batch_async(
+                    qemu_get_subqueue(n->nic, queue_index),
+                    pkts, num, virtio_net_tx_complete);
+        q->tx_flushing = false;
+
+        for (i = 0; i < sent; i++) {
+            virtqueue_fill(q->tx_vq, &q->tx_batch[i].elem, 0, i);
+        }
+        if (sent) {
+            virtqueue_flush(q->tx_vq, sent);
+            virtio_notify(vdev, q->tx_vq);
+        }
+        num_packets += sent;
+        q->tx_packets += sent;
 
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
-        if (ret == 0) {
+        if (sent < num) {
+            /* Packet "sent" was queued; the rest go back to the ring */
+            for (i = num - 1; i > sent; i--) {
+                virtqueue_discard(q->tx_vq, &q->tx_batch[i].elem, 0);
+            }
             virtio_queue_set_notification(q->tx_vq, 0);
-            q->async_tx.elem = elem;
-            q->async_tx.len  = len;
+            q->async_tx.elem = q->tx_batch[sent].elem;
+            q->async_tx.len  = n->guest_hdr_len;
             return -EBUSY;
         }
 
-        len += ret;
-
-        virtqueue_push(q->tx_vq, &elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-
-        if (++num_packets >= n->tx_burst) {
+        if (num < budget) {
             break;
         }
     }
     return num_packets;
 }
 
+/* Once per interval, update the packet rate of a tx queue and, in adaptive
+ * mode, pick the delay and burst size for the next interval.  Sparse traffic
+ * is sent right away; denser traffic is held back long enough to collect a
+ * batch, at most x-txtimer, but flushed sooner and in bigger bursts while
+ * the guest keeps the ring filling up.
+ */
+static void virtio_net_tx_adapt(VirtIONetQueue *q)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    int64_t now = qemu_get_clock_ns(vm_clock);
+    int64_t elapsed = now - q->tx_sample_start;
+    unsigned int ring_size;
+
+    if (elapsed < TX_ADAPT_INTERVAL) {
+        return;
+    }
+
+    q->tx_rate = muldiv64(q->tx_packets - q->tx_sample_packets,
+                          get_ticks_per_sec(), elapsed);
+
+    if (n->tx_mode == TX_MITIGATION_MODE_ADAPTIVE) {
+        ring_size = virtio_queue_get_num(vdev,
+                                         virtio_get_queue_index(q->tx_vq));
+
+        if (q->tx_rate < TX_ADAPT_RATE_LOW) {
+            q->tx_delay = 0;
+        } else {
+            q->tx_delay = MIN(TX_ADAPT_BATCH * get_ticks_per_sec() / q->tx_rate,
+                              n->tx_timeout);
+        }
+        if (q->tx_max_pending > ring_size / 2) {
+            q->tx_delay /= 2;
+        }
+
+        if (q->tx_max_pending >= q->tx_burst) {
+            q->tx_burst = MIN(q->tx_burst * 2, TX_ADAPT_BURST_MAX);
+        } else if (q->tx_max_pending < q->tx_burst / 4) {
+            q->tx_burst = MAX(q->tx_burst / 2, TX_ADAPT_BURST_MIN);
+        }
+    }
+
+    q->tx_sample_start = now;
+    q->tx_sample_packets = q->tx_packets;
+    q->tx_max_pending = 0;
+}
+
 static void virtio_net_handle_tx_timer(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
 
+    q->tx_kicks++;
+
     /* This happens when device was stopped but VCPU wasn't. */
     if (!vdev->vm_running) {
         q->tx_waiting = 1;
@@ -1147,6 +1571,7 @@ static void virtio_net_handle_tx_bh(VirtIODevice *vdev, VirtQueue *vq)
     VirtIONet *n = VIRTIO_NET(vdev);
     VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
 
+    q->tx_kicks++;
     if (unlikely(q->tx_waiting)) {
         return;
     }
@@ -1156,7 +1581,8 @@ static void virtio_net_handle_tx_bh(VirtIODevice *vdev, VirtQueue *vq)
         return;
     }
     virtio_queue_set_notification(vq, 0);
-    qemu_bh_schedule(q->tx_bh);
+    /* In adaptive mode this may arm the timer instead */
+    virtio_net_tx_schedule(q);
 }
 
 static void virtio_net_tx_timer(void *opaque)
@@ -1175,6 +1601,7 @@ static void virtio_net_tx_timer(void *opaque)
 
     virtio_queue_set_notification(q->tx_vq, 1);
     virtio_net_flush_tx(q);
+    virtio_net_tx_adapt(q);
 }
 
 static void virtio_net_tx_bh(void *opaque)
@@ -1194,13 +1621,14 @@ static void virtio_net_tx_bh(void *opaque)
     }
 
     ret = virtio_net_flush_tx(q);
+    virtio_net_tx_adapt(q);
     if (ret == -EBUSY) {
         return; /* Notification re-enable handled by tx_complete */
     }
 
     /* If we flush a full burst of packets, assume there are
      * more coming and immediately reschedule */
-    if (ret >= n->tx_burst) {
+    if (ret >= q->tx_burst) {
         qemu_bh_schedule(q->tx_bh);
         q->tx_waiting = 1;
         return;
@@ -1217,6 +1645,49 @@ static void virtio_net_tx_bh(void *opaque)
     }
 }
 
+static void virtio_net_add_tx_queue(VirtIONet *n, int index)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    VirtIONetQueue *q = &n->vqs[index];
+
+    if (!q->tx_batch) {
+        q->tx_batch = g_new(VirtIONetTxElem, VIRTIO_NET_TX_BATCH);
+    }
+
+    switch (n->tx_mode) {
+    case TX_MITIGATION_MODE_TIMER:
+        q->tx_vq = virtio_add_queue(vdev, 256, virtio_net_handle_tx_timer);
+        if (!q->tx_timer) {
+            q->tx_timer = qemu_new_timer_ns(vm_clock, virtio_net_tx_timer, q);
+        }
+        q->tx_delay = n->tx_timeout;
+        break;
+    case TX_MITIGATION_MODE_ADAPTIVE:
+        /* The timer delays a flush, the bottom half runs it right away */
+        q->tx_vq = virtio_add_queue(vdev, 256, virtio_net_handle_tx_bh);
+        if (!q->tx_timer) {
+            q->tx_timer = qemu_new_timer_ns(vm_clock, virtio_net_tx_bh, q);
+        }
+        if (!q->tx_bh) {
+            q->tx_bh = qemu_bh_new(virtio_net_tx_bh, q);
+        }
+        q->tx_delay = 0;
+        break;
+    default:
+        q->tx_vq = virtio_add_queue(vdev, 256, virtio_net_handle_tx_bh);
+        if (!q->tx_bh) {
+            q->tx_bh = qemu_bh_new(virtio_net_tx_bh, q);
+        }
+        q->tx_delay = 0;
+        break;
+    }
+
+    q->tx_burst = n->tx_burst;
+    q->tx_sample_start = qemu_get_clock_ns(vm_clock);
+    q->tx_sample_packets = q->tx_packets;
+    q->tx_max_pending = 0;
+}
+
 static void virtio_net_set_multiqueue(VirtIONet *n, int multiqueue)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -1230,20 +1701,9 @@ static void virtio_net_set_multiqueue(VirtIONet *n, int multiqueue)
 
     for (i = 1; i < max; i++) {
         n->vqs[i].rx_vq = virtio_add_queue(vdev, 256, virtio_net_handle_rx);
-        if (n->vqs[i].tx_timer) {
-            n->vqs[i].tx_vq =
-                virtio_add_queue(vdev, 256, virtio_net_handle_tx_timer);
-            n->vqs[i].tx_timer = qemu_new_timer_ns(vm_clock,
-                                                   virtio_net_tx_timer,
-                                                   &n->vqs[i]);
-        } else {
-            n->vqs[i].tx_vq =
-                virtio_add_queue(vdev, 256, virtio_net_handle_tx_bh);
-            n->vqs[i].tx_bh = qemu_bh_new(virtio_net_tx_bh, &n->vqs[i]);
-        }
-
-        n->vqs[i].tx_waiting = 0;
         n->vqs[i].n = n;
+        virtio_net_add_tx_queue(n, i);
+        n->vqs[i].tx_waiting = 0;
     }
 
     /* Note: Minux Guests (version 3.2.1) use ctrl vq but don't ack
@@ -1426,9 +1886,12 @@ static NetClientInfo net_virtio_info = {
     .size = sizeof(NICState),
     .can_receive = virtio_net_can_receive,
     .receive = virtio_net_receive,
+    .rx_buf_get = virtio_net_rx_buf_get,
+    .rx_buf_put = virtio_net_rx_buf_put,
         .cleanup = virtio_net_cleanup,
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
+    .query_tx_stats = virtio_net_query_tx_stats,
 };
 
 static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
@@ -1494,6 +1957,11 @@ static int virtio_net_device_init(VirtIODevice *vdev)
 
     virtio_init(VIRTIO_DEVICE(n), "virtio-net", VIRTIO_ID_NET,
                                   n->config_size);
+    if (virtio_set_irq_moderation(vdev, n->net_conf.irq_max_usecs,
+                                  n->net_conf.irq_max_frames) < 0) {
+        virtio_cleanup(vdev);
+        return -1;
+    }
 
     n->max_queues = MAX(n->nic_conf.queues, 1);
     n->vqs = g_malloc0(sizeof(VirtIONetQueue) * n->max_queues);
@@ -1501,25 +1969,21 @@ static int virtio_net_device_init(VirtIODevice *vdev)
     n->curr_queues = 1;
     n->vqs[0].n = n;
     n->tx_timeout = n->net_conf.txtimer;
+    n->tx_burst = n->net_conf.txburst;
 
-    if (n->net_conf.tx && strcmp(n->net_conf.tx, "timer")
-                       && strcmp(n->net_conf.tx, "bh")) {
+    n->tx_mode = TX_MITIGATION_MODE_BH;
+    if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
+        n->tx_mode = TX_MITIGATION_MODE_TIMER;
+    } else if (n->net_conf.tx && !strcmp(n->net_conf.tx, "adaptive")) {
+        n->tx_mode = TX_MITIGATION_MODE_ADAPTIVE;
+    } else if (n->net_conf.tx && strcmp(n->net_conf.tx, "bh")) {
         error_report("virtio-net: "
-                     "Unknown option tx=%s, valid options: \"timer\" \"bh\"",
-                     n->net_conf.tx);
+                     "Unknown option tx=%s, valid options: \"timer\" \"bh\" "
+                     "\"adaptive\"", n->net_conf.tx);
         error_report("Defaulting to \"bh\"");
     }
 
-    if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
-        n->vqs[0].tx_vq = virtio_add_queue(vdev, 256,
-                                           virtio_net_handle_tx_timer);
-        n->vqs[0].tx_timer = qemu_new_timer_ns(vm_clock, virtio_net_tx_timer,
-                                               &n->vqs[0]);
-    } else {
-        n->vqs[0].tx_vq = virtio_add_queue(vdev, 256,
-                                           virtio_net_handle_tx_bh);
-        n->vqs[0].tx_bh = qemu_bh_new(virtio_net_tx_bh, &n->vqs[0]);
-    }
+    virtio_net_add_tx_queue(n, 0);
     n->ctrl_vq = virtio_add_queue(vdev, 64, virtio_net_handle_ctrl);
     qemu_macaddr_default_if_unset(&n->nic_conf.macaddr);
     memcpy(&n->mac[0], &n->nic_conf.macaddr, sizeof(n->mac));
@@ -1546,10 +2010,19 @@ static int virtio_net_device_init(VirtIODevice *vdev)
         n->host_hdr_len = 0;
     }
 
+    if (n->net_conf.gro && !peer_has_vnet_hdr(n)) {
+        for (i = 0; i < n->max_queues; i++) {
+            VirtIONetQueue *q = &n->vqs[i];
+
+            q->n = n;
+            q->rx_gro = net_gro_new(virtio_net_gro_deliver, q);
+            q->rx_gro_bh = qemu_bh_new(virtio_net_rx_gro_bh, q);
+        }
+    }
+
     qemu_format_nic_info_str(qemu_get_queue(n->nic), n->nic_conf.macaddr.a);
 
     n->vqs[0].tx_waiting = 0;
-    n->tx_burst = n->net_conf.txburst;
     virtio_net_set_mrg_rx_bufs(n, 0);
     n->promisc = 1; /* for compatibility */
 
@@ -1561,6 +2034,21 @@ static int virtio_net_device_init(VirtIODevice *vdev)
     nc->rxfilter_notify_enabled = 1;
 
     n->qdev = qdev;
+
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    if (!virtio_net_data_plane_create(n, &n->dataplane)) {
+        qemu_del_nic(n->nic);
+        g_free(n->mac_table.macs);
+        g_free(n->vlans);
+        g_free(n->vqs[0].tx_batch);
+        g_free(n->vqs);
+        virtio_cleanup(vdev);
+        return -1;
+    }
+    n->migration_state_notifier.notify = virtio_net_migration_state_changed;
+    add_migration_state_change_notifier(&n->migration_state_notifier);
+#endif
+
     register_savevm(qdev, "virtio-net", -1, VIRTIO_NET_VM_VERSION,
                     virtio_net_save, virtio_net_load, n);
 
@@ -1577,6 +2065,12 @@ static int virtio_net_device_exit(DeviceState *qdev)
     /* This will stop vhost backend if appropriate. */
     virtio_net_set_status(vdev, 0);
 
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    remove_migration_state_change_notifier(&n->migration_state_notifier);
+    virtio_net_data_plane_destroy(n->dataplane);
+    n->dataplane = NULL;
+#endif
+
     unregister_savevm(qdev, "virtio-net", n);
 
     if (n->netclient_name) {
@@ -1600,9 +2094,15 @@ static int virtio_net_device_exit(DeviceState *qdev)
         if (q->tx_timer) {
             qemu_del_timer(q->tx_timer);
             qemu_free_timer(q->tx_timer);
-        } else if (q->tx_bh) {
+        }
+        if (q->tx_bh) {
             qemu_bh_delete(q->tx_bh);
         }
+        if (q->rx_gro) {
+            qemu_bh_delete(q->rx_gro_bh);
+            net_gro_free(q->rx_gro);
+        }
+        g_free(q->tx_batch);
     }
 
     g_free(n->vqs);
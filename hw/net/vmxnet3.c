@@ -20,6 +20,7 @@
 #include "net/net.h"
 #include "net/tap.h"
 #include "net/checksum.h"
+#include "net/gro.h"
 #include "sysemu/sysemu.h"
 #include "qemu-common.h"
 #include "qemu/bswap.h"
@@ -282,6 +283,15 @@ typedef struct {
 
         bool peer_has_vhdr;
 
+        /* LRO for peers without virtio header, done by QEMU if the "gro"
+         * property is set.  Held segments are not migrated: they are
+         * dropped when the VM stops, and TCP retransmits them.
+         */
+        bool gro;
+        NetGRO *rx_gro;
+        QEMUBH *rx_gro_bh;
+        VMChangeStateEntry *rx_gro_vmstate;
+
         /* TX packets to QEMU interface */
         struct VmxnetTxPkt *tx_pkt;
         uint32_t offload_mode;
@@ -1142,6 +1152,9 @@ static void vmxnet3_reset(VMXNET3State *s)
     vmxnet3_deactivate_device(s);
     vmxnet3_reset_interrupt_states(s);
     vmxnet_tx_pkt_reset(s->tx_pkt);
+    if (s->rx_gro) {
+        net_gro_reset(s->rx_gro);
+    }
     s->drv_shmem = 0;
     s->tx_sop = true;
     s->skip_current_tx_pkt = false;
@@ -1289,6 +1302,9 @@ static void vmxnet3_update_features(VMXNET3State *s)
     VMW_CFPRN("Features configuration: LRO: %d, RXCSUM: %d, VLANSTRIP: %d",
               s->lro_supported, rxcso_supported,
               s->rx_vlan_stripping);
+    if (!s->lro_supported && s->rx_gro) {
+        net_gro_flush(s->rx_gro);
+    }
     if (s->peer_has_vhdr) {
         tap_set_offload(qemu_get_queue(s->nic)->peer,
                         rxcso_supported,
@@ -1807,6 +1823,61 @@ vmxnet3_rx_filter_may_indicate(VMXNET3State *s, const void *data,
     return true;
 }
 
+static size_t
+vmxnet3_indicate_data(VMXNET3State *s, const uint8_t *buf, size_t size)
+{
+    size_t bytes_indicated;
+
+    vmxnet_rx_pkt_attach_data(s->rx_pkt, buf, size, s->rx_vlan_stripping);
+    bytes_indicated = vmxnet3_indicate_packet(s) ? size : -1;
+    if (bytes_indicated < size) {
+        VMW_PKPRN("RX: %lu of %lu bytes indicated", bytes_indicated, size);
+    }
+    return bytes_indicated;
+}
+
+static ssize_t
+vmxnet3_rx_gro_deliver(void *opaque, const struct virtio_net_hdr *hdr,
+                       const uint8_t *buf, size_t size)
+{
+    VMXNET3State *s = opaque;
+    size_t bytes_indicated;
+
+    if (!vmxnet3_can_receive(qemu_get_queue(s->nic))) {
+        return 0;
+    }
+
+    vmxnet_rx_pkt_set_packet_type(s->rx_pkt,
+        get_eth_packet_type(PKT_GET_ETH_HDR(buf)));
+
+    /* Coalesced frames come with a header describing their checksum */
+    if (hdr) {
+        vmxnet_rx_pkt_set_vhdr(s->rx_pkt, (struct virtio_net_hdr *)hdr);
+    }
+    vmxnet_rx_pkt_set_has_virt_hdr(s->rx_pkt, hdr != NULL);
+    bytes_indicated = vmxnet3_indicate_data(s, buf, size);
+    vmxnet_rx_pkt_set_has_virt_hdr(s->rx_pkt, false);
+
+    return bytes_indicated;
+}
+
+static void vmxnet3_rx_gro_bh(void *opaque)
+{
+    VMXNET3State *s = opaque;
+
+    net_gro_flush(s->rx_gro);
+}
+
+static void vmxnet3_rx_gro_vm_state_change(void *opaque, int running,
+                                           RunState state)
+{
+    VMXNET3State *s = opaque;
+
+    if (!running) {
+        net_gro_reset(s->rx_gro);
+    }
+}
+
 static ssize_t
 vmxnet3_receive(NetClientState *nc, const uint8_t *buf, size_t size)
 {
@@ -1827,15 +1898,17 @@ vmxnet3_receive(NetClientState *nc, const uint8_t *buf, size_t size)
     vmxnet_rx_pkt_set_packet_type(s->rx_pkt,
         get_eth_packet_type(PKT_GET_ETH_HDR(buf)));
 
-    if (vmxnet3_rx_filter_may_indicate(s, buf, size)) {
-        vmxnet_rx_pkt_attach_data(s->rx_pkt, buf, size, s->rx_vlan_stripping);
-        bytes_indicated = vmxnet3_indicate_packet(s) ? size : -1;
-        if (bytes_indicated < size) {
-            VMW_PKPRN("RX: %lu of %lu bytes indicated", bytes_indicated, size);
-        }
-    } else {
+    if (!vmxnet3_rx_filter_may_indicate(s, buf, size)) {
         VMW_PKPRN("Packet dropped by RX filter");
         bytes_indicated = size;
+    } else if (s->rx_gro && s->lro_supported) {
+        /* The peer provides no LRO, so coalesce here */
+        bytes_indicated = net_gro_receive(s->rx_gro, buf, size);
+        if (net_gro_pending(s->rx_gro)) {
+            qemu_bh_schedule(s->rx_gro_bh);
+        }
+    } else {
+        bytes_indicated = vmxnet3_indicate_data(s, buf, size);
     }
 
     assert(size > 0);
@@ -1888,6 +1961,11 @@ static bool vmxnet3_peer_has_vnet_hdr(VMXNET3State *s)
 
 static void vmxnet3_net_uninit(VMXNET3State *s)
 {
+    if (s->rx_gro) {
+        qemu_del_vm_change_state_handler(s->rx_gro_vmstate);
+        qemu_bh_delete(s->rx_gro_bh);
+        net_gro_free(s->rx_gro);
+    }
     g_free(s->mcast_list);
     vmxnet_tx_pkt_reset(s->tx_pkt);
     vmxnet_tx_pkt_uninit(s->tx_pkt);
@@ -1930,6 +2008,11 @@ static void vmxnet3_net_init(VMXNET3State *s)
             sizeof(struct virtio_net_hdr));
 
         tap_using_vnet_hdr(qemu_get_queue(s->nic)->peer, 1);
+    } else if (s->gro) {
+        s->rx_gro = net_gro_new(vmxnet3_rx_gro_deliver, s);
+        s->rx_gro_bh = qemu_bh_new(vmxnet3_rx_gro_bh, s);
+        s->rx_gro_vmstate = qemu_add_vm_change_state_handler(
+            vmxnet3_rx_gro_vm_state_change, s);
     }
 
     qemu_format_nic_info_str(qemu_get_queue(s->nic), s->conf.macaddr.a);
@@ -2432,6 +2515,7 @@ vmxnet3_write_config(PCIDevice *pci_dev, uint32_t addr, uint32_t val, int len)
 
 static Property vmxnet3_properties[] = {
     DEFINE_NIC_PROPERTIES(VMXNET3State, conf),
+    DEFINE_PROP_BOOL("gro", VMXNET3State, gro, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -172,6 +172,14 @@ bool vmxnet_rx_pkt_has_virt_hdr(struct VmxnetRxPkt *pkt)
     return pkt->has_virt_hdr;
 }
 
+void vmxnet_rx_pkt_set_has_virt_hdr(struct VmxnetRxPkt *pkt,
+                                    bool has_virt_hdr)
+{
+    assert(pkt);
+
+    pkt->has_virt_hdr = has_virt_hdr;
+}
+
 uint16_t vmxnet_rx_pkt_get_num_frags(struct VmxnetRxPkt *pkt)
 {
     assert(pkt);
@@ -113,6 +113,18 @@ bool vmxnet_rx_pkt_is_vlan_stripped(struct VmxnetRxPkt *pkt);
  */
 bool vmxnet_rx_pkt_has_virt_hdr(struct VmxnetRxPkt *pkt);
 
+/**
+ * sets whether the packet has virtio header, for packets coalesced by
+ * QEMU when the peer itself provides none
+ *
+ * @pkt:            packet
+ * @has_virt_hdr:   true if the header set with vmxnet_rx_pkt_set_vhdr
+ *                  describes the packet
+ *
+ */
+void vmxnet_rx_pkt_set_has_virt_hdr(struct VmxnetRxPkt *pkt,
+                                    bool has_virt_hdr);
+
 /**
  * returns number of frags attached to the packet
  *
@@ -341,9 +341,18 @@ int vring_pop(VirtIODevice *vdev, Vring *vring,
  * Stolen from linux/drivers/vhost/vhost.c.
  */
 void vring_push(Vring *vring, unsigned int head, int len)
+{
+    vring_fill(vring, head, len, 0);
+    vring_flush(vring, 1);
+}
+
+/* Write the idx-th used ring entry past the last published one, without
+ * making it visible to the guest yet.  Use vring_flush() to publish a group
+ * of buffers that the guest must see at once.
+ */
+void vring_fill(Vring *vring, unsigned int head, int len, unsigned int idx)
 {
     struct vring_used_elem *used;
-    uint16_t new;
 
     /* Don't touch vring if a fatal error occurred */
     if (vring->broken) {
@@ -352,15 +361,27 @@ void vring_push(Vring *vring, unsigned int head, int len)
 
     /* The virtqueue contains a ring of used buffers.  Get a pointer to the
      * next entry in that used ring. */
-    used = &vring->vr.used->ring[vring->last_used_idx % vring->vr.num];
+    used = &vring->vr.used->ring[(vring->last_used_idx + idx) %
+                                 vring->vr.num];
     used->id = head;
     used->len = len;
+}
+
+void vring_flush(Vring *vring, unsigned int count)
+{
+    uint16_t old, new;
+
+    if (vring->broken) {
+        return;
+    }
 
     /* Make sure buffer is written before we update index. */
     smp_wmb();
 
-    new = vring->vr.used->idx = ++vring->last_used_idx;
-    if (unlikely((int16_t)(new - vring->signalled_used) < (uint16_t)1)) {
+    old = vring->last_used_idx;
+    new = vring->vr.used->idx = vring->last_used_idx += count;
+    if (unlikely((int16_t)(new - vring->signalled_used) <
+                 (uint16_t)(new - old))) {
         vring->signalled_used_valid = false;
     }
 }
@@ -12,7 +12,8 @@
  */
 
 #include "exec/address-spaces.h"
-#include "hw/virtio/dataplane/hostmem.h"
+#include "qemu/atomic.h"
+#include "hw/virtio/hostmem.h"
 
 static int hostmem_lookup_cmp(const void *phys_, const void *region_)
 {
@@ -28,20 +29,81 @@ static int hostmem_lookup_cmp(const void *phys_, const void *region_)
     }
 }
 
+/* Enter a read-side critical section and return the current table */
+static HostMemTable *hostmem_read_lock(HostMem *hostmem, int *idx)
+{
+    HostMemTable *table;
+    int i;
+
+    for (;;) {
+        i = atomic_read(&hostmem->epoch) & 1;
+        atomic_inc(&hostmem->readers[i]);
+
+        /* If the epoch flipped meanwhile the writer may not have seen our
+         * increment, so retry in the new epoch.
+         */
+        if ((atomic_read(&hostmem->epoch) & 1) == i) {
+            break;
+        }
+        atomic_dec(&hostmem->readers[i]);
+    }
+
+    *idx = i;
+    table = atomic_read(&hostmem->current);
+    smp_read_barrier_depends();
+    return table;
+}
+
+static void hostmem_read_unlock(HostMem *hostmem, int idx)
+{
+    atomic_dec(&hostmem->readers[idx]);
+}
+
+/* Wait until no reader can still be using a table that was unpublished
+ * before this call.  Only called by the listener, so there is one writer.
+ */
+static void hostmem_synchronize(HostMem *hostmem)
+{
+    int old = hostmem->epoch & 1;
+
+    atomic_inc(&hostmem->epoch);
+
+    while (atomic_read(&hostmem->readers[old])) {
+        g_usleep(1);
+    }
+}
+
+static HostMemRegion *hostmem_find_region(HostMemTable *table, hwaddr phys)
+{
+    HostMemRegion *region;
+    unsigned int last_hit = atomic_read(&table->last_hit);
+
+    if (last_hit < table->num_regions &&
+        hostmem_lookup_cmp(&phys, &table->regions[last_hit]) == 0) {
+        return &table->regions[last_hit];
+    }
+
+    region = bsearch(&phys, table->regions, table->num_regions,
+                     sizeof(table->regions[0]), hostmem_lookup_cmp);
+    if (region) {
+        atomic_set(&table->last_hit, region - table->regions);
+    }
+    return region;
+}
+
 /**
  * Map guest physical address to host pointer
  */
 void *hostmem_lookup(HostMem *hostmem, hwaddr phys, hwaddr len, bool is_write)
 {
+    HostMemTable *table;
     HostMemRegion *region;
     void *host_addr = NULL;
     hwaddr offset_within_region;
+    int idx;
 
-    qemu_mutex_lock(&hostmem->current_regions_lock);
-    region = bsearch(&phys, hostmem->current_regions,
-                     hostmem->num_current_regions,
-                     sizeof(hostmem->current_regions[0]),
-                     hostmem_lookup_cmp);
+    table = hostmem_read_lock(hostmem, &idx);
+    region = hostmem_find_region(table, phys);
     if (!region) {
         goto out;
     }
@@ -53,29 +115,74 @@ void *hostmem_lookup(HostMem *hostmem, hwaddr phys, hwaddr len, bool is_write)
         host_addr = region->host_addr + offset_within_region;
     }
 out:
-    qemu_mutex_unlock(&hostmem->current_regions_lock);
+    hostmem_read_unlock(hostmem, idx);
 
     return host_addr;
 }
 
+/**
+ * Copy the region containing a guest physical address
+ */
+bool hostmem_lookup_region(HostMem *hostmem, hwaddr phys,
+                           HostMemRegion *region)
+{
+    HostMemTable *table;
+    HostMemRegion *found;
+    int idx;
+
+    table = hostmem_read_lock(hostmem, &idx);
+    found = hostmem_find_region(table, phys);
+    if (found) {
+        *region = *found;
+    }
+    hostmem_read_unlock(hostmem, idx);
+
+    return found != NULL;
+}
+
+static HostMemTable *hostmem_table_new(HostMemRegion *regions, size_t num)
+{
+    HostMemTable *table;
+
+    table = g_malloc(sizeof(*table) + num * sizeof(table->regions[0]));
+    table->last_hit = 0;
+    table->num_regions = num;
+    if (num) {
+        memcpy(table->regions, regions, num * sizeof(table->regions[0]));
+    }
+    return table;
+}
+
+static void hostmem_table_free(HostMemTable *table)
+{
+    size_t i;
+
+    for (i = 0; i < table->num_regions; i++) {
+        memory_region_unref(table->regions[i].mr);
+    }
+    g_free(table);
+}
+
 /**
  * Install new regions list
  */
 static void hostmem_listener_commit(MemoryListener *listener)
 {
     HostMem *hostmem = container_of(listener, HostMem, listener);
-    int i;
+    HostMemTable *old = hostmem->current;
 
-    qemu_mutex_lock(&hostmem->current_regions_lock);
-    for (i = 0; i < hostmem->num_current_regions; i++) {
-        memory_region_unref(hostmem->current_regions[i].mr);
-    }
-    g_free(hostmem->current_regions);
-    hostmem->current_regions = hostmem->new_regions;
-    hostmem->num_current_regions = hostmem->num_new_regions;
-    qemu_mutex_unlock(&hostmem->current_regions_lock);
+    /* Make the table contents visible before the pointer */
+    smp_wmb();
+    atomic_set(&hostmem->current,
+               hostmem_table_new(hostmem->new_regions,
+                                 hostmem->num_new_regions));
+    hostmem->generation++;
+
+    hostmem_synchronize(hostmem);
+    hostmem_table_free(old);
 
     /* Reset new regions list */
+    g_free(hostmem->new_regions);
     hostmem->new_regions = NULL;
     hostmem->num_new_regions = 0;
 }
@@ -148,7 +255,7 @@ void hostmem_init(HostMem *hostmem)
 {
     memset(hostmem, 0, sizeof(*hostmem));
 
-    qemu_mutex_init(&hostmem->current_regions_lock);
+    hostmem->current = hostmem_table_new(NULL, 0);
 
     hostmem->listener = (MemoryListener){
         .begin = hostmem_listener_dummy,
@@ -178,6 +285,5 @@ void hostmem_finalize(HostMem *hostmem)
 {
     memory_listener_unregister(&hostmem->listener);
     g_free(hostmem->new_regions);
-    g_free(hostmem->current_regions);
-    qemu_mutex_destroy(&hostmem->current_regions_lock);
+    hostmem_table_free(hostmem->current);
 }
@@ -18,6 +18,10 @@
 #include "hw/virtio/virtio.h"
 #include "qemu/atomic.h"
 #include "hw/virtio/virtio-bus.h"
+#include "hw/virtio/hostmem.h"
+#include "hw/xen/xen.h"
+#include "qemu/timer.h"
+#include "qapi/visitor.h"
 
 /*
  * The alignment to use between consumer and producer parts of vring.
@@ -63,9 +67,23 @@ typedef struct VRing
     hwaddr used;
 } VRing;
 
+/* Host mappings of the rings and of the RAM region that last backed one of
+ * the queue's buffers.  They are only used while generation matches
+ * virtio_hostmem.generation; a NULL ring pointer means the ring is not in
+ * directly accessible RAM and ld*_phys must be used instead.
+ */
+typedef struct VRingCache
+{
+    unsigned int generation;
+    VRingDesc *desc;
+    VRingAvail *avail;
+    HostMemRegion last;
+} VRingCache;
+
 struct VirtQueue
 {
     VRing vring;
+    VRingCache cache;
     hwaddr pa;
     uint16_t last_avail_idx;
     /* Last used index value we have signalled on */
@@ -86,8 +104,76 @@ struct VirtQueue
     VirtIODevice *vdev;
     EventNotifier guest_notifier;
     EventNotifier host_notifier;
+
+    /* Interrupt moderation, see virtio_set_irq_moderation() */
+    QEMUTimer *irq_timer;
+    unsigned int irq_pending;
+    uint64_t irq_count;
 };
 
+/* Guest RAM layout used by all virtqueues that are processed under the
+ * iothread mutex.  The memory listener behind it runs under the same mutex,
+ * so the generation number can be compared without taking the lock.
+ */
+static HostMem virtio_hostmem;
+static bool virtio_hostmem_enabled;
+
+static void vring_cache_refresh(VirtQueue *vq)
+{
+    VRingCache *cache = &vq->cache;
+
+    cache->generation = virtio_hostmem.generation;
+    cache->desc = NULL;
+    cache->avail = NULL;
+    cache->last.size = 0;
+
+    if (!virtio_hostmem_enabled || !vq->vring.avail) {
+        return;
+    }
+
+    cache->desc = hostmem_lookup(&virtio_hostmem, vq->vring.desc,
+                                 vq->vring.num * sizeof(VRingDesc), false);
+    /* The used_event field lives right after the avail ring */
+    cache->avail = hostmem_lookup(&virtio_hostmem, vq->vring.avail,
+                                  offsetof(VRingAvail,
+                                           ring[vq->vring.num + 1]),
+                                  false);
+}
+
+static inline VRingCache *vring_cache(VirtQueue *vq)
+{
+    if (unlikely(vq->cache.generation != virtio_hostmem.generation)) {
+        vring_cache_refresh(vq);
+    }
+    return &vq->cache;
+}
+
+/* Translate a guest buffer using the last RAM region seen by this queue,
+ * returns NULL if the buffer must go through cpu_physical_memory_map().
+ */
+static void *vring_translate(VirtQueue *vq, hwaddr addr, hwaddr len,
+                             bool is_write)
+{
+    HostMemRegion *last;
+    hwaddr offset;
+
+    if (!virtio_hostmem_enabled) {
+        return NULL;
+    }
+    last = &vring_cache(vq)->last;
+    if (addr - last->guest_addr >= last->size) {
+        if (!hostmem_lookup_region(&virtio_hostmem, addr, last)) {
+            last->size = 0;
+            return NULL;
+        }
+    }
+    offset = addr - last->guest_addr;
+    if (len > last->size - offset || (is_write && last->readonly)) {
+        return NULL;
+    }
+    return last->host_addr + offset;
+}
+
 /* virt queue functions */
 static void virtqueue_init(VirtQueue *vq)
 {
@@ -98,53 +184,82 @@ static void virtqueue_init(VirtQueue *vq)
     vq->vring.used = vring_align(vq->vring.avail +
                                  offsetof(VRingAvail, ring[vq->vring.num]),
                                  vq->vring.align);
+    vring_cache_refresh(vq);
 }
 
-static inline uint64_t vring_desc_addr(hwaddr desc_pa, int i)
+static inline uint64_t vring_desc_addr(hwaddr desc_pa, VRingDesc *desc_host,
+                                       int i)
 {
     hwaddr pa;
+    if (desc_host) {
+        return ldq_p(&desc_host[i].addr);
+    }
     pa = desc_pa + sizeof(VRingDesc) * i + offsetof(VRingDesc, addr);
     return ldq_phys(pa);
 }
 
-static inline uint32_t vring_desc_len(hwaddr desc_pa, int i)
+static inline uint32_t vring_desc_len(hwaddr desc_pa, VRingDesc *desc_host,
+                                      int i)
 {
     hwaddr pa;
+    if (desc_host) {
+        return ldl_p(&desc_host[i].len);
+    }
     pa = desc_pa + sizeof(VRingDesc) * i + offsetof(VRingDesc, len);
     return ldl_phys(pa);
 }
 
-static inline uint16_t vring_desc_flags(hwaddr desc_pa, int i)
+static inline uint16_t vring_desc_flags(hwaddr desc_pa, VRingDesc *desc_host,
+                                        int i)
 {
     hwaddr pa;
+    if (desc_host) {
+        return lduw_p(&desc_host[i].flags);
+    }
     pa = desc_pa + sizeof(VRingDesc) * i + offsetof(VRingDesc, flags);
     return lduw_phys(pa);
 }
 
-static inline uint16_t vring_desc_next(hwaddr desc_pa, int i)
+static inline uint16_t vring_desc_next(hwaddr desc_pa, VRingDesc *desc_host,
+                                       int i)
 {
     hwaddr pa;
+    if (desc_host) {
+        return lduw_p(&desc_host[i].next);
+    }
     pa = desc_pa + sizeof(VRingDesc) * i + offsetof(VRingDesc, next);
     return lduw_phys(pa);
 }
 
 static inline uint16_t vring_avail_flags(VirtQueue *vq)
 {
+    VRingAvail *avail = vring_cache(vq)->avail;
     hwaddr pa;
+    if (avail) {
+        return lduw_p(&avail->flags);
+    }
     pa = vq->vring.avail + offsetof(VRingAvail, flags);
     return lduw_phys(pa);
 }
 
 static inline uint16_t vring_avail_idx(VirtQueue *vq)
 {
+    VRingAvail *avail = vring_cache(vq)->avail;
     hwaddr pa;
+    if (avail) {
+        return lduw_p(&avail->idx);
+    }
     pa = vq->vring.avail + offsetof(VRingAvail, idx);
     return lduw_phys(pa);
 }
 
 static inline uint16_t vring_avail_ring(VirtQueue *vq, int i)
 {
+    VRingAvail *avail = vring_cache(vq)->avail;
     hwaddr pa;
+    if (avail) {
+        return lduw_p(&avail->ring[i]);
+    }
     pa = vq->vring.avail + offsetof(VRingAvail, ring[i]);
     return lduw_phys(pa);
 }
@@ -232,14 +347,18 @@ int virtio_queue_empty(VirtQueue *vq)
     return vring_avail_idx(vq) == vq->last_avail_idx;
 }
 
-void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
-                    unsigned int len, unsigned int idx)
+/* Number of buffers the guest made available that were not popped yet */
+unsigned int virtio_queue_pending(VirtQueue *vq)
+{
+    return (uint16_t)(vring_avail_idx(vq) - vq->last_avail_idx);
+}
+
+static void virtqueue_unmap_sg(VirtQueue *vq, const VirtQueueElement *elem,
+                               unsigned int len)
 {
     unsigned int offset;
     int i;
 
-    trace_virtqueue_fill(vq, elem, len, idx);
-
     offset = 0;
     for (i = 0; i < elem->in_num; i++) {
         size_t size = MIN(len - offset, elem->in_sg[i].iov_len);
@@ -255,6 +374,25 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
         cpu_physical_memory_unmap(elem->out_sg[i].iov_base,
                                   elem->out_sg[i].iov_len,
                                   0, elem->out_sg[i].iov_len);
+}
+
+/* Return an element obtained by the last virtqueue_pop() to the avail ring
+ * without completing it; len bytes of its in buffers were written.
+ */
+void virtqueue_discard(VirtQueue *vq, const VirtQueueElement *elem,
+                       unsigned int len)
+{
+    vq->last_avail_idx--;
+    vq->inuse--;
+    virtqueue_unmap_sg(vq, elem, len);
+}
+
+void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
+                    unsigned int len, unsigned int idx)
+{
+    trace_virtqueue_fill(vq, elem, len, idx);
+
+    virtqueue_unmap_sg(vq, elem, len);
 
     idx = (idx + vring_used_idx(vq)) % vq->vring.num;
 
@@ -320,17 +458,17 @@ static unsigned int virtqueue_get_head(VirtQueue *vq, unsigned int idx)
     return head;
 }
 
-static unsigned virtqueue_next_desc(hwaddr desc_pa,
+static unsigned virtqueue_next_desc(hwaddr desc_pa, VRingDesc *desc_host,
                                     unsigned int i, unsigned int max)
 {
     unsigned int next;
 
     /* If this descriptor says it doesn't chain, we're done. */
-    if (!(vring_desc_flags(desc_pa, i) & VRING_DESC_F_NEXT))
+    if (!(vring_desc_flags(desc_pa, desc_host, i) & VRING_DESC_F_NEXT))
         return max;
 
     /* Check they're not leading us off end of descriptors. */
-    next = vring_desc_next(desc_pa, i);
+    next = vring_desc_next(desc_pa, desc_host, i);
     /* Make sure compiler knows to grab that: we don't want it changing! */
     smp_wmb();
 
@@ -355,15 +493,17 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
     while (virtqueue_num_heads(vq, idx)) {
         unsigned int max, num_bufs, indirect = 0;
         hwaddr desc_pa;
+        VRingDesc *desc_host;
         int i;
 
         max = vq->vring.num;
         num_bufs = total_bufs;
         i = virtqueue_get_head(vq, idx++);
         desc_pa = vq->vring.desc;
+        desc_host = vring_cache(vq)->desc;
 
-        if (vring_desc_flags(desc_pa, i) & VRING_DESC_F_INDIRECT) {
-            if (vring_desc_len(desc_pa, i) % sizeof(VRingDesc)) {
+        if (vring_desc_flags(desc_pa, desc_host, i) & VRING_DESC_F_INDIRECT) {
+            if (vring_desc_len(desc_pa, desc_host, i) % sizeof(VRingDesc)) {
                 error_report("Invalid size for indirect buffer table");
                 exit(1);
             }
@@ -376,8 +516,10 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
 
             /* loop over the indirect descriptor table */
             indirect = 1;
-            max = vring_desc_len(desc_pa, i) / sizeof(VRingDesc);
-            desc_pa = vring_desc_addr(desc_pa, i);
+            max = vring_desc_len(desc_pa, desc_host, i) / sizeof(VRingDesc);
+            desc_pa = vring_desc_addr(desc_pa, desc_host, i);
+            desc_host = vring_translate(vq, desc_pa, max * sizeof(VRingDesc),
+                                        false);
             num_bufs = i = 0;
         }
 
@@ -388,15 +530,15 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
                 exit(1);
             }
 
-            if (vring_desc_flags(desc_pa, i) & VRING_DESC_F_WRITE) {
-                in_total += vring_desc_len(desc_pa, i);
+            if (vring_desc_flags(desc_pa, desc_host, i) & VRING_DESC_F_WRITE) {
+                in_total += vring_desc_len(desc_pa, desc_host, i);
             } else {
-                out_total += vring_desc_len(desc_pa, i);
+                out_total += vring_desc_len(desc_pa, desc_host, i);
             }
             if (in_total >= max_in_bytes && out_total >= max_out_bytes) {
                 goto done;
             }
-        } while ((i = virtqueue_next_desc(desc_pa, i, max)) != max);
+        } while ((i = virtqueue_next_desc(desc_pa, desc_host, i, max)) != max);
 
         if (!indirect)
             total_bufs = num_bufs;
@@ -421,6 +563,32 @@ int virtqueue_avail_bytes(VirtQueue *vq, unsigned int in_bytes,
     return in_bytes <= in_total && out_bytes <= out_total;
 }
 
+/* Like virtqueue_map_sg(), but try the queue's translation cache first.
+ * Buffers translated directly hold a MemoryRegion reference just like
+ * cpu_physical_memory_map() would take, so that virtqueue_fill() can unmap
+ * every element the same way.
+ */
+static void vring_map_sg(VirtQueue *vq, struct iovec *sg, hwaddr *addr,
+                         size_t num_sg, int is_write)
+{
+    unsigned int i;
+    hwaddr len;
+
+    for (i = 0; i < num_sg; i++) {
+        len = sg[i].iov_len;
+        sg[i].iov_base = vring_translate(vq, addr[i], len, is_write);
+        if (sg[i].iov_base) {
+            memory_region_ref(vq->cache.last.mr);
+            continue;
+        }
+        sg[i].iov_base = cpu_physical_memory_map(addr[i], &len, is_write);
+        if (sg[i].iov_base == NULL || len != sg[i].iov_len) {
+            error_report("virtio: trying to map MMIO memory");
+            exit(1);
+        }
+    }
+}
+
 void virtqueue_map_sg(struct iovec *sg, hwaddr *addr,
     size_t num_sg, int is_write)
 {
@@ -441,6 +609,7 @@ int virtqueue_pop(VirtQueue *vq, VirtQueueElement *elem)
 {
     unsigned int i, head, max;
     hwaddr desc_pa = vq->vring.desc;
+    VRingDesc *desc_host;
 
     if (!virtqueue_num_heads(vq, vq->last_avail_idx))
         return 0;
@@ -455,15 +624,18 @@ int virtqueue_pop(VirtQueue *vq, VirtQueueElement *elem)
         vring_avail_event(vq, vring_avail_idx(vq));
     }
 
-    if (vring_desc_flags(desc_pa, i) & VRING_DESC_F_INDIRECT) {
-        if (vring_desc_len(desc_pa, i) % sizeof(VRingDesc)) {
+    desc_host = vring_cache(vq)->desc;
+    if (vring_desc_flags(desc_pa, desc_host, i) & VRING_DESC_F_INDIRECT) {
+        if (vring_desc_len(desc_pa, desc_host, i) % sizeof(VRingDesc)) {
             error_report("Invalid size for indirect buffer table");
             exit(1);
         }
 
         /* loop over the indirect descriptor table */
-        max = vring_desc_len(desc_pa, i) / sizeof(VRingDesc);
-        desc_pa = vring_desc_addr(desc_pa, i);
+        max = vring_desc_len(desc_pa, desc_host, i) / sizeof(VRingDesc);
+        desc_pa = vring_desc_addr(desc_pa, desc_host, i);
+        desc_host = vring_translate(vq, desc_pa, max * sizeof(VRingDesc),
+                                    false);
         i = 0;
     }
 
@@ -471,34 +643,36 @@ int virtqueue_pop(VirtQueue *vq, VirtQueueElement *elem)
     do {
         struct iovec *sg;
 
-        if (vring_desc_flags(desc_pa, i) & VRING_DESC_F_WRITE) {
+        if (vring_desc_flags(desc_pa, desc_host, i) & VRING_DESC_F_WRITE) {
             if (elem->in_num >= ARRAY_SIZE(elem->in_sg)) {
                 error_report("Too many write descriptors in indirect table");
                 exit(1);
             }
-            elem->in_addr[elem->in_num] = vring_desc_addr(desc_pa, i);
+            elem->in_addr[elem->in_num] = vring_desc_addr(desc_pa, desc_host,
+                                                          i);
             sg = &elem->in_sg[elem->in_num++];
         } else {
             if (elem->out_num >= ARRAY_SIZE(elem->out_sg)) {
                 error_report("Too many read descriptors in indirect table");
                 exit(1);
             }
-            elem->out_addr[elem->out_num] = vring_desc_addr(desc_pa, i);
+            elem->out_addr[elem->out_num] = vring_desc_addr(desc_pa, desc_host,
+                                                            i);
             sg = &elem->out_sg[elem->out_num++];
         }
 
-        sg->iov_len = vring_desc_len(desc_pa, i);
+        sg->iov_len = vring_desc_len(desc_pa, desc_host, i);
 
         /* If we've got too many, that implies a descriptor loop. */
         if ((elem->in_num + elem->out_num) > max) {
             error_report("Looped descriptor");
             exit(1);
         }
-    } while ((i = virtqueue_next_desc(desc_pa, i, max)) != max);
+    } while ((i = virtqueue_next_desc(desc_pa, desc_host, i, max)) != max);
 
     /* Now map what we have collected */
-    virtqueue_map_sg(elem->in_sg, elem->in_addr, elem->in_num, 1);
-    virtqueue_map_sg(elem->out_sg, elem->out_addr, elem->out_num, 0);
+    vring_map_sg(vq, elem->in_sg, elem->in_addr, elem->in_num, 1);
+    vring_map_sg(vq, elem->out_sg, elem->out_addr, elem->out_num, 0);
 
     elem->index = head;
 
@@ -564,6 +738,11 @@ void virtio_reset(void *opaque)
         vdev->vq[i].signalled_used = 0;
         vdev->vq[i].signalled_used_valid = false;
         vdev->vq[i].notification = true;
+        vring_cache_refresh(&vdev->vq[i]);
+        if (vdev->vq[i].irq_timer) {
+            qemu_del_timer(vdev->vq[i].irq_timer);
+        }
+        vdev->vq[i].irq_pending = 0;
     }
 }
 
@@ -738,9 +917,19 @@ void virtio_queue_set_vector(VirtIODevice *vdev, int n, uint16_t vector)
         vdev->vq[n].vector = vector;
 }
 
+static void virtio_queue_get_irq_count(Object *obj, Visitor *v, void *opaque,
+                                       const char *name, Error **errp)
+{
+    VirtQueue *vq = opaque;
+    uint64_t irq_count = atomic_read(&vq->irq_count);
+
+    visit_type_uint64(v, &irq_count, name, errp);
+}
+
 VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
                             void (*handle_output)(VirtIODevice *, VirtQueue *))
 {
+    char *name;
     int i;
 
     for (i = 0; i < VIRTIO_PCI_QUEUE_MAX; i++) {
@@ -755,6 +944,14 @@ VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
     vdev->vq[i].vring.align = VIRTIO_PCI_VRING_ALIGN;
     vdev->vq[i].handle_output = handle_output;
 
+    name = g_strdup_printf("vq%d-interrupts", i);
+    if (!object_property_find(OBJECT(vdev), name, NULL)) {
+        object_property_add(OBJECT(vdev), name, "uint64",
+                            virtio_queue_get_irq_count, NULL, NULL,
+                            &vdev->vq[i], NULL);
+    }
+    g_free(name);
+
     return &vdev->vq[i];
 }
 
@@ -765,6 +962,10 @@ void virtio_del_queue(VirtIODevice *vdev, int n)
     }
 
     vdev->vq[n].vring.num = 0;
+    if (vdev->vq[n].irq_timer) {
+        qemu_del_timer(vdev->vq[n].irq_timer);
+    }
+    vdev->vq[n].irq_pending = 0;
 }
 
 void virtio_irq(VirtQueue *vq)
@@ -810,17 +1011,84 @@ static bool vring_notify(VirtIODevice *vdev, VirtQueue *vq)
     return !v || vring_need_event(vring_used_event(vq), new, old);
 }
 
-void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
+static void virtio_queue_send_irq(VirtQueue *vq)
 {
+    VirtIODevice *vdev = vq->vdev;
+
+    vq->irq_pending = 0;
     if (!vring_notify(vdev, vq)) {
         return;
     }
 
     trace_virtio_notify(vdev, vq);
     vdev->isr |= 0x01;
+    virtio_queue_inc_irq_count(vq);
     virtio_notify_vector(vdev, vq->vector);
 }
 
+static void virtio_queue_irq_timer(void *opaque)
+{
+    VirtQueue *vq = opaque;
+
+    if (vq->irq_pending) {
+        virtio_queue_send_irq(vq);
+    }
+}
+
+/* Send held back interrupts now, e.g. before the VM stops */
+static void virtio_queue_flush_irq(VirtQueue *vq)
+{
+    if (vq->irq_timer) {
+        qemu_del_timer(vq->irq_timer);
+    }
+    if (vq->irq_pending) {
+        virtio_queue_send_irq(vq);
+    }
+}
+
+void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    /* A stopped VM does not run the timer, don't hold anything back */
+    if (!vdev->irq_max_usecs || !vdev->vm_running) {
+        virtio_queue_send_irq(vq);
+        return;
+    }
+
+    vq->irq_pending++;
+    if (vdev->irq_max_frames && vq->irq_pending >= vdev->irq_max_frames) {
+        virtio_queue_flush_irq(vq);
+        return;
+    }
+
+    if (!vq->irq_timer) {
+        vq->irq_timer = qemu_new_timer_ns(vm_clock, virtio_queue_irq_timer, vq);
+    }
+    if (!qemu_timer_pending(vq->irq_timer)) {
+        qemu_mod_timer(vq->irq_timer, qemu_get_clock_ns(vm_clock) +
+                       (int64_t)vdev->irq_max_usecs * SCALE_US);
+    }
+}
+
+int virtio_set_irq_moderation(VirtIODevice *vdev, uint32_t max_usecs,
+                              uint32_t max_frames)
+{
+    if (max_usecs > VIRTIO_IRQ_MAX_USECS) {
+        error_report("%s: irq-max-usecs must not exceed %d",
+                     vdev->name, VIRTIO_IRQ_MAX_USECS);
+        return -EINVAL;
+    }
+    vdev->irq_max_usecs = max_usecs;
+    vdev->irq_max_frames = max_frames;
+    return 0;
+}
+
+/* Dataplane threads send interrupts too, so the count is updated
+ * atomically */
+void virtio_queue_inc_irq_count(VirtQueue *vq)
+{
+    atomic_inc(&vq->irq_count);
+}
+
 void virtio_notify_config(VirtIODevice *vdev)
 {
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK))
@@ -958,6 +1226,14 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f)
 
 void virtio_cleanup(VirtIODevice *vdev)
 {
+    int i;
+
+    for (i = 0; i < VIRTIO_PCI_QUEUE_MAX; i++) {
+        if (vdev->vq[i].irq_timer) {
+            qemu_del_timer(vdev->vq[i].irq_timer);
+            qemu_free_timer(vdev->vq[i].irq_timer);
+        }
+    }
     qemu_del_vm_change_state_handler(vdev->vmstate);
     g_free(vdev->config);
     g_free(vdev->vq);
@@ -969,8 +1245,19 @@ static void virtio_vmstate_change(void *opaque, int running, RunState state)
     BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
     bool backend_run = running && (vdev->status & VIRTIO_CONFIG_S_DRIVER_OK);
+    int i;
+
     vdev->vm_running = running;
 
+    /* Moderation timers do not run while the VM is stopped and pending
+     * interrupts are not migrated, so deliver them now.
+     */
+    if (!running) {
+        for (i = 0; i < VIRTIO_PCI_QUEUE_MAX; i++) {
+            virtio_queue_flush_irq(&vdev->vq[i]);
+        }
+    }
+
     if (backend_run) {
         virtio_set_status(vdev, vdev->status);
     }
@@ -995,6 +1282,10 @@ void virtio_init(VirtIODevice *vdev, const char *name,
     vdev->config_vector = VIRTIO_NO_VECTOR;
     vdev->vq = g_malloc0(sizeof(VirtQueue) * VIRTIO_PCI_QUEUE_MAX);
     vdev->vm_running = runstate_is_running();
+    if (!virtio_hostmem_enabled && !xen_enabled()) {
+        hostmem_init(&virtio_hostmem);
+        virtio_hostmem_enabled = true;
+    }
     for (i = 0; i < VIRTIO_PCI_QUEUE_MAX; i++) {
         vdev->vq[i].vector = VIRTIO_NO_VECTOR;
         vdev->vq[i].vdev = vdev;
@@ -18,6 +18,7 @@
 #include "qemu/queue.h"
 #include "qemu/event_notifier.h"
 #include "qemu/thread.h"
+#include "qemu/rfifolock.h"
 
 typedef struct BlockDriverAIOCB BlockDriverAIOCB;
 typedef void BlockDriverCompletionFunc(void *opaque, int ret);
@@ -45,6 +46,9 @@ typedef void IOHandler(void *opaque);
 typedef struct AioContext {
     GSource source;
 
+    /* Protects all fields from multi-threaded access */
+    RFifoLock lock;
+
     /* The list of registered AIO handlers */
     QLIST_HEAD(, AioHandler) aio_handlers;
 
@@ -67,16 +71,46 @@ typedef struct AioContext {
     /* Used for aio_notify.  */
     EventNotifier notifier;
 
+    /* Set by aio_notify() until the notifier is dispatched, so that
+     * busy-polling can stop without reading the notifier.
+     */
+    bool notified;
+
     /* GPollFDs for aio_poll() */
     GArray *pollfds;
 
+    /* epoll(7) instance holding all handlers.  When epoll_enabled is false
+     * aio_poll() rebuilds pollfds and calls g_poll() instead.
+     */
+    int epollfd;
+    bool epoll_enabled;
+
+    /* Busy-polling window before blocking, adapted between 0 and
+     * poll_max_ns; see aio_context_set_poll_params().
+     */
+    int64_t poll_max_ns;
+    int64_t poll_ns;
+
+    /* Number of times busy-polling found work, or gave up and blocked */
+    uint64_t poll_hits;
+    uint64_t poll_misses;
+
     /* Thread pool for performing work and receiving completion callbacks */
     struct ThreadPool *thread_pool;
+
+    /* Worker limits for thread_pool; see aio_context_set_thread_pool_params() */
+    int thread_pool_min;
+    int thread_pool_max;
 } AioContext;
 
 /* Returns 1 if there are still outstanding AIO requests; 0 otherwise */
 typedef int (AioFlushEventNotifierHandler)(EventNotifier *e);
 
+/* Checks for work without blocking and processes it; returns true if
+ * progress was made.
+ */
+typedef bool AioPollFn(void *opaque);
+
 /**
  * aio_context_new: Allocate a new AioContext.
  *
@@ -102,6 +136,64 @@ void aio_context_ref(AioContext *ctx);
  */
 void aio_context_unref(AioContext *ctx);
 
+/**
+ * aio_context_setup, aio_context_destroy:
+ * @ctx: The AioContext to operate on.
+ *
+ * Initialize and release the host-specific parts of an AioContext.  These
+ * are internal functions called by aio_context_new and on finalization.
+ */
+void aio_context_setup(AioContext *ctx);
+void aio_context_destroy(AioContext *ctx);
+
+/**
+ * aio_context_set_poll_params:
+ * @ctx: The AioContext to operate on.
+ * @max_ns: Upper bound of the busy-polling window in nanoseconds, 0 to
+ *          disable busy-polling.
+ *
+ * Before blocking, aio_poll() runs the io_poll callbacks of the context's
+ * handlers in a loop.  The window grows while events tend to arrive shortly
+ * after it expires and shrinks when they do not.  Hits and misses are
+ * counted in @ctx->poll_hits and @ctx->poll_misses.
+ */
+void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns);
+
+/**
+ * aio_context_set_thread_pool_params:
+ * @ctx: The AioContext to operate on.
+ * @min: Number of worker threads that are kept alive while idle.
+ * @max: Upper bound on the number of worker threads.
+ *
+ * Requests submitted when all @max workers are busy wait in the queue.
+ * @min is capped at @max, so the two can be set in any order.  Takes
+ * effect immediately if the context's thread pool already exists.
+ */
+void aio_context_set_thread_pool_params(AioContext *ctx, int min, int max);
+
+/**
+ * aio_context_acquire:
+ * @ctx: The AioContext to operate on.
+ *
+ * The event loop thread holds the AioContext while running aio_poll().
+ * Other threads, typically the main loop working on a BlockDriverState
+ * bound to @ctx, must acquire it before touching objects of the context.
+ * aio_poll() is kicked out of blocking so that the lock is handed over
+ * promptly.
+ *
+ * Acquiring is recursive and fair: threads get the AioContext in the order
+ * they asked for it.
+ */
+void aio_context_acquire(AioContext *ctx);
+
+/**
+ * aio_context_release:
+ * @ctx: The AioContext to operate on.
+ *
+ * Relinquish ownership of an AioContext taken with aio_context_acquire.
+ */
+void aio_context_release(AioContext *ctx);
+
 /**
  * aio_bh_new: Allocate a new bottom half structure.
  *
@@ -214,6 +306,11 @@ void aio_set_fd_handler(AioContext *ctx,
                         IOHandler *io_write,
                         AioFlushHandler *io_flush,
                         void *opaque);
+
+/* Attach a busy-polling callback to the handler registered for @fd.  It is
+ * dropped together with the handler.
+ */
+void aio_set_fd_poll(AioContext *ctx, int fd, AioPollFn *io_poll);
 #endif
 
 /* Register an event notifier and associated callbacks.  Behaves very similarly
@@ -228,6 +325,13 @@ void aio_set_event_notifier(AioContext *ctx,
                             EventNotifierHandler *io_read,
                             AioFlushEventNotifierHandler *io_flush);
 
+/* Attach a busy-polling callback to an event notifier registered with
+ * aio_set_event_notifier.  @io_poll receives the notifier as its argument.
+ */
+void aio_set_event_notifier_poll(AioContext *ctx,
+                                 EventNotifier *notifier,
+                                 AioPollFn *io_poll);
+
 /* Return a GSource that lets the main loop poll the file descriptors attached
  * to this AioContext.
  */
@@ -265,6 +265,7 @@ void bdrv_invalidate_cache(BlockDriverState *bs);
 void bdrv_invalidate_cache_all(void);
 
 void bdrv_clear_incoming_migration_all(void);
+void bdrv_set_incoming_migration_all(void);
 
 /* Ensure contents are flushed to disk.  */
 int bdrv_flush(BlockDriverState *bs);
@@ -353,20 +354,50 @@ void bdrv_reset_dirty(BlockDriverState *bs, int64_t cur_sector, int nr_sectors);
 void bdrv_dirty_iter_init(BlockDriverState *bs, struct HBitmapIter *hbi);
 int64_t bdrv_get_dirty_count(BlockDriverState *bs);
 
+typedef struct BdrvDirtyBitmap BdrvDirtyBitmap;
+struct HBitmap;
+BdrvDirtyBitmap *bdrv_create_dirty_bitmap(BlockDriverState *bs,
+                                          int64_t granularity,
+                                          const char *name, Error **errp);
+BdrvDirtyBitmap *bdrv_find_dirty_bitmap(BlockDriverState *bs,
+                                        const char *name);
+int64_t bdrv_dirty_bitmap_granularity(BdrvDirtyBitmap *bitmap);
+void bdrv_dirty_bitmap_make_persistent(BlockDriverState *bs,
+                                       BdrvDirtyBitmap *bitmap, Error **errp);
+void bdrv_release_dirty_bitmap(BlockDriverState *bs, BdrvDirtyBitmap *bitmap);
+void bdrv_clear_dirty_bitmap(BlockDriverState *bs, BdrvDirtyBitmap *bitmap);
+struct HBitmap *bdrv_freeze_dirty_bitmap(BlockDriverState *bs,
+                                         BdrvDirtyBitmap *bitmap);
+void bdrv_thaw_dirty_bitmap(BlockDriverState *bs, BdrvDirtyBitmap *bitmap,
+                            struct HBitmap *unused);
+
 void bdrv_enable_copy_on_read(BlockDriverState *bs);
 void bdrv_disable_copy_on_read(BlockDriverState *bs);
 
 void bdrv_set_in_use(BlockDriverState *bs, int in_use);
 int bdrv_in_use(BlockDriverState *bs);
 
-#ifdef CONFIG_LINUX_AIO
-int raw_get_aio_fd(BlockDriverState *bs);
-#else
-static inline int raw_get_aio_fd(BlockDriverState *bs)
-{
-    return -ENOTSUP;
-}
-#endif
+void bdrv_io_plug(BlockDriverState *bs);
+void bdrv_io_unplug(BlockDriverState *bs);
+
+/**
+ * bdrv_set_aio_context:
+ *
+ * Changes the #AioContext used for fd handlers, bottom halves and
+ * completions of @bs and its children.  All requests are drained first.
+ *
+ * This function must be called from the old #AioContext, or with it
+ * acquired.
+ */
+void bdrv_set_aio_context(BlockDriverState *bs, AioContext *new_context);
+
+/**
+ * bdrv_can_set_aio_context:
+ *
+ * Returns: true if every driver used by @bs supports
+ * bdrv_set_aio_context().
+ */
+bool bdrv_can_set_aio_context(BlockDriverState *bs);
 
 enum BlockAcctType {
     BDRV_ACCT_READ,
@@ -384,6 +415,8 @@ typedef struct BlockAcctCookie {
 void bdrv_acct_start(BlockDriverState *bs, BlockAcctCookie *cookie,
         int64_t bytes, enum BlockAcctType type);
 void bdrv_acct_done(BlockDriverState *bs, BlockAcctCookie *cookie);
+void bdrv_acct_merge_done(BlockDriverState *bs, enum BlockAcctType type,
+                          int num_requests);
 
 typedef enum {
     BLKDBG_L1_UPDATE,
@@ -69,6 +69,13 @@ typedef struct BdrvTrackedRequest {
     CoQueue wait_queue; /* coroutines blocked on this request */
 } BdrvTrackedRequest;
 
+struct BdrvDirtyBitmap {
+    HBitmap *bitmap;
+    char *name;
+    bool persistent;    /* stored in the image by the format driver */
+    bool frozen;        /* a block job owns the previous generation */
+    QLIST_ENTRY(BdrvDirtyBitmap) list;
+};
 
 typedef struct BlockIOLimit {
     int64_t bps[3];
@@ -218,6 +225,29 @@ struct BlockDriver {
      */
     int (*bdrv_has_zero_init)(BlockDriverState *bs);
 
+    /*
+     * Called when a persistent dirty bitmap has been added to or removed
+     * from bs->dirty_bitmaps, so that the format can update the list of
+     * bitmaps in the image.  Bitmap contents are stored on close.
+     */
+    int (*bdrv_update_dirty_bitmaps)(BlockDriverState *bs);
+
+    /*
+     * Between plug and unplug, requests may be queued instead of being
+     * submitted right away; unplug submits them as one batch.  Calls nest.
+     */
+    void (*bdrv_io_plug)(BlockDriverState *bs);
+    void (*bdrv_io_unplug)(BlockDriverState *bs);
+
+    /*
+     * Move file descriptor handlers, bottom halves and other event loop
+     * state from the current AioContext to a new one.  Required for
+     * protocol drivers that can be used with bdrv_set_aio_context().
+     */
+    void (*bdrv_detach_aio_context)(BlockDriverState *bs);
+    void (*bdrv_attach_aio_context)(BlockDriverState *bs,
+                                    AioContext *new_context);
+
     QLIST_ENTRY(BlockDriver) list;
 };
 
@@ -255,6 +285,9 @@ struct BlockDriverState {
     BlockDriverState *backing_hd;
     BlockDriverState *file;
 
+    /* event loop used for fd handlers, timers, and bottom halves */
+    AioContext *aio_context;
+
     NotifierList close_notifiers;
 
     /* Callback before write request is processed */
@@ -276,6 +309,7 @@ struct BlockDriverState {
     uint64_t nr_bytes[BDRV_MAX_IOTYPE];
     uint64_t nr_ops[BDRV_MAX_IOTYPE];
     uint64_t total_time_ns[BDRV_MAX_IOTYPE];
+    uint64_t nr_merged[BDRV_MAX_IOTYPE];
     uint64_t wr_highest_sector;
 
     /* Whether the disk can expand beyond total_sectors */
@@ -294,6 +328,7 @@ struct BlockDriverState {
     BlockDeviceIoStatus iostatus;
     char device_name[32];
     HBitmap *dirty_bitmap;
+    QLIST_HEAD(, BdrvDirtyBitmap) dirty_bitmaps;
     int in_use; /* users other than guest access, eg. block migration */
     QTAILQ_ENTRY(BlockDriverState) list;
 
@@ -405,6 +440,8 @@ void mirror_start(BlockDriverState *bs, BlockDriverState *target,
  * @target: Block device to write to.
  * @speed: The maximum speed, in bytes per second, or 0 for unlimited.
  * @sync_mode: What parts of the disk image should be copied to the destination.
+ * @sync_bitmap: The dirty bitmap selecting the clusters to copy if
+ * @sync_mode is MIRROR_SYNC_MODE_INCREMENTAL, otherwise NULL.
  * @on_source_error: The action to take upon error reading from the source.
  * @on_target_error: The action to take upon error writing to the target.
  * @cb: Completion function for the job.
@@ -415,6 +452,7 @@ void mirror_start(BlockDriverState *bs, BlockDriverState *target,
  */
 void backup_start(BlockDriverState *bs, BlockDriverState *target,
                   int64_t speed, MirrorSyncMode sync_mode,
+                  BdrvDirtyBitmap *sync_bitmap,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   BlockDriverCompletionFunc *cb, void *opaque,
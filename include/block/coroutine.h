@@ -95,6 +95,14 @@ Coroutine *coroutine_fn qemu_coroutine_self(void);
  */
 bool qemu_in_coroutine(void);
 
+/**
+ * Grow or shrink the coroutine free pools
+ *
+ * Devices that keep many requests in flight should call this with their
+ * queue depth when they are created, and with the negated value when they
+ * go away, so that steady-state I/O does not allocate coroutine stacks.
+ */
+void qemu_coroutine_adjust_pool_size(int n);
 
 
 /**
@@ -19,7 +19,7 @@
 
 #include <linux/virtio_ring.h>
 #include "qemu-common.h"
-#include "hostmem.h"
+#include "hw/virtio/hostmem.h"
 #include "hw/virtio/virtio.h"
 
 typedef struct {
@@ -43,6 +43,12 @@ static inline bool vring_more_avail(Vring *vring)
     return vring->vr.avail->idx != vring->last_avail_idx;
 }
 
+/* Give back the last n buffers returned by vring_pop() */
+static inline void vring_unpop(Vring *vring, unsigned int n)
+{
+    vring->last_avail_idx -= n;
+}
+
 /* Fail future vring_pop() and vring_push() calls until reset */
 static inline void vring_set_broken(Vring *vring)
 {
@@ -58,5 +64,7 @@ int vring_pop(VirtIODevice *vdev, Vring *vring,
               struct iovec iov[], struct iovec *iov_end,
               unsigned int *out_num, unsigned int *in_num);
 void vring_push(Vring *vring, unsigned int head, int len);
+void vring_fill(Vring *vring, unsigned int head, int len, unsigned int idx);
+void vring_flush(Vring *vring, unsigned int count);
 
 #endif /* VRING_H */
@@ -15,7 +15,6 @@
 #define HOSTMEM_H
 
 #include "exec/memory.h"
-#include "qemu/thread.h"
 
 typedef struct {
     MemoryRegion *mr;
@@ -25,6 +24,13 @@ typedef struct {
     bool readonly;
 } HostMemRegion;
 
+/* An immutable snapshot of the guest RAM layout, sorted by guest address */
+typedef struct {
+    unsigned int last_hit;          /* index of the last match, only a hint */
+    size_t num_regions;
+    HostMemRegion regions[];
+} HostMemTable;
+
 typedef struct {
     /* The listener is invoked when regions change and a new list of regions is
      * built up completely before they are installed.
@@ -33,13 +39,18 @@ typedef struct {
     HostMemRegion *new_regions;
     size_t num_new_regions;
 
-    /* Current regions are accessed from multiple threads either to lookup
-     * addresses or to install a new list of regions.  The lock protects the
-     * pointer and the regions.
+    /* Lookups may happen in any thread and never block.  The listener
+     * publishes a new table with a single pointer store and frees the old
+     * one only after the readers of the previous epoch have drained.
+     */
+    HostMemTable *current;
+    unsigned int epoch;
+    int readers[2];
+
+    /* Incremented whenever a new list of regions is installed.  Users that
+     * keep copies of regions compare it to find out when they went stale.
      */
-    QemuMutex current_regions_lock;
-    HostMemRegion *current_regions;
-    size_t num_current_regions;
+    unsigned int generation;
 } HostMem;
 
 void hostmem_init(HostMem *hostmem);
@@ -55,4 +66,14 @@ void hostmem_finalize(HostMem *hostmem);
  */
 void *hostmem_lookup(HostMem *hostmem, hwaddr phys, hwaddr len, bool is_write);
 
+/**
+ * Copy the region that contains a guest physical address
+ *
+ * Returns false if @phys is not backed by directly accessible RAM.  The copy
+ * and its host mapping remain valid as long as hostmem->generation does not
+ * change; the region's MemoryRegion is referenced for that long.
+ */
+bool hostmem_lookup_region(HostMem *hostmem, hwaddr phys,
+                           HostMemRegion *region);
+
 #endif /* HOSTMEM_H */
@@ -16,6 +16,7 @@
 
 #include "hw/virtio/virtio.h"
 #include "hw/block/block.h"
+#include "sysemu/iothread.h"
 
 #define TYPE_VIRTIO_BLK "virtio-blk-device"
 #define VIRTIO_BLK(obj) \
@@ -38,6 +39,7 @@
 #define VIRTIO_BLK_F_WCE        9       /* write cache enabled */
 #define VIRTIO_BLK_F_TOPOLOGY   10      /* Topology information is available */
 #define VIRTIO_BLK_F_CONFIG_WCE 11      /* write cache configurable */
+#define VIRTIO_BLK_F_MQ         12      /* support more than one vq */
 
 #define VIRTIO_BLK_ID_BYTES     20      /* ID string length */
 
@@ -55,6 +57,8 @@ struct virtio_blk_config
     uint16_t min_io_size;
     uint32_t opt_io_size;
     uint8_t wce;
+    uint8_t unused;
+    uint16_t num_queues;    /* only valid with VIRTIO_BLK_F_MQ */
 } QEMU_PACKED;
 
 /* These two define direction. */
@@ -110,6 +114,11 @@ struct VirtIOBlkConf
     uint32_t scsi;
     uint32_t config_wce;
     uint32_t data_plane;
+    uint16_t num_queues;
+    uint32_t read_merge_max;    /* largest merged read in bytes, 0 disables */
+    uint32_t irq_max_usecs;
+    uint32_t irq_max_frames;
+    IOThread *iothread;         /* event loop for dataplane, or NULL */
 };
 
 struct VirtIOBlockDataPlane;
@@ -117,8 +126,10 @@ struct VirtIOBlockDataPlane;
 typedef struct VirtIOBlock {
     VirtIODevice parent_obj;
     BlockDriverState *bs;
-    VirtQueue *vq;
     void *rq;
+    void *free_reqs;            /* recycled VirtIOBlockReqs */
+    unsigned int num_free_reqs;
+    unsigned int max_free_reqs;
     QEMUBH *bh;
     BlockConf *conf;
     VirtIOBlkConf blk;
@@ -131,6 +142,9 @@ typedef struct VirtIOBlock {
 #endif
 } VirtIOBlock;
 
+/* Contiguous reads from one virtqueue kick are merged up to this size */
+#define VIRTIO_BLK_READ_MERGE_MAX_DEFAULT (1024 * 1024)
+
 #define DEFINE_VIRTIO_BLK_FEATURES(_state, _field) \
         DEFINE_VIRTIO_COMMON_FEATURES(_state, _field)
 
@@ -140,13 +154,23 @@ typedef struct VirtIOBlock {
         DEFINE_BLOCK_CHS_PROPERTIES(_state, _field.conf),                     \
         DEFINE_PROP_STRING("serial", _state, _field.serial),                  \
         DEFINE_PROP_BIT("config-wce", _state, _field.config_wce, 0, true),    \
+        DEFINE_PROP_UINT16("num-queues", _state, _field.num_queues, 1),       \
+        DEFINE_PROP_UINT32("read-merge-max", _state, _field.read_merge_max,   \
+                           VIRTIO_BLK_READ_MERGE_MAX_DEFAULT),                \
+        DEFINE_PROP_UINT32("irq-max-usecs", _state, _field.irq_max_usecs, 0), \
+        DEFINE_PROP_UINT32("irq-max-frames", _state, _field.irq_max_frames, 0),\
         DEFINE_PROP_BIT("scsi", _state, _field.scsi, 0, true)
 #else
 #define DEFINE_VIRTIO_BLK_PROPERTIES(_state, _field)                          \
         DEFINE_BLOCK_PROPERTIES(_state, _field.conf),                         \
         DEFINE_BLOCK_CHS_PROPERTIES(_state, _field.conf),                     \
         DEFINE_PROP_STRING("serial", _state, _field.serial),                  \
-        DEFINE_PROP_BIT("config-wce", _state, _field.config_wce, 0, true)
+        DEFINE_PROP_BIT("config-wce", _state, _field.config_wce, 0, true),    \
+        DEFINE_PROP_UINT16("num-queues", _state, _field.num_queues, 1),       \
+        DEFINE_PROP_UINT32("read-merge-max", _state, _field.read_merge_max,   \
+                           VIRTIO_BLK_READ_MERGE_MAX_DEFAULT),                \
+        DEFINE_PROP_UINT32("irq-max-usecs", _state, _field.irq_max_usecs, 0), \
+        DEFINE_PROP_UINT32("irq-max-frames", _state, _field.irq_max_frames, 0)
 #endif /* __linux__ */
 
 void virtio_blk_set_conf(DeviceState *dev, VirtIOBlkConf *blk);
@@ -16,6 +16,7 @@
 
 #include "hw/virtio/virtio.h"
 #include "hw/pci/pci.h"
+#include "net/gro.h"
 
 #define TYPE_VIRTIO_NET "virtio-net-device"
 #define VIRTIO_NET(obj) \
@@ -65,11 +66,26 @@
  * and latency. */
 #define TX_BURST 256
 
+/* Adaptive mitigation (tx=adaptive) re-evaluates every TX_ADAPT_INTERVAL ns.
+ * Below TX_ADAPT_RATE_LOW packets/s there is no delay; above it the delay
+ * covers about TX_ADAPT_BATCH packets, capped by x-txtimer.  The burst size
+ * starts at x-txburst and moves between the MIN and MAX bounds.
+ */
+#define TX_ADAPT_INTERVAL   1000000
+#define TX_ADAPT_RATE_LOW   20000
+#define TX_ADAPT_BATCH      32
+#define TX_ADAPT_BURST_MIN  16
+#define TX_ADAPT_BURST_MAX  1024
+
 typedef struct virtio_net_conf
 {
     uint32_t txtimer;
     int32_t txburst;
     char *tx;
+    uint32_t irq_max_usecs;
+    uint32_t irq_max_frames;
+    uint32_t data_plane;
+    uint32_t gro;
 } virtio_net_conf;
 
 /* Maximum packet size we can receive from tap device: header + 64k */
@@ -141,6 +157,14 @@ struct virtio_net_ctrl_mac {
     uint8_t macs[][ETH_ALEN];
 };
 
+/* Maximum number of tx packets handed to the peer in one batch */
+#define VIRTIO_NET_TX_BATCH 16
+
+typedef struct VirtIONetTxElem {
+    VirtQueueElement elem;
+    struct iovec sg[VIRTQUEUE_MAX_SIZE];
+} VirtIONetTxElem;
+
 typedef struct VirtIONetQueue {
     VirtQueue *rx_vq;
     VirtQueue *tx_vq;
@@ -151,7 +175,28 @@ typedef struct VirtIONetQueue {
         VirtQueueElement elem;
         ssize_t len;
     } async_tx;
+    /* Elements popped by virtio_net_flush_tx() for the current batch */
+    VirtIONetTxElem *tx_batch;
+    bool tx_flushing;
+    struct {
+        VirtQueueElement elem;
+        size_t len;
+        bool active;
+    } rx_lent;
+    /* Receive coalescing for backends without a vnet header */
+    NetGRO *rx_gro;
+    QEMUBH *rx_gro_bh;
     struct VirtIONet *n;
+    /* Transmit statistics, also driving the adaptive mitigation */
+    uint64_t tx_packets;
+    uint64_t tx_kicks;
+    uint64_t tx_flushes;
+    uint64_t tx_rate;              /* packets/s over the last interval */
+    int64_t tx_sample_start;
+    uint64_t tx_sample_packets;
+    unsigned int tx_max_pending;   /* ring occupancy high-water mark */
+    int64_t tx_delay;              /* ns from notification to flush */
+    int32_t tx_burst;              /* packets per flush */
 } VirtIONetQueue;
 
 typedef struct VirtIONet {
@@ -163,6 +208,7 @@ typedef struct VirtIONet {
     NICState *nic;
     uint32_t tx_timeout;
     int32_t tx_burst;
+    TxMitigationMode tx_mode;
     uint32_t has_vnet_hdr;
     size_t host_hdr_len;
     size_t guest_hdr_len;
@@ -193,6 +239,11 @@ typedef struct VirtIONet {
     char *netclient_name;
     char *netclient_type;
     uint64_t curr_guest_offloads;
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    struct VirtIONetDataPlane *dataplane;
+    Notifier migration_state_notifier;
+    bool dataplane_migrating;
+#endif
 } VirtIONet;
 
 #define VIRTIO_NET_CTRL_MAC    1
@@ -268,10 +319,14 @@ struct virtio_net_ctrl_mq {
 #define DEFINE_VIRTIO_NET_PROPERTIES(_state, _field)                           \
     DEFINE_PROP_UINT32("x-txtimer", _state, _field.txtimer, TX_TIMER_INTERVAL),\
     DEFINE_PROP_INT32("x-txburst", _state, _field.txburst, TX_BURST),          \
-    DEFINE_PROP_STRING("tx", _state, _field.tx)
+    DEFINE_PROP_STRING("tx", _state, _field.tx),                               \
+    DEFINE_PROP_UINT32("irq-max-usecs", _state, _field.irq_max_usecs, 0),      \
+    DEFINE_PROP_UINT32("irq-max-frames", _state, _field.irq_max_frames, 0),\
+    DEFINE_PROP_BIT("gro", _state, _field.gro, 0, false)
 
 void virtio_net_set_config_size(VirtIONet *n, uint32_t host_features);
 void virtio_net_set_netclient_name(VirtIONet *n, const char *name,
                                    const char *type);
+int virtio_net_receive_filter(VirtIONet *n, const uint8_t *buf, int size);
 
 #endif
@@ -121,6 +121,8 @@ struct VirtIODevice
     bool vm_running;
     VMChangeStateEntry *vmstate;
     char *bus_name;
+    uint32_t irq_max_usecs;     /* interrupt moderation, 0 is off */
+    uint32_t irq_max_frames;
 };
 
 typedef struct VirtioDeviceClass {
@@ -166,6 +168,8 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
 void virtqueue_flush(VirtQueue *vq, unsigned int count);
 void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len, unsigned int idx);
+void virtqueue_discard(VirtQueue *vq, const VirtQueueElement *elem,
+                       unsigned int len);
 
 void virtqueue_map_sg(struct iovec *sg, hwaddr *addr,
     size_t num_sg, int is_write);
@@ -178,6 +182,27 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
 
 void virtio_notify(VirtIODevice *vdev, VirtQueue *vq);
 
+/* Upper bound for the irq-max-usecs properties */
+#define VIRTIO_IRQ_MAX_USECS 1000000
+
+/**
+ * virtio_set_irq_moderation:
+ * @vdev: the device
+ * @max_usecs: longest time a queue interrupt may be held back, 0 disables
+ *             moderation
+ * @max_frames: number of virtio_notify() calls after which a held back
+ *              interrupt is sent right away, 0 for no limit
+ *
+ * Coalesce used buffer notifications of every queue of @vdev.  The event
+ * index and the guest's interrupt suppression flags are evaluated when the
+ * interrupt is finally sent, so a single interrupt covers the whole batch.
+ *
+ * Returns 0 on success, or -EINVAL if @max_usecs exceeds
+ * VIRTIO_IRQ_MAX_USECS.
+ */
+int virtio_set_irq_moderation(VirtIODevice *vdev, uint32_t max_usecs,
+                              uint32_t max_frames);
+
 void virtio_save(VirtIODevice *vdev, QEMUFile *f);
 
 int virtio_load(VirtIODevice *vdev, QEMUFile *f);
@@ -189,6 +214,7 @@ void virtio_queue_set_notification(VirtQueue *vq, int enable);
 int virtio_queue_ready(VirtQueue *vq);
 
 int virtio_queue_empty(VirtQueue *vq);
+unsigned int virtio_queue_pending(VirtQueue *vq);
 
 /* Host binding interface.  */
 
@@ -249,4 +275,6 @@ void virtio_queue_set_host_notifier_fd_handler(VirtQueue *vq, bool assign,
                                                bool set_handler);
 void virtio_queue_notify_vq(VirtQueue *vq);
 void virtio_irq(VirtQueue *vq);
+/* For code that signals guest notifiers itself, like dataplane */
+void virtio_queue_inc_irq_count(VirtQueue *vq);
 #endif
@@ -0,0 +1,57 @@
+/*
+ * Receive-side TCP segment coalescing
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_NET_GRO_H
+#define QEMU_NET_GRO_H
+
+#include "qemu-common.h"
+#include "net/tap.h"
+
+typedef struct NetGRO NetGRO;
+
+/**
+ * NetGRODeliver: hand one frame to the NIC
+ *
+ * @hdr describes the frame the way a vnet header from tap would, or is
+ * NULL for a frame that went through unchanged.  Coalesced frames carry
+ * VIRTIO_NET_HDR_GSO_TCPV4 with a partial checksum; single segments
+ * whose checksum was verified carry VIRTIO_NET_HDR_F_DATA_VALID.
+ *
+ * Returns 0 if the NIC has no room for the frame right now, anything
+ * else if the frame was consumed (delivered or dropped).
+ */
+typedef ssize_t (NetGRODeliver)(void *opaque, const struct virtio_net_hdr *hdr,
+                                const uint8_t *buf, size_t size);
+
+NetGRO *net_gro_new(NetGRODeliver *deliver, void *opaque);
+void net_gro_free(NetGRO *gro);
+
+/**
+ * net_gro_receive: feed one ethernet frame (without vnet header)
+ *
+ * In-order TCP/IPv4 segments are held back and merged with the rest of
+ * their flow; anything else is delivered right away, after the held
+ * segments of its own flow.  Returns @size if the frame was consumed,
+ * or 0 if a frame could not be delivered and the caller must retry
+ * later, like a NetClientInfo receive handler.
+ */
+ssize_t net_gro_receive(NetGRO *gro, const uint8_t *buf, size_t size);
+
+/**
+ * net_gro_flush: deliver all held flows, oldest first
+ *
+ * Returns false if the NIC ran out of room; the remaining flows stay
+ * held until the next flush.
+ */
+bool net_gro_flush(NetGRO *gro);
+
+/* Drop all held flows without delivering them */
+void net_gro_reset(NetGRO *gro);
+
+bool net_gro_pending(NetGRO *gro);
+
+#endif /* QEMU_NET_GRO_H */
@@ -46,10 +46,14 @@ typedef void (NetPoll)(NetClientState *, bool enable);
 typedef int (NetCanReceive)(NetClientState *);
 typedef ssize_t (NetReceive)(NetClientState *, const uint8_t *, size_t);
 typedef ssize_t (NetReceiveIOV)(NetClientState *, const struct iovec *, int);
+typedef int (NetReceiveIOVBatch)(NetClientState *, const NetPacketIOV *, int);
 typedef void (NetCleanup) (NetClientState *);
 typedef void (LinkStatusChanged)(NetClientState *);
 typedef void (NetClientDestructor)(NetClientState *);
 typedef RxFilterInfo *(QueryRxFilter)(NetClientState *);
+typedef TxQueueStats *(QueryTxStats)(NetClientState *);
+typedef int (NetRxBufGet)(NetClientState *, struct iovec *, int);
+typedef ssize_t (NetRxBufPut)(NetClientState *, size_t, uint8_t *, size_t);
 
 typedef struct NetClientInfo {
     NetClientOptionsKind type;
@@ -57,11 +61,23 @@ typedef struct NetClientInfo {
     NetReceive *receive;
     NetReceive *receive_raw;
     NetReceiveIOV *receive_iov;
+    /* Returns how many packets from the start of the batch were consumed;
+     * a short count means the next one must be retried later, as when
+     * receive returns 0.
+     */
+    NetReceiveIOVBatch *receive_iov_batch;
     NetCanReceive *can_receive;
     NetCleanup *cleanup;
     LinkStatusChanged *link_status_changed;
     QueryRxFilter *query_rx_filter;
+    QueryTxStats *query_tx_stats;
     NetPoll *poll;
+    /* Optional zero-copy receive: rx_buf_get lends the buffer for the next
+     * packet, rx_buf_put completes or cancels it.  See
+     * qemu_peer_rx_buf_get().
+     */
+    NetRxBufGet *rx_buf_get;
+    NetRxBufPut *rx_buf_put;
 } NetClientInfo;
 
 struct NetClientState {
@@ -113,7 +129,12 @@ ssize_t qemu_sendv_packet(NetClientState *nc, const struct iovec *iov,
                           int iovcnt);
 ssize_t qemu_sendv_packet_async(NetClientState *nc, const struct iovec *iov,
                                 int iovcnt, NetPacketSent *sent_cb);
+int qemu_sendv_packet_batch_async(NetClientState *nc, const NetPacketIOV *pkts,
+                                  int count, NetPacketSent *sent_cb);
 void qemu_send_packet(NetClientState *nc, const uint8_t *buf, int size);
+int qemu_peer_rx_buf_get(NetClientState *nc, struct iovec *iov, int iovcnt);
+ssize_t qemu_peer_rx_buf_put(NetClientState *nc, size_t size,
+                             uint8_t *buf, size_t buf_size);
 ssize_t qemu_send_packet_raw(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_send_packet_async(NetClientState *nc, const uint8_t *buf,
                                int size, NetPacketSent *sent_cb);
@@ -136,6 +157,11 @@ ssize_t qemu_deliver_packet_iov(NetClientState *sender,
                             const struct iovec *iov,
                             int iovcnt,
                             void *opaque);
+int qemu_deliver_packet_iov_batch(NetClientState *sender,
+                                  unsigned flags,
+                                  const NetPacketIOV *pkts,
+                                  int count,
+                                  void *opaque);
 
 void print_net_client(Monitor *mon, NetClientState *nc);
 void do_info_network(Monitor *mon, const QDict *qdict);
@@ -0,0 +1,52 @@
+/*
+ * Event loop thread
+ *
+ * Copyright Red Hat Inc., 2013
+ *
+ * Authors:
+ *  Stefan Hajnoczi   <stefanha@redhat.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#ifndef IOTHREAD_H
+#define IOTHREAD_H
+
+#include "qom/object.h"
+#include "block/aio.h"
+
+#define TYPE_IOTHREAD "iothread"
+
+typedef struct IOThread IOThread;
+
+#define IOTHREAD(obj) \
+    OBJECT_CHECK(IOThread, obj, TYPE_IOTHREAD)
+
+/**
+ * iothread_find:
+ * @id: the id given to -object iothread,id=...
+ *
+ * Returns: the IOThread created with @id, or NULL if there is none.
+ */
+IOThread *iothread_find(const char *id);
+
+/**
+ * iothread_get_id:
+ * @iothread: the IOThread
+ *
+ * Returns: the id of @iothread.  The caller must free the string.
+ */
+char *iothread_get_id(IOThread *iothread);
+
+/**
+ * iothread_get_aio_context:
+ * @iothread: the IOThread
+ *
+ * Returns: the AioContext run by @iothread.  Other threads must hold it
+ * with aio_context_acquire() before touching anything attached to it.
+ */
+AioContext *iothread_get_aio_context(IOThread *iothread);
+
+#endif /* IOTHREAD_H */
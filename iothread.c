@@ -0,0 +1,257 @@
+/*
+ * Event loop thread
+ *
+ * Copyright Red Hat Inc., 2013
+ *
+ * Authors:
+ *  Stefan Hajnoczi   <stefanha@redhat.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "qom/object.h"
+#include "qemu/module.h"
+#include "qemu/thread.h"
+#include "block/aio.h"
+#include "sysemu/iothread.h"
+#include "qmp-commands.h"
+#include "qapi/visitor.h"
+#include "qapi/qmp/qerror.h"
+
+#define IOTHREADS_PATH "/objects"
+
+/* An IOThread usually serves a few busy devices, so spinning a little
+ * before blocking is cheap compared to the wakeup latency it saves.
+ */
+#define IOTHREAD_POLL_MAX_NS_DEFAULT 32768
+
+/* Sanity limit for the thread-pool-min and thread-pool-max properties */
+#define IOTHREAD_THREAD_POOL_MAX 1024
+
+struct IOThread {
+    Object parent_obj;
+
+    QemuThread thread;
+    AioContext *ctx;
+    QemuMutex init_done_lock;
+    QemuCond init_done_cond;    /* is thread initialization done? */
+    bool stopping;
+    int thread_id;
+};
+
+static void *iothread_run(void *opaque)
+{
+    IOThread *iothread = opaque;
+
+    qemu_mutex_lock(&iothread->init_done_lock);
+    iothread->thread_id = qemu_get_thread_id();
+    qemu_cond_signal(&iothread->init_done_cond);
+    qemu_mutex_unlock(&iothread->init_done_lock);
+
+    while (!iothread->stopping) {
+        aio_context_acquire(iothread->ctx);
+        aio_poll(iothread->ctx, true);
+        aio_context_release(iothread->ctx);
+    }
+    return NULL;
+}
+
+static void iothread_get_poll_max_ns(Object *obj, Visitor *v, void *opaque,
+                                     const char *name, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    int64_t value = iothread->ctx->poll_max_ns;
+
+    visit_type_int(v, &value, name, errp);
+}
+
+static void iothread_set_poll_max_ns(Object *obj, Visitor *v, void *opaque,
+                                     const char *name, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    int64_t value;
+
+    visit_type_int(v, &value, name, errp);
+    if (error_is_set(errp)) {
+        return;
+    }
+    if (value < 0) {
+        error_set(errp, QERR_PROPERTY_VALUE_OUT_OF_RANGE, "",
+                  name ? name : "null", value, (int64_t)0, INT64_MAX);
+        return;
+    }
+
+    aio_context_acquire(iothread->ctx);
+    aio_context_set_poll_params(iothread->ctx, value);
+    aio_context_release(iothread->ctx);
+}
+
+static void iothread_get_thread_pool_param(Object *obj, Visitor *v,
+                                           void *opaque, const char *name,
+                                           Error **errp)
+{
+    int *field = opaque;
+    int64_t value = *field;
+
+    visit_type_int(v, &value, name, errp);
+}
+
+static void iothread_set_thread_pool_param(Object *obj, Visitor *v,
+                                           void *opaque, const char *name,
+                                           Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    AioContext *ctx = iothread->ctx;
+    int *field = opaque;
+    int64_t value;
+
+    visit_type_int(v, &value, name, errp);
+    if (error_is_set(errp)) {
+        return;
+    }
+    if (value < 0 || value > IOTHREAD_THREAD_POOL_MAX) {
+        error_set(errp, QERR_PROPERTY_VALUE_OUT_OF_RANGE, "",
+                  name ? name : "null", value, (int64_t)0,
+                  (int64_t)IOTHREAD_THREAD_POOL_MAX);
+        return;
+    }
+
+    aio_context_acquire(ctx);
+    *field = value;
+    aio_context_set_thread_pool_params(ctx, ctx->thread_pool_min,
+                                       ctx->thread_pool_max);
+    aio_context_release(ctx);
+}
+
+static void iothread_instance_init(Object *obj)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    iothread->stopping = false;
+    iothread->thread_id = -1;
+    iothread->ctx = aio_context_new();
+    aio_context_set_poll_params(iothread->ctx, IOTHREAD_POLL_MAX_NS_DEFAULT);
+
+    object_property_add(obj, "poll-max-ns", "int",
+                        iothread_get_poll_max_ns,
+                        iothread_set_poll_max_ns,
+                        NULL, NULL, NULL);
+    object_property_add(obj, "thread-pool-min", "int",
+                        iothread_get_thread_pool_param,
+                        iothread_set_thread_pool_param,
+                        NULL, &iothread->ctx->thread_pool_min, NULL);
+    object_property_add(obj, "thread-pool-max", "int",
+                        iothread_get_thread_pool_param,
+                        iothread_set_thread_pool_param,
+                        NULL, &iothread->ctx->thread_pool_max, NULL);
+
+    qemu_mutex_init(&iothread->init_done_lock);
+    qemu_cond_init(&iothread->init_done_cond);
+
+    /* This assumes we are called from a thread with useful CPU affinity for us
+     * to inherit.
+     */
+    qemu_thread_create(&iothread->thread, iothread_run,
+                       iothread, QEMU_THREAD_JOINABLE);
+
+    /* Wait for initialization to complete so query-iothreads has the id */
+    qemu_mutex_lock(&iothread->init_done_lock);
+    while (iothread->thread_id == -1) {
+        qemu_cond_wait(&iothread->init_done_cond,
+                       &iothread->init_done_lock);
+    }
+    qemu_mutex_unlock(&iothread->init_done_lock);
+}
+
+static void iothread_instance_finalize(Object *obj)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    iothread->stopping = true;
+    aio_notify(iothread->ctx);
+    qemu_thread_join(&iothread->thread);
+    qemu_cond_destroy(&iothread->init_done_cond);
+    qemu_mutex_destroy(&iothread->init_done_lock);
+    aio_context_unref(iothread->ctx);
+}
+
+static const TypeInfo iothread_info = {
+    .name = TYPE_IOTHREAD,
+    .parent = TYPE_OBJECT,
+    .instance_size = sizeof(IOThread),
+    .instance_init = iothread_instance_init,
+    .instance_finalize = iothread_instance_finalize,
+};
+
+static void iothread_register_types(void)
+{
+    type_register_static(&iothread_info);
+}
+
+type_init(iothread_register_types)
+
+IOThread *iothread_find(const char *id)
+{
+    Object *container = container_get(object_get_root(), IOTHREADS_PATH);
+    Object *child;
+
+    child = object_resolve_path_component(container, id);
+    if (!child) {
+        return NULL;
+    }
+    return (IOThread *)object_dynamic_cast(child, TYPE_IOTHREAD);
+}
+
+char *iothread_get_id(IOThread *iothread)
+{
+    char *path = object_get_canonical_path(OBJECT(iothread));
+    char *id = g_strdup(strrchr(path, '/') + 1);
+
+    g_free(path);
+    return id;
+}
+
+AioContext *iothread_get_aio_context(IOThread *iothread)
+{
+    return iothread->ctx;
+}
+
+static int query_one_iothread(Object *object, void *opaque)
+{
+    IOThreadInfoList ***prev = opaque;
+    IOThreadInfoList *elem;
+    IOThreadInfo *info;
+    IOThread *iothread;
+
+    iothread = (IOThread *)object_dynamic_cast(object, TYPE_IOTHREAD);
+    if (!iothread) {
+        return 0;
+    }
+
+    info = g_new0(IOThreadInfo, 1);
+    info->id = iothread_get_id(iothread);
+    info->thread_id = iothread->thread_id;
+    info->poll_max_ns = iothread->ctx->poll_max_ns;
+    info->poll_hits = iothread->ctx->poll_hits;
+    info->poll_misses = iothread->ctx->poll_misses;
+
+    elem = g_new0(IOThreadInfoList, 1);
+    elem->value = info;
+    elem->next = NULL;
+
+    **prev = elem;
+    *prev = &elem->next;
+    return 0;
+}
+
+IOThreadInfoList *qmp_query_iothreads(Error **errp)
+{
+    IOThreadInfoList *head = NULL;
+    IOThreadInfoList **prev = &head;
+    Object *container = container_get(object_get_root(), IOTHREADS_PATH);
+
+    object_child_foreach(container, query_one_iothread, &prev);
+    return head;
+}
@@ -635,6 +635,7 @@ static void *migration_thread(void *opaque)
         int64_t end_time = qemu_get_clock_ms(rt_clock);
         s->total_time = end_time - s->total_time;
         s->downtime = end_time - start_time;
+        bdrv_set_incoming_migration_all();
         runstate_set(RUN_STATE_POSTMIGRATE);
     } else {
         if (old_vm_running) {
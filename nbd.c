@@ -86,6 +86,7 @@ struct NBDRequest {
     QSIMPLEQ_ENTRY(NBDRequest) entry;
     NBDClient *client;
     uint8_t *data;
+    size_t data_size;
 };
 
 struct NBDExport {
@@ -117,7 +118,13 @@ struct NBDClient {
 
     QTAILQ_ENTRY(NBDClient) next;
     int nb_requests;
+    size_t buffered_bytes;          /* request buffers, in flight or cached */
     bool closing;
+
+    /* Completed requests are kept here together with their buffer, so that
+     * the steady state of a pipelined client does not allocate.
+     */
+    QSIMPLEQ_HEAD(, NBDRequest) free_reqs;
 };
 
 /* That's all folks */
@@ -768,11 +775,8 @@ ssize_t nbd_receive_reply(int csock, struct nbd_reply *reply)
     return 0;
 }
 
-static ssize_t nbd_send_reply(int csock, struct nbd_reply *reply)
+static void nbd_encode_reply(uint8_t *buf, struct nbd_reply *reply)
 {
-    uint8_t buf[NBD_REPLY_SIZE];
-    ssize_t ret;
-
     /* Reply
        [ 0 ..  3]    magic   (NBD_REPLY_MAGIC)
        [ 4 ..  7]    error   (0 == no error)
@@ -781,6 +785,14 @@ static ssize_t nbd_send_reply(int csock, struct nbd_reply *reply)
     cpu_to_be32w((uint32_t*)buf, NBD_REPLY_MAGIC);
     cpu_to_be32w((uint32_t*)(buf + 4), reply->error);
     cpu_to_be64w((uint64_t*)(buf + 8), reply->handle);
+}
+
+static ssize_t nbd_send_reply(int csock, struct nbd_reply *reply)
+{
+    uint8_t buf[NBD_REPLY_SIZE];
+    ssize_t ret;
+
+    nbd_encode_reply(buf, reply);
 
     TRACE("Sending response to client");
 
@@ -796,7 +808,19 @@ static ssize_t nbd_send_reply(int csock, struct nbd_reply *reply)
     return 0;
 }
 
-#define MAX_NBD_REQUESTS 16
+/* Enough for the queue depth of a busy initiator; each request only holds
+ * a buffer of the size the client asked for.
+ */
+#define MAX_NBD_REQUESTS 128
+
+/* Total size of the request buffers of one client.  No new request is read
+ * unless a maximum sized one still fits, so that a client cannot pin
+ * MAX_NBD_REQUESTS * NBD_MAX_BUFFER_SIZE bytes of server memory.
+ */
+#define NBD_MAX_BUFFERED_BYTES (512 * 1024 * 1024)
+
+/* Buffers up to this size stay attached to a free request for reuse */
+#define NBD_REQUEST_CACHE_SIZE (1024 * 1024)
 
 void nbd_client_get(NBDClient *client)
 {
@@ -811,6 +835,14 @@ void nbd_client_put(NBDClient *client)
          */
         assert(client->closing);
 
+        while (!QSIMPLEQ_EMPTY(&client->free_reqs)) {
+            NBDRequest *req = QSIMPLEQ_FIRST(&client->free_reqs);
+
+            QSIMPLEQ_REMOVE_HEAD(&client->free_reqs, entry);
+            qemu_vfree(req->data);
+            g_slice_free(NBDRequest, req);
+        }
+
         qemu_set_fd_handler2(client->sock, NULL, NULL, NULL, NULL);
         close(client->sock);
         client->sock = -1;
@@ -841,6 +873,13 @@ void nbd_client_close(NBDClient *client)
     }
 }
 
+static bool nbd_client_can_accept(NBDClient *client)
+{
+    return client->nb_requests < MAX_NBD_REQUESTS &&
+           client->buffered_bytes + NBD_MAX_BUFFER_SIZE <=
+           NBD_MAX_BUFFERED_BYTES;
+}
+
 static NBDRequest *nbd_request_get(NBDClient *client)
 {
     NBDRequest *req;
@@ -848,7 +887,12 @@ static NBDRequest *nbd_request_get(NBDClient *client)
     assert(client->nb_requests <= MAX_NBD_REQUESTS - 1);
     client->nb_requests++;
 
-    req = g_slice_new0(NBDRequest);
+    req = QSIMPLEQ_FIRST(&client->free_reqs);
+    if (req) {
+        QSIMPLEQ_REMOVE_HEAD(&client->free_reqs, entry);
+    } else {
+        req = g_slice_new0(NBDRequest);
+    }
     nbd_client_get(client);
     req->client = client;
     return req;
@@ -857,13 +901,18 @@ static NBDRequest *nbd_request_get(NBDClient *client)
 static void nbd_request_put(NBDRequest *req)
 {
     NBDClient *client = req->client;
+    bool was_full = !nbd_client_can_accept(client);
 
-    if (req->data) {
+    if (req->data_size > NBD_REQUEST_CACHE_SIZE) {
         qemu_vfree(req->data);
+        client->buffered_bytes -= req->data_size;
+        req->data = NULL;
+        req->data_size = 0;
     }
-    g_slice_free(NBDRequest, req);
+    QSIMPLEQ_INSERT_HEAD(&client->free_reqs, req, entry);
 
-    if (client->nb_requests-- == MAX_NBD_REQUESTS) {
+    client->nb_requests--;
+    if (was_full && nbd_client_can_accept(client)) {
         qemu_notify_event();
     }
     nbd_client_put(client);
@@ -976,6 +1025,8 @@ static ssize_t nbd_co_send_reply(NBDRequest *req, struct nbd_reply *reply,
 {
     NBDClient *client = req->client;
     int csock = client->sock;
+    uint8_t buf[NBD_REPLY_SIZE];
+    struct iovec iov[2];
     ssize_t rc, ret;
 
     qemu_co_mutex_lock(&client->send_lock);
@@ -986,15 +1037,19 @@ static ssize_t nbd_co_send_reply(NBDRequest *req, struct nbd_reply *reply,
     if (!len) {
         rc = nbd_send_reply(csock, reply);
     } else {
-        socket_set_cork(csock, 1);
-        rc = nbd_send_reply(csock, reply);
-        if (rc >= 0) {
-            ret = qemu_co_send(csock, req->data, len);
-            if (ret != len) {
-                rc = -EIO;
-            }
-        }
-        socket_set_cork(csock, 0);
+        /* Header and payload go out in a single sendmsg, straight from the
+         * buffer the block layer read into.
+         */
+        nbd_encode_reply(buf, reply);
+        iov[0].iov_base = buf;
+        iov[0].iov_len = sizeof(buf);
+        iov[1].iov_base = req->data;
+        iov[1].iov_len = len;
+
+        TRACE("Sending response to client");
+
+        ret = qemu_co_sendv(csock, iov, 2, 0, sizeof(buf) + len);
+        rc = ret == sizeof(buf) + len ? 0 : -EIO;
     }
 
     client->send_coroutine = NULL;
@@ -1036,8 +1091,12 @@ static ssize_t nbd_co_receive_request(NBDRequest *req, struct nbd_request *reque
     TRACE("Decoding type");
 
     command = request->type & NBD_CMD_MASK_COMMAND;
-    if (command == NBD_CMD_READ || command == NBD_CMD_WRITE) {
-        req->data = qemu_blockalign(client->exp->bs, request->len);
+    if ((command == NBD_CMD_READ || command == NBD_CMD_WRITE) &&
+        req->data_size < request->len) {
+        qemu_vfree(req->data);
+        client->buffered_bytes += request->len - req->data_size;
+        req->data_size = request->len;
+        req->data = qemu_blockalign(client->exp->bs, req->data_size);
     }
     if (command == NBD_CMD_WRITE) {
         TRACE("Reading %u byte(s)", request->len);
@@ -1062,6 +1121,8 @@ static void nbd_trip(void *opaque)
     NBDRequest *req;
     struct nbd_request request;
     struct nbd_reply reply;
+    struct iovec iov;
+    QEMUIOVector qiov;
     ssize_t ret;
 
     TRACE("Reading request.");
@@ -1108,8 +1169,11 @@ static void nbd_trip(void *opaque)
             }
         }
 
-        ret = bdrv_read(exp->bs, (request.from + exp->dev_offset) / 512,
-                        req->data, request.len / 512);
+        iov.iov_base = req->data;
+        iov.iov_len = request.len;
+        qemu_iovec_init_external(&qiov, &iov, 1);
+        ret = bdrv_co_readv(exp->bs, (request.from + exp->dev_offset) / 512,
+                            request.len / 512, &qiov);
         if (ret < 0) {
             LOG("reading from file failed");
             reply.error = -ret;
@@ -1131,8 +1195,11 @@ static void nbd_trip(void *opaque)
 
         TRACE("Writing to device");
 
-        ret = bdrv_write(exp->bs, (request.from + exp->dev_offset) / 512,
-                         req->data, request.len / 512);
+        iov.iov_base = req->data;
+        iov.iov_len = request.len;
+        qemu_iovec_init_external(&qiov, &iov, 1);
+        ret = bdrv_co_writev(exp->bs, (request.from + exp->dev_offset) / 512,
+                             request.len / 512, &qiov);
         if (ret < 0) {
             LOG("writing to file failed");
             reply.error = -ret;
@@ -1206,7 +1273,7 @@ static int nbd_can_read(void *opaque)
 {
     NBDClient *client = opaque;
 
-    return client->recv_coroutine || client->nb_requests < MAX_NBD_REQUESTS;
+    return client->recv_coroutine || nbd_client_can_accept(client);
 }
 
 static void nbd_read(void *opaque)
@@ -1241,6 +1308,7 @@ NBDClient *nbd_client_new(NBDExport *exp, int csock,
     }
     client->close = close;
     qemu_co_mutex_init(&client->send_lock);
+    QSIMPLEQ_INIT(&client->free_reqs);
     qemu_set_fd_handler2(csock, nbd_can_read, nbd_read, NULL, client);
 
     if (exp) {
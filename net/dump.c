@@ -27,13 +27,53 @@
 #include "qemu/error-report.h"
 #include "qemu/log.h"
 #include "qemu/timer.h"
+#include "qemu/thread.h"
+#include "qemu/atomic.h"
 #include "hub.h"
 
+/* Captured packets are copied into a ring by the receive callback and
+ * written out by a separate thread, so that a slow disk does not stall
+ * the network.  The ring has a single producer (the net layer, which runs
+ * under the global mutex) and a single consumer (the writer thread); head
+ * and tail are free-running byte counts.  Records are stored exactly as
+ * they appear in the pcap file, so the writer can hand whole batches to
+ * write().
+ */
+
+#define DUMP_RING_DEFAULT       (4 * 1024 * 1024)
+#define DUMP_FILTER_MAX         16
+
+typedef struct DumpFilter {
+    uint16_t ethertype;     /* 0 matches IPv4 and IPv6 */
+    uint8_t ipproto;        /* 0 matches any */
+    int port;               /* -1 matches any */
+} DumpFilter;
+
 typedef struct DumpState {
     NetClientState nc;
     int64_t start_ts;
-    int fd;
     int pcap_caplen;
+    char *filename;
+
+    DumpFilter filter[DUMP_FILTER_MAX];
+    int nb_filters;
+
+    uint8_t *ring;
+    size_t ring_size;       /* power of two */
+    size_t head;            /* written by the producer */
+    size_t tail;            /* written by the writer thread */
+    uint64_t dropped;
+
+    /* Only accessed by the writer thread once it is running */
+    int fd;
+    uint64_t file_bytes;
+    uint64_t rotate_size;   /* 0 disables rotation */
+    int rotate_files;
+
+    QemuThread thread;
+    QemuSemaphore wakeup;
+    bool writer_idle;
+    bool stopping;
 } DumpState;
 
 #define PCAP_MAGIC 0xa1b2c3d4
@@ -57,40 +97,345 @@ struct pcap_sf_pkthdr {
     uint32_t len;
 };
 
+#define ETH_P_IP        0x0800
+#define ETH_P_ARP       0x0806
+#define ETH_P_VLAN      0x8100
+#define ETH_P_IPV6      0x86dd
+
+static const struct {
+    const char *name;
+    DumpFilter filter;
+} dump_filter_names[] = {
+    { "arp",   { ETH_P_ARP,  0,  -1 } },
+    { "ip",    { ETH_P_IP,   0,  -1 } },
+    { "ip6",   { ETH_P_IPV6, 0,  -1 } },
+    { "icmp",  { ETH_P_IP,   1,  -1 } },
+    { "icmp6", { ETH_P_IPV6, 58, -1 } },
+    { "tcp",   { 0,          6,  -1 } },
+    { "udp",   { 0,          17, -1 } },
+};
+
+/* Parse "term|term|...", where a term is one of dump_filter_names,
+ * optionally followed by ":port" for tcp and udp.
+ */
+static int dump_parse_filter(DumpFilter *filter, int *nb_filters,
+                             const char *str)
+{
+    gchar **terms = g_strsplit(str, "|", 0);
+    int i, j, ret = -1;
+
+    for (i = 0; terms[i]; i++) {
+        char *port = strchr(terms[i], ':');
+        DumpFilter *f;
+
+        if (i == DUMP_FILTER_MAX) {
+            error_report("-net dump: at most %d filter terms are supported",
+                         DUMP_FILTER_MAX);
+            goto out;
+        }
+        if (port) {
+            *port++ = '\0';
+        }
+        for (j = 0; j < ARRAY_SIZE(dump_filter_names); j++) {
+            if (!strcmp(terms[i], dump_filter_names[j].name)) {
+                break;
+            }
+        }
+        if (j == ARRAY_SIZE(dump_filter_names)) {
+            error_report("-net dump: unknown filter term '%s'", terms[i]);
+            goto out;
+        }
+
+        f = &filter[i];
+        *f = dump_filter_names[j].filter;
+        if (port) {
+            unsigned long long val;
+
+            if ((f->ipproto != 6 && f->ipproto != 17) ||
+                parse_uint_full(port, &val, 10) < 0 || val > 65535) {
+                error_report("-net dump: invalid port in filter term '%s'",
+                             terms[i]);
+                goto out;
+            }
+            f->port = val;
+        }
+    }
+    *nb_filters = i;
+    ret = 0;
+
+out:
+    g_strfreev(terms);
+    return ret;
+}
+
+static bool dump_filter_match(DumpState *s, const uint8_t *buf, size_t size)
+{
+    uint16_t ethertype;
+    size_t off = 12;
+    int ipproto = -1, sport = -1, dport = -1;
+    int i;
+
+    if (size < off + 2) {
+        return false;
+    }
+    ethertype = lduw_be_p(buf + off);
+    off += 2;
+    if (ethertype == ETH_P_VLAN && size >= off + 4) {
+        ethertype = lduw_be_p(buf + off + 2);
+        off += 4;
+    }
+
+    if (ethertype == ETH_P_IP && size >= off + 20) {
+        size_t ihl = (buf[off] & 0xf) * 4;
+
+        ipproto = buf[off + 9];
+        /* Only the first fragment carries the ports */
+        if ((lduw_be_p(buf + off + 6) & 0x1fff) == 0) {
+            off += ihl;
+        } else {
+            off = size;
+        }
+    } else if (ethertype == ETH_P_IPV6 && size >= off + 40) {
+        ipproto = buf[off + 6];
+        off += 40;
+    }
+    if ((ipproto == 6 || ipproto == 17) && size >= off + 4) {
+        sport = lduw_be_p(buf + off);
+        dport = lduw_be_p(buf + off + 2);
+    }
+
+    for (i = 0; i < s->nb_filters; i++) {
+        const DumpFilter *f = &s->filter[i];
+
+        if (f->ethertype ? f->ethertype != ethertype
+                         : ethertype != ETH_P_IP && ethertype != ETH_P_IPV6) {
+            continue;
+        }
+        if (f->ipproto && f->ipproto != ipproto) {
+            continue;
+        }
+        if (f->port >= 0 && f->port != sport && f->port != dport) {
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
+
+static void dump_ring_put(DumpState *s, size_t pos, const void *data,
+                          size_t len)
+{
+    size_t off = pos & (s->ring_size - 1);
+    size_t n = MIN(len, s->ring_size - off);
+
+    memcpy(s->ring + off, data, n);
+    memcpy(s->ring, (const uint8_t *)data + n, len - n);
+}
+
+static void dump_ring_get(DumpState *s, size_t pos, void *data, size_t len)
+{
+    size_t off = pos & (s->ring_size - 1);
+    size_t n = MIN(len, s->ring_size - off);
+
+    memcpy(data, s->ring + off, n);
+    memcpy((uint8_t *)data + n, s->ring, len - n);
+}
+
+static void dump_kick_writer(DumpState *s)
+{
+    if (atomic_read(&s->writer_idle) && atomic_xchg(&s->writer_idle, false)) {
+        qemu_sem_post(&s->wakeup);
+    }
+}
+
 static ssize_t dump_receive(NetClientState *nc, const uint8_t *buf, size_t size)
 {
     DumpState *s = DO_UPCAST(DumpState, nc, nc);
     struct pcap_sf_pkthdr hdr;
     int64_t ts;
+    size_t head;
     int caplen;
 
-    /* Early return in case of previous error. */
-    if (s->fd < 0) {
+    if (s->nb_filters && !dump_filter_match(s, buf, size)) {
         return size;
     }
 
-    ts = muldiv64(qemu_get_clock_ns(vm_clock), 1000000, get_ticks_per_sec());
     caplen = size > s->pcap_caplen ? s->pcap_caplen : size;
+    head = s->head;
+    if (s->ring_size - (head - atomic_mb_read(&s->tail)) <
+        sizeof(hdr) + caplen) {
+        s->dropped++;
+        snprintf(nc->info_str, sizeof(nc->info_str),
+                 "dump to %s (len=%d, dropped %" PRIu64 ")",
+                 s->filename, s->pcap_caplen, s->dropped);
+        return size;
+    }
+
+    ts = muldiv64(qemu_get_clock_ns(vm_clock), 1000000, get_ticks_per_sec());
 
     hdr.ts.tv_sec = ts / 1000000 + s->start_ts;
     hdr.ts.tv_usec = ts % 1000000;
     hdr.caplen = caplen;
     hdr.len = size;
-    if (write(s->fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
-        write(s->fd, buf, caplen) != caplen) {
-        qemu_log("-net dump write error - stop dump\n");
-        close(s->fd);
-        s->fd = -1;
-    }
+    dump_ring_put(s, head, &hdr, sizeof(hdr));
+    dump_ring_put(s, head + sizeof(hdr), buf, caplen);
+
+    /* Publish the record, then look at writer_idle.  Pairs with the
+     * barrier in dump_writer_wait().
+     */
+    atomic_mb_set(&s->head, head + sizeof(hdr) + caplen);
+    dump_kick_writer(s);
 
     return size;
 }
 
+static int dump_open_file(const char *filename, int caplen)
+{
+    struct pcap_file_hdr hdr;
+    int fd;
+
+    fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY | O_BINARY, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    hdr.magic = PCAP_MAGIC;
+    hdr.version_major = 2;
+    hdr.version_minor = 4;
+    hdr.thiszone = 0;
+    hdr.sigfigs = 0;
+    hdr.snaplen = caplen;
+    hdr.linktype = 1;
+
+    if (qemu_write_full(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Shift file.1 ... file.N-1 up by one, move file to file.1 and start
+ * over with an empty capture.
+ */
+static void dump_rotate(DumpState *s)
+{
+    char *from, *to;
+    int i;
+
+    close(s->fd);
+    for (i = s->rotate_files; i > 0; i--) {
+        from = i > 1 ? g_strdup_printf("%s.%d", s->filename, i - 1)
+                     : g_strdup(s->filename);
+        to = g_strdup_printf("%s.%d", s->filename, i);
+        rename(from, to);
+        g_free(from);
+        g_free(to);
+    }
+
+    s->fd = dump_open_file(s->filename, s->pcap_caplen);
+    if (s->fd < 0) {
+        qemu_log("-net dump: can't open %s - stop dump\n", s->filename);
+    }
+    s->file_bytes = sizeof(struct pcap_file_hdr);
+}
+
+static void dump_write_range(DumpState *s, size_t start, size_t end)
+{
+    while (s->fd >= 0 && start != end) {
+        size_t off = start & (s->ring_size - 1);
+        size_t len = MIN(end - start, s->ring_size - off);
+
+        if (qemu_write_full(s->fd, s->ring + off, len) != len) {
+            qemu_log("-net dump write error - stop dump\n");
+            close(s->fd);
+            s->fd = -1;
+        }
+        s->file_bytes += len;
+        start += len;
+    }
+}
+
+/* Write out the records between tail and head, batching as many as
+ * possible into each write() and splitting batches at rotation points.
+ */
+static void dump_write_records(DumpState *s, size_t head)
+{
+    size_t batch = s->tail, pos = s->tail;
+
+    while (pos != head) {
+        struct pcap_sf_pkthdr hdr;
+        size_t reclen;
+
+        dump_ring_get(s, pos, &hdr, sizeof(hdr));
+        reclen = sizeof(hdr) + hdr.caplen;
+
+        if (s->rotate_size && s->fd >= 0 &&
+            s->file_bytes + (pos - batch) + reclen > s->rotate_size &&
+            s->file_bytes + (pos - batch) > sizeof(struct pcap_file_hdr)) {
+            dump_write_range(s, batch, pos);
+            atomic_mb_set(&s->tail, pos);
+            dump_rotate(s);
+            batch = pos;
+        }
+        pos += reclen;
+    }
+
+    dump_write_range(s, batch, pos);
+    atomic_mb_set(&s->tail, pos);
+}
+
+static void dump_writer_wait(DumpState *s)
+{
+    atomic_mb_set(&s->writer_idle, true);
+    if (atomic_mb_read(&s->head) != s->tail ||
+        atomic_mb_read(&s->stopping)) {
+        /* If writer_idle is already clear, the producer has posted the
+         * semaphore and the wait below returns immediately.
+         */
+        if (atomic_xchg(&s->writer_idle, false)) {
+            return;
+        }
+    }
+    qemu_sem_wait(&s->wakeup);
+}
+
+static void *dump_writer_thread(void *opaque)
+{
+    DumpState *s = opaque;
+
+    for (;;) {
+        size_t head = atomic_mb_read(&s->head);
+
+        if (head != s->tail) {
+            dump_write_records(s, head);
+        } else if (atomic_mb_read(&s->stopping)) {
+            break;
+        } else {
+            dump_writer_wait(s);
+        }
+    }
+    return NULL;
+}
+
 static void dump_cleanup(NetClientState *nc)
 {
     DumpState *s = DO_UPCAST(DumpState, nc, nc);
 
-    close(s->fd);
+    /* The writer drains the ring before it exits */
+    atomic_mb_set(&s->stopping, true);
+    qemu_sem_post(&s->wakeup);
+    qemu_thread_join(&s->thread);
+
+    if (s->dropped) {
+        qemu_log("-net dump: %" PRIu64 " packets dropped, ring was full\n",
+                 s->dropped);
+    }
+    if (s->fd >= 0) {
+        close(s->fd);
+    }
+    qemu_sem_destroy(&s->wakeup);
+    g_free(s->ring);
+    g_free(s->filename);
 }
 
 static NetClientInfo net_dump_info = {
@@ -101,31 +446,34 @@ static NetClientInfo net_dump_info = {
 };
 
 static int net_dump_init(NetClientState *peer, const char *device,
-                         const char *name, const char *filename, int len)
+                         const char *name, const char *filename, int len,
+                         const NetdevDumpOptions *dump)
 {
-    struct pcap_file_hdr hdr;
     NetClientState *nc;
     DumpState *s;
     struct tm tm;
+    uint64_t ring_size = DUMP_RING_DEFAULT;
+    DumpFilter filter[DUMP_FILTER_MAX];
+    int nb_filters = 0;
     int fd;
 
-    fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY | O_BINARY, 0644);
-    if (fd < 0) {
-        error_report("-net dump: can't open %s", filename);
+    if (dump->has_filter &&
+        dump_parse_filter(filter, &nb_filters, dump->filter) < 0) {
         return -1;
     }
+    if (dump->has_ring) {
+        ring_size = dump->ring > SIZE_MAX / 2 ? 0 : pow2floor(dump->ring);
+        if (ring_size < sizeof(struct pcap_sf_pkthdr) + len) {
+            error_report("-net dump: ring must hold at least one packet "
+                         "of %d bytes", len);
+            return -1;
+        }
+    }
 
-    hdr.magic = PCAP_MAGIC;
-    hdr.version_major = 2;
-    hdr.version_minor = 4;
-    hdr.thiszone = 0;
-    hdr.sigfigs = 0;
-    hdr.snaplen = len;
-    hdr.linktype = 1;
-
-    if (write(fd, &hdr, sizeof(hdr)) < sizeof(hdr)) {
-        error_report("-net dump write error: %s", strerror(errno));
-        close(fd);
+    fd = dump_open_file(filename, len);
+    if (fd < 0) {
+        error_report("-net dump: can't open %s: %s", filename,
+                     strerror(errno));
         return -1;
     }
 
@@ -137,32 +485,67 @@ static int net_dump_init(NetClientState *peer, const char *device,
     s = DO_UPCAST(DumpState, nc, nc);
 
     s->fd = fd;
+    s->file_bytes = sizeof(struct pcap_file_hdr);
     s->pcap_caplen = len;
+    s->filename = g_strdup(filename);
+    memcpy(s->filter, filter, sizeof(filter[0]) * nb_filters);
+    s->nb_filters = nb_filters;
+
+    if (dump->has_rotate) {
+        s->rotate_size = dump->rotate;
+        s->rotate_files = dump->has_rotate_files ? dump->rotate_files : 1;
+    }
 
     qemu_get_timedate(&tm, 0);
     s->start_ts = mktime(&tm);
 
+    s->ring_size = ring_size;
+    s->ring = g_malloc(ring_size);
+    qemu_sem_init(&s->wakeup, 0);
+    qemu_thread_create(&s->thread, dump_writer_thread, s,
+                       QEMU_THREAD_JOINABLE);
     return 0;
 }
 
 int net_init_dump(const NetClientOptions *opts, const char *name,
                   NetClientState *peer)
 {
-    int len;
+    int len, ret;
     const char *file;
     char def_file[128];
     const NetdevDumpOptions *dump;
+    NetClientState *hubport = NULL;
 
     assert(opts->kind == NET_CLIENT_OPTIONS_KIND_DUMP);
     dump = opts->dump;
 
-    assert(peer);
+    if (dump->has_len) {
+        if (dump->len > INT_MAX) {
+            error_report("invalid length: %"PRIu64, dump->len);
+            return -1;
+        }
+        len = dump->len;
+    } else {
+        len = 65536;
+    }
+
+    /* -net dump gets a port on its vlan; -netdev dump names the hub */
+    if (peer && dump->has_hubid) {
+        error_report("-net dump: use vlan instead of hubid");
+        return -1;
+    }
+    if (!peer) {
+        if (!dump->has_hubid) {
+            error_report("-netdev dump: hubid is required");
+            return -1;
+        }
+        peer = hubport = net_hub_add_port(dump->hubid, NULL);
+    }
 
     if (dump->has_file) {
         file = dump->file;
     } else {
         int id;
-        int ret;
 
         ret = net_hub_id_for_client(peer, &id);
         assert(ret == 0); /* peer must be on a hub */
@@ -171,15 +554,9 @@ int net_init_dump(const NetClientOptions *opts, const char *name,
         file = def_file;
     }
 
-    if (dump->has_len) {
-        if (dump->len > INT_MAX) {
-            error_report("invalid length: %"PRIu64, dump->len);
-            return -1;
-        }
-        len = dump->len;
-    } else {
-        len = 65536;
+    ret = net_dump_init(peer, "dump", name, file, len, dump);
+    if (ret < 0 && hubport) {
+        qemu_del_net_client(hubport);
     }
-
-    return net_dump_init(peer, "dump", name, file, len);
+    return ret;
 }
@@ -0,0 +1,341 @@
+/*
+ * Receive-side TCP segment coalescing
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "net/gro.h"
+#include "net/eth.h"
+#include "net/checksum.h"
+
+/* Backends without a vnet header (slirp, socket, hub) hand us one MTU
+ * sized TCP segment at a time, and each one costs the guest a descriptor
+ * and usually an interrupt.  For guests that can take large receive
+ * frames we hold back in-order segments of a flow and merge them, much
+ * like the host kernel does before tap passes a packet up with a vnet
+ * header.
+ *
+ * Only plain TCP/IPv4 segments without IP options, fragmentation or
+ * flags other than ACK and PSH are merged, and only if both checksums
+ * are correct; the merged frame is then handed over with a partial
+ * checksum.  A segment joins a flow if it continues the sequence space,
+ * carries the same ACK and TCP options, and is no longer than the
+ * first one.  A shorter segment or PSH ends the flow.
+ */
+
+#define NET_GRO_MAX_FLOWS   8
+#define NET_GRO_MAX_FRAME   (ETH_MAX_L2_HDR_LEN + ETH_MAX_IP_DGRAM_LEN)
+
+/* TCP flags live in the low 9 bits of th_offset_flags (NS, CWR, ECE...) */
+#define TCP_FLAGS_MASK      0x01ff
+
+typedef struct NetGROSegment {
+    size_t l3_off;
+    size_t l4_off;
+    size_t hdr_len;             /* l2 + IP + TCP headers */
+    size_t payload;
+    uint32_t seq;
+    uint16_t tcp_flags;
+    bool mergeable;
+} NetGROSegment;
+
+typedef struct NetGROFlow {
+    uint8_t *buf;               /* NET_GRO_MAX_FRAME bytes, kept for reuse */
+    size_t size;
+    size_t l3_off;
+    size_t l4_off;
+    size_t hdr_len;
+    size_t mss;                 /* payload of the first segment */
+    unsigned int segs;
+    uint32_t next_seq;
+    bool closed;                /* no more segments may be merged */
+} NetGROFlow;
+
+struct NetGRO {
+    NetGRODeliver *deliver;
+    void *opaque;
+    /* flows[0..nflows) are held, oldest first */
+    NetGROFlow flows[NET_GRO_MAX_FLOWS];
+    int nflows;
+};
+
+NetGRO *net_gro_new(NetGRODeliver *deliver, void *opaque)
+{
+    NetGRO *gro = g_malloc0(sizeof(*gro));
+
+    gro->deliver = deliver;
+    gro->opaque = opaque;
+    return gro;
+}
+
+void net_gro_free(NetGRO *gro)
+{
+    int i;
+
+    for (i = 0; i < NET_GRO_MAX_FLOWS; i++) {
+        g_free(gro->flows[i].buf);
+    }
+    g_free(gro);
+}
+
+static bool net_gro_csum_ok(const uint8_t *buf, const NetGROSegment *seg)
+{
+    uint8_t *l3 = (uint8_t *)buf + seg->l3_off;
+    uint16_t tcp_len = seg->hdr_len - seg->l4_off + seg->payload;
+
+    return net_raw_checksum(l3, seg->l4_off - seg->l3_off) == 0 &&
+           net_checksum_tcpudp(tcp_len, IP_PROTO_TCP,
+                               (uint8_t *)&PKT_GET_IP_HDR(buf)->ip_src,
+                               (uint8_t *)buf + seg->l4_off) == 0;
+}
+
+/* Returns false for anything but TCP over IPv4 */
+static bool net_gro_parse(const uint8_t *buf, size_t size, NetGROSegment *seg)
+{
+    const struct ip_header *iph;
+    const tcp_header *th;
+    size_t ihl, ip_len, thl;
+    uint16_t off;
+
+    if (size < sizeof(struct eth_header) + sizeof(struct ip_header) +
+               sizeof(tcp_header)) {
+        return false;
+    }
+    seg->l3_off = eth_get_l2_hdr_length(buf);
+    if (eth_get_l3_proto(buf, seg->l3_off) != ETH_P_IP ||
+        size < seg->l3_off + sizeof(struct ip_header) + sizeof(tcp_header)) {
+        return false;
+    }
+
+    iph = (const struct ip_header *)(buf + seg->l3_off);
+    if (IP_HEADER_VERSION(iph) != IP_HEADER_VERSION_4 ||
+        iph->ip_p != IP_PROTO_TCP) {
+        return false;
+    }
+    ihl = IP_HDR_GET_LEN(iph);
+    ip_len = be16_to_cpu(iph->ip_len);
+    if (ihl < sizeof(struct ip_header) ||
+        ip_len < ihl + sizeof(tcp_header) || seg->l3_off + ip_len > size) {
+        return false;
+    }
+
+    seg->l4_off = seg->l3_off + ihl;
+    th = (const tcp_header *)(buf + seg->l4_off);
+    off = be16_to_cpu(th->th_offset_flags);
+    thl = (off >> 12) << 2;
+    if (thl < sizeof(tcp_header) || ihl + thl > ip_len) {
+        return false;
+    }
+    seg->hdr_len = seg->l4_off + thl;
+    seg->payload = seg->l3_off + ip_len - seg->hdr_len;
+    seg->seq = be32_to_cpu(th->th_seq);
+    seg->tcp_flags = off & TCP_FLAGS_MASK;
+
+    seg->mergeable = ihl == sizeof(struct ip_header) &&
+                     !(be16_to_cpu(iph->ip_off) & (IP_MF | IP_OFFMASK)) &&
+                     (seg->tcp_flags & ~TH_PUSH) == TH_ACK &&
+                     seg->payload > 0 &&
+                     seg->l3_off + ip_len == size &&
+                     net_gro_csum_ok(buf, seg);
+    return true;
+}
+
+static int net_gro_find(NetGRO *gro, const uint8_t *buf,
+                        const NetGROSegment *seg)
+{
+    const struct ip_header *iph = (const struct ip_header *)(buf + seg->l3_off);
+    const tcp_header *th = (const tcp_header *)(buf + seg->l4_off);
+    int i;
+
+    for (i = 0; i < gro->nflows; i++) {
+        NetGROFlow *flow = &gro->flows[i];
+        const struct ip_header *fiph;
+        const tcp_header *fth;
+
+        if (flow->l3_off != seg->l3_off ||
+            memcmp(flow->buf, buf, seg->l3_off)) {
+            continue;
+        }
+        fiph = (const struct ip_header *)(flow->buf + flow->l3_off);
+        fth = (const tcp_header *)(flow->buf + flow->l4_off);
+        if (fiph->ip_src == iph->ip_src && fiph->ip_dst == iph->ip_dst &&
+            fth->th_sport == th->th_sport && fth->th_dport == th->th_dport) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool net_gro_can_merge(const NetGROFlow *flow, const uint8_t *buf,
+                              const NetGROSegment *seg)
+{
+    const struct ip_header *fiph, *iph;
+    const tcp_header *fth, *th;
+
+    if (!seg->mergeable || flow->closed || seg->seq != flow->next_seq ||
+        seg->payload > flow->mss || seg->hdr_len != flow->hdr_len ||
+        flow->size + seg->payload > flow->l3_off + ETH_MAX_IP_DGRAM_LEN) {
+        return false;
+    }
+
+    fiph = (const struct ip_header *)(flow->buf + flow->l3_off);
+    iph = (const struct ip_header *)(buf + seg->l3_off);
+    if (fiph->ip_tos != iph->ip_tos || fiph->ip_ttl != iph->ip_ttl) {
+        return false;
+    }
+
+    fth = (const tcp_header *)(flow->buf + flow->l4_off);
+    th = (const tcp_header *)(buf + seg->l4_off);
+    if (fth->th_ack != th->th_ack) {
+        return false;
+    }
+    /* Options, timestamps in particular, must match byte for byte */
+    return !memcmp(fth + 1, th + 1,
+                   seg->hdr_len - seg->l4_off - sizeof(tcp_header));
+}
+
+static void net_gro_merge(NetGROFlow *flow, const uint8_t *buf,
+                          const NetGROSegment *seg)
+{
+    tcp_header *fth = (tcp_header *)(flow->buf + flow->l4_off);
+    const tcp_header *th = (const tcp_header *)(buf + seg->l4_off);
+
+    memcpy(flow->buf + flow->size, buf + seg->hdr_len, seg->payload);
+    flow->size += seg->payload;
+    flow->next_seq += seg->payload;
+    flow->segs++;
+
+    fth->th_win = th->th_win;
+    if (seg->tcp_flags & TH_PUSH) {
+        fth->th_offset_flags |= cpu_to_be16(TH_PUSH);
+        flow->closed = true;
+    }
+    if (seg->payload < flow->mss) {
+        flow->closed = true;
+    }
+}
+
+static void net_gro_start(NetGRO *gro, const uint8_t *buf, size_t size,
+                          const NetGROSegment *seg)
+{
+    NetGROFlow *flow = &gro->flows[gro->nflows++];
+
+    if (!flow->buf) {
+        flow->buf = g_malloc(NET_GRO_MAX_FRAME);
+    }
+    memcpy(flow->buf, buf, size);
+    flow->size = size;
+    flow->l3_off = seg->l3_off;
+    flow->l4_off = seg->l4_off;
+    flow->hdr_len = seg->hdr_len;
+    flow->mss = seg->payload;
+    flow->segs = 1;
+    flow->next_seq = seg->seq + seg->payload;
+    flow->closed = false;
+}
+
+static void net_gro_remove(NetGRO *gro, int i)
+{
+    uint8_t *buf = gro->flows[i].buf;
+
+    gro->nflows--;
+    memmove(&gro->flows[i], &gro->flows[i + 1],
+            (gro->nflows - i) * sizeof(gro->flows[0]));
+    gro->flows[gro->nflows].buf = buf;
+}
+
+static bool net_gro_flush_flow(NetGRO *gro, int i)
+{
+    NetGROFlow *flow = &gro->flows[i];
+    struct virtio_net_hdr hdr = {
+        .flags = VIRTIO_NET_HDR_F_DATA_VALID,
+        .gso_type = VIRTIO_NET_HDR_GSO_NONE,
+    };
+
+    if (flow->segs > 1) {
+        struct ip_header *iph = (struct ip_header *)(flow->buf + flow->l3_off);
+        tcp_header *th = (tcp_header *)(flow->buf + flow->l4_off);
+        uint32_t pseudo;
+
+        /* Rewritten on every attempt: a flow the NIC had no room for
+         * may have grown since. */
+        iph->ip_len = cpu_to_be16(flow->size - flow->l3_off);
+        eth_fix_ip4_checksum(iph, flow->l4_off - flow->l3_off);
+
+        /* Leave the pseudo-header sum for the guest to complete */
+        pseudo = eth_calc_pseudo_hdr_csum(iph, flow->size - flow->l4_off);
+        th->th_sum = cpu_to_be16((uint16_t)~net_checksum_finish(pseudo));
+
+        hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+        hdr.hdr_len = flow->hdr_len;
+        hdr.gso_size = flow->mss;
+        hdr.csum_start = flow->l4_off;
+        hdr.csum_offset = offsetof(tcp_header, th_sum);
+    }
+
+    if (gro->deliver(gro->opaque, &hdr, flow->buf, flow->size) == 0) {
+        return false;
+    }
+    net_gro_remove(gro, i);
+    return true;
+}
+
+ssize_t net_gro_receive(NetGRO *gro, const uint8_t *buf, size_t size)
+{
+    NetGROSegment seg;
+    int i;
+
+    if (!net_gro_parse(buf, size, &seg)) {
+        return gro->deliver(gro->opaque, NULL, buf, size);
+    }
+
+    i = net_gro_find(gro, buf, &seg);
+    if (i >= 0) {
+        NetGROFlow *flow = &gro->flows[i];
+
+        if (net_gro_can_merge(flow, buf, &seg)) {
+            net_gro_merge(flow, buf, &seg);
+            if (flow->closed) {
+                /* If the NIC is full the flow simply stays held */
+                net_gro_flush_flow(gro, i);
+            }
+            return size;
+        }
+        /* Whatever this segment is, it must not overtake its flow */
+        if (!net_gro_flush_flow(gro, i)) {
+            return 0;
+        }
+    }
+
+    if (!seg.mergeable || (seg.tcp_flags & TH_PUSH)) {
+        return gro->deliver(gro->opaque, NULL, buf, size);
+    }
+
+    if (gro->nflows == NET_GRO_MAX_FLOWS && !net_gro_flush_flow(gro, 0)) {
+        return 0;
+    }
+    net_gro_start(gro, buf, size, &seg);
+    return size;
+}
+
+bool net_gro_flush(NetGRO *gro)
+{
+    while (gro->nflows) {
+        if (!net_gro_flush_flow(gro, 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void net_gro_reset(NetGRO *gro)
+{
+    gro->nflows = 0;
+}
+
+bool net_gro_pending(NetGRO *gro)
+{
+    return gro->nflows > 0;
+}
@@ -485,6 +485,44 @@ void qemu_send_packet(NetClientState *nc, const uint8_t *buf, int size)
     qemu_send_packet_async(nc, buf, size, NULL);
 }
 
+/* Zero-copy receive into the peer's buffers
+ *
+ * Returns the number of iovec elements describing memory into which the
+ * next packet (laid out exactly as it would be passed to qemu_send_packet)
+ * may be read, or 0 if the peer cannot lend buffers right now; the regular
+ * copying path must then be used.  A successful call must be followed by
+ * qemu_peer_rx_buf_put() before returning to the main loop.
+ */
+int qemu_peer_rx_buf_get(NetClientState *nc, struct iovec *iov, int iovcnt)
+{
+    NetClientState *peer = nc->peer;
+
+    if (nc->link_down || !peer || peer->link_down ||
+        peer->receive_disabled || !peer->info->rx_buf_get ||
+        !qemu_net_queue_empty(peer->send_queue)) {
+        return 0;
+    }
+
+    return peer->info->rx_buf_get(peer, iov, iovcnt);
+}
+
+/* Complete a packet started with qemu_peer_rx_buf_get()
+ *
+ * size is the length of the packet, 0 to cancel.  Any bytes that did not fit
+ * in the lent buffers must be at the start of buf, which must be able to hold
+ * the whole packet.  Returns size if the peer consumed the packet; 0 if it
+ * did not, in which case buf now holds the complete packet and it must be
+ * sent through the regular path.
+ */
+ssize_t qemu_peer_rx_buf_put(NetClientState *nc, size_t size,
+                             uint8_t *buf, size_t buf_size)
+{
+    NetClientState *peer = nc->peer;
+
+    assert(size <= buf_size);
+    return peer->info->rx_buf_put(peer, size, buf, buf_size);
+}
+
 ssize_t qemu_send_packet_raw(NetClientState *nc, const uint8_t *buf, int size)
 {
     return qemu_send_packet_async_with_flags(nc, QEMU_NET_PACKET_FLAG_RAW,
@@ -532,6 +570,48 @@ ssize_t qemu_deliver_packet_iov(NetClientState *sender,
     return ret;
 }
 
+int qemu_deliver_packet_iov_batch(NetClientState *sender,
+                                  unsigned flags,
+                                  const NetPacketIOV *pkts,
+                                  int count,
+                                  void *opaque)
+{
+    NetClientState *nc = opaque;
+    int ret;
+
+    if (nc->link_down) {
+        return count;
+    }
+
+    if (nc->receive_disabled) {
+        return 0;
+    }
+
+    if (nc->info->receive_iov_batch) {
+        ret = nc->info->receive_iov_batch(nc, pkts, count);
+    } else {
+        for (ret = 0; ret < count; ret++) {
+            ssize_t len;
+
+            if (nc->info->receive_iov) {
+                len = nc->info->receive_iov(nc, pkts[ret].iov,
+                                            pkts[ret].iovcnt);
+            } else {
+                len = nc_sendv_compat(nc, pkts[ret].iov, pkts[ret].iovcnt);
+            }
+            if (len == 0) {
+                break;
+            }
+        }
+    }
+
+    if (ret < count) {
+        nc->receive_disabled = 1;
+    }
+
+    return ret;
+}
+
 ssize_t qemu_sendv_packet_async(NetClientState *sender,
                                 const struct iovec *iov, int iovcnt,
                                 NetPacketSent *sent_cb)
@@ -549,6 +629,30 @@ ssize_t qemu_sendv_packet_async(NetClientState *sender,
                                    iov, iovcnt, sent_cb);
 }
 
+/* Send a burst of packets
+ *
+ * Returns how many packets from the start of the batch were sent.  If that is
+ * less than count, the next packet was queued and sent_cb will be called for
+ * it; the ones after it were not touched and must be sent again once sent_cb
+ * has run.
+ */
+int qemu_sendv_packet_batch_async(NetClientState *sender,
+                                  const NetPacketIOV *pkts, int count,
+                                  NetPacketSent *sent_cb)
+{
+    NetQueue *queue;
+
+    if (sender->link_down || !sender->peer) {
+        return count;
+    }
+
+    queue = sender->peer->send_queue;
+
+    return qemu_net_queue_send_iov_batch(queue, sender,
+                                         QEMU_NET_PACKET_FLAG_NONE,
+                                         pkts, count, sent_cb);
+}
+
 ssize_t
 qemu_sendv_packet(NetClientState *nc, const struct iovec *iov, int iovcnt)
 {
@@ -755,6 +859,7 @@ static int net_client_init1(const void *object, int is_netdev, Error **errp)
         case NET_CLIENT_OPTIONS_KIND_BRIDGE:
 #endif
         case NET_CLIENT_OPTIONS_KIND_HUBPORT:
+        case NET_CLIENT_OPTIONS_KIND_DUMP:
             break;
 
         default:
@@ -959,6 +1064,31 @@ void print_net_client(Monitor *mon, NetClientState *nc)
                    nc->queue_index,
                    NetClientOptionsKind_lookup[nc->info->type],
                    nc->info_str);
+
+    if (nc->info->query_tx_stats) {
+        TxQueueStats *stats = nc->info->query_tx_stats(nc);
+
+        monitor_printf(mon, "    tx: mode=%s,packets=%" PRId64
+                       ",notifications=%" PRId64 ",flushes=%" PRId64
+                       ",rate=%" PRId64 "pps,delay=%" PRId64 "ns"
+                       ",burst=%" PRId64 "\n",
+                       TxMitigationMode_lookup[stats->mode], stats->packets,
+                       stats->notifications, stats->flushes,
+                       stats->packet_rate, stats->delay, stats->burst);
+        qapi_free_TxQueueStats(stats);
+    }
+
+    if (nc->send_queue) {
+        NetQueueStats stats;
+
+        qemu_net_queue_get_stats(nc->send_queue, &stats);
+        if (stats.queued || stats.dropped) {
+            monitor_printf(mon, "    queue: depth=%" PRIu32 ",max-depth=%"
+                           PRIu32 ",queued=%" PRIu64 ",dropped=%" PRIu64 "\n",
+                           stats.depth, stats.max_depth, stats.queued,
+                           stats.dropped);
+        }
+    }
 }
 
 RxFilterInfoList *qmp_query_rx_filter(bool has_name, const char *name,
@@ -1009,6 +1139,58 @@ RxFilterInfoList *qmp_query_rx_filter(bool has_name, const char *name,
     return filter_list;
 }
 
+TxQueueStatsList *qmp_query_tx_stats(bool has_name, const char *name,
+                                     Error **errp)
+{
+    NetClientState *nc;
+    TxQueueStatsList *stats_list = NULL, *last_entry = NULL;
+    bool found = false;
+
+    QTAILQ_FOREACH(nc, &net_clients, next) {
+        TxQueueStatsList *entry;
+
+        if (has_name && strcmp(nc->name, name) != 0) {
+            continue;
+        }
+        found = true;
+
+        /* only NICs have transmit queues; all queues share the NIC name */
+        if (nc->info->type != NET_CLIENT_OPTIONS_KIND_NIC) {
+            if (has_name) {
+                error_setg(errp, "net client(%s) isn't a NIC", name);
+                break;
+            }
+            continue;
+        }
+
+        if (nc->info->query_tx_stats) {
+            entry = g_malloc0(sizeof(*entry));
+            entry->value = nc->info->query_tx_stats(nc);
+
+            if (!stats_list) {
+                stats_list = entry;
+            } else {
+                last_entry->next = entry;
+            }
+            last_entry = entry;
+        } else if (has_name) {
+            error_setg(errp, "net client(%s) doesn't support"
+                       " transmit statistics", name);
+            break;
+        }
+    }
+
+    if (error_is_set(errp)) {
+        qapi_free_TxQueueStatsList(stats_list);
+        return NULL;
+    }
+    if (!found && has_name) {
+        error_setg(errp, "invalid net client name: %s", name);
+    }
+
+    return stats_list;
+}
+
 void do_info_network(Monitor *mon, const QDict *qdict)
 {
     NetClientState *nc, *peer;
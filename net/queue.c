@@ -23,6 +23,8 @@
 
 #include "net/queue.h"
 #include "qemu/queue.h"
+#include "qemu/atomic.h"
+#include "qemu/iov.h"
 #include "net/net.h"
 
 /* The delivery handler may only return zero if it will call
@@ -37,27 +39,92 @@
  *
  * If a sent callback isn't provided, we just drop the packet to avoid
  * unbounded queueing.
+ *
+ * Queued packets live in a power-of-two ring of packet pointers with a
+ * single producer (the send functions) and a single consumer (flush).
+ * The producer only writes the tail index and the consumer only writes
+ * the head index, so the two sides may eventually run in different
+ * threads.  Purging rewrites the ring in place and therefore must not
+ * race with the producer; today everything runs under the global mutex.
+ * A packet stays in the ring until it has been delivered, so purge
+ * leaves the one being flushed alone, as it did when flush unlinked
+ * the packet before delivering it.
+ *
+ * Buffers for regular frames are recycled through a pool.  The consumer
+ * pushes freed packets onto the release list and the producer grabs the
+ * whole list when its own alloc list runs dry, as the coroutine pool
+ * does.  Larger packets are allocated with their exact size; rounding
+ * them up to NET_BUFSIZE would waste most of the buffer.
  */
 
+enum {
+    NET_QUEUE_SLOTS_MIN = 64,
+    /* Packets with a sent callback may exceed nq_maxlen, but only by the
+     * number of senders; leave that much headroom in the ring. */
+    NET_QUEUE_HEADROOM  = 1024,
+
+    NET_PACKET_SMALL    = 2048,
+    NET_POOL_SMALL_MAX  = 256,
+};
+
 struct NetPacket {
-    QTAILQ_ENTRY(NetPacket) entry;
+    QSLIST_ENTRY(NetPacket) pool_next;
     NetClientState *sender;
     unsigned flags;
     int size;
+    size_t buf_size;
     NetPacketSent *sent_cb;
     uint8_t data[0];
 };
 
+typedef struct NetPacketPool {
+    size_t buf_size;
+    unsigned int max;
+    QSLIST_HEAD(, NetPacket) alloc;         /* producer only */
+    QSLIST_HEAD(, NetPacket) release;       /* filled by the consumer */
+    unsigned int release_num;
+} NetPacketPool;
+
 struct NetQueue {
     void *opaque;
     uint32_t nq_maxlen;
-    uint32_t nq_count;
 
-    QTAILQ_HEAD(packets, NetPacket) packets;
+    NetPacket **ring;
+    unsigned int ring_size;
+    unsigned int head;                      /* written by the consumer */
+    unsigned int tail;                      /* written by the producer */
+
+    NetPacketPool small_pool;
 
+    uint64_t queued;
+    uint64_t dropped;
+    uint32_t max_depth;
+
+    NetPacket *flushing;                    /* being delivered by flush */
     unsigned delivering : 1;
 };
 
+static void qemu_net_packet_pool_init(NetPacketPool *pool, size_t buf_size,
+                                      unsigned int max)
+{
+    pool->buf_size = buf_size;
+    pool->max = max;
+    QSLIST_INIT(&pool->alloc);
+    QSLIST_INIT(&pool->release);
+}
+
+static void qemu_net_packet_pool_cleanup(NetPacketPool *pool)
+{
+    NetPacket *packet;
+
+    QSLIST_MOVE_ATOMIC(&pool->alloc, &pool->release);
+    while ((packet = QSLIST_FIRST(&pool->alloc))) {
+        QSLIST_REMOVE_HEAD(&pool->alloc, pool_next);
+        g_free(packet);
+    }
+    pool->release_num = 0;
+}
+
 NetQueue *qemu_new_net_queue(void *opaque)
 {
     NetQueue *queue;
@@ -66,28 +133,158 @@ NetQueue *qemu_new_net_queue(void *opaque)
 
     queue->opaque = opaque;
     queue->nq_maxlen = 10000;
-    queue->nq_count = 0;
 
-    QTAILQ_INIT(&queue->packets);
+    /* The ring itself is only allocated once something gets queued;
+     * most queues never hold a packet. */
+    queue->ring = NULL;
+    queue->ring_size = 0;
+    queue->head = queue->tail = 0;
+
+    qemu_net_packet_pool_init(&queue->small_pool, NET_PACKET_SMALL,
+                              NET_POOL_SMALL_MAX);
 
     queue->delivering = 0;
 
     return queue;
 }
 
+static NetPacket *qemu_net_packet_alloc(NetQueue *queue, size_t size)
+{
+    NetPacketPool *pool = &queue->small_pool;
+    NetPacket *packet;
+
+    if (size > pool->buf_size) {
+        packet = g_malloc(sizeof(NetPacket) + size);
+        packet->buf_size = size;
+        return packet;
+    }
+
+    packet = QSLIST_FIRST(&pool->alloc);
+    if (!packet && atomic_read(&pool->release_num)) {
+        atomic_xchg(&pool->release_num, 0);
+        QSLIST_MOVE_ATOMIC(&pool->alloc, &pool->release);
+        packet = QSLIST_FIRST(&pool->alloc);
+    }
+    if (packet) {
+        QSLIST_REMOVE_HEAD(&pool->alloc, pool_next);
+        return packet;
+    }
+
+    packet = g_malloc(sizeof(NetPacket) + pool->buf_size);
+    packet->buf_size = pool->buf_size;
+    return packet;
+}
+
+static void qemu_net_packet_free(NetQueue *queue, NetPacket *packet)
+{
+    NetPacketPool *pool = &queue->small_pool;
+
+    if (packet->buf_size != pool->buf_size) {
+        g_free(packet);
+        return;
+    }
+
+    if (atomic_read(&pool->release_num) < pool->max) {
+        QSLIST_INSERT_HEAD_ATOMIC(&pool->release, packet, pool_next);
+        atomic_inc(&pool->release_num);
+        return;
+    }
+    g_free(packet);
+}
+
+static inline unsigned int qemu_net_queue_depth(NetQueue *queue)
+{
+    return atomic_read(&queue->tail) - atomic_read(&queue->head);
+}
+
+/* Consumer side: return the oldest packet without removing it */
+static NetPacket *qemu_net_queue_peek(NetQueue *queue)
+{
+    unsigned int head = queue->head;
+
+    if (head == atomic_read(&queue->tail)) {
+        return NULL;
+    }
+    smp_rmb();
+    return queue->ring[head & (queue->ring_size - 1)];
+}
+
+/* Consumer side: drop the packet returned by qemu_net_queue_peek() */
+static void qemu_net_queue_pop(NetQueue *queue)
+{
+    /* The slot must be read before the producer may reuse it */
+    smp_mb();
+    atomic_set(&queue->head, queue->head + 1);
+}
+
+static void qemu_net_queue_grow(NetQueue *queue)
+{
+    unsigned int size = MAX(queue->ring_size * 2, NET_QUEUE_SLOTS_MIN);
+    NetPacket **ring = g_new(NetPacket *, size);
+    unsigned int i, n = queue->tail - queue->head;
+
+    for (i = 0; i < n; i++) {
+        ring[i] = queue->ring[(queue->head + i) & (queue->ring_size - 1)];
+    }
+    g_free(queue->ring);
+    queue->ring = ring;
+    queue->ring_size = size;
+    queue->head = 0;
+    queue->tail = n;
+}
+
+/* Producer side: reserve a slot, or return false if the packet must be
+ * dropped.  The ring grows geometrically up to nq_maxlen plus headroom;
+ * growing moves the consumer index as well, which is fine as long as
+ * both sides share the global mutex. */
+static bool qemu_net_queue_reserve(NetQueue *queue, NetPacketSent *sent_cb)
+{
+    unsigned int depth = qemu_net_queue_depth(queue);
+
+    if (depth >= queue->nq_maxlen && !sent_cb) {
+        return false; /* drop if queue full and no callback */
+    }
+    if (depth >= queue->nq_maxlen + NET_QUEUE_HEADROOM) {
+        return false;
+    }
+    if (depth == queue->ring_size) {
+        qemu_net_queue_grow(queue);
+    }
+    return true;
+}
+
+static void qemu_net_queue_push(NetQueue *queue, NetPacket *packet)
+{
+    unsigned int tail = queue->tail;
+    unsigned int depth;
+
+    queue->ring[tail & (queue->ring_size - 1)] = packet;
+    smp_wmb();
+    atomic_set(&queue->tail, tail + 1);
+
+    queue->queued++;
+    depth = tail + 1 - atomic_read(&queue->head);
+    if (depth > queue->max_depth) {
+        queue->max_depth = depth;
+    }
+}
+
 void qemu_del_net_queue(NetQueue *queue)
 {
-    NetPacket *packet, *next;
+    NetPacket *packet;
 
-    QTAILQ_FOREACH_SAFE(packet, &queue->packets, entry, next) {
-        QTAILQ_REMOVE(&queue->packets, packet, entry);
+    while ((packet = qemu_net_queue_peek(queue))) {
+        qemu_net_queue_pop(queue);
         g_free(packet);
     }
+    g_free(queue->ring);
+
+    qemu_net_packet_pool_cleanup(&queue->small_pool);
 
     g_free(queue);
 }
 
-static void qemu_net_queue_append(NetQueue *queue,
+static bool qemu_net_queue_append(NetQueue *queue,
                                   NetClientState *sender,
                                   unsigned flags,
                                   const uint8_t *buf,
@@ -96,21 +293,22 @@ static void qemu_net_queue_append(NetQueue *queue,
 {
     NetPacket *packet;
 
-    if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
-        return; /* drop if queue full and no callback */
+    if (!qemu_net_queue_reserve(queue, sent_cb)) {
+        queue->dropped++;
+        return false;
     }
-    packet = g_malloc(sizeof(NetPacket) + size);
+    packet = qemu_net_packet_alloc(queue, size);
     packet->sender = sender;
     packet->flags = flags;
     packet->size = size;
     packet->sent_cb = sent_cb;
     memcpy(packet->data, buf, size);
 
-    queue->nq_count++;
-    QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
+    qemu_net_queue_push(queue, packet);
+    return true;
 }
 
-static void qemu_net_queue_append_iov(NetQueue *queue,
+static bool qemu_net_queue_append_iov(NetQueue *queue,
                                       NetClientState *sender,
                                       unsigned flags,
                                       const struct iovec *iov,
@@ -121,14 +319,15 @@ static void qemu_net_queue_append_iov(NetQueue *queue,
     size_t max_len = 0;
     int i;
 
-    if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
-        return; /* drop if queue full and no callback */
+    if (!qemu_net_queue_reserve(queue, sent_cb)) {
+        queue->dropped++;
+        return false;
     }
     for (i = 0; i < iovcnt; i++) {
         max_len += iov[i].iov_len;
     }
 
-    packet = g_malloc(sizeof(NetPacket) + max_len);
+    packet = qemu_net_packet_alloc(queue, max_len);
     packet->sender = sender;
     packet->sent_cb = sent_cb;
     packet->flags = flags;
@@ -141,8 +340,8 @@ static void qemu_net_queue_append_iov(NetQueue *queue,
         packet->size += len;
     }
 
-    queue->nq_count++;
-    QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
+    qemu_net_queue_push(queue, packet);
+    return true;
 }
 
 static ssize_t qemu_net_queue_deliver(NetQueue *queue,
@@ -185,14 +384,14 @@ ssize_t qemu_net_queue_send(NetQueue *queue,
     ssize_t ret;
 
     if (queue->delivering || !qemu_can_send_packet(sender)) {
-        qemu_net_queue_append(queue, sender, flags, data, size, sent_cb);
-        return 0;
+        return qemu_net_queue_append(queue, sender, flags, data, size,
+                                     sent_cb) ? 0 : size;
     }
 
     ret = qemu_net_queue_deliver(queue, sender, flags, data, size);
     if (ret == 0) {
-        qemu_net_queue_append(queue, sender, flags, data, size, sent_cb);
-        return 0;
+        return qemu_net_queue_append(queue, sender, flags, data, size,
+                                     sent_cb) ? 0 : size;
     }
 
     qemu_net_queue_flush(queue);
@@ -210,14 +409,47 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
     ssize_t ret;
 
     if (queue->delivering || !qemu_can_send_packet(sender)) {
-        qemu_net_queue_append_iov(queue, sender, flags, iov, iovcnt, sent_cb);
-        return 0;
+        return qemu_net_queue_append_iov(queue, sender, flags, iov, iovcnt,
+                                         sent_cb) ? 0 : iov_size(iov, iovcnt);
     }
 
     ret = qemu_net_queue_deliver_iov(queue, sender, flags, iov, iovcnt);
     if (ret == 0) {
-        qemu_net_queue_append_iov(queue, sender, flags, iov, iovcnt, sent_cb);
-        return 0;
+        return qemu_net_queue_append_iov(queue, sender, flags, iov, iovcnt,
+                                         sent_cb) ? 0 : iov_size(iov, iovcnt);
+    }
+
+    qemu_net_queue_flush(queue);
+
+    return ret;
+}
+
+int qemu_net_queue_send_iov_batch(NetQueue *queue,
+                                  NetClientState *sender,
+                                  unsigned flags,
+                                  const NetPacketIOV *pkts,
+                                  int count,
+                                  NetPacketSent *sent_cb)
+{
+    int ret;
+
+    assert(count > 0);
+
+    if (queue->delivering || !qemu_can_send_packet(sender)) {
+        return qemu_net_queue_append_iov(queue, sender, flags,
+                                         pkts[0].iov, pkts[0].iovcnt,
+                                         sent_cb) ? 0 : 1;
+    }
+
+    queue->delivering = 1;
+    ret = qemu_deliver_packet_iov_batch(sender, flags, pkts, count,
+                                        queue->opaque);
+    queue->delivering = 0;
+
+    if (ret < count) {
+        return qemu_net_queue_append_iov(queue, sender, flags,
+                                         pkts[ret].iov, pkts[ret].iovcnt,
+                                         sent_cb) ? ret : ret + 1;
     }
 
     qemu_net_queue_flush(queue);
@@ -227,43 +459,65 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
 
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
 {
-    NetPacket *packet, *next;
+    unsigned int mask = queue->ring_size - 1;
+    unsigned int i, tail = queue->head;
+
+    for (i = queue->head; i != queue->tail; i++) {
+        NetPacket *packet = queue->ring[i & mask];
 
-    QTAILQ_FOREACH_SAFE(packet, &queue->packets, entry, next) {
-        if (packet->sender == from) {
-            QTAILQ_REMOVE(&queue->packets, packet, entry);
-            queue->nq_count--;
-            g_free(packet);
+        if (packet->sender == from && packet != queue->flushing) {
+            qemu_net_packet_free(queue, packet);
+        } else {
+            queue->ring[tail++ & mask] = packet;
         }
     }
+    atomic_set(&queue->tail, tail);
+}
+
+bool qemu_net_queue_empty(NetQueue *queue)
+{
+    return qemu_net_queue_depth(queue) == 0 && !queue->delivering;
 }
 
 bool qemu_net_queue_flush(NetQueue *queue)
 {
-    while (!QTAILQ_EMPTY(&queue->packets)) {
-        NetPacket *packet;
-        int ret;
+    NetPacket *packet;
+
+    /* The packet stays in the ring while it is being delivered, so a
+     * nested flush from the delivery handler must not send it again;
+     * the outer loop carries on once the handler returns. */
+    if (queue->delivering) {
+        return false;
+    }
 
-        packet = QTAILQ_FIRST(&queue->packets);
-        QTAILQ_REMOVE(&queue->packets, packet, entry);
-        queue->nq_count--;
+    while ((packet = qemu_net_queue_peek(queue))) {
+        int ret;
 
+        queue->flushing = packet;
         ret = qemu_net_queue_deliver(queue,
                                      packet->sender,
                                      packet->flags,
                                      packet->data,
                                      packet->size);
+        queue->flushing = NULL;
         if (ret == 0) {
-            queue->nq_count++;
-            QTAILQ_INSERT_HEAD(&queue->packets, packet, entry);
             return false;
         }
+        qemu_net_queue_pop(queue);
 
         if (packet->sent_cb) {
             packet->sent_cb(packet->sender, ret);
         }
 
-        g_free(packet);
+        qemu_net_packet_free(queue, packet);
     }
     return true;
 }
+
+void qemu_net_queue_get_stats(NetQueue *queue, NetQueueStats *stats)
+{
+    stats->depth = qemu_net_queue_depth(queue);
+    stats->max_depth = queue->max_depth;
+    stats->queued = queue->queued;
+    stats->dropped = queue->dropped;
+}
@@ -36,6 +36,8 @@
 #include "qemu/sockets.h"
 #include "slirp/libslirp.h"
 #include "sysemu/char.h"
+#include "qemu/event_notifier.h"
+#include "qemu/thread.h"
 
 static int get_str_sep(char *buf, int buf_size, const char **pp, int sep)
 {
@@ -69,6 +71,15 @@ struct slirp_config_str {
     int legacy_format;
 };
 
+/* Frames the slirp thread produced, waiting for the main loop */
+typedef struct SlirpPacket {
+    QSIMPLEQ_ENTRY(SlirpPacket) next;
+    int size;
+    uint8_t data[0];
+} SlirpPacket;
+
+#define SLIRP_OUTPUT_MAX 4096
+
 typedef struct SlirpState {
     NetClientState nc;
     QTAILQ_ENTRY(SlirpState) entry;
@@ -76,6 +87,20 @@ typedef struct SlirpState {
 #ifndef _WIN32
     char smb_dir[128];
 #endif
+
+    /* thread=on: the stack is polled by its own thread.  lock protects
+     * the Slirp instance and the output queue.
+     */
+    bool threaded;
+    bool thread_running;
+    bool thread_stop;
+    QemuThread thread;
+    QemuMutex lock;
+    EventNotifier wakeup;           /* kicks the thread out of g_poll */
+    EventNotifier output_notifier;  /* output queue became non-empty */
+    QSIMPLEQ_HEAD(, SlirpPacket) output;
+    int output_len;
+    uint64_t output_dropped;
 } SlirpState;
 
 static struct slirp_config_str *slirp_configs;
@@ -99,18 +124,172 @@ static void slirp_smb_cleanup(SlirpState *s);
 static inline void slirp_smb_cleanup(SlirpState *s) { }
 #endif
 
+static void net_slirp_lock(SlirpState *s)
+{
+    if (s->threaded) {
+        qemu_mutex_lock(&s->lock);
+    }
+}
+
+/* The instance may have new sockets or timers, let the thread poll again */
+static void net_slirp_unlock(SlirpState *s)
+{
+    if (s->threaded) {
+        qemu_mutex_unlock(&s->lock);
+        event_notifier_set(&s->wakeup);
+    }
+}
+
 void slirp_output(void *opaque, const uint8_t *pkt, int pkt_len)
 {
     SlirpState *s = opaque;
+    SlirpPacket *packet;
 
-    qemu_send_packet(&s->nc, pkt, pkt_len);
+    if (!s->threaded) {
+        qemu_send_packet(&s->nc, pkt, pkt_len);
+        return;
+    }
+
+    /* Called with s->lock held, from either thread */
+    if (s->output_len >= SLIRP_OUTPUT_MAX) {
+        s->output_dropped++;
+        return;
+    }
+    packet = g_malloc(sizeof(*packet) + pkt_len);
+    packet->size = pkt_len;
+    memcpy(packet->data, pkt, pkt_len);
+    QSIMPLEQ_INSERT_TAIL(&s->output, packet, next);
+    if (s->output_len++ == 0) {
+        event_notifier_set(&s->output_notifier);
+    }
+}
+
+static void net_slirp_output_ready(EventNotifier *e)
+{
+    SlirpState *s = container_of(e, SlirpState, output_notifier);
+    QSIMPLEQ_HEAD(, SlirpPacket) output;
+    SlirpPacket *packet;
+
+    event_notifier_test_and_clear(e);
+
+    QSIMPLEQ_INIT(&output);
+    qemu_mutex_lock(&s->lock);
+    QSIMPLEQ_CONCAT(&output, &s->output);
+    s->output_len = 0;
+    qemu_mutex_unlock(&s->lock);
+
+    while ((packet = QSIMPLEQ_FIRST(&output))) {
+        QSIMPLEQ_REMOVE_HEAD(&output, next);
+        qemu_send_packet(&s->nc, packet->data, packet->size);
+        g_free(packet);
+    }
+}
+
+#ifndef _WIN32
+static void *net_slirp_thread(void *opaque)
+{
+    SlirpState *s = opaque;
+    GArray *pollfds = g_array_new(FALSE, FALSE, sizeof(GPollFD));
+    GPollFD wakeup = {
+        .fd = event_notifier_get_fd(&s->wakeup),
+        .events = G_IO_IN,
+    };
+
+    qemu_mutex_lock(&s->lock);
+    while (!s->thread_stop) {
+        uint32_t timeout = 1000;
+        int ret;
+
+        g_array_set_size(pollfds, 0);
+        g_array_append_val(pollfds, wakeup);
+        slirp_instance_pollfds_fill(s->slirp, pollfds, &timeout);
+        qemu_mutex_unlock(&s->lock);
+
+        ret = g_poll((GPollFD *)pollfds->data, pollfds->len, timeout);
+        if (g_array_index(pollfds, GPollFD, 0).revents) {
+            event_notifier_test_and_clear(&s->wakeup);
+        }
+
+        qemu_mutex_lock(&s->lock);
+        slirp_instance_pollfds_poll(s->slirp, pollfds, ret < 0);
+    }
+    qemu_mutex_unlock(&s->lock);
+
+    g_array_free(pollfds, TRUE);
+    return NULL;
+}
+
+static void net_slirp_thread_start(SlirpState *s)
+{
+    slirp_set_own_loop(s->slirp, &s->lock);
+    s->thread_running = true;
+    qemu_thread_create(&s->thread, net_slirp_thread, s,
+                       QEMU_THREAD_JOINABLE);
+}
+
+static void net_slirp_thread_stop(SlirpState *s)
+{
+    if (!s->thread_running) {
+        return;
+    }
+    qemu_mutex_lock(&s->lock);
+    s->thread_stop = true;
+    qemu_mutex_unlock(&s->lock);
+    event_notifier_set(&s->wakeup);
+    qemu_thread_join(&s->thread);
+    s->thread_running = false;
+}
+#else
+static inline void net_slirp_thread_start(SlirpState *s) { }
+static inline void net_slirp_thread_stop(SlirpState *s) { }
+#endif
+
+static int net_slirp_threaded_init(SlirpState *s)
+{
+#ifndef _WIN32
+    if (event_notifier_init(&s->wakeup, 0) < 0) {
+        return -1;
+    }
+    if (event_notifier_init(&s->output_notifier, 0) < 0) {
+        event_notifier_cleanup(&s->wakeup);
+        return -1;
+    }
+    qemu_mutex_init(&s->lock);
+    QSIMPLEQ_INIT(&s->output);
+    event_notifier_set_handler(&s->output_notifier, net_slirp_output_ready);
+    s->threaded = true;
+    return 0;
+#else
+    error_report("thread=on is not supported on this host");
+    return -1;
+#endif
+}
+
+static void net_slirp_threaded_cleanup(SlirpState *s)
+{
+    SlirpPacket *packet;
+
+    if (!s->threaded) {
+        return;
+    }
+    event_notifier_set_handler(&s->output_notifier, NULL);
+    while ((packet = QSIMPLEQ_FIRST(&s->output))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->output, next);
+        g_free(packet);
+    }
+    event_notifier_cleanup(&s->output_notifier);
+    event_notifier_cleanup(&s->wakeup);
+    qemu_mutex_destroy(&s->lock);
+    s->threaded = false;
 }
 
 static ssize_t net_slirp_receive(NetClientState *nc, const uint8_t *buf, size_t size)
 {
     SlirpState *s = DO_UPCAST(SlirpState, nc, nc);
 
+    net_slirp_lock(s);
     slirp_input(s->slirp, buf, size);
+    net_slirp_unlock(s);
 
     return size;
 }
@@ -119,7 +298,9 @@ static void net_slirp_cleanup(NetClientState *nc)
 {
     SlirpState *s = DO_UPCAST(SlirpState, nc, nc);
 
+    net_slirp_thread_stop(s);
     slirp_cleanup(s->slirp);
+    net_slirp_threaded_cleanup(s);
     slirp_smb_cleanup(s);
     QTAILQ_REMOVE(&slirp_stacks, s, entry);
 }
@@ -137,7 +318,8 @@ static int net_slirp_init(NetClientState *peer, const char *model,
                           const char *vhostname, const char *tftp_export,
                           const char *bootfile, const char *vdhcp_start,
                           const char *vnameserver, const char *smb_export,
-                          const char *vsmbserver, const char **dnssearch)
+                          const char *vsmbserver, const char **dnssearch,
+                          bool threaded)
 {
     /* default settings according to historic slirp */
     struct in_addr net  = { .s_addr = htonl(0x0a000200) }; /* 10.0.2.0 */
@@ -246,6 +428,10 @@ static int net_slirp_init(NetClientState *peer, const char *model,
                           tftp_export, bootfile, dhcp, dns, dnssearch, s);
     QTAILQ_INSERT_TAIL(&slirp_stacks, s, entry);
 
+    if (threaded && net_slirp_threaded_init(s) < 0) {
+        goto error;
+    }
+
     for (config = slirp_configs; config; config = config->next) {
         if (config->flags & SLIRP_CFG_HOSTFWD) {
             if (slirp_hostfwd(s, config->str,
@@ -267,6 +453,10 @@ static int net_slirp_init(NetClientState *peer, const char *model,
     }
 #endif
 
+    if (s->threaded) {
+        net_slirp_thread_start(s);
+    }
+
     return 0;
 
 error:
@@ -344,8 +534,9 @@ void net_slirp_hostfwd_remove(Monitor *mon, const QDict *qdict)
 
     host_port = atoi(p);
 
-    err = slirp_remove_hostfwd(QTAILQ_FIRST(&slirp_stacks)->slirp, is_udp,
-                               host_addr, host_port);
+    net_slirp_lock(s);
+    err = slirp_remove_hostfwd(s->slirp, is_udp, host_addr, host_port);
+    net_slirp_unlock(s);
 
     monitor_printf(mon, "host forwarding rule for %s %s\n", src_str,
                    err ? "not found" : "removed");
@@ -436,7 +627,9 @@ void net_slirp_hostfwd_add(Monitor *mon, const QDict *qdict)
         redir_str = arg1;
     }
     if (s) {
+        net_slirp_lock(s);
         slirp_hostfwd(s, redir_str, 0);
+        net_slirp_unlock(s);
     }
 
 }
@@ -444,6 +637,8 @@ void net_slirp_hostfwd_add(Monitor *mon, const QDict *qdict)
 int net_slirp_redir(const char *redir_str)
 {
     struct slirp_config_str *config;
+    SlirpState *s;
+    int ret;
 
     if (QTAILQ_EMPTY(&slirp_stacks)) {
         config = g_malloc(sizeof(*config));
@@ -454,7 +649,11 @@ int net_slirp_redir(const char *redir_str)
         return 0;
     }
 
-    return slirp_hostfwd(QTAILQ_FIRST(&slirp_stacks), redir_str, 1);
+    s = QTAILQ_FIRST(&slirp_stacks);
+    net_slirp_lock(s);
+    ret = slirp_hostfwd(s, redir_str, 1);
+    net_slirp_unlock(s);
+    return ret;
 }
 
 #ifndef _WIN32
@@ -561,6 +760,8 @@ static int slirp_smb(SlirpState* s, const char *exported_dir,
 int net_slirp_smb(const char *exported_dir)
 {
     struct in_addr vserver_addr = { .s_addr = 0 };
+    SlirpState *s;
+    int ret;
 
     if (legacy_smb_export) {
         fprintf(stderr, "-smb given twice\n");
@@ -568,8 +769,11 @@ int net_slirp_smb(const char *exported_dir)
     }
     legacy_smb_export = exported_dir;
     if (!QTAILQ_EMPTY(&slirp_stacks)) {
-        return slirp_smb(QTAILQ_FIRST(&slirp_stacks), exported_dir,
-                         vserver_addr);
+        s = QTAILQ_FIRST(&slirp_stacks);
+        net_slirp_lock(s);
+        ret = slirp_smb(s, exported_dir, vserver_addr);
+        net_slirp_unlock(s);
+        return ret;
     }
     return 0;
 }
@@ -643,6 +847,14 @@ static int slirp_guestfwd(SlirpState *s, const char *config_str,
             return -1;
         }
     } else {
+        /* slirp would write to the chardev from its own thread */
+        if (s->threaded) {
+            error_report("guest forwarding to a character device is not "
+                         "supported with thread=on");
+            g_free(fwd);
+            return -1;
+        }
+
         fwd->hd = qemu_chr_new(buf, p, NULL);
         if (!fwd->hd) {
             error_report("could not open guest forwarding device '%s'", buf);
@@ -681,7 +893,13 @@ void do_info_usernet(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "VLAN %d (%s):\n",
                        got_vlan_id ? id : -1,
                        s->nc.name);
+        net_slirp_lock(s);
+        if (s->threaded) {
+            monitor_printf(mon, "  thread: output queue %d, dropped %" PRIu64
+                           "\n", s->output_len, s->output_dropped);
+        }
         slirp_connection_info(s->slirp, mon);
+        net_slirp_unlock(s);
     }
 }
 
@@ -752,7 +970,8 @@ int net_init_slirp(const NetClientOptions *opts, const char *name,
     ret = net_slirp_init(peer, "user", name, user->q_restrict, vnet,
                          user->host, user->hostname, user->tftp,
                          user->bootfile, user->dhcpstart, user->dns, user->smb,
-                         user->smbserver, dnssearch);
+                         user->smbserver, dnssearch,
+                         user->has_thread && user->thread);
 
     while (slirp_configs) {
         config = slirp_configs;
@@ -786,7 +1005,11 @@ int net_slirp_parse_legacy(QemuOptsList *opts_list, const char *optarg, int *ret
         slirp_configs = config;
         *ret = 0;
     } else {
-        *ret = slirp_guestfwd(QTAILQ_FIRST(&slirp_stacks), optarg, 1);
+        SlirpState *s = QTAILQ_FIRST(&slirp_stacks);
+
+        net_slirp_lock(s);
+        *ret = slirp_guestfwd(s, optarg, 1);
+        net_slirp_unlock(s);
     }
 
     return 1;
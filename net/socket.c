@@ -141,6 +141,48 @@ static ssize_t net_socket_receive_dgram(NetClientState *nc, const uint8_t *buf,
     return ret;
 }
 
+#ifdef CONFIG_SENDMMSG
+/* Maximum number of datagrams handed to one sendmmsg() call */
+#define NET_SOCKET_DGRAM_BATCH 64
+
+static int net_socket_receive_iov_batch_dgram(NetClientState *nc,
+                                              const NetPacketIOV *pkts,
+                                              int count)
+{
+    NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
+    struct mmsghdr msgs[NET_SOCKET_DGRAM_BATCH];
+    int done = 0;
+
+    while (done < count) {
+        int i, num = MIN(count - done, NET_SOCKET_DGRAM_BATCH);
+        int ret;
+
+        memset(msgs, 0, num * sizeof(msgs[0]));
+        for (i = 0; i < num; i++) {
+            msgs[i].msg_hdr.msg_name = &s->dgram_dst;
+            msgs[i].msg_hdr.msg_namelen = sizeof(s->dgram_dst);
+            msgs[i].msg_hdr.msg_iov = (struct iovec *)pkts[done + i].iov;
+            msgs[i].msg_hdr.msg_iovlen = pkts[done + i].iovcnt;
+        }
+
+        do {
+            ret = sendmmsg(s->fd, msgs, num, 0);
+        } while (ret == -1 && errno == EINTR);
+
+        if (ret == -1 && errno == EAGAIN) {
+            net_socket_write_poll(s, true);
+            break;
+        }
+        if (ret == -1) {
+            /* Drop the failing datagram, like net_socket_receive_dgram */
+            ret = 1;
+        }
+        done += ret;
+    }
+    return done;
+}
+#endif
+
 static void net_socket_send(void *opaque)
 {
     NetSocketState *s = opaque;
@@ -336,6 +378,9 @@ static NetClientInfo net_dgram_socket_info = {
     .type = NET_CLIENT_OPTIONS_KIND_SOCKET,
     .size = sizeof(NetSocketState),
     .receive = net_socket_receive_dgram,
+#ifdef CONFIG_SENDMMSG
+    .receive_iov_batch = net_socket_receive_iov_batch_dgram,
+#endif
     .cleanup = net_socket_cleanup,
 };
 
@@ -39,6 +39,8 @@
 #include <syslog.h>
 #include <stropts.h>
 #include "qemu/error-report.h"
+#include "qemu/iov.h"
+#include "net/net.h"
 
 ssize_t tap_read_packet(int tapfd, uint8_t *buf, int maxlen)
 {
@@ -51,6 +53,18 @@ ssize_t tap_read_packet(int tapfd, uint8_t *buf, int maxlen)
     return getmsg(tapfd, NULL, &sbuf, &f) >= 0 ? sbuf.len : -1;
 }
 
+ssize_t tap_readv_packet(int tapfd, const struct iovec *iov, int iovcnt)
+{
+    uint8_t buf[NET_BUFSIZE];
+    ssize_t len;
+
+    len = tap_read_packet(tapfd, buf, sizeof(buf));
+    if (len > 0) {
+        iov_from_buf(iov, iovcnt, 0, buf, len);
+    }
+    return len;
+}
+
 #define TUNNEWPPA       (('T'<<16) | 0x0001)
 /*
  * Allocate TAP device, returns opened fd.
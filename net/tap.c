@@ -59,6 +59,9 @@ typedef struct TAPState {
     unsigned host_vnet_hdr_len;
 } TAPState;
 
+/* Packets read per wakeup before yielding back to the main loop */
+#define TAP_RX_BATCH 64
+
 static int launch_script(const char *setup_script, const char *ifname, int fd);
 
 static int tap_can_send(void *opaque);
@@ -177,6 +180,11 @@ ssize_t tap_read_packet(int tapfd, uint8_t *buf, int maxlen)
 {
     return read(tapfd, buf, maxlen);
 }
+
+ssize_t tap_readv_packet(int tapfd, const struct iovec *iov, int iovcnt)
+{
+    return readv(tapfd, iov, iovcnt);
+}
 #endif
 
 static void tap_send_completed(NetClientState *nc, ssize_t len)
@@ -185,18 +193,57 @@ static void tap_send_completed(NetClientState *nc, ssize_t len)
     tap_read_poll(s, true);
 }
 
+/* Read one packet, straight into the peer's buffers when it lends them.
+ * Sets *consumed if the peer already took the packet; otherwise it is in
+ * s->buf.
+ */
+static ssize_t tap_read_direct(TAPState *s, bool *consumed)
+{
+    struct iovec iov[IOV_MAX];
+    ssize_t size;
+    int iovcnt = 0;
+
+    *consumed = false;
+
+    if (!s->host_vnet_hdr_len || s->using_vnet_hdr) {
+        iovcnt = qemu_peer_rx_buf_get(&s->nc, iov, IOV_MAX - 1);
+    }
+    if (iovcnt == 0) {
+        return tap_read_packet(s->fd, s->buf, sizeof(s->buf));
+    }
+
+    /* Whatever does not fit in the lent buffers spills into s->buf */
+    iov[iovcnt].iov_base = s->buf;
+    iov[iovcnt].iov_len = sizeof(s->buf);
+
+    size = tap_readv_packet(s->fd, iov, iovcnt + 1);
+    if (size <= 0) {
+        qemu_peer_rx_buf_put(&s->nc, 0, s->buf, sizeof(s->buf));
+        return size;
+    }
+
+    *consumed = qemu_peer_rx_buf_put(&s->nc, size, s->buf,
+                                     sizeof(s->buf)) == size;
+    return size;
+}
+
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
+    int packets = 0;
     int size;
 
     do {
         uint8_t *buf = s->buf;
+        bool consumed;
 
-        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
+        size = tap_read_direct(s, &consumed);
         if (size <= 0) {
             break;
         }
+        if (consumed) {
+            continue;
+        }
 
         if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
             buf  += s->host_vnet_hdr_len;
@@ -207,7 +254,8 @@ static void tap_send(void *opaque)
         if (size == 0) {
             tap_read_poll(s, false);
         }
-    } while (size > 0 && qemu_can_send_packet(&s->nc));
+    } while (size > 0 && ++packets < TAP_RX_BATCH &&
+             qemu_can_send_packet(&s->nc));
 }
 
 bool tap_has_ufo(NetClientState *nc)
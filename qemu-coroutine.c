@@ -15,31 +15,76 @@
 #include "trace.h"
 #include "qemu-common.h"
 #include "qemu/thread.h"
+#include "qemu/atomic.h"
+#include "qemu/notify.h"
 #include "block/coroutine.h"
 #include "block/coroutine_int.h"
 
 enum {
-    /* Maximum free pool size prevents holding too many freed coroutines */
-    POOL_MAX_SIZE = 64,
+    /* Default number of coroutines kept in each free pool */
+    POOL_DEFAULT_SIZE = 64,
 };
 
-/** Free list to speed up creation */
-static QemuMutex pool_lock;
-static QSLIST_HEAD(, Coroutine) pool = QSLIST_HEAD_INITIALIZER(pool);
-static unsigned int pool_size;
+/** Free list to speed up creation
+ *
+ * Each thread allocates from and releases to its own alloc_pool without any
+ * synchronization.  Coroutines that do not fit in the thread-local pool
+ * overflow into the global release_pool, which threads drain in one batch
+ * once their local pool runs dry.  Both pools are bounded by pool_max_size,
+ * which devices raise according to their queue depth.
+ */
+static QSLIST_HEAD(, Coroutine) release_pool = QSLIST_HEAD_INITIALIZER(pool);
+static unsigned int release_pool_size;
+static unsigned int pool_max_size = POOL_DEFAULT_SIZE;
+static __thread QSLIST_HEAD(, Coroutine) alloc_pool =
+    QSLIST_HEAD_INITIALIZER(pool);
+static __thread unsigned int alloc_pool_size;
+static __thread Notifier coroutine_pool_cleanup_notifier;
+
+static void coroutine_pool_cleanup(Notifier *n, void *value)
+{
+    Coroutine *co;
+    Coroutine *tmp;
+
+    QSLIST_FOREACH_SAFE(co, &alloc_pool, pool_next, tmp) {
+        QSLIST_REMOVE_HEAD(&alloc_pool, pool_next);
+        qemu_coroutine_delete(co);
+    }
+    alloc_pool_size = 0;
+}
+
+/* Frees alloc_pool when the thread exits; call before adding to it */
+static void coroutine_pool_register_cleanup(void)
+{
+    if (!coroutine_pool_cleanup_notifier.notify) {
+        coroutine_pool_cleanup_notifier.notify = coroutine_pool_cleanup;
+        qemu_thread_atexit_add(&coroutine_pool_cleanup_notifier);
+    }
+}
 
 Coroutine *qemu_coroutine_create(CoroutineEntry *entry)
 {
     Coroutine *co = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
-        qemu_mutex_lock(&pool_lock);
-        co = QSLIST_FIRST(&pool);
+        co = QSLIST_FIRST(&alloc_pool);
+        if (!co && atomic_read(&release_pool_size)) {
+            coroutine_pool_register_cleanup();
+
+            /* release_pool_size may be slightly off from the real length of
+             * release_pool while other threads push to it; it is only used
+             * as a heuristic, so this is harmless.
+             */
+            QSLIST_MOVE_ATOMIC(&alloc_pool, &release_pool);
+            alloc_pool_size = atomic_xchg(&release_pool_size, 0);
+            co = QSLIST_FIRST(&alloc_pool);
+        }
         if (co) {
-            QSLIST_REMOVE_HEAD(&pool, pool_next);
-            pool_size--;
+            QSLIST_REMOVE_HEAD(&alloc_pool, pool_next);
+            if (alloc_pool_size) {
+                alloc_pool_size--;
+            }
         }
-        qemu_mutex_unlock(&pool_lock);
     }
 
     if (!co) {
@@ -53,37 +98,44 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry)
 
 static void coroutine_delete(Coroutine *co)
 {
+    co->caller = NULL;
+
     if (CONFIG_COROUTINE_POOL) {
-        qemu_mutex_lock(&pool_lock);
-        if (pool_size < POOL_MAX_SIZE) {
-            QSLIST_INSERT_HEAD(&pool, co, pool_next);
-            co->caller = NULL;
-            pool_size++;
-            qemu_mutex_unlock(&pool_lock);
+        unsigned int max_size = atomic_read(&pool_max_size);
+
+        if (alloc_pool_size < max_size) {
+            coroutine_pool_register_cleanup();
+            QSLIST_INSERT_HEAD(&alloc_pool, co, pool_next);
+            alloc_pool_size++;
+            return;
+        }
+        if (atomic_read(&release_pool_size) < max_size) {
+            QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
+            atomic_inc(&release_pool_size);
             return;
         }
-        qemu_mutex_unlock(&pool_lock);
     }
 
     qemu_coroutine_delete(co);
 }
 
-static void __attribute__((constructor)) coroutine_pool_init(void)
+void qemu_coroutine_adjust_pool_size(int n)
 {
-    qemu_mutex_init(&pool_lock);
+    atomic_add(&pool_max_size, n);
 }
 
-static void __attribute__((destructor)) coroutine_pool_cleanup(void)
+static void __attribute__((destructor)) coroutine_pool_fini(void)
 {
     Coroutine *co;
     Coroutine *tmp;
 
-    QSLIST_FOREACH_SAFE(co, &pool, pool_next, tmp) {
-        QSLIST_REMOVE_HEAD(&pool, pool_next);
+    QSLIST_FOREACH_SAFE(co, &release_pool, pool_next, tmp) {
+        QSLIST_REMOVE_HEAD(&release_pool, pool_next);
         qemu_coroutine_delete(co);
     }
+    release_pool_size = 0;
 
-    qemu_mutex_destroy(&pool_lock);
+    coroutine_pool_cleanup(NULL, NULL);
 }
 
 static void coroutine_swap(Coroutine *from, Coroutine *to)
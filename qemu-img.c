@@ -47,6 +47,7 @@ typedef struct img_cmd_t {
 enum {
     OPTION_OUTPUT = 256,
     OPTION_BACKING_CHAIN = 257,
+    OPTION_BUFFER_SIZE = 258,
 };
 
 typedef enum OutputFormat {
@@ -102,6 +103,10 @@ static void help(void)
            "  '-q' use Quiet mode - do not print any output (except errors)\n"
            "  '-S' indicates the consecutive number of bytes that must contain only zeros\n"
            "       for qemu-img to create a sparse image during conversion\n"
+           "  '-m' number of parallel coroutines for convert (1 to 16, default 8)\n"
+           "  '-W' allow convert to write to the target out of order rather than\n"
+           "       sequentially\n"
+           "  '--buffer-size' size of each convert I/O request (default 2M)\n"
            "  '--output' takes the format in which the output must be done (human or json)\n"
            "\n"
            "Parameters to check subcommand:\n"
@@ -1114,17 +1119,300 @@ out3:
     return ret;
 }
 
+#define CONVERT_MAX_COROUTINES 16
+#define CONVERT_DEFAULT_COROUTINES 8
+#define CONVERT_MAX_BUF_SIZE (32 * 1024 * 1024)
+
+typedef struct ImgConvertState {
+    BlockDriverState **src;
+    int64_t *src_sectors;
+    int src_num;
+    int64_t total_sectors;
+    BlockDriverState *target;
+    bool has_zero_init;
+    bool target_has_backing;
+    bool wr_in_order;
+    int min_sparse;
+    int buf_sectors;
+
+    /* Next output sector to be claimed by a worker */
+    int64_t sector_num;
+    /* First output sector that has not been written yet (in-order mode) */
+    int64_t wr_offs;
+    CoMutex lock;
+    int num_coroutines;
+    int running_coroutines;
+    Coroutine *co[CONVERT_MAX_COROUTINES];
+    int64_t wait_sector_num[CONVERT_MAX_COROUTINES];
+    int ret;
+} ImgConvertState;
+
+/* Find the source image that contains output sector @sector_num */
+static int convert_select_part(ImgConvertState *s, int64_t sector_num,
+                               int64_t *src_cur_offset)
+{
+    int src_cur = 0;
+
+    *src_cur_offset = 0;
+    while (sector_num - *src_cur_offset >= s->src_sectors[src_cur]) {
+        *src_cur_offset += s->src_sectors[src_cur];
+        src_cur++;
+        assert(src_cur < s->src_num);
+    }
+    return src_cur;
+}
+
+/*
+ * Claim the next chunk of the output image for the calling worker.
+ *
+ * Returns the number of sectors claimed (stored in *sector_num) or a
+ * negative errno.  *copy is set to false if the chunk is unallocated in the
+ * source and the target's backing file already provides its contents.
+ */
+static int coroutine_fn convert_co_claim(ImgConvertState *s,
+                                         int64_t *sector_num, bool *copy)
+{
+    int64_t src_cur_offset;
+    int src_cur, n, n1, ret;
+
+    *sector_num = s->sector_num;
+    src_cur = convert_select_part(s, *sector_num, &src_cur_offset);
+
+    n = MIN(s->total_sectors - *sector_num, s->buf_sectors);
+    n = MIN(n, src_cur_offset + s->src_sectors[src_cur] - *sector_num);
+    *copy = true;
+
+    /* If the output image is being created as a copy on write image,
+       assume that sectors which are unallocated in the input image
+       are present in both the output's and input's base images (no
+       need to copy them). */
+    if (s->has_zero_init && s->target_has_backing) {
+        ret = bdrv_co_is_allocated(s->src[src_cur],
+                                   *sector_num - src_cur_offset, n, &n1);
+        if (ret < 0) {
+            error_report("error while reading metadata for sector "
+                         "%" PRId64 ": %s",
+                         *sector_num - src_cur_offset, strerror(-ret));
+            return ret;
+        }
+        n = n1;
+        *copy = ret;
+    }
+
+    s->sector_num += n;
+    return n;
+}
+
+static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
+                                        int nb_sectors, uint8_t *buf)
+{
+    QEMUIOVector qiov;
+    struct iovec iov;
+    int64_t src_cur_offset;
+    int src_cur, ret;
+
+    src_cur = convert_select_part(s, sector_num, &src_cur_offset);
+
+    iov.iov_base = buf;
+    iov.iov_len = nb_sectors * BDRV_SECTOR_SIZE;
+    qemu_iovec_init_external(&qiov, &iov, 1);
+
+    ret = bdrv_co_readv(s->src[src_cur], sector_num - src_cur_offset,
+                        nb_sectors, &qiov);
+    if (ret < 0) {
+        error_report("error while reading sector %" PRId64 ": %s",
+                     sector_num - src_cur_offset, strerror(-ret));
+    }
+    return ret;
+}
+
+static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
+                                         int nb_sectors, uint8_t *buf)
+{
+    QEMUIOVector qiov;
+    struct iovec iov;
+    int n, ret;
+
+    while (nb_sectors > 0) {
+        n = nb_sectors;
+
+        /* If the output image is being created as a copy on write image,
+           copy all sectors even the ones containing only NUL bytes,
+           because they may differ from the sectors in the base image.
+
+           If the output is to a host device, we also write out
+           sectors that are entirely 0, since whatever data was
+           already there is garbage, not 0s. */
+        if (!s->has_zero_init || s->target_has_backing ||
+            is_allocated_sectors_min(buf, nb_sectors, &n, s->min_sparse)) {
+            iov.iov_base = buf;
+            iov.iov_len = n * BDRV_SECTOR_SIZE;
+            qemu_iovec_init_external(&qiov, &iov, 1);
+
+            ret = bdrv_co_writev(s->target, sector_num, n, &qiov);
+            if (ret < 0) {
+                error_report("error while writing sector %" PRId64
+                             ": %s", sector_num, strerror(-ret));
+                return ret;
+            }
+        }
+        sector_num += n;
+        nb_sectors -= n;
+        buf += n * BDRV_SECTOR_SIZE;
+    }
+    return 0;
+}
+
+/* Let workers blocked on in-order writes notice that the copy failed */
+static void convert_wake_waiters(ImgConvertState *s)
+{
+    int i;
+
+    for (i = 0; i < s->num_coroutines; i++) {
+        if (s->co[i] && s->wait_sector_num[i] != -1) {
+            s->wait_sector_num[i] = -1;
+            qemu_coroutine_enter(s->co[i], NULL);
+        }
+    }
+}
+
+static void coroutine_fn convert_co_do_copy(void *opaque)
+{
+    ImgConvertState *s = opaque;
+    uint8_t *buf;
+    int64_t sector_num;
+    bool copy;
+    int index = -1;
+    int i, n, ret;
+
+    for (i = 0; i < s->num_coroutines; i++) {
+        if (s->co[i] == qemu_coroutine_self()) {
+            index = i;
+            break;
+        }
+    }
+    assert(index >= 0);
+
+    buf = qemu_blockalign(s->target, s->buf_sectors * BDRV_SECTOR_SIZE);
+
+    for (;;) {
+        qemu_co_mutex_lock(&s->lock);
+        if (s->ret != -EINPROGRESS || s->sector_num >= s->total_sectors) {
+            qemu_co_mutex_unlock(&s->lock);
+            break;
+        }
+        n = convert_co_claim(s, &sector_num, &copy);
+        qemu_co_mutex_unlock(&s->lock);
+        if (n < 0) {
+            ret = n;
+            goto fail;
+        }
+
+        if (copy) {
+            ret = convert_co_read(s, sector_num, n, buf);
+            if (ret < 0) {
+                goto fail;
+            }
+        }
+
+        if (s->wr_in_order) {
+            /* Keep writes in order: wait until all preceding chunks are
+             * written.  The worker that completes the chunk right before
+             * ours reenters us. */
+            while (s->wr_offs != sector_num) {
+                if (s->ret != -EINPROGRESS) {
+                    goto out;
+                }
+                s->wait_sector_num[index] = sector_num;
+                qemu_coroutine_yield();
+            }
+            s->wait_sector_num[index] = -1;
+        }
+
+        if (copy) {
+            ret = convert_co_write(s, sector_num, n, buf);
+            if (ret < 0) {
+                goto fail;
+            }
+        }
+
+        qemu_progress_print(100.0 * n / s->total_sectors, 100);
+
+        if (s->wr_in_order) {
+            s->wr_offs = sector_num + n;
+            for (i = 0; i < s->num_coroutines; i++) {
+                if (s->co[i] && s->wait_sector_num[i] == s->wr_offs) {
+                    qemu_coroutine_enter(s->co[i], NULL);
+                    break;
+                }
+            }
+        }
+    }
+    goto out;
+
+fail:
+    if (s->ret == -EINPROGRESS) {
+        s->ret = ret;
+    }
+out:
+    qemu_vfree(buf);
+    s->co[index] = NULL;
+    s->running_coroutines--;
+    if (s->ret != -EINPROGRESS) {
+        convert_wake_waiters(s);
+    }
+}
+
+/*
+ * Copy all source images to the target using s->num_coroutines concurrent
+ * workers.  Each worker claims a chunk of up to s->buf_sectors sectors,
+ * reads it and writes it out; unless s->wr_in_order is false, writes are
+ * issued in ascending order so that targets that grow sequentially (e.g.
+ * qcow2 on a host device) still get a linear layout.
+ */
+static int convert_do_copy(ImgConvertState *s)
+{
+    int i;
+
+    qemu_co_mutex_init(&s->lock);
+    s->sector_num = 0;
+    s->wr_offs = 0;
+    s->ret = -EINPROGRESS;
+
+    /* Create all workers before entering any of them: each one looks up
+     * its index in s->co[] */
+    for (i = 0; i < s->num_coroutines; i++) {
+        s->co[i] = qemu_coroutine_create(convert_co_do_copy);
+        s->wait_sector_num[i] = -1;
+        s->running_coroutines++;
+    }
+    for (i = 0; i < s->num_coroutines; i++) {
+        if (s->co[i]) {
+            qemu_coroutine_enter(s->co[i], s);
+        }
+    }
+
+    while (s->running_coroutines) {
+        qemu_aio_wait();
+    }
+
+    if (s->ret == -EINPROGRESS) {
+        s->ret = 0;
+    }
+    return s->ret;
+}
+
 static int img_convert(int argc, char **argv)
 {
-    int c, ret = 0, n, n1, bs_n, bs_i, compress, cluster_size, cluster_sectors;
+    int c, ret = 0, n, bs_n, bs_i, compress, cluster_size, cluster_sectors;
     int progress = 0, flags;
     const char *fmt, *out_fmt, *cache, *out_baseimg, *out_filename;
     BlockDriver *drv, *proto_drv;
     BlockDriverState **bs = NULL, *out_bs = NULL;
     int64_t total_sectors, nb_sectors, sector_num, bs_offset;
     uint64_t bs_sectors;
+    int64_t *bs_sectors_array = NULL;
     uint8_t * buf = NULL;
-    const uint8_t *buf1;
     BlockDriverInfo bdi;
     QEMUOptionParameter *param = NULL, *create_options = NULL;
     QEMUOptionParameter *out_baseimg_param;
@@ -1132,6 +1420,9 @@ static int img_convert(int argc, char **argv)
     const char *snapshot_name = NULL;
     float local_progress = 0;
     int min_sparse = 8; /* Need at least 4k of zeros for sparse detection */
+    int num_coroutines = CONVERT_DEFAULT_COROUTINES;
+    int64_t buf_size = IO_BUF_SIZE;
+    bool wr_in_order = true;
     bool quiet = false;
 
     fmt = NULL;
@@ -1140,7 +1431,14 @@ static int img_convert(int argc, char **argv)
     out_baseimg = NULL;
     compress = 0;
     for(;;) {
-        c = getopt(argc, argv, "f:O:B:s:hce6o:pS:t:q");
+        int option_index = 0;
+        static const struct option long_options[] = {
+            {"help", no_argument, 0, 'h'},
+            {"buffer-size", required_argument, 0, OPTION_BUFFER_SIZE},
+            {0, 0, 0, 0}
+        };
+        c = getopt_long(argc, argv, "f:O:B:s:hce6o:pS:t:qm:W",
+                        long_options, &option_index);
         if (c == -1) {
             break;
         }
@@ -1197,6 +1495,36 @@ static int img_convert(int argc, char **argv)
         case 'q':
             quiet = true;
             break;
+        case 'm':
+        {
+            char *end;
+            num_coroutines = strtol(optarg, &end, 10);
+            if (*end || num_coroutines < 1 ||
+                num_coroutines > CONVERT_MAX_COROUTINES) {
+                error_report("Invalid number of coroutines. Allowed number of"
+                             " coroutines is between 1 and %d",
+                             CONVERT_MAX_COROUTINES);
+                return 1;
+            }
+            break;
+        }
+        case 'W':
+            wr_in_order = false;
+            break;
+        case OPTION_BUFFER_SIZE:
+        {
+            char *end;
+            buf_size = strtosz_suffix(optarg, &end, STRTOSZ_DEFSUFFIX_B);
+            if (buf_size < BDRV_SECTOR_SIZE || *end ||
+                buf_size % BDRV_SECTOR_SIZE ||
+                buf_size > CONVERT_MAX_BUF_SIZE) {
+                error_report("Invalid buffer size specified. It must be a "
+                             "multiple of 512 bytes and at most %d MB",
+                             CONVERT_MAX_BUF_SIZE >> 20);
+                return 1;
+            }
+            break;
+        }
         }
     }
 
@@ -1229,6 +1557,7 @@ static int img_convert(int argc, char **argv)
     qemu_progress_print(0, 100);
 
     bs = g_malloc0(bs_n * sizeof(BlockDriverState *));
+    bs_sectors_array = g_malloc0(bs_n * sizeof(int64_t));
 
     total_sectors = 0;
     for (bs_i = 0; bs_i < bs_n; bs_i++) {
@@ -1240,6 +1569,7 @@ static int img_convert(int argc, char **argv)
             goto out;
         }
         bdrv_get_geometry(bs[bs_i], &bs_sectors);
+        bs_sectors_array[bs_i] = bs_sectors;
         total_sectors += bs_sectors;
     }
 
@@ -1361,9 +1691,8 @@ static int img_convert(int argc, char **argv)
     bs_i = 0;
     bs_offset = 0;
     bdrv_get_geometry(bs[0], &bs_sectors);
-    buf = qemu_blockalign(out_bs, IO_BUF_SIZE);
-
     if (compress) {
+        buf = qemu_blockalign(out_bs, IO_BUF_SIZE);
         ret = bdrv_get_info(out_bs, &bdi);
         if (ret < 0) {
             error_report("could not get block driver info");
@@ -1445,99 +1774,21 @@ static int img_convert(int argc, char **argv)
         /* signal EOF to align */
         bdrv_write_compressed(out_bs, 0, NULL, 0);
     } else {
-        int has_zero_init = bdrv_has_zero_init(out_bs);
-
-        sector_num = 0; // total number of sectors converted so far
-        nb_sectors = total_sectors - sector_num;
-        if (nb_sectors != 0) {
-            local_progress = (float)100 /
-                (nb_sectors / MIN(nb_sectors, IO_BUF_SIZE / 512));
-        }
-
-        for(;;) {
-            nb_sectors = total_sectors - sector_num;
-            if (nb_sectors <= 0) {
-                break;
-            }
-            if (nb_sectors >= (IO_BUF_SIZE / 512)) {
-                n = (IO_BUF_SIZE / 512);
-            } else {
-                n = nb_sectors;
-            }
-
-            while (sector_num - bs_offset >= bs_sectors) {
-                bs_i ++;
-                assert (bs_i < bs_n);
-                bs_offset += bs_sectors;
-                bdrv_get_geometry(bs[bs_i], &bs_sectors);
-                /* printf("changing part: sector_num=%" PRId64 ", bs_i=%d, "
-                  "bs_offset=%" PRId64 ", bs_sectors=%" PRId64 "\n",
-                   sector_num, bs_i, bs_offset, bs_sectors); */
-            }
-
-            if (n > bs_offset + bs_sectors - sector_num) {
-                n = bs_offset + bs_sectors - sector_num;
-            }
-
-            if (has_zero_init) {
-                /* If the output image is being created as a copy on write image,
-                   assume that sectors which are unallocated in the input image
-                   are present in both the output's and input's base images (no
-                   need to copy them). */
-                if (out_baseimg) {
-                    ret = bdrv_is_allocated(bs[bs_i], sector_num - bs_offset,
-                                            n, &n1);
-                    if (ret < 0) {
-                        error_report("error while reading metadata for sector "
-                                     "%" PRId64 ": %s",
-                                     sector_num - bs_offset, strerror(-ret));
-                        goto out;
-                    }
-                    if (!ret) {
-                        sector_num += n1;
-                        continue;
-                    }
-                    /* The next 'n1' sectors are allocated in the input image. Copy
-                       only those as they may be followed by unallocated sectors. */
-                    n = n1;
-                }
-            } else {
-                n1 = n;
-            }
+        ImgConvertState state = {
+            .src                = bs,
+            .src_sectors        = bs_sectors_array,
+            .src_num            = bs_n,
+            .total_sectors      = total_sectors,
+            .target             = out_bs,
+            .has_zero_init      = bdrv_has_zero_init(out_bs),
+            .target_has_backing = out_baseimg != NULL,
+            .wr_in_order        = wr_in_order,
+            .min_sparse         = min_sparse,
+            .buf_sectors        = buf_size / BDRV_SECTOR_SIZE,
+            .num_coroutines     = num_coroutines,
+        };
 
-            ret = bdrv_read(bs[bs_i], sector_num - bs_offset, buf, n);
-            if (ret < 0) {
-                error_report("error while reading sector %" PRId64 ": %s",
-                             sector_num - bs_offset, strerror(-ret));
-                goto out;
-            }
-            /* NOTE: at the same time we convert, we do not write zero
-               sectors to have a chance to compress the image. Ideally, we
-               should add a specific call to have the info to go faster */
-            buf1 = buf;
-            while (n > 0) {
-                /* If the output image is being created as a copy on write image,
-                   copy all sectors even the ones containing only NUL bytes,
-                   because they may differ from the sectors in the base image.
-
-                   If the output is to a host device, we also write out
-                   sectors that are entirely 0, since whatever data was
-                   already there is garbage, not 0s. */
-                if (!has_zero_init || out_baseimg ||
-                    is_allocated_sectors_min(buf1, n, &n1, min_sparse)) {
-                    ret = bdrv_write(out_bs, sector_num, buf1, n1);
-                    if (ret < 0) {
-                        error_report("error while writing sector %" PRId64
-                                     ": %s", sector_num, strerror(-ret));
-                        goto out;
-                    }
-                }
-                sector_num += n1;
-                n -= n1;
-                buf1 += n1 * 512;
-            }
-            qemu_progress_print(local_progress, 100);
-        }
+        ret = convert_do_copy(&state);
     }
 out:
     qemu_progress_end();
@@ -1555,6 +1806,7 @@ out:
         }
         g_free(bs);
     }
+    g_free(bs_sectors_array);
     if (ret) {
         return 1;
     }
@@ -19,6 +19,8 @@
 #include "qemu-common.h"
 #include "block/block.h"
 #include "block/nbd.h"
+#include "qemu/timer.h"
+#include "qemu/sockets.h"
 
 #include <stdarg.h>
 #include <stdio.h>
@@ -37,6 +39,9 @@
 #define QEMU_NBD_OPT_CACHE   1
 #define QEMU_NBD_OPT_AIO     2
 #define QEMU_NBD_OPT_DISCARD 3
+#define QEMU_NBD_OPT_BENCH   4
+
+#define BENCH_BLOCK_SIZE     4096
 
 static NBDExport *exp;
 static int verbose;
@@ -46,6 +51,7 @@ static int persistent = 0;
 static enum { RUNNING, TERMINATE, TERMINATING, TERMINATED } state;
 static int shared = 1;
 static int nb_fds;
+static int bench_time;
 
 static void usage(const char *name)
 {
@@ -64,6 +70,8 @@ static void usage(const char *name)
 "  -e, --shared=NUM     device can be shared by NUM clients (default '1')\n"
 "  -t, --persistent     don't exit on the last connection\n"
 "  -v, --verbose        display extra debugging information\n"
+"      --bench=SECONDS  measure random 4k reads over a local unix socket for\n"
+"                       SECONDS each at queue depth 1, 32 and 128, then exit\n"
 "\n"
 "Exposing part of the image:\n"
 "  -o, --offset=OFFSET  offset into the image\n"
@@ -265,6 +273,128 @@ out:
     return (void *) EXIT_FAILURE;
 }
 
+static int bench_send(int sock, int64_t *start, uint64_t handle,
+                      uint64_t nb_blocks)
+{
+    struct nbd_request request = {
+        .type = NBD_CMD_READ,
+        .handle = handle,
+        .from = (random() % nb_blocks) * BENCH_BLOCK_SIZE,
+        .len = BENCH_BLOCK_SIZE,
+    };
+
+    start[handle] = get_clock();
+    return nbd_send_request(sock, &request);
+}
+
+/* Keep @depth reads in flight for @seconds and report what we got */
+static int bench_run(int sock, off_t size, int depth)
+{
+    uint64_t nb_blocks = size / BENCH_BLOCK_SIZE;
+    int64_t *start = g_new(int64_t, depth);
+    uint8_t *buf = g_malloc(BENCH_BLOCK_SIZE);
+    struct nbd_reply reply;
+    int64_t begin, now, deadline, latency;
+    int64_t latency_total = 0, latency_max = 0;
+    uint64_t completed = 0;
+    int i, in_flight = 0;
+    int ret = -EIO;
+
+    begin = get_clock();
+    deadline = begin + bench_time * get_ticks_per_sec();
+    for (i = 0; i < depth; i++) {
+        if (bench_send(sock, start, i, nb_blocks) < 0) {
+            goto out;
+        }
+        in_flight++;
+    }
+
+    while (in_flight > 0) {
+        if (nbd_receive_reply(sock, &reply) < 0 || reply.handle >= depth) {
+            goto out;
+        }
+        if (reply.error) {
+            ret = -reply.error;
+            goto out;
+        }
+        if (nbd_wr_sync(sock, buf, BENCH_BLOCK_SIZE, true) !=
+            BENCH_BLOCK_SIZE) {
+            goto out;
+        }
+        in_flight--;
+
+        now = get_clock();
+        latency = now - start[reply.handle];
+        latency_total += latency;
+        latency_max = MAX(latency_max, latency);
+        completed++;
+
+        if (now < deadline) {
+            if (bench_send(sock, start, reply.handle, nb_blocks) < 0) {
+                goto out;
+            }
+            in_flight++;
+        }
+    }
+
+    now = get_clock();
+    printf("queue depth %3d: %10.0f IOPS, latency avg %8.1f us, "
+           "max %8.1f us\n", depth,
+           (double)completed * get_ticks_per_sec() / (now - begin),
+           latency_total / 1000.0 / completed, latency_max / 1000.0);
+    ret = 0;
+
+out:
+    g_free(buf);
+    g_free(start);
+    return ret;
+}
+
+static void *nbd_bench_thread(void *arg)
+{
+    static const int depths[] = { 1, 32, 128 };
+    off_t size;
+    size_t blocksize;
+    uint32_t nbdflags;
+    int sock;
+    int i, ret;
+
+    sock = unix_socket_outgoing(sockpath);
+    if (sock < 0) {
+        kill(getpid(), SIGTERM);
+        return (void *) EXIT_FAILURE;
+    }
+
+    ret = nbd_receive_negotiate(sock, NULL, &nbdflags, &size, &blocksize);
+
+    /* Negotiation leaves the socket non-blocking, but this thread simply
+     * waits for replies.
+     */
+    qemu_set_block(sock);
+    if (ret >= 0 && size < BENCH_BLOCK_SIZE) {
+        fprintf(stderr, "Image is too small for benchmarking\n");
+        ret = -EINVAL;
+    }
+
+    for (i = 0; ret >= 0 && i < ARRAY_SIZE(depths); i++) {
+        ret = bench_run(sock, size, depths[i]);
+        if (ret < 0) {
+            fprintf(stderr, "Benchmark failed: %s\n", strerror(-ret));
+        }
+    }
+
+    /* The server exits once its only client is gone */
+    if (ret >= 0) {
+        struct nbd_request request = { .type = NBD_CMD_DISC };
+        nbd_send_request(sock, &request);
+    }
+    close(sock);
+    if (ret < 0) {
+        return (void *) EXIT_FAILURE;
+    }
+    return (void *) EXIT_SUCCESS;
+}
+
 static int nbd_can_accept(void *opaque)
 {
     return nb_fds < shared;
@@ -333,6 +463,7 @@ int main(int argc, char **argv)
         { "aio", 1, NULL, QEMU_NBD_OPT_AIO },
 #endif
         { "discard", 1, NULL, QEMU_NBD_OPT_DISCARD },
+        { "bench", 1, NULL, QEMU_NBD_OPT_BENCH },
         { "shared", 1, NULL, 'e' },
         { "format", 1, NULL, 'f' },
         { "persistent", 0, NULL, 't' },
@@ -404,6 +535,12 @@ int main(int argc, char **argv)
                 errx(EXIT_FAILURE, "Invalid discard mode `%s'", optarg);
             }
             break;
+        case QEMU_NBD_OPT_BENCH:
+            bench_time = strtol(optarg, &end, 0);
+            if (*end || bench_time < 1) {
+                errx(EXIT_FAILURE, "Invalid benchmark time `%s'", optarg);
+            }
+            break;
         case 'b':
             bindto = optarg;
             break;
@@ -500,6 +637,15 @@ int main(int argc, char **argv)
 	return 0;
     }
 
+    if (bench_time) {
+        if (device || persistent) {
+            errx(EXIT_FAILURE, "--bench cannot be used with -c or -t");
+        }
+        if (sockpath == NULL) {
+            sockpath = g_strdup_printf("/tmp/qemu-nbd-bench-%d", getpid());
+        }
+    }
+
     if (device && !verbose) {
         int stderr_fd[2];
         pid_t pid;
@@ -600,10 +746,12 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    if (device) {
+    if (device || bench_time) {
         int ret;
 
-        ret = pthread_create(&client_thread, NULL, nbd_client_thread, device);
+        ret = pthread_create(&client_thread, NULL,
+                             device ? nbd_client_thread : nbd_bench_thread,
+                             device);
         if (ret != 0) {
             errx(EXIT_FAILURE, "Failed to create client thread: %s",
                  strerror(ret));
@@ -638,7 +786,7 @@ int main(int argc, char **argv)
         unlink(sockpath);
     }
 
-    if (device) {
+    if (device || bench_time) {
         void *ret;
         pthread_join(client_thread, &ret);
         exit(ret != NULL);
@@ -1407,6 +1407,7 @@ DEF("net", HAS_ARG, QEMU_OPTION_net,
     "         [,bootfile=f][,hostfwd=rule][,guestfwd=rule]"
 #ifndef _WIN32
                                              "[,smb=dir[,smbserver=addr]]\n"
+    "         [,thread=on|off]\n"
 #endif
     "                connect the user mode network stack to VLAN 'n', configure its\n"
     "                DHCP server and enabled optional services\n"
@@ -1454,8 +1455,12 @@ DEF("net", HAS_ARG, QEMU_OPTION_net,
     "                Use group 'groupname' and mode 'octalmode' to change default\n"
     "                ownership and permissions for communication port.\n"
 #endif
-    "-net dump[,vlan=n][,file=f][,len=n]\n"
+    "-net dump[,vlan=n][,file=f][,len=n][,ring=n][,filter=expr]\n"
+    "         [,rotate=n][,rotate-files=n]\n"
     "                dump traffic on vlan 'n' to file 'f' (max n bytes per packet)\n"
+    "                through a ring buffer of 'ring' bytes; 'filter' selects\n"
+    "                packets, e.g. 'arp|tcp:22'; start a new file every 'rotate'\n"
+    "                bytes and keep 'rotate-files' old ones\n"
     "-net none       use it alone to have zero network devices. If no -net option\n"
     "                is provided, the default is '-net nic -net user'\n", QEMU_ARCH_ALL)
 DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
@@ -1469,7 +1474,8 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "vde|"
 #endif
     "socket|"
-    "hubport],id=str[,option][,option][,...]\n", QEMU_ARCH_ALL)
+    "hubport|"
+    "dump],id=str[,option][,option][,...]\n", QEMU_ARCH_ALL)
 STEXI
 @item -net nic[,vlan=@var{n}][,macaddr=@var{mac}][,model=@var{type}] [,name=@var{name}][,addr=@var{addr}][,vectors=@var{v}]
 @findex -net
@@ -1630,6 +1636,13 @@ so that QEMU behaves similar to an inetd process for that virtual server:
 qemu -net 'user,guestfwd=tcp:10.0.2.100:1234-cmd:netcat 10.10.1.1 4321'
 @end example
 
+@item thread=on|off
+Run the network stack in a dedicated thread with its own poll loop instead of
+the main loop, so that socket traffic does not delay vCPU exits and device
+emulation. Default is off. Guest forwarding to a character device cannot be
+combined with this option; forwarding to a command (@var{cmd:command}) can.
+Not available on Windows hosts.
+
 @end table
 
 Note: Legacy stand-alone options -tftp, -bootp, -smb and -redir are still
@@ -1799,11 +1812,28 @@ The hubport netdev lets you connect a NIC to a QEMU "vlan" instead of a single
 netdev.  @code{-net} and @code{-device} with parameter @option{vlan} create the
 required hub automatically.
 
-@item -net dump[,vlan=@var{n}][,file=@var{file}][,len=@var{len}]
+@item -net dump[,vlan=@var{n}][,file=@var{file}][,len=@var{len}][,ring=@var{size}][,filter=@var{expr}][,rotate=@var{size}][,rotate-files=@var{n}]
+@item -netdev dump,id=@var{id},hubid=@var{n}[,file=@var{file}][,...]
 Dump network traffic on VLAN @var{n} to file @var{file} (@file{qemu-vlan0.pcap} by default).
 At most @var{len} bytes (64k by default) per packet are stored. The file format is
 libpcap, so it can be analyzed with tools such as tcpdump or Wireshark.
 
+Packets are copied into a buffer of @var{size} bytes (4M by default) and written
+to the file by a separate thread, so capturing does not slow down the network.
+Packets that arrive while the buffer is full are dropped; @code{info network}
+shows how many.
+
+@var{expr} is a list of terms separated by @code{|}; a packet is captured if it
+matches any of them.  The terms are @code{arp}, @code{ip}, @code{ip6},
+@code{icmp}, @code{icmp6}, @code{tcp} and @code{udp}; @code{tcp} and @code{udp}
+can be followed by @code{:@var{port}} to match a source or destination port.
+For example, @option{filter=arp|tcp:22} captures ARP and SSH traffic.
+
+With @option{rotate}, the capture moves to @file{@var{file}.1} once it would
+grow beyond @var{size} bytes and a new @var{file} is started.  Up to
+@var{n} old captures (1 by default) are kept as @file{@var{file}.1} to
+@file{@var{file}.@var{n}}, newest first.
+
 @item -net none
 Indicate that no network devices should be configured. It is used to
 override the default configuration (@option{-net nic -net user}) which
@@ -3148,6 +3178,24 @@ Create an new object of type @var{typename} setting properties
 in the order they are specified.  Note that the 'id'
 property must be set.  These objects are placed in the
 '/objects' path.
+
+@table @option
+@item -object iothread,id=@var{id}[,poll-max-ns=@var{ns}][,thread-pool-min=@var{min}][,thread-pool-max=@var{max}]
+
+Creates an event loop thread that devices can be bound to with their
+@option{iothread} property, e.g.
+@option{-device virtio-blk-pci,drive=drive0,iothread=@var{id}}.
+Several devices may share one iothread.  The host thread ID is reported by
+the @code{query-iothreads} QMP command, for example to pin it to a host CPU.
+
+The thread busy-polls its devices for up to @var{ns} nanoseconds before
+going to sleep (default 32768, 0 disables polling).
+
+Blocking work such as file I/O is handed to a pool of worker threads that
+belongs to the iothread.  At most @var{max} workers are started (default
+64); @var{min} of them stay alive while idle (default 0), which saves the
+thread creation cost on the first requests after a quiet period.
+@end table
 ETEXI
 
 DEF("msg", HAS_ARG, QEMU_OPTION_msg,
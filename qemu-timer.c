@@ -29,6 +29,7 @@
 #include "hw/hw.h"
 
 #include "qemu/timer.h"
+#include "qemu/thread.h"
 #ifdef CONFIG_POSIX
 #include <pthread.h>
 #endif
@@ -295,8 +296,15 @@ void qemu_free_timer(QEMUTimer *ts)
     g_free(ts);
 }
 
-/* stop a timer, but do not dealloc it */
-void qemu_del_timer(QEMUTimer *ts)
+/* Timers may be armed by threads other than the one running the main loop,
+ * for example by block drivers running in an AioContext of their own.
+ * Writers of the active_timers lists serialize on this lock; readers such as
+ * qemu_timer_expired() do not need it because the lists are updated in a
+ * signal-safe way.
+ */
+static QemuMutex active_timers_lock;
+
+static void qemu_timer_unlink(QEMUTimer *ts)
 {
     QEMUTimer **pt, *t;
 
@@ -315,13 +323,23 @@ void qemu_del_timer(QEMUTimer *ts)
     }
 }
 
+/* stop a timer, but do not dealloc it */
+void qemu_del_timer(QEMUTimer *ts)
+{
+    qemu_mutex_lock(&active_timers_lock);
+    qemu_timer_unlink(ts);
+    qemu_mutex_unlock(&active_timers_lock);
+}
+
 /* modify the current timer so that it will be fired when current_time
    >= expire_time. The corresponding callback will be called. */
 void qemu_mod_timer_ns(QEMUTimer *ts, int64_t expire_time)
 {
     QEMUTimer **pt, *t;
+    bool rearm;
 
-    qemu_del_timer(ts);
+    qemu_mutex_lock(&active_timers_lock);
+    qemu_timer_unlink(ts);
 
     /* add the timer in the sorted list */
     /* NOTE: this code must be signal safe because
@@ -337,9 +355,11 @@ void qemu_mod_timer_ns(QEMUTimer *ts, int64_t expire_time)
     ts->expire_time = expire_time;
     ts->next = *pt;
     *pt = ts;
+    rearm = pt == &ts->clock->active_timers;
+    qemu_mutex_unlock(&active_timers_lock);
 
     /* Rearm if necessary  */
-    if (pt == &ts->clock->active_timers) {
+    if (rearm) {
         if (!alarm_timer->pending) {
             qemu_rearm_alarm_timer(alarm_timer);
         }
@@ -382,13 +402,16 @@ void qemu_run_timers(QEMUClock *clock)
 
     current_time = qemu_get_clock_ns(clock);
     for(;;) {
+        qemu_mutex_lock(&active_timers_lock);
         ts = clock->active_timers;
         if (!qemu_timer_expired_ns(ts, current_time)) {
+            qemu_mutex_unlock(&active_timers_lock);
             break;
         }
         /* remove timer from the list before calling the callback */
         clock->active_timers = ts->next;
         ts->next = NULL;
+        qemu_mutex_unlock(&active_timers_lock);
 
         /* run the callback (the timer list can be modified) */
         ts->cb(ts->opaque);
@@ -433,6 +456,7 @@ void qemu_unregister_clock_reset_notifier(QEMUClock *clock, Notifier *notifier)
 void init_clocks(void)
 {
     if (!rt_clock) {
+        qemu_mutex_init(&active_timers_lock);
         rt_clock = qemu_new_clock(QEMU_CLOCK_REALTIME);
         vm_clock = qemu_new_clock(QEMU_CLOCK_VIRTUAL);
         host_clock = qemu_new_clock(QEMU_CLOCK_HOST);
@@ -917,7 +917,7 @@ EQMP
     {
         .name       = "drive-backup",
         .args_type  = "sync:s,device:B,target:s,speed:i?,mode:s?,format:s?,"
-                      "on-source-error:s?,on-target-error:s?",
+                      "bitmap:s?,on-source-error:s?,on-target-error:s?",
         .mhandler.cmd_new = qmp_marshal_input_drive_backup,
     },
 
@@ -944,11 +944,14 @@ Arguments:
             (json-string, optional)
 - "sync": what parts of the disk image should be copied to the destination;
   possibilities include "full" for all the disk, "top" for only the sectors
-  allocated in the topmost image, or "none" to only replicate new I/O
-  (MirrorSyncMode).
+  allocated in the topmost image, "none" to only replicate new I/O, or
+  "incremental" for the sectors marked in "bitmap" (MirrorSyncMode).
 - "mode": whether and how QEMU should create a new image
           (NewImageMode, optional, default 'absolute-paths')
 - "speed": the maximum speed, in bytes per second (json-int, optional)
+- "bitmap": the dirty bitmap to use with sync mode "incremental"; on success
+            it only records the writes made since the backup started
+            (json-string, optional)
 - "on-source-error": the action to take on an error on the source, default
                      'report'.  'stop' and 'enospc' can only be used
                      if the block device supports io-status.
@@ -963,6 +966,80 @@ Example:
                                                "sync": "full",
                                                "target": "backup.img" } }
 <- { "return": {} }
+EQMP
+
+    {
+        .name       = "block-dirty-bitmap-add",
+        .args_type  = "device:B,name:s,granularity:i?,persistent:b?",
+        .mhandler.cmd_new = qmp_marshal_input_block_dirty_bitmap_add,
+    },
+
+SQMP
+block-dirty-bitmap-add
+----------------------
+
+Create a named dirty bitmap that records the writes to a block device.
+
+Arguments:
+
+- "device": the name of the block device (json-string)
+- "name": the name of the new dirty bitmap (json-string)
+- "granularity": the bitmap granularity in bytes, a power of two between 512
+                 and 64M (json-int, optional, default is the cluster size)
+- "persistent": keep the bitmap in the image across restarts (json-bool,
+                optional, default false, only for qcow2 with compat=1.1)
+
+Example:
+-> { "execute": "block-dirty-bitmap-add", "arguments": { "device": "drive0",
+                                                         "name": "backup0",
+                                                         "persistent": true } }
+<- { "return": {} }
+EQMP
+
+    {
+        .name       = "block-dirty-bitmap-remove",
+        .args_type  = "device:B,name:s",
+        .mhandler.cmd_new = qmp_marshal_input_block_dirty_bitmap_remove,
+    },
+
+SQMP
+block-dirty-bitmap-remove
+-------------------------
+
+Delete a named dirty bitmap.
+
+Arguments:
+
+- "device": the name of the block device (json-string)
+- "name": the name of the dirty bitmap (json-string)
+
+Example:
+-> { "execute": "block-dirty-bitmap-remove", "arguments": { "device": "drive0",
+                                                            "name": "backup0" } }
+<- { "return": {} }
+EQMP
+
+    {
+        .name       = "block-dirty-bitmap-clear",
+        .args_type  = "device:B,name:s",
+        .mhandler.cmd_new = qmp_marshal_input_block_dirty_bitmap_clear,
+    },
+
+SQMP
+block-dirty-bitmap-clear
+------------------------
+
+Reset all bits of a named dirty bitmap.
+
+Arguments:
+
+- "device": the name of the block device (json-string)
+- "name": the name of the dirty bitmap (json-string)
+
+Example:
+-> { "execute": "block-dirty-bitmap-clear", "arguments": { "device": "drive0",
+                                                           "name": "backup0" } }
+<- { "return": {} }
 EQMP
 
     {
@@ -1907,6 +1984,10 @@ Each json-object contain the following:
     - "flush_total_time_ns": total time spend on cache flushes in nano-seconds (json-int)
     - "wr_highest_offset": Highest offset of a sector written since the
                            BlockDriverState has been opened (json-int)
+    - "rd_merged": number of read requests merged into another request
+                   (json-int)
+    - "wr_merged": number of write requests merged into another request
+                   (json-int)
 - "parent": Contains recursively the statistics of the underlying
             protocol (e.g. the host file for a qcow2 image). If there is
             no underlying protocol, this field is omitted
@@ -2045,6 +2126,54 @@ EQMP
         .mhandler.cmd_new = qmp_marshal_input_query_cpus,
     },
 
+SQMP
+query-iothreads
+---------------
+
+Returns a list of information about each iothread.
+
+Note this list excludes the QEMU main loop thread, which is not declared
+using the -object iothread command-line option.  It is always the main thread
+of the process.
+
+Return a json-array. Each iothread is represented by a json-object, which contains:
+
+- "id": name of iothread (json-str)
+- "thread-id": ID of the underlying host thread (json-int)
+- "poll-max-ns": maximum busy-polling time in nanoseconds (json-int)
+- "poll-hits": times busy-polling found work before blocking (json-int)
+- "poll-misses": times busy-polling gave up and blocked (json-int)
+
+Example:
+
+-> { "execute": "query-iothreads" }
+<- {
+      "return":[
+         {
+            "id":"iothread0",
+            "thread-id":3134,
+            "poll-max-ns":32768,
+            "poll-hits":1290,
+            "poll-misses":17
+         },
+         {
+            "id":"iothread1",
+            "thread-id":3135,
+            "poll-max-ns":0,
+            "poll-hits":0,
+            "poll-misses":0
+         }
+      ]
+   }
+
+EQMP
+
+    {
+        .name       = "query-iothreads",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_iothreads,
+    },
+
 SQMP
 query-pci
 ---------
@@ -3123,4 +3252,53 @@ Example:
       ]
    }
 
+EQMP
+
+    {
+        .name       = "query-tx-stats",
+        .args_type  = "name:s?",
+        .mhandler.cmd_new = qmp_marshal_input_query_tx_stats,
+    },
+
+SQMP
+query-tx-stats
+--------------
+
+Show transmit statistics.
+
+Returns a json-array with one entry per NIC queue (or per queue of the
+given NIC), returning an error if the given NIC doesn't exist, or given
+NIC doesn't support transmit statistics, or given net client isn't a NIC.
+
+Each array entry contains the following:
+
+- "name": net client name (json-string)
+- "queue-index": index of the queue (json-int)
+- "mode": transmit mitigation mode (one of 'timer', 'bh', 'adaptive')
+- "packets": packets transmitted (json-int)
+- "notifications": transmit notifications from the guest (json-int)
+- "flushes": times transmit requests were processed (json-int)
+- "packet-rate": packets per second over the last sampling interval
+                 (json-int)
+- "delay": current delay before transmitting, in ns (json-int)
+- "burst": current maximum number of packets per flush (json-int)
+
+Example:
+
+-> { "execute": "query-tx-stats", "arguments": { "name": "vnet0" } }
+<- { "return": [
+        {
+            "name": "vnet0",
+            "queue-index": 0,
+            "mode": "adaptive",
+            "packets": 1432876,
+            "notifications": 20391,
+            "flushes": 18022,
+            "packet-rate": 81243,
+            "delay": 150000,
+            "burst": 256
+        }
+      ]
+   }
+
 EQMP
@@ -176,6 +176,11 @@ void qmp_cont(Error **errp)
     if (runstate_check(RUN_STATE_INMIGRATE)) {
         autostart = 1;
     } else {
+        if (runstate_check(RUN_STATE_POSTMIGRATE)) {
+            /* Take the images back from the migration destination */
+            bdrv_clear_incoming_migration_all();
+            bdrv_invalidate_cache_all();
+        }
         vm_start();
     }
 }
@@ -89,7 +89,7 @@ static int icmp_send(struct socket *so, struct mbuf *m, int hlen)
     so->so_iptos = ip->ip_tos;
     so->so_type = IPPROTO_ICMP;
     so->so_state = SS_ISFCONNECTED;
-    so->so_expire = curtime + SO_EXPIRE;
+    so->so_expire = so->slirp->curtime + SO_EXPIRE;
 
     addr.sin_family = AF_INET;
     addr.sin_addr = so->so_faddr;
@@ -2,6 +2,7 @@
 #define _LIBSLIRP_H
 
 #include "qemu-common.h"
+#include "qemu/thread.h"
 
 struct Slirp;
 typedef struct Slirp Slirp;
@@ -21,6 +22,15 @@ void slirp_pollfds_fill(GArray *pollfds);
 
 void slirp_pollfds_poll(GArray *pollfds, int select_error);
 
+/* Instances with their own poll loop are skipped by the functions above;
+ * @lock must be held around every other call into such an instance.
+ */
+void slirp_set_own_loop(Slirp *slirp, QemuMutex *lock);
+void slirp_instance_pollfds_fill(Slirp *slirp, GArray *pollfds,
+                                 uint32_t *timeout);
+void slirp_instance_pollfds_poll(Slirp *slirp, GArray *pollfds,
+                                 int select_error);
+
 void slirp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len);
 
 /* you must provide the following functions: */
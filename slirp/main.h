@@ -30,7 +30,6 @@ extern int ctty_closed;
 
 extern char *slirp_tty;
 extern char *exec_shell;
-extern u_int curtime;
 extern struct in_addr loopback_addr;
 extern unsigned long loopback_mask;
 extern char *username;
@@ -63,6 +63,12 @@
 #define M_FREEROOM(m) (M_ROOM(m) - (m)->m_len)
 #define M_TRAILINGSPACE M_FREEROOM
 
+/*
+ * How much room there is in front of m_data
+ */
+#define M_LEADINGSPACE(m) ((m)->m_data - (((m)->m_flags & M_EXT) ? \
+                                          (m)->m_ext : (m)->m_dat))
+
 struct mbuf {
 	/* XXX should union some of these! */
 	/* header at beginning of each mbuf: */
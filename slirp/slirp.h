@@ -217,6 +217,15 @@ struct Slirp {
     int restricted;
     struct ex_list *exec_list;
 
+    /* timers */
+    u_int curtime;          /* time of the last poll, in ms */
+    u_int time_fasttimo;    /* non-zero if a tcp_fasttimo is wanted */
+    u_int last_slowtimo;
+    bool do_slowtimo;
+
+    /* set if this instance is polled by its own thread */
+    QemuMutex *lock;
+
     /* mbuf states */
     struct mbuf m_freelist, m_usedlist;
     int mbuf_alloced;
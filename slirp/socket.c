@@ -518,9 +518,9 @@ sorecvfrom(struct socket *so)
 	   */
 	    if (so->so_expire) {
 	      if (so->so_fport == htons(53))
-		so->so_expire = curtime + SO_EXPIREFAST;
+		so->so_expire = so->slirp->curtime + SO_EXPIREFAST;
 	      else
-		so->so_expire = curtime + SO_EXPIRE;
+		so->so_expire = so->slirp->curtime + SO_EXPIRE;
 	    }
 
 	    /*
@@ -573,7 +573,7 @@ sosendto(struct socket *so, struct mbuf *m)
 	 * but only if it's an expirable socket
 	 */
 	if (so->so_expire)
-		so->so_expire = curtime + SO_EXPIRE;
+		so->so_expire = slirp->curtime + SO_EXPIRE;
 	so->so_state &= SS_PERSISTENT_MASK;
 	so->so_state |= SS_ISFCONNECTED; /* So that it gets select()ed */
 	return 0;
@@ -0,0 +1,351 @@
+/*
+ * QTest testcase for the pcap network dump
+ *
+ * Frames are injected through a "-net socket" backend on the same VLAN
+ * as the dump client, and the capture files are parsed back.  Every frame
+ * carries a sequence number in the last two bytes of its source MAC.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <glib.h>
+
+#include "libqtest.h"
+#include "qemu-common.h"
+
+#define ETH_HLEN            14
+#define ETH_P_IP            0x0800
+#define ETH_P_ARP           0x0806
+#define ETH_P_IPV6          0x86dd
+
+#define PCAP_MAGIC          0xa1b2c3d4
+#define PCAP_FILE_HDR_LEN   24
+#define PCAP_PKT_HDR_LEN    16
+
+#define WAIT_TIMEOUT_US     (5 * 1000 * 1000)
+
+typedef struct CapturedPacket {
+    int seq;
+    uint32_t caplen;
+    uint32_t len;
+    uint16_t ethertype;
+} CapturedPacket;
+
+static char tmpdir[] = "/tmp/qtest-dump.XXXXXX";
+static int sock_fd;
+
+static int listen_local(int *port)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t addrlen = sizeof(addr);
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    g_assert(fd >= 0);
+    g_assert(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    g_assert(listen(fd, 1) == 0);
+    g_assert(getsockname(fd, (struct sockaddr *)&addr, &addrlen) == 0);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+/* Start QEMU with @dump_args and a socket backend on VLAN 0 */
+static void dump_start(const char *dump_args)
+{
+    int lfd, port;
+    char *args;
+
+    lfd = listen_local(&port);
+    args = g_strdup_printf("%s -net socket,vlan=0,connect=127.0.0.1:%d",
+                           dump_args, port);
+    qtest_start(args);
+    g_free(args);
+
+    sock_fd = accept(lfd, NULL, NULL);
+    g_assert(sock_fd >= 0);
+    close(lfd);
+}
+
+static void dump_stop(void)
+{
+    qtest_quit(global_qtest);
+    close(sock_fd);
+}
+
+static void send_frame(const uint8_t *frame, size_t size)
+{
+    uint8_t buf[4 + 2048];
+    size_t off = 0;
+    ssize_t n;
+
+    g_assert(size <= sizeof(buf) - 4);
+    stl_be_p(buf, size);
+    memcpy(buf + 4, frame, size);
+    while (off < size + 4) {
+        n = send(sock_fd, buf + off, size + 4 - off, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        g_assert_cmpint(n, >, 0);
+        off += n;
+    }
+}
+
+/* Build a frame of @size bytes; @ipproto and @port only apply to IP */
+static void send_packet(int seq, uint16_t ethertype, int ipproto, int port,
+                        size_t size)
+{
+    uint8_t frame[2048];
+    uint8_t *l3 = frame + ETH_HLEN;
+    uint8_t *l4 = NULL;
+
+    g_assert(size <= sizeof(frame));
+    memset(frame, 0xa5, size);
+    memset(frame, 0xff, 6);
+    frame[6] = 0x52;
+    frame[7] = 0x54;
+    frame[8] = 0x00;
+    frame[9] = 0x12;
+    stw_be_p(frame + 10, seq);
+    stw_be_p(frame + 12, ethertype);
+
+    if (ethertype == ETH_P_IP) {
+        l3[0] = 0x45;
+        stw_be_p(l3 + 6, 0);
+        l3[9] = ipproto;
+        l4 = l3 + 20;
+    } else if (ethertype == ETH_P_IPV6) {
+        l3[0] = 0x60;
+        l3[6] = ipproto;
+        l4 = l3 + 40;
+    }
+    if (l4) {
+        stw_be_p(l4, 40000);
+        stw_be_p(l4 + 2, port);
+    }
+
+    send_frame(frame, size);
+}
+
+static GArray *read_capture(const char *filename)
+{
+    GArray *pkts = g_array_new(FALSE, FALSE, sizeof(CapturedPacket));
+    gchar *buf;
+    gsize len, off;
+
+    if (!g_file_get_contents(filename, &buf, &len, NULL)) {
+        return pkts;
+    }
+    if (len < PCAP_FILE_HDR_LEN) {
+        g_free(buf);
+        return pkts;
+    }
+
+    g_assert_cmphex((uint32_t)ldl_p(buf), ==, PCAP_MAGIC);
+    for (off = PCAP_FILE_HDR_LEN; off + PCAP_PKT_HDR_LEN <= len; ) {
+        CapturedPacket p;
+        const uint8_t *data = (uint8_t *)buf + off + PCAP_PKT_HDR_LEN;
+
+        p.caplen = ldl_p(buf + off + 8);
+        p.len = ldl_p(buf + off + 12);
+        if (off + PCAP_PKT_HDR_LEN + p.caplen > len) {
+            /* partially written record */
+            break;
+        }
+        p.seq = lduw_be_p(data + 10);
+        p.ethertype = lduw_be_p(data + 12);
+        g_array_append_val(pkts, p);
+        off += PCAP_PKT_HDR_LEN + p.caplen;
+    }
+
+    g_free(buf);
+    return pkts;
+}
+
+/* The writer runs in the background; wait for @seq to reach the file */
+static void wait_for_seq(const char *filename, int seq)
+{
+    gint64 deadline = g_get_monotonic_time() + WAIT_TIMEOUT_US;
+
+    for (;;) {
+        GArray *pkts = read_capture(filename);
+        bool found = pkts->len &&
+            g_array_index(pkts, CapturedPacket, pkts->len - 1).seq == seq;
+
+        g_array_free(pkts, TRUE);
+        if (found) {
+            return;
+        }
+        g_assert(g_get_monotonic_time() < deadline);
+        g_usleep(10000);
+    }
+}
+
+static void test_capture(void)
+{
+    char *file = g_strdup_printf("%s/capture.pcap", tmpdir);
+    char *args = g_strdup_printf("-net dump,vlan=0,file=%s,len=100", file);
+    GArray *pkts;
+    int i;
+
+    dump_start(args);
+    for (i = 0; i < 200; i++) {
+        send_packet(i, ETH_P_ARP, 0, 0, 60 + i);
+    }
+    wait_for_seq(file, 199);
+    dump_stop();
+
+    pkts = read_capture(file);
+    g_assert_cmpint(pkts->len, ==, 200);
+    for (i = 0; i < 200; i++) {
+        CapturedPacket *p = &g_array_index(pkts, CapturedPacket, i);
+
+        g_assert_cmpint(p->seq, ==, i);
+        g_assert_cmpint(p->len, ==, 60 + i);
+        g_assert_cmpint(p->caplen, ==, MIN(60 + i, 100));
+    }
+
+    g_array_free(pkts, TRUE);
+    unlink(file);
+    g_free(args);
+    g_free(file);
+}
+
+static void test_filter(void)
+{
+    char *file = g_strdup_printf("%s/filter.pcap", tmpdir);
+    char *args = g_strdup_printf("-net dump,vlan=0,file=%s,"
+                                 "filter='arp|udp:53|icmp6'", file);
+    GArray *pkts;
+    static const int expected[] = { 0, 1, 3, 6, 7 };
+    int i;
+
+    dump_start(args);
+    send_packet(0, ETH_P_ARP, 0, 0, 60);
+    send_packet(1, ETH_P_IP, 17, 53, 100);
+    send_packet(2, ETH_P_IP, 17, 54, 100);
+    send_packet(3, ETH_P_IPV6, 17, 53, 100);
+    send_packet(4, ETH_P_IP, 6, 53, 100);
+    send_packet(5, ETH_P_IP, 58, 0, 100);
+    send_packet(6, ETH_P_IPV6, 58, 0, 100);
+    send_packet(7, ETH_P_ARP, 0, 0, 60);
+    wait_for_seq(file, 7);
+    dump_stop();
+
+    pkts = read_capture(file);
+    g_assert_cmpint(pkts->len, ==, ARRAY_SIZE(expected));
+    for (i = 0; i < ARRAY_SIZE(expected); i++) {
+        g_assert_cmpint(g_array_index(pkts, CapturedPacket, i).seq, ==,
+                        expected[i]);
+    }
+
+    g_array_free(pkts, TRUE);
+    unlink(file);
+    g_free(args);
+    g_free(file);
+}
+
+static void test_rotate(void)
+{
+    char *file = g_strdup_printf("%s/rotate.pcap", tmpdir);
+    char *args = g_strdup_printf("-net dump,vlan=0,file=%s,"
+                                 "rotate=4096,rotate-files=2", file);
+    char *names[4];
+    int i, j, seq;
+
+    names[0] = g_strdup_printf("%s.3", file);
+    names[1] = g_strdup_printf("%s.2", file);
+    names[2] = g_strdup_printf("%s.1", file);
+    names[3] = g_strdup(file);
+
+    /* 100 records of 216 bytes, 18 to a file */
+    dump_start(args);
+    for (i = 0; i < 100; i++) {
+        send_packet(i, ETH_P_ARP, 0, 0, 200);
+    }
+    wait_for_seq(file, 99);
+    dump_stop();
+
+    g_assert(access(names[0], F_OK) != 0);
+
+    /* Oldest to newest, the kept files hold consecutive packets */
+    seq = -1;
+    for (i = 1; i < 4; i++) {
+        GArray *pkts = read_capture(names[i]);
+        struct stat st;
+
+        g_assert(stat(names[i], &st) == 0);
+        g_assert_cmpint(st.st_size, <=, 4096);
+        g_assert_cmpint(pkts->len, >, 0);
+        for (j = 0; j < pkts->len; j++) {
+            int cur = g_array_index(pkts, CapturedPacket, j).seq;
+
+            g_assert(seq == -1 || cur == seq + 1);
+            seq = cur;
+        }
+        g_array_free(pkts, TRUE);
+        unlink(names[i]);
+    }
+    g_assert_cmpint(seq, ==, 99);
+
+    for (i = 0; i < 4; i++) {
+        g_free(names[i]);
+    }
+    g_free(args);
+    g_free(file);
+}
+
+static void test_netdev(void)
+{
+    char *file = g_strdup_printf("%s/netdev.pcap", tmpdir);
+    char *args = g_strdup_printf("-netdev dump,id=dump0,hubid=0,file=%s",
+                                 file);
+    GArray *pkts;
+
+    dump_start(args);
+    send_packet(0, ETH_P_ARP, 0, 0, 60);
+    wait_for_seq(file, 0);
+    dump_stop();
+
+    pkts = read_capture(file);
+    g_assert_cmpint(pkts->len, ==, 1);
+
+    g_array_free(pkts, TRUE);
+    unlink(file);
+    g_free(args);
+    g_free(file);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_assert(mkdtemp(tmpdir) != NULL);
+
+    qtest_add_func("/dump/capture", test_capture);
+    qtest_add_func("/dump/filter", test_filter);
+    qtest_add_func("/dump/rotate", test_rotate);
+    qtest_add_func("/dump/netdev", test_netdev);
+
+    ret = g_test_run();
+
+    rmdir(tmpdir);
+    return ret;
+}
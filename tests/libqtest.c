@@ -30,6 +30,8 @@
 
 #include "qemu/compiler.h"
 #include "qemu/osdep.h"
+#include "qapi/qmp/json-streamer.h"
+#include "qapi/qmp/json-parser.h"
 
 #define MAX_IRQ 256
 
@@ -335,6 +337,63 @@ void qtest_qmp(QTestState *s, const char *fmt, ...)
     va_end(ap);
 }
 
+typedef struct QMPResponseParser {
+    JSONMessageParser parser;
+    QDict *response;
+} QMPResponseParser;
+
+static void qmp_response(JSONMessageParser *parser, QList *tokens)
+{
+    QMPResponseParser *qmp = container_of(parser, QMPResponseParser, parser);
+    QObject *obj = json_parser_parse(tokens, NULL);
+
+    g_assert(obj && qobject_type(obj) == QTYPE_QDICT);
+    if (qdict_haskey(qobject_to_qdict(obj), "event")) {
+        qobject_decref(obj);
+        return;
+    }
+    qmp->response = qobject_to_qdict(obj);
+}
+
+QDict *qtest_qmpv_reply(QTestState *s, const char *fmt, va_list ap)
+{
+    QMPResponseParser qmp = { .response = NULL };
+
+    socket_sendf(s->qmp_fd, fmt, ap);
+
+    json_message_parser_init(&qmp.parser, qmp_response);
+    while (!qmp.response) {
+        ssize_t len;
+        char c;
+
+        len = read(s->qmp_fd, &c, 1);
+        if (len == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (len == -1 || len == 0) {
+            fprintf(stderr, "Broken pipe\n");
+            exit(1);
+        }
+
+        json_message_parser_feed(&qmp.parser, &c, 1);
+    }
+    json_message_parser_destroy(&qmp.parser);
+
+    return qmp.response;
+}
+
+QDict *qtest_qmp_reply(QTestState *s, const char *fmt, ...)
+{
+    va_list ap;
+    QDict *response;
+
+    va_start(ap, fmt);
+    response = qtest_qmpv_reply(s, fmt, ap);
+    va_end(ap);
+    return response;
+}
+
 const char *qtest_get_arch(void)
 {
     const char *qemu = getenv("QTEST_QEMU_BINARY");
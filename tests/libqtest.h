@@ -22,6 +22,7 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <sys/types.h>
+#include "qapi/qmp/qdict.h"
 
 typedef struct QTestState QTestState;
 
@@ -62,6 +63,31 @@ void qtest_qmp(QTestState *s, const char *fmt, ...);
  */
 void qtest_qmpv(QTestState *s, const char *fmt, va_list ap);
 
+/**
+ * qtest_qmp_reply:
+ * @s: #QTestState instance to operate on.
+ * @fmt...: QMP message to send to qemu
+ *
+ * Sends a QMP message to QEMU and waits for its response, skipping any
+ * asynchronous events that arrive first.
+ *
+ * Returns: The response; release it with QDECREF().
+ */
+QDict *qtest_qmp_reply(QTestState *s, const char *fmt, ...);
+
+/**
+ * qtest_qmpv_reply:
+ * @s: #QTestState instance to operate on.
+ * @fmt: QMP message to send to QEMU
+ * @ap: QMP message arguments
+ *
+ * Sends a QMP message to QEMU and waits for its response, skipping any
+ * asynchronous events that arrive first.
+ *
+ * Returns: The response; release it with QDECREF().
+ */
+QDict *qtest_qmpv_reply(QTestState *s, const char *fmt, va_list ap);
+
 /**
  * qtest_get_irq:
  * @s: #QTestState instance to operate on.
@@ -345,6 +371,24 @@ static inline void qmp(const char *fmt, ...)
     va_end(ap);
 }
 
+/**
+ * qmp_reply:
+ * @fmt...: QMP message to send to qemu
+ *
+ * Sends a QMP message to QEMU and returns its response, which must be
+ * released with QDECREF().
+ */
+static inline QDict *qmp_reply(const char *fmt, ...)
+{
+    va_list ap;
+    QDict *response;
+
+    va_start(ap, fmt);
+    response = qtest_qmpv_reply(global_qtest, fmt, ap);
+    va_end(ap);
+    return response;
+}
+
 /**
  * get_irq:
  * @num: Interrupt to observe.
@@ -70,9 +70,10 @@ def create_image(name, size):
 class VM(object):
     '''A QEMU VM'''
 
-    def __init__(self):
-        self._monitor_path = os.path.join(test_dir, 'qemu-mon.%d' % os.getpid())
-        self._qemu_log_path = os.path.join(test_dir, 'qemu-log.%d' % os.getpid())
+    def __init__(self, path_suffix=''):
+        name = '%d%s' % (os.getpid(), path_suffix)
+        self._monitor_path = os.path.join(test_dir, 'qemu-mon.' + name)
+        self._qemu_log_path = os.path.join(test_dir, 'qemu-log.' + name)
         self._args = qemu_args + ['-chardev',
                      'socket,id=mon,path=' + self._monitor_path,
                      '-mon', 'chardev=mon,mode=control',
@@ -112,6 +113,12 @@ class VM(object):
         self._args.append(','.join(options))
         return self
 
+    def add_incoming(self, uri):
+        '''Wait for an incoming migration from @uri'''
+        self._args.append('-incoming')
+        self._args.append(uri)
+        return self
+
     def launch(self):
         '''Launch the VM and establish a QMP connection'''
         devnull = open('/dev/null', 'rb')
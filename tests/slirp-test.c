@@ -0,0 +1,452 @@
+/*
+ * QTest testcase and throughput benchmark for the user mode network stack
+ *
+ * The test plays the guest: it is attached to a "-net user" stack through
+ * a "-net socket" backend on the same VLAN, answers ARP and runs a minimal
+ * TCP receiver on 10.0.2.15:5001.  A host thread connects to a hostfwd
+ * port and streams data to it, like "iperf -c" on the host against
+ * "iperf -s" in the guest.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <glib.h>
+
+#include "libqtest.h"
+#include "qemu-common.h"
+#include "qemu/thread.h"
+
+#define GUEST_IP            0x0a00020f  /* 10.0.2.15 */
+#define GUEST_PORT          5001
+#define GUEST_WINDOW        65535
+#define GUEST_MSS           1460
+
+#define TEST_BYTES          (4 * 1024 * 1024)
+#define PERF_BYTES          (256 * 1024 * 1024)
+
+/* The stream carries offset % PATTERN_LEN, which never lines up with
+ * segment boundaries.
+ */
+#define PATTERN_LEN         251
+
+#define ETH_HLEN            14
+#define ETH_P_IP            0x0800
+#define ETH_P_ARP           0x0806
+
+static const uint8_t guest_mac[6] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };
+
+typedef struct TestGuest {
+    int fd;                     /* "-net socket" stream */
+    uint8_t rbuf[128 * 1024];
+    size_t rlen;
+    size_t roff;
+
+    uint8_t host_mac[6];
+    uint32_t host_ip;
+    uint16_t host_port;
+    uint32_t snd_nxt;
+    uint32_t rcv_nxt;
+    bool established;
+    bool closed;
+    int unacked;
+
+    bool verify;
+    uint64_t received;
+} TestGuest;
+
+typedef struct TestSender {
+    QemuThread thread;
+    int port;
+    uint64_t bytes;
+} TestSender;
+
+static uint32_t csum_add(uint32_t sum, const uint8_t *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < len; i += 2) {
+        sum += (buf[i] << 8) | buf[i + 1];
+    }
+    if (len & 1) {
+        sum += buf[len - 1] << 8;
+    }
+    return sum;
+}
+
+static uint16_t csum_fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return ~sum;
+}
+
+static void guest_send(TestGuest *g, const uint8_t *frame, size_t size)
+{
+    uint8_t buf[4 + 128];
+    size_t off = 0;
+    ssize_t n;
+
+    g_assert(size <= sizeof(buf) - 4);
+    stl_be_p(buf, size);
+    memcpy(buf + 4, frame, size);
+    while (off < size + 4) {
+        n = send(g->fd, buf + off, size + 4 - off, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        g_assert_cmpint(n, >, 0);
+        off += n;
+    }
+}
+
+static void guest_send_arp_reply(TestGuest *g, const uint8_t *req)
+{
+    const uint8_t *rarp = req + ETH_HLEN;
+    uint8_t frame[60] = { 0 };
+    uint8_t *arp = frame + ETH_HLEN;
+
+    memcpy(frame, req + 6, 6);
+    memcpy(frame + 6, guest_mac, 6);
+    stw_be_p(frame + 12, ETH_P_ARP);
+
+    stw_be_p(arp, 1);                   /* ethernet */
+    stw_be_p(arp + 2, ETH_P_IP);
+    arp[4] = 6;
+    arp[5] = 4;
+    stw_be_p(arp + 6, 2);               /* reply */
+    memcpy(arp + 8, guest_mac, 6);
+    stl_be_p(arp + 14, GUEST_IP);
+    memcpy(arp + 18, rarp + 8, 10);     /* requester's hw and IP address */
+
+    guest_send(g, frame, sizeof(frame));
+}
+
+static void guest_send_tcp(TestGuest *g, uint8_t flags)
+{
+    int thlen = (flags & TH_SYN) ? 24 : 20;
+    uint8_t frame[ETH_HLEN + 20 + 24] = { 0 };
+    uint8_t *ip = frame + ETH_HLEN;
+    uint8_t *th = ip + 20;
+    uint32_t sum;
+
+    memcpy(frame, g->host_mac, 6);
+    memcpy(frame + 6, guest_mac, 6);
+    stw_be_p(frame + 12, ETH_P_IP);
+
+    ip[0] = 0x45;
+    stw_be_p(ip + 2, 20 + thlen);
+    ip[8] = 64;
+    ip[9] = IPPROTO_TCP;
+    stl_be_p(ip + 12, GUEST_IP);
+    stl_be_p(ip + 16, g->host_ip);
+    stw_be_p(ip + 10, csum_fold(csum_add(0, ip, 20)));
+
+    stw_be_p(th, GUEST_PORT);
+    stw_be_p(th + 2, g->host_port);
+    stl_be_p(th + 4, g->snd_nxt);
+    stl_be_p(th + 8, g->rcv_nxt);
+    th[12] = (thlen / 4) << 4;
+    th[13] = flags;
+    stw_be_p(th + 14, GUEST_WINDOW);
+    if (flags & TH_SYN) {
+        th[20] = 2;                     /* MSS option */
+        th[21] = 4;
+        stw_be_p(th + 22, GUEST_MSS);
+    }
+    sum = csum_add(0, ip + 12, 8) + IPPROTO_TCP + thlen;
+    stw_be_p(th + 16, csum_fold(csum_add(sum, th, thlen)));
+
+    guest_send(g, frame, ETH_HLEN + 20 + thlen);
+}
+
+static void guest_fill(TestGuest *g)
+{
+    ssize_t n;
+
+    if (g->roff) {
+        memmove(g->rbuf, g->rbuf + g->roff, g->rlen - g->roff);
+        g->rlen -= g->roff;
+        g->roff = 0;
+    }
+    do {
+        n = recv(g->fd, g->rbuf + g->rlen, sizeof(g->rbuf) - g->rlen, 0);
+    } while (n < 0 && errno == EINTR);
+    g_assert_cmpint(n, >, 0);
+    g->rlen += n;
+}
+
+static bool guest_frame_buffered(TestGuest *g)
+{
+    size_t avail = g->rlen - g->roff;
+
+    return avail >= 4 && avail >= 4 + ldl_be_p(g->rbuf + g->roff);
+}
+
+static bool guest_input_pending(TestGuest *g)
+{
+    struct pollfd pfd = { .fd = g->fd, .events = POLLIN };
+
+    return guest_frame_buffered(g) || poll(&pfd, 1, 0) > 0;
+}
+
+/* The frame stays valid until the next call */
+static const uint8_t *guest_recv(TestGuest *g, size_t *size)
+{
+    const uint8_t *frame;
+
+    while (!guest_frame_buffered(g)) {
+        guest_fill(g);
+    }
+    *size = ldl_be_p(g->rbuf + g->roff);
+    g_assert_cmpint(*size, <=, sizeof(g->rbuf) - 4);
+    frame = g->rbuf + g->roff + 4;
+    g->roff += 4 + *size;
+    return frame;
+}
+
+static void guest_check_data(TestGuest *g, const uint8_t *data, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (data[i] != (g->received + i) % PATTERN_LEN) {
+            g_assert_cmpint(data[i], ==, (g->received + i) % PATTERN_LEN);
+        }
+    }
+}
+
+static void guest_input_tcp(TestGuest *g, const uint8_t *frame,
+                            const uint8_t *ip, const uint8_t *th)
+{
+    int ihl = (ip[0] & 0xf) * 4;
+    int doff = (th[12] >> 4) * 4;
+    uint8_t flags = th[13];
+    uint32_t seq = ldl_be_p(th + 4);
+    size_t len = lduw_be_p(ip + 2) - ihl - doff;
+
+    g_assert(!(flags & TH_RST));
+
+    if (flags & TH_SYN) {
+        memcpy(g->host_mac, frame + 6, 6);
+        g->host_ip = ldl_be_p(ip + 12);
+        g->host_port = lduw_be_p(th);
+        g->rcv_nxt = seq + 1;
+        g->snd_nxt = 0x1000;
+        guest_send_tcp(g, TH_SYN | TH_ACK);
+        g->snd_nxt++;
+        g->established = true;
+        return;
+    }
+
+    if (len && seq == g->rcv_nxt) {
+        if (g->verify) {
+            guest_check_data(g, th + doff, len);
+        }
+        g->rcv_nxt += len;
+        g->received += len;
+        g->unacked++;
+    } else if (len) {
+        /* retransmission or reordering: ack what we have right away */
+        g->unacked = 2;
+    }
+
+    if ((flags & TH_FIN) && seq + len == g->rcv_nxt) {
+        g->rcv_nxt++;
+        guest_send_tcp(g, TH_FIN | TH_ACK);
+        g->snd_nxt++;
+        g->closed = true;
+        return;
+    }
+
+    /* ack every other segment, and whatever is left once we caught up */
+    if (g->unacked >= 2 || (g->unacked && !guest_input_pending(g))) {
+        guest_send_tcp(g, TH_ACK);
+        g->unacked = 0;
+    }
+}
+
+static void guest_input(TestGuest *g)
+{
+    const uint8_t *frame, *ip, *th;
+    size_t size;
+
+    frame = guest_recv(g, &size);
+    g_assert_cmpint(size, >=, ETH_HLEN);
+
+    switch (lduw_be_p(frame + 12)) {
+    case ETH_P_ARP:
+        /* request for the guest address */
+        if (lduw_be_p(frame + ETH_HLEN + 6) == 1 &&
+            ldl_be_p(frame + ETH_HLEN + 24) == GUEST_IP) {
+            guest_send_arp_reply(g, frame);
+        }
+        break;
+    case ETH_P_IP:
+        ip = frame + ETH_HLEN;
+        th = ip + (ip[0] & 0xf) * 4;
+        if (ip[9] == IPPROTO_TCP && ldl_be_p(ip + 16) == GUEST_IP &&
+            lduw_be_p(th + 2) == GUEST_PORT) {
+            guest_input_tcp(g, frame, ip, th);
+        }
+        break;
+    }
+}
+
+static void *sender_thread(void *opaque)
+{
+    TestSender *s = opaque;
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(s->port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    uint8_t *buf = g_malloc(65536 + PATTERN_LEN);
+    uint64_t off = 0;
+    ssize_t n;
+    int fd;
+    int i;
+
+    for (i = 0; i < 65536 + PATTERN_LEN; i++) {
+        buf[i] = i % PATTERN_LEN;
+    }
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    g_assert(fd >= 0);
+    g_assert(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+
+    while (off < s->bytes) {
+        n = send(fd, buf + off % PATTERN_LEN, MIN(65536, s->bytes - off), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        g_assert_cmpint(n, >, 0);
+        off += n;
+    }
+
+    close(fd);
+    g_free(buf);
+    return NULL;
+}
+
+static int listen_local(int *port)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t addrlen = sizeof(addr);
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    g_assert(fd >= 0);
+    g_assert(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    g_assert(listen(fd, 1) == 0);
+    g_assert(getsockname(fd, (struct sockaddr *)&addr, &addrlen) == 0);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+/* Stream @bytes from the host to the guest, returns the time it took */
+static double stream_to_guest(bool threaded, uint64_t bytes, bool verify)
+{
+    TestGuest *g = g_new0(TestGuest, 1);
+    TestSender sender;
+    double duration;
+    int net_port, fwd_port;
+    int lfd, fd;
+    int one = 1;
+    char *args;
+
+    lfd = listen_local(&net_port);
+
+    /* grab a free port for the forwarding rule */
+    fd = listen_local(&fwd_port);
+    close(fd);
+
+    args = g_strdup_printf("-net user,vlan=0,thread=%s,"
+                           "hostfwd=tcp:127.0.0.1:%d-10.0.2.15:%d "
+                           "-net socket,vlan=0,connect=127.0.0.1:%d",
+                           threaded ? "on" : "off",
+                           fwd_port, GUEST_PORT, net_port);
+    qtest_start(args);
+    g_free(args);
+
+    g->fd = accept(lfd, NULL, NULL);
+    g_assert(g->fd >= 0);
+    close(lfd);
+    /* ACKs are tiny writes, don't let Nagle hold them back */
+    setsockopt(g->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    g->verify = verify;
+
+    sender.port = fwd_port;
+    sender.bytes = bytes;
+    qemu_thread_create(&sender.thread, sender_thread, &sender,
+                       QEMU_THREAD_JOINABLE);
+
+    while (!g->established) {
+        guest_input(g);
+    }
+    g_test_timer_start();
+    while (!g->closed) {
+        guest_input(g);
+    }
+    duration = g_test_timer_elapsed();
+
+    qemu_thread_join(&sender.thread);
+    g_assert_cmpint(g->received, ==, bytes);
+
+    qtest_quit(global_qtest);
+    close(g->fd);
+    g_free(g);
+    return duration;
+}
+
+static void test_stream_main_loop(void)
+{
+    stream_to_guest(false, TEST_BYTES, true);
+}
+
+static void test_stream_thread(void)
+{
+    stream_to_guest(true, TEST_BYTES, true);
+}
+
+static void perf_stream(void)
+{
+    static const bool modes[] = { false, true };
+    double duration;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(modes); i++) {
+        duration = stream_to_guest(modes[i], PERF_BYTES, false);
+        g_test_message("thread=%s: %d MB in %f s, %.0f Mbit/s\n",
+                       modes[i] ? "on" : "off", PERF_BYTES >> 20, duration,
+                       (double)PERF_BYTES * 8 / duration / 1e6);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/slirp/hostfwd/stream/main-loop", test_stream_main_loop);
+    qtest_add_func("/slirp/hostfwd/stream/thread", test_stream_thread);
+    if (g_test_perf()) {
+        qtest_add_func("/slirp/perf/stream", perf_stream);
+    }
+
+    return g_test_run();
+}
@@ -76,6 +76,55 @@ static void event_ready_cb(EventNotifier *e)
     }
 }
 
+typedef struct {
+    EventNotifierTestData data;
+    bool ready;
+} PollTestData;
+
+static bool event_poll_cb(void *opaque)
+{
+    PollTestData *poll = container_of(opaque, PollTestData, data.e);
+
+    if (!poll->ready) {
+        return false;
+    }
+    poll->ready = false;
+    poll->data.n++;
+    poll->data.active--;
+    return true;
+}
+
+typedef struct {
+    QemuMutex start_lock;
+    bool thread_acquired;
+} AcquireTestData;
+
+static void *test_acquire_thread(void *opaque)
+{
+    AcquireTestData *data = opaque;
+
+    /* Wait for other thread to let us start */
+    qemu_mutex_lock(&data->start_lock);
+    qemu_mutex_unlock(&data->start_lock);
+
+    aio_context_acquire(ctx);
+    aio_context_release(ctx);
+
+    data->thread_acquired = true; /* success, we got here */
+
+    return NULL;
+}
+
+static void dummy_notifier_read(EventNotifier *unused)
+{
+    g_assert(false); /* should never be invoked */
+}
+
+static int dummy_notifier_flush(EventNotifier *unused)
+{
+    return 1;
+}
+
 /* Tests using aio_*.  */
 
 static void test_notify(void)
@@ -86,6 +135,38 @@ static void test_notify(void)
     g_assert(!aio_poll(ctx, false));
 }
 
+static void test_acquire(void)
+{
+    QemuThread thread;
+    EventNotifier notifier;
+    AcquireTestData data;
+
+    /* Dummy event notifier ensures aio_poll() will block */
+    event_notifier_init(&notifier, false);
+    aio_set_event_notifier(ctx, &notifier, dummy_notifier_read,
+                           dummy_notifier_flush);
+    g_assert(aio_poll(ctx, false)); /* consume aio_notify() */
+
+    qemu_mutex_init(&data.start_lock);
+    qemu_mutex_lock(&data.start_lock);
+    data.thread_acquired = false;
+
+    qemu_thread_create(&thread, test_acquire_thread,
+                       &data, QEMU_THREAD_JOINABLE);
+
+    /* Block in aio_poll(), let other thread kick us and acquire context */
+    aio_context_acquire(ctx);
+    qemu_mutex_unlock(&data.start_lock); /* let the thread run */
+    g_assert(aio_poll(ctx, true));
+    aio_context_release(ctx);
+
+    qemu_thread_join(&thread);
+    aio_set_event_notifier(ctx, &notifier, NULL, NULL);
+    event_notifier_cleanup(&notifier);
+
+    g_assert(data.thread_acquired);
+}
+
 static void test_bh_schedule(void)
 {
     BHTestData data = { .n = 0 };
@@ -291,6 +372,129 @@ static void test_flush_event_notifier(void)
     event_notifier_cleanup(&data.e);
 }
 
+static void test_poll_event_notifier(void)
+{
+    PollTestData poll = { .data = { .n = 0, .active = 3 } };
+    EventNotifierTestData *data = &poll.data;
+
+    event_notifier_init(&data->e, false);
+    aio_set_event_notifier(ctx, &data->e, event_ready_cb, event_active_cb);
+    aio_set_event_notifier_poll(ctx, &data->e, event_poll_cb);
+    aio_context_set_poll_params(ctx, 1000000000);
+    g_assert(aio_poll(ctx, false));
+
+    /* The window starts closed and opens after a short wait */
+    event_notifier_set(&data->e);
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(data->n, ==, 1);
+    g_assert_cmpint(ctx->poll_hits, ==, 0);
+    g_assert_cmpint(ctx->poll_ns, >, 0);
+
+    /* Work is now found by polling, without the notifier being set */
+    poll.ready = true;
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(data->n, ==, 2);
+    g_assert_cmpint(ctx->poll_hits, ==, 1);
+
+    /* Polling gives up and the notifier is dispatched */
+    event_notifier_set(&data->e);
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(data->n, ==, 3);
+    g_assert_cmpint(ctx->poll_hits, ==, 1);
+    g_assert_cmpint(ctx->poll_misses, ==, 1);
+
+    aio_context_set_poll_params(ctx, 0);
+    aio_set_event_notifier(ctx, &data->e, NULL, NULL);
+    g_assert(!aio_poll(ctx, false));
+    g_assert(!aio_poll(ctx, false));
+    event_notifier_cleanup(&data->e);
+}
+
+/* A handler whose io_flush returns 0 is not dispatched, even though its
+ * descriptor is ready and another handler keeps aio_poll() busy.
+ */
+static void test_flush_idle_event_notifier(void)
+{
+    EventNotifierTestData idle = { .n = 0, .active = 0 };
+    EventNotifierTestData dummy = { .n = 0, .active = 2 };
+
+    event_notifier_init(&idle.e, false);
+    aio_set_event_notifier(ctx, &idle.e, event_ready_cb, event_active_cb);
+    event_notifier_init(&dummy.e, false);
+    aio_set_event_notifier(ctx, &dummy.e, event_ready_cb, event_active_cb);
+    g_assert(aio_poll(ctx, false));
+
+    event_notifier_set(&idle.e);
+    event_notifier_set(&dummy.e);
+    g_assert(aio_poll(ctx, false));
+    g_assert_cmpint(dummy.n, ==, 1);
+    g_assert_cmpint(idle.n, ==, 0);
+
+    /* Once it has work, the pending event is picked up */
+    idle.active = 1;
+    g_assert(aio_poll(ctx, false));
+    g_assert_cmpint(idle.n, ==, 1);
+    g_assert_cmpint(dummy.n, ==, 1);
+
+    aio_set_event_notifier(ctx, &idle.e, NULL, NULL);
+    aio_set_event_notifier(ctx, &dummy.e, NULL, NULL);
+    event_notifier_cleanup(&idle.e);
+    event_notifier_cleanup(&dummy.e);
+}
+
+typedef struct {
+    QEMUBH *bh;
+    int64_t delay_ns;
+} ScheduleTestData;
+
+static void *schedule_bh_thread(void *opaque)
+{
+    ScheduleTestData *data = opaque;
+
+    g_usleep(data->delay_ns / 1000);
+    qemu_bh_schedule(data->bh);
+    return NULL;
+}
+
+/* A bottom half scheduled from another thread ends busy-polling right away,
+ * instead of after the polling window.
+ */
+static void test_poll_bh_schedule(void)
+{
+    PollTestData poll = { .data = { .n = 0, .active = 1 } };
+    BHTestData bh_data = { .n = 0 };
+    ScheduleTestData sched = { .delay_ns = 10000000 };
+    QemuThread thread;
+    int64_t start;
+
+    event_notifier_init(&poll.data.e, false);
+    aio_set_event_notifier(ctx, &poll.data.e, event_ready_cb,
+                           event_active_cb);
+    aio_set_event_notifier_poll(ctx, &poll.data.e, event_poll_cb);
+    aio_context_set_poll_params(ctx, 10000000000LL);
+    g_assert(aio_poll(ctx, false)); /* consume aio_notify() */
+
+    bh_data.bh = aio_bh_new(ctx, bh_test_cb, &bh_data);
+    sched.bh = bh_data.bh;
+    ctx->poll_ns = ctx->poll_max_ns;
+
+    start = g_get_monotonic_time();
+    qemu_thread_create(&thread, schedule_bh_thread, &sched,
+                       QEMU_THREAD_JOINABLE);
+    while (bh_data.n == 0) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(g_get_monotonic_time() - start, <,
+                    ctx->poll_max_ns / 2000);
+    qemu_thread_join(&thread);
+
+    qemu_bh_delete(bh_data.bh);
+    aio_context_set_poll_params(ctx, 0);
+    aio_set_event_notifier(ctx, &poll.data.e, NULL, NULL);
+    while (aio_poll(ctx, false));
+    event_notifier_cleanup(&poll.data.e);
+}
+
 static void test_wait_event_notifier_noflush(void)
 {
     EventNotifierTestData data = { .n = 0 };
@@ -637,6 +841,7 @@ int main(int argc, char **argv)
 
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/aio/notify",                  test_notify);
+    g_test_add_func("/aio/acquire",                 test_acquire);
     g_test_add_func("/aio/bh/schedule",             test_bh_schedule);
     g_test_add_func("/aio/bh/schedule10",           test_bh_schedule10);
     g_test_add_func("/aio/bh/cancel",               test_bh_cancel);
@@ -648,6 +853,9 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/wait",              test_wait_event_notifier);
     g_test_add_func("/aio/event/wait/no-flush-cb",  test_wait_event_notifier_noflush);
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
+    g_test_add_func("/aio/event/poll",              test_poll_event_notifier);
+    g_test_add_func("/aio/event/flush-idle",        test_flush_idle_event_notifier);
+    g_test_add_func("/aio/bh/poll-schedule",        test_poll_bh_schedule);
 
     g_test_add_func("/aio-gsource/notify",                  test_source_notify);
     g_test_add_func("/aio-gsource/flush",                   test_source_flush);
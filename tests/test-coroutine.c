@@ -13,6 +13,7 @@
 
 #include <glib.h>
 #include "block/coroutine.h"
+#include "qemu/thread.h"
 
 /*
  * Check that qemu_in_coroutine() works
@@ -150,6 +151,46 @@ static void test_lifecycle(void)
     g_assert(done); /* expect done to be true (second time) */
 }
 
+/*
+ * Check that coroutines can be created and recycled from several threads
+ */
+
+enum {
+    NUM_THREADS = 4,
+};
+
+static void *lifecycle_thread(void *opaque)
+{
+    unsigned int i;
+
+    for (i = 0; i < 1000; i++) {
+        NestData nd = {
+            .n_enter  = 0,
+            .n_return = 0,
+            .max      = 128,
+        };
+
+        test_lifecycle();
+        qemu_coroutine_enter(qemu_coroutine_create(nest), &nd);
+        g_assert_cmpint(nd.n_return, ==, nd.max);
+    }
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    QemuThread threads[NUM_THREADS];
+    unsigned int i;
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        qemu_thread_create(&threads[i], lifecycle_thread, NULL,
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < NUM_THREADS; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+}
+
 /*
  * Lifecycle benchmark
  */
@@ -202,6 +243,104 @@ static void perf_nesting(void)
         maxcycles, maxnesting, duration);
 }
 
+/*
+ * Multithreaded lifecycle benchmark
+ */
+
+static void *perf_lifecycle_thread(void *opaque)
+{
+    unsigned int i, max = *(unsigned int *)opaque;
+    Coroutine *coroutine;
+
+    for (i = 0; i < max; i++) {
+        coroutine = qemu_coroutine_create(empty_coroutine);
+        qemu_coroutine_enter(coroutine, NULL);
+    }
+    return NULL;
+}
+
+static void perf_lifecycle_threads(void)
+{
+    QemuThread threads[NUM_THREADS];
+    unsigned int i, max;
+    double duration;
+
+    max = 1000000;
+
+    g_test_timer_start();
+    for (i = 0; i < NUM_THREADS; i++) {
+        qemu_thread_create(&threads[i], perf_lifecycle_thread, &max,
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < NUM_THREADS; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("Lifecycle %u iterations in %u threads: %f s\n",
+        max, NUM_THREADS, duration);
+}
+
+/*
+ * Yield benchmark
+ */
+
+static void coroutine_fn yield_loop(void *opaque)
+{
+    unsigned int *counter = opaque;
+
+    while ((*counter) > 0) {
+        (*counter)--;
+        qemu_coroutine_yield();
+    }
+}
+
+static void perf_yield(void)
+{
+    unsigned int i, maxcycles;
+    double duration;
+
+    maxcycles = 100000000;
+    i = maxcycles;
+    Coroutine *coroutine = qemu_coroutine_create(yield_loop);
+
+    g_test_timer_start();
+    while (i > 0) {
+        qemu_coroutine_enter(coroutine, &i);
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("Yield %u iterations: %f s\n",
+        maxcycles, duration);
+}
+
+/*
+ * Baseline for the benchmarks above: a plain, non-inlined function call
+ */
+
+static __attribute__((noinline)) void dummy(unsigned *i)
+{
+    (*i)--;
+}
+
+static void perf_baseline(void)
+{
+    unsigned int i, maxcycles;
+    double duration;
+
+    maxcycles = 100000000;
+    i = maxcycles;
+
+    g_test_timer_start();
+    while (i > 0) {
+        dummy(&i);
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("Function call %u iterations: %f s\n",
+        maxcycles, duration);
+}
+
 
 int main(int argc, char **argv)
 {
@@ -211,9 +350,13 @@ int main(int argc, char **argv)
     g_test_add_func("/basic/nesting", test_nesting);
     g_test_add_func("/basic/self", test_self);
     g_test_add_func("/basic/in_coroutine", test_in_coroutine);
+    g_test_add_func("/basic/threads", test_threads);
     if (g_test_perf()) {
         g_test_add_func("/perf/lifecycle", perf_lifecycle);
+        g_test_add_func("/perf/lifecycle-threads", perf_lifecycle_threads);
         g_test_add_func("/perf/nesting", perf_nesting);
+        g_test_add_func("/perf/yield", perf_yield);
+        g_test_add_func("/perf/function-call", perf_baseline);
     }
     return g_test_run();
 }
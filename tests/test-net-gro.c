@@ -0,0 +1,325 @@
+/*
+ * Receive-side TCP segment coalescing unit tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include "qemu-common.h"
+#include "net/gro.h"
+#include "net/eth.h"
+#include "net/checksum.h"
+
+#define MSS         1448
+#define HDR_LEN     (sizeof(struct eth_header) + sizeof(struct ip_header) + \
+                     sizeof(tcp_header))
+
+typedef struct Delivered {
+    struct virtio_net_hdr hdr;
+    bool has_hdr;
+    uint8_t *buf;
+    size_t size;
+} Delivered;
+
+typedef struct TestNIC {
+    Delivered frames[64];
+    int count;
+    bool full;
+} TestNIC;
+
+static ssize_t test_deliver(void *opaque, const struct virtio_net_hdr *hdr,
+                            const uint8_t *buf, size_t size)
+{
+    TestNIC *nic = opaque;
+    Delivered *d;
+
+    if (nic->full) {
+        return 0;
+    }
+    g_assert(nic->count < ARRAY_SIZE(nic->frames));
+    d = &nic->frames[nic->count++];
+    d->has_hdr = hdr != NULL;
+    if (hdr) {
+        d->hdr = *hdr;
+    }
+    d->buf = g_memdup(buf, size);
+    d->size = size;
+    return size;
+}
+
+static void test_nic_reset(TestNIC *nic)
+{
+    int i;
+
+    for (i = 0; i < nic->count; i++) {
+        g_free(nic->frames[i].buf);
+    }
+    nic->count = 0;
+}
+
+/* Build an Ethernet/IPv4/TCP frame with valid checksums; the payload
+ * byte at stream offset n is (uint8_t)n so merged data can be checked. */
+static size_t build_tcp(uint8_t *frame, uint16_t sport, uint32_t seq,
+                        size_t payload, uint16_t flags)
+{
+    struct eth_header *eh = (struct eth_header *)frame;
+    struct ip_header *iph = (struct ip_header *)(eh + 1);
+    tcp_header *th = (tcp_header *)(iph + 1);
+    uint8_t *data = (uint8_t *)(th + 1);
+    size_t i;
+
+    memset(frame, 0, HDR_LEN);
+    memcpy(eh->h_dest, "\x52\x54\x00\x12\x34\x56", ETH_ALEN);
+    memcpy(eh->h_source, "\x52\x55\x0a\x00\x02\x02", ETH_ALEN);
+    eh->h_proto = cpu_to_be16(ETH_P_IP);
+
+    iph->ip_ver_len = 0x45;
+    iph->ip_len = cpu_to_be16(sizeof(*iph) + sizeof(*th) + payload);
+    iph->ip_off = cpu_to_be16(IP_DF);
+    iph->ip_ttl = 64;
+    iph->ip_p = IP_PROTO_TCP;
+    iph->ip_src = cpu_to_be32(0x0a000202);
+    iph->ip_dst = cpu_to_be32(0x0a00020f);
+    eth_fix_ip4_checksum(iph, sizeof(*iph));
+
+    th->th_sport = cpu_to_be16(sport);
+    th->th_dport = cpu_to_be16(22);
+    th->th_seq = cpu_to_be32(seq);
+    th->th_ack = cpu_to_be32(1000);
+    th->th_offset_flags = cpu_to_be16((5 << 12) | flags);
+    th->th_win = cpu_to_be16(8192);
+
+    for (i = 0; i < payload; i++) {
+        data[i] = seq + i;
+    }
+
+    net_checksum_calculate(frame, HDR_LEN + payload);
+    return HDR_LEN + payload;
+}
+
+static void check_payload(const Delivered *d, uint32_t seq, size_t payload)
+{
+    size_t i;
+
+    g_assert_cmpint(d->size, ==, HDR_LEN + payload);
+    for (i = 0; i < payload; i++) {
+        g_assert_cmpint(d->buf[HDR_LEN + i], ==, (uint8_t)(seq + i));
+    }
+}
+
+static void test_coalesce(void)
+{
+    static uint8_t frame[HDR_LEN + MSS];
+    static uint8_t full[HDR_LEN + 4 * MSS];
+    TestNIC nic = {};
+    NetGRO *gro = net_gro_new(test_deliver, &nic);
+    const Delivered *d;
+    struct ip_header *iph;
+    size_t size;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        size = build_tcp(frame, 1234, i * MSS, MSS, TH_ACK);
+        g_assert_cmpint(net_gro_receive(gro, frame, size), ==, size);
+    }
+    g_assert_cmpint(nic.count, ==, 0);
+    g_assert(net_gro_pending(gro));
+
+    g_assert(net_gro_flush(gro));
+    g_assert(!net_gro_pending(gro));
+    g_assert_cmpint(nic.count, ==, 1);
+
+    d = &nic.frames[0];
+    check_payload(d, 0, 4 * MSS);
+    g_assert(d->has_hdr);
+    g_assert_cmpint(d->hdr.gso_type, ==, VIRTIO_NET_HDR_GSO_TCPV4);
+    g_assert_cmpint(d->hdr.flags, ==, VIRTIO_NET_HDR_F_NEEDS_CSUM);
+    g_assert_cmpint(d->hdr.gso_size, ==, MSS);
+    g_assert_cmpint(d->hdr.hdr_len, ==, HDR_LEN);
+    g_assert_cmpint(d->hdr.csum_start, ==, HDR_LEN - sizeof(tcp_header));
+    g_assert_cmpint(d->hdr.csum_offset, ==, offsetof(tcp_header, th_sum));
+
+    iph = PKT_GET_IP_HDR(d->buf);
+    g_assert_cmpint(be16_to_cpu(iph->ip_len), ==, d->size - 14);
+    g_assert_cmpint(net_raw_checksum((uint8_t *)iph, sizeof(*iph)), ==, 0);
+
+    /* Completing the partial checksum must give the real one */
+    memcpy(full, d->buf, d->size);
+    net_checksum_calculate(full, d->size);
+    g_assert_cmpint(net_raw_checksum(d->buf + d->hdr.csum_start,
+                                     d->size - d->hdr.csum_start), ==,
+                    lduw_be_p(full + d->hdr.csum_start + d->hdr.csum_offset));
+
+    test_nic_reset(&nic);
+    net_gro_free(gro);
+}
+
+static void test_single_segment(void)
+{
+    static uint8_t frame[HDR_LEN + MSS];
+    TestNIC nic = {};
+    NetGRO *gro = net_gro_new(test_deliver, &nic);
+    size_t size;
+
+    size = build_tcp(frame, 1234, 0, MSS, TH_ACK);
+    net_gro_receive(gro, frame, size);
+    g_assert(net_gro_flush(gro));
+
+    g_assert_cmpint(nic.count, ==, 1);
+    g_assert(nic.frames[0].has_hdr);
+    g_assert_cmpint(nic.frames[0].hdr.gso_type, ==, VIRTIO_NET_HDR_GSO_NONE);
+    g_assert_cmpint(nic.frames[0].hdr.flags, ==, VIRTIO_NET_HDR_F_DATA_VALID);
+    g_assert(!memcmp(nic.frames[0].buf, frame, size));
+
+    test_nic_reset(&nic);
+    net_gro_free(gro);
+}
+
+static void test_push_and_short(void)
+{
+    static uint8_t frame[HDR_LEN + MSS];
+    TestNIC nic = {};
+    NetGRO *gro = net_gro_new(test_deliver, &nic);
+    size_t size;
+
+    /* A short segment ends the flow right away */
+    size = build_tcp(frame, 1234, 0, MSS, TH_ACK);
+    net_gro_receive(gro, frame, size);
+    size = build_tcp(frame, 1234, MSS, 100, TH_ACK);
+    net_gro_receive(gro, frame, size);
+    g_assert_cmpint(nic.count, ==, 1);
+    check_payload(&nic.frames[0], 0, MSS + 100);
+
+    /* So does PSH */
+    size = build_tcp(frame, 1234, MSS + 100, MSS, TH_ACK);
+    net_gro_receive(gro, frame, size);
+    size = build_tcp(frame, 1234, 2 * MSS + 100, MSS, TH_ACK | TH_PUSH);
+    net_gro_receive(gro, frame, size);
+    g_assert_cmpint(nic.count, ==, 2);
+    check_payload(&nic.frames[1], MSS + 100, 2 * MSS);
+    g_assert(!net_gro_pending(gro));
+
+    test_nic_reset(&nic);
+    net_gro_free(gro);
+}
+
+static void test_ordering(void)
+{
+    static uint8_t frame[HDR_LEN + MSS];
+    TestNIC nic = {};
+    NetGRO *gro = net_gro_new(test_deliver, &nic);
+    uint8_t arp[60] = {};
+    size_t size;
+
+    /* Non-IP frames pass straight through without a header */
+    arp[12] = 0x08;
+    arp[13] = 0x06;
+    size = build_tcp(frame, 1234, 0, MSS, TH_ACK);
+    net_gro_receive(gro, frame, size);
+    g_assert_cmpint(net_gro_receive(gro, arp, sizeof(arp)), ==, sizeof(arp));
+    g_assert_cmpint(nic.count, ==, 1);
+    g_assert(!nic.frames[0].has_hdr);
+    g_assert_cmpint(nic.frames[0].size, ==, sizeof(arp));
+
+    /* A FIN for the held flow pushes the held data out first */
+    size = build_tcp(frame, 1234, MSS, 0, TH_ACK | TH_FIN);
+    net_gro_receive(gro, frame, size);
+    g_assert_cmpint(nic.count, ==, 3);
+    check_payload(&nic.frames[1], 0, MSS);
+    g_assert(!nic.frames[2].has_hdr);
+    g_assert_cmpint(nic.frames[2].size, ==, HDR_LEN);
+
+    /* A gap in the sequence space starts a new flow */
+    size = build_tcp(frame, 1234, 0, MSS, TH_ACK);
+    net_gro_receive(gro, frame, size);
+    size = build_tcp(frame, 1234, 3 * MSS, MSS, TH_ACK);
+    net_gro_receive(gro, frame, size);
+    g_assert_cmpint(nic.count, ==, 4);
+    check_payload(&nic.frames[3], 0, MSS);
+    g_assert(net_gro_flush(gro));
+    check_payload(&nic.frames[4], 3 * MSS, MSS);
+
+    /* Distinct flows are held side by side */
+    size = build_tcp(frame, 1, 0, MSS, TH_ACK);
+    net_gro_receive(gro, frame, size);
+    size = build_tcp(frame, 2, 0, MSS, TH_ACK);
+    net_gro_receive(gro, frame, size);
+    size = build_tcp(frame, 1, MSS, MSS, TH_ACK);
+    net_gro_receive(gro, frame, size);
+    g_assert_cmpint(nic.count, ==, 5);
+    g_assert(net_gro_flush(gro));
+    g_assert_cmpint(nic.count, ==, 7);
+    check_payload(&nic.frames[5], 0, 2 * MSS);
+    check_payload(&nic.frames[6], 0, MSS);
+
+    test_nic_reset(&nic);
+    net_gro_free(gro);
+}
+
+static void test_bad_csum(void)
+{
+    static uint8_t frame[HDR_LEN + MSS];
+    TestNIC nic = {};
+    NetGRO *gro = net_gro_new(test_deliver, &nic);
+    size_t size;
+
+    size = build_tcp(frame, 1234, 0, MSS, TH_ACK);
+    net_gro_receive(gro, frame, size);
+    size = build_tcp(frame, 1234, MSS, MSS, TH_ACK);
+    frame[HDR_LEN] ^= 0xff;
+    net_gro_receive(gro, frame, size);
+
+    /* Left for the guest to verify and drop */
+    g_assert_cmpint(nic.count, ==, 2);
+    check_payload(&nic.frames[0], 0, MSS);
+    g_assert(!nic.frames[1].has_hdr);
+    g_assert(!net_gro_pending(gro));
+
+    test_nic_reset(&nic);
+    net_gro_free(gro);
+}
+
+static void test_backpressure(void)
+{
+    static uint8_t frame[HDR_LEN + MSS];
+    TestNIC nic = {};
+    NetGRO *gro = net_gro_new(test_deliver, &nic);
+    size_t size;
+
+    size = build_tcp(frame, 1234, 0, MSS, TH_ACK);
+    net_gro_receive(gro, frame, size);
+
+    nic.full = true;
+    g_assert(!net_gro_flush(gro));
+    g_assert(net_gro_pending(gro));
+
+    /* The held flow still grows... */
+    size = build_tcp(frame, 1234, MSS, MSS, TH_ACK);
+    g_assert_cmpint(net_gro_receive(gro, frame, size), ==, size);
+
+    /* ...but nothing may overtake it while the NIC is full */
+    size = build_tcp(frame, 1234, 5 * MSS, MSS, TH_ACK);
+    g_assert_cmpint(net_gro_receive(gro, frame, size), ==, 0);
+
+    nic.full = false;
+    g_assert(net_gro_flush(gro));
+    g_assert_cmpint(nic.count, ==, 1);
+    check_payload(&nic.frames[0], 0, 2 * MSS);
+
+    test_nic_reset(&nic);
+    net_gro_free(gro);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/gro/coalesce", test_coalesce);
+    g_test_add_func("/net/gro/single-segment", test_single_segment);
+    g_test_add_func("/net/gro/push-and-short", test_push_and_short);
+    g_test_add_func("/net/gro/ordering", test_ordering);
+    g_test_add_func("/net/gro/bad-csum", test_bad_csum);
+    g_test_add_func("/net/gro/backpressure", test_backpressure);
+    return g_test_run();
+}
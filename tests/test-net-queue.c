@@ -0,0 +1,313 @@
+/*
+ * NetQueue unit tests
+ *
+ * net/queue.c is linked on its own; the delivery functions from net/net.c
+ * are replaced by a receiver that records packets and can refuse them.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include "qemu-common.h"
+#include "qemu/iov.h"
+#include "net/net.h"
+#include "net/queue.h"
+
+/* Default queue limit, which packets with a sent callback may exceed by
+ * QUEUE_HEADROOM */
+#define QUEUE_MAXLEN    10000
+#define QUEUE_HEADROOM  1024
+
+typedef struct Delivered {
+    NetClientState *sender;
+    uint32_t seq;
+    size_t size;
+} Delivered;
+
+typedef struct TestReceiver {
+    NetQueue *queue;
+    bool blocked;
+    GArray *delivered;
+    /* Sent from the delivery handler, as a backend looping back would */
+    int resend_count;
+    uint32_t resend_seq;
+} TestReceiver;
+
+static NetClientState sender_a, sender_b;
+static int sent_cb_count;
+static bool can_send = true;
+
+static void send_seq(TestReceiver *r, NetClientState *sender, uint32_t seq,
+                     size_t size, NetPacketSent *sent_cb, ssize_t expect);
+
+int qemu_can_send_packet(NetClientState *nc)
+{
+    return can_send;
+}
+
+ssize_t qemu_deliver_packet(NetClientState *sender,
+                            unsigned flags,
+                            const uint8_t *data,
+                            size_t size,
+                            void *opaque)
+{
+    TestReceiver *r = opaque;
+    Delivered d;
+    int i;
+
+    if (r->blocked) {
+        return 0;
+    }
+    d.sender = sender;
+    d.seq = ldl_p(data);
+    d.size = size;
+    g_assert_cmpint(data[size - 1], ==, (uint8_t)d.seq);
+    g_array_append_val(r->delivered, d);
+
+    for (i = 0; i < r->resend_count; i++) {
+        send_seq(r, sender, r->resend_seq++, 64, NULL, 0);
+    }
+    r->resend_count = 0;
+    return size;
+}
+
+ssize_t qemu_deliver_packet_iov(NetClientState *sender,
+                                unsigned flags,
+                                const struct iovec *iov,
+                                int iovcnt,
+                                void *opaque)
+{
+    size_t size = iov_size(iov, iovcnt);
+    uint8_t *buf = g_malloc(size);
+    ssize_t ret;
+
+    iov_to_buf(iov, iovcnt, 0, buf, size);
+    ret = qemu_deliver_packet(sender, flags, buf, size, opaque);
+    g_free(buf);
+    return ret;
+}
+
+int qemu_deliver_packet_iov_batch(NetClientState *sender,
+                                  unsigned flags,
+                                  const NetPacketIOV *pkts,
+                                  int count,
+                                  void *opaque)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (!qemu_deliver_packet_iov(sender, flags, pkts[i].iov,
+                                     pkts[i].iovcnt, opaque)) {
+            break;
+        }
+    }
+    return i;
+}
+
+static void test_sent_cb(NetClientState *sender, ssize_t ret)
+{
+    g_assert(ret > 0);
+    sent_cb_count++;
+}
+
+static TestReceiver *receiver_new(void)
+{
+    TestReceiver *r = g_new0(TestReceiver, 1);
+
+    r->queue = qemu_new_net_queue(r);
+    r->delivered = g_array_new(FALSE, FALSE, sizeof(Delivered));
+    sent_cb_count = 0;
+    can_send = true;
+    return r;
+}
+
+static void receiver_free(TestReceiver *r)
+{
+    qemu_del_net_queue(r->queue);
+    g_array_free(r->delivered, TRUE);
+    g_free(r);
+}
+
+/* Send a packet carrying @seq; the last byte checks the payload survived */
+static void send_seq(TestReceiver *r, NetClientState *sender, uint32_t seq,
+                     size_t size, NetPacketSent *sent_cb, ssize_t expect)
+{
+    uint8_t *buf = g_malloc0(size);
+    ssize_t ret;
+
+    stl_p(buf, seq);
+    buf[size - 1] = seq;
+    ret = qemu_net_queue_send(r->queue, sender, 0, buf, size, sent_cb);
+    g_assert_cmpint(ret, ==, expect);
+    g_free(buf);
+}
+
+static void check_delivered(TestReceiver *r, uint32_t first, uint32_t count)
+{
+    uint32_t i;
+
+    g_assert_cmpint(r->delivered->len, ==, count);
+    for (i = 0; i < count; i++) {
+        g_assert_cmpint(g_array_index(r->delivered, Delivered, i).seq, ==,
+                        first + i);
+    }
+}
+
+static void check_stats(TestReceiver *r, uint32_t depth, uint32_t max_depth,
+                        uint64_t queued, uint64_t dropped)
+{
+    NetQueueStats stats;
+
+    qemu_net_queue_get_stats(r->queue, &stats);
+    g_assert_cmpint(stats.depth, ==, depth);
+    g_assert_cmpint(stats.max_depth, ==, max_depth);
+    g_assert_cmpint(stats.queued, ==, queued);
+    g_assert_cmpint(stats.dropped, ==, dropped);
+}
+
+static void test_ring(void)
+{
+    TestReceiver *r = receiver_new();
+    /* Small, exact-size and oversized buffers */
+    static const size_t sizes[] = { 60, 2048, 2049, 9000, NET_BUFSIZE + 1 };
+    uint32_t seq;
+
+    /* Delivered directly while the receiver accepts packets */
+    send_seq(r, &sender_a, 0, 64, NULL, 64);
+    check_delivered(r, 0, 1);
+    check_stats(r, 0, 0, 0, 0);
+    g_array_set_size(r->delivered, 0);
+
+    /* Move the indices off zero so that the ring wraps when it grows */
+    r->blocked = true;
+    for (seq = 0; seq < 40; seq++) {
+        send_seq(r, &sender_a, seq, sizes[seq % ARRAY_SIZE(sizes)], NULL, 0);
+    }
+    r->blocked = false;
+    g_assert(qemu_net_queue_flush(r->queue));
+    check_delivered(r, 0, 40);
+    g_array_set_size(r->delivered, 0);
+
+    r->blocked = true;
+    for (seq = 0; seq < 300; seq++) {
+        send_seq(r, &sender_a, seq, sizes[seq % ARRAY_SIZE(sizes)], NULL, 0);
+    }
+    check_stats(r, 300, 300, 340, 0);
+    g_assert(!qemu_net_queue_empty(r->queue));
+
+    /* A refused packet stays at the head */
+    g_assert(!qemu_net_queue_flush(r->queue));
+    check_stats(r, 300, 300, 340, 0);
+
+    r->blocked = false;
+    g_assert(qemu_net_queue_flush(r->queue));
+    check_delivered(r, 0, 300);
+    for (seq = 0; seq < 300; seq++) {
+        g_assert_cmpint(g_array_index(r->delivered, Delivered, seq).size, ==,
+                        sizes[seq % ARRAY_SIZE(sizes)]);
+    }
+    check_stats(r, 0, 300, 340, 0);
+    g_assert(qemu_net_queue_empty(r->queue));
+
+    receiver_free(r);
+}
+
+static void test_grow_during_flush(void)
+{
+    TestReceiver *r = receiver_new();
+    uint32_t seq;
+
+    /* Fill the initial ring completely */
+    r->blocked = true;
+    for (seq = 0; seq < 64; seq++) {
+        send_seq(r, &sender_a, seq, 64, NULL, 0);
+    }
+
+    /* Delivering the first packet queues enough to grow the ring twice,
+     * behind the packets that are still waiting */
+    r->blocked = false;
+    r->resend_count = 100;
+    r->resend_seq = 64;
+    g_assert(qemu_net_queue_flush(r->queue));
+
+    check_delivered(r, 0, 164);
+    check_stats(r, 0, 164, 164, 0);
+
+    receiver_free(r);
+}
+
+static void test_purge(void)
+{
+    TestReceiver *r = receiver_new();
+    uint32_t seq;
+
+    r->blocked = true;
+    for (seq = 0; seq < 200; seq++) {
+        send_seq(r, seq % 3 ? &sender_a : &sender_b, seq, 64, test_sent_cb, 0);
+    }
+    qemu_net_queue_purge(r->queue, &sender_b);
+    check_stats(r, 133, 200, 200, 0);
+
+    /* The kept packets are compacted in order and the queue still works */
+    send_seq(r, &sender_a, 200, 64, NULL, 0);
+    r->blocked = false;
+    g_assert(qemu_net_queue_flush(r->queue));
+
+    g_assert_cmpint(r->delivered->len, ==, 134);
+    for (seq = 0; seq < 134; seq++) {
+        Delivered *d = &g_array_index(r->delivered, Delivered, seq);
+
+        g_assert(d->sender == &sender_a);
+        g_assert_cmpint(d->seq, ==, seq == 133 ? 200 : seq + seq / 2 + 1);
+    }
+    /* Purged packets never get their callback */
+    g_assert_cmpint(sent_cb_count, ==, 133);
+
+    receiver_free(r);
+}
+
+static void test_drop(void)
+{
+    TestReceiver *r = receiver_new();
+    uint32_t seq;
+
+    /* The backend cannot send at all, so everything is queued */
+    can_send = false;
+    for (seq = 0; seq < QUEUE_MAXLEN; seq++) {
+        send_seq(r, &sender_a, seq, 64, NULL, 0);
+    }
+
+    /* Without a callback the packet is dropped and reported as sent */
+    send_seq(r, &sender_a, seq, 64, NULL, 64);
+    check_stats(r, QUEUE_MAXLEN, QUEUE_MAXLEN, QUEUE_MAXLEN, 1);
+
+    /* With a callback it may use the headroom... */
+    for (; seq < QUEUE_MAXLEN + QUEUE_HEADROOM; seq++) {
+        send_seq(r, &sender_a, seq, 64, test_sent_cb, 0);
+    }
+
+    /* ...but is dropped beyond it, and the callback is never called */
+    send_seq(r, &sender_a, seq, 64, test_sent_cb, 64);
+    check_stats(r, seq, seq, seq, 2);
+
+    can_send = true;
+    g_assert(qemu_net_queue_flush(r->queue));
+    check_delivered(r, 0, seq);
+    g_assert_cmpint(sent_cb_count, ==, QUEUE_HEADROOM);
+
+    receiver_free(r);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/net/queue/ring", test_ring);
+    g_test_add_func("/net/queue/grow-during-flush", test_grow_during_flush);
+    g_test_add_func("/net/queue/purge", test_purge);
+    g_test_add_func("/net/queue/drop", test_drop);
+
+    return g_test_run();
+}
@@ -29,6 +29,36 @@ static int long_cb(void *opaque)
     return 0;
 }
 
+static int concurrent;
+static int peak_concurrent;
+static int rendezvous_ms;
+
+/* Returns once data->n requests are running at the same time, or after
+ * rendezvous_ms.  Counts the peak number of requests running in parallel.
+ */
+static int rendezvous_cb(void *opaque)
+{
+    WorkerTestData *data = opaque;
+    int want = data->n;
+    int now = atomic_fetch_inc(&concurrent) + 1;
+    int peak, i;
+
+    while ((peak = atomic_read(&peak_concurrent)) < now &&
+           atomic_cmpxchg(&peak_concurrent, peak, now) != peak) {
+        /* retry */
+    }
+    for (i = 0; i < rendezvous_ms && atomic_read(&peak_concurrent) < want; i++) {
+        g_usleep(1000);
+    }
+    atomic_dec(&concurrent);
+    return 0;
+}
+
+static int noop_cb(void *opaque)
+{
+    return 0;
+}
+
 static void done_cb(void *opaque, int ret)
 {
     WorkerTestData *data = opaque;
@@ -201,6 +231,121 @@ static void test_cancel(void)
     }
 }
 
+static void test_thread_limits(void)
+{
+    WorkerTestData data[8];
+    int i;
+
+    /* Four workers must be able to run at once, but never more.  */
+    aio_context_set_thread_pool_params(ctx, 4, 4);
+    concurrent = peak_concurrent = 0;
+    rendezvous_ms = 5000;
+    for (i = 0; i < 8; i++) {
+        data[i].n = 4;
+        data[i].ret = -EINPROGRESS;
+        thread_pool_submit_aio(pool, rendezvous_cb, &data[i],
+                               done_cb, &data[i]);
+    }
+    active = 8;
+    while (active > 0) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(peak_concurrent, ==, 4);
+
+    /* Shrinking the pool serializes requests, even though more idle
+     * threads than that are still around.
+     */
+    aio_context_set_thread_pool_params(ctx, 0, 1);
+    concurrent = peak_concurrent = 0;
+    rendezvous_ms = 20;
+    for (i = 0; i < 8; i++) {
+        data[i].n = 2;
+        data[i].ret = -EINPROGRESS;
+        thread_pool_submit_aio(pool, rendezvous_cb, &data[i],
+                               done_cb, &data[i]);
+    }
+    active = 8;
+    while (active > 0) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(peak_concurrent, ==, 1);
+    for (i = 0; i < 8; i++) {
+        g_assert_cmpint(data[i].ret, ==, 0);
+    }
+
+    aio_context_set_thread_pool_params(ctx, 0,
+                                       THREAD_POOL_MAX_THREADS_DEFAULT);
+}
+
+#define PERF_LATENCY_REQS       20000
+#define PERF_THROUGHPUT_REQS    500000
+#define PERF_THROUGHPUT_DEPTH   256
+
+static int perf_submitted;
+
+static void perf_done_cb(void *opaque, int ret)
+{
+    active--;
+    if (perf_submitted < PERF_THROUGHPUT_REQS) {
+        perf_submitted++;
+        active++;
+        thread_pool_submit_aio(pool, noop_cb, NULL, perf_done_cb, NULL);
+    }
+}
+
+static void perf_latency(void)
+{
+    gint64 start, end;
+    int i;
+
+    /* Warm up, so that thread creation is not measured */
+    aio_context_set_thread_pool_params(ctx, 1,
+                                       THREAD_POOL_MAX_THREADS_DEFAULT);
+    test_submit_aio();
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < PERF_LATENCY_REQS; i++) {
+        perf_submitted = PERF_THROUGHPUT_REQS;
+        active = 1;
+        thread_pool_submit_aio(pool, noop_cb, NULL, perf_done_cb, NULL);
+        while (active > 0) {
+            aio_poll(ctx, true);
+        }
+    }
+    end = g_get_monotonic_time();
+
+    g_test_message("%d requests one at a time: %.2f us per round trip\n",
+                   PERF_LATENCY_REQS,
+                   (double)(end - start) / PERF_LATENCY_REQS);
+    aio_context_set_thread_pool_params(ctx, 0,
+                                       THREAD_POOL_MAX_THREADS_DEFAULT);
+}
+
+static void perf_throughput(void)
+{
+    gint64 start, end;
+    int i;
+
+    test_submit_many();
+
+    start = g_get_monotonic_time();
+    perf_submitted = 0;
+    active = 0;
+    for (i = 0; i < PERF_THROUGHPUT_DEPTH; i++) {
+        perf_submitted++;
+        active++;
+        thread_pool_submit_aio(pool, noop_cb, NULL, perf_done_cb, NULL);
+    }
+    while (active > 0) {
+        aio_poll(ctx, true);
+    }
+    end = g_get_monotonic_time();
+
+    g_test_message("%d requests, depth %d: %.0f requests/s\n",
+                   PERF_THROUGHPUT_REQS, PERF_THROUGHPUT_DEPTH,
+                   PERF_THROUGHPUT_REQS * 1e6 / (end - start));
+}
+
 int main(int argc, char **argv)
 {
     int ret;
@@ -214,6 +359,11 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-co", test_submit_co);
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
     g_test_add_func("/thread-pool/cancel", test_cancel);
+    g_test_add_func("/thread-pool/thread-limits", test_thread_limits);
+    if (g_test_perf()) {
+        g_test_add_func("/thread-pool/perf/latency", perf_latency);
+        g_test_add_func("/thread-pool/perf/throughput", perf_throughput);
+    }
 
     ret = g_test_run();
 
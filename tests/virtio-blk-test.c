@@ -0,0 +1,613 @@
+/*
+ * QTest testcase for virtio-blk multiqueue
+ *
+ * Copyright Red Hat, Inc. 2013
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "libqtest.h"
+#include "libqos/pci-pc.h"
+#include "libqos/malloc-pc.h"
+
+#include "qemu-common.h"
+#include "qapi/qmp/qlist.h"
+#include "hw/pci/pci_regs.h"
+
+#define TEST_IMAGE_SIZE     (64 * 1024 * 1024)
+
+#define PCI_SLOT            4
+#define PCI_VENDOR_ID_REDHAT_QUMRANET   0x1af4
+#define PCI_DEVICE_ID_VIRTIO_BLOCK      0x1001
+
+#define MAX_QUEUES          8
+#define REQ_SIZE            4096
+#define DESCS_PER_REQ       3
+
+#define USED_TIMEOUT_US     (5 * 1000 * 1000)
+
+/* Legacy virtio-pci register layout, MSI-X disabled */
+enum {
+    VIRTIO_PCI_HOST_FEATURES    = 0x00,
+    VIRTIO_PCI_GUEST_FEATURES   = 0x04,
+    VIRTIO_PCI_QUEUE_PFN        = 0x08,
+    VIRTIO_PCI_QUEUE_NUM        = 0x0c,
+    VIRTIO_PCI_QUEUE_SEL        = 0x0e,
+    VIRTIO_PCI_QUEUE_NOTIFY     = 0x10,
+    VIRTIO_PCI_STATUS           = 0x12,
+    VIRTIO_PCI_ISR              = 0x13,
+    VIRTIO_PCI_CONFIG           = 0x14,
+};
+
+enum {
+    VIRTIO_CONFIG_S_ACKNOWLEDGE = 1,
+    VIRTIO_CONFIG_S_DRIVER      = 2,
+    VIRTIO_CONFIG_S_DRIVER_OK   = 4,
+};
+
+enum {
+    VRING_DESC_F_NEXT   = 1,
+    VRING_DESC_F_WRITE  = 2,
+};
+
+enum {
+    VIRTIO_BLK_F_MQ             = 12,
+    VIRTIO_BLK_CFG_NUM_QUEUES   = 34,   /* offset in device config */
+};
+
+enum {
+    VIRTIO_BLK_T_IN     = 0,
+    VIRTIO_BLK_T_OUT    = 1,
+};
+
+typedef struct {
+    uint16_t index;
+    uint16_t num;
+    uint64_t desc;
+    uint64_t avail;
+    uint64_t used;
+    uint16_t avail_idx;
+    uint16_t last_used_idx;
+
+    /* One preallocated request per slot, using descriptors
+     * DESCS_PER_REQ * slot onwards.
+     */
+    unsigned int nslots;
+    uint64_t hdr;
+    uint64_t data;
+    uint64_t status;
+} TestQueue;
+
+typedef struct {
+    QPCIDevice *dev;
+    void *addr;
+    unsigned int num_queues;
+    TestQueue vq[MAX_QUEUES];
+} TestDevice;
+
+static QPCIBus *pcibus;
+static QGuestAllocator *guest_malloc;
+static char tmp_path[] = "/tmp/qtest.XXXXXX";
+
+static void vblk_writeb(TestDevice *d, int off, uint8_t val)
+{
+    qpci_io_writeb(d->dev, d->addr + off, val);
+}
+
+static void vblk_writew(TestDevice *d, int off, uint16_t val)
+{
+    qpci_io_writew(d->dev, d->addr + off, val);
+}
+
+static void vblk_writel(TestDevice *d, int off, uint32_t val)
+{
+    qpci_io_writel(d->dev, d->addr + off, val);
+}
+
+static uint8_t vblk_readb(TestDevice *d, int off)
+{
+    return qpci_io_readb(d->dev, d->addr + off);
+}
+
+static uint16_t vblk_readw(TestDevice *d, int off)
+{
+    return qpci_io_readw(d->dev, d->addr + off);
+}
+
+static uint32_t vblk_readl(TestDevice *d, int off)
+{
+    return qpci_io_readl(d->dev, d->addr + off);
+}
+
+static TestDevice *vblk_start_opts(unsigned int num_queues, const char *opts)
+{
+    TestDevice *d = g_new0(TestDevice, 1);
+    char *cmdline;
+
+    cmdline = g_strdup_printf("-drive if=none,id=drive0,file=%s,format=raw "
+                              "-device virtio-blk-pci,drive=drive0,"
+                              "addr=%d.0,num-queues=%u%s",
+                              tmp_path, PCI_SLOT, num_queues, opts);
+    qtest_start(cmdline);
+    g_free(cmdline);
+
+    guest_malloc = pc_alloc_init();
+    if (!pcibus) {
+        pcibus = qpci_init_pc();
+    }
+
+    d->dev = qpci_device_find(pcibus, QPCI_DEVFN(PCI_SLOT, 0));
+    g_assert(d->dev != NULL);
+    g_assert_cmphex(qpci_config_readw(d->dev, PCI_VENDOR_ID), ==,
+                    PCI_VENDOR_ID_REDHAT_QUMRANET);
+    g_assert_cmphex(qpci_config_readw(d->dev, PCI_DEVICE_ID), ==,
+                    PCI_DEVICE_ID_VIRTIO_BLOCK);
+
+    qpci_device_enable(d->dev);
+    d->addr = qpci_iomap(d->dev, 0);
+    g_assert(d->addr != NULL);
+
+    vblk_writeb(d, VIRTIO_PCI_STATUS, 0);
+    vblk_writeb(d, VIRTIO_PCI_STATUS,
+                VIRTIO_CONFIG_S_ACKNOWLEDGE | VIRTIO_CONFIG_S_DRIVER);
+    return d;
+}
+
+static TestDevice *vblk_start(unsigned int num_queues)
+{
+    return vblk_start_opts(num_queues, "");
+}
+
+static void vblk_stop(TestDevice *d)
+{
+    g_free(d->dev);
+    g_free(d);
+    qtest_end();
+}
+
+/* Allocate a legacy vring layout plus per-slot request buffers */
+static void vq_setup(TestDevice *d, unsigned int index)
+{
+    TestQueue *vq = &d->vq[index];
+    size_t desc_size, avail_size, used_offset, ring_size;
+    void *zero;
+    unsigned int i;
+
+    vblk_writew(d, VIRTIO_PCI_QUEUE_SEL, index);
+    vq->index = index;
+    vq->num = vblk_readw(d, VIRTIO_PCI_QUEUE_NUM);
+    g_assert_cmpint(vq->num, >, 0);
+
+    desc_size = 16 * vq->num;
+    avail_size = 6 + 2 * vq->num;
+    used_offset = (desc_size + avail_size + 4095) & ~4095;
+    ring_size = used_offset + 6 + 8 * vq->num;
+
+    vq->desc = guest_alloc(guest_malloc, ring_size);
+    vq->avail = vq->desc + desc_size;
+    vq->used = vq->desc + used_offset;
+
+    zero = g_malloc0(ring_size);
+    memwrite(vq->desc, zero, ring_size);
+    g_free(zero);
+
+    vq->nslots = vq->num / DESCS_PER_REQ;
+    vq->hdr = guest_alloc(guest_malloc, 16 * vq->nslots);
+    vq->data = guest_alloc(guest_malloc, REQ_SIZE * vq->nslots);
+    vq->status = guest_alloc(guest_malloc, vq->nslots);
+
+    for (i = 0; i < vq->nslots; i++) {
+        uint64_t desc = vq->desc + 16 * DESCS_PER_REQ * i;
+        uint16_t head = DESCS_PER_REQ * i;
+
+        writeq(desc, vq->hdr + 16 * i);
+        writel(desc + 8, 16);
+        writew(desc + 12, VRING_DESC_F_NEXT);
+        writew(desc + 14, head + 1);
+
+        writeq(desc + 16, vq->data + REQ_SIZE * i);
+        writel(desc + 24, REQ_SIZE);
+        writew(desc + 28, VRING_DESC_F_NEXT | VRING_DESC_F_WRITE);
+        writew(desc + 30, head + 2);
+
+        writeq(desc + 32, vq->status + i);
+        writel(desc + 40, 1);
+        writew(desc + 44, VRING_DESC_F_WRITE);
+    }
+
+    vblk_writel(d, VIRTIO_PCI_QUEUE_PFN, vq->desc >> 12);
+}
+
+static void vblk_setup(TestDevice *d, unsigned int num_queues)
+{
+    uint32_t features = 0;
+    unsigned int i;
+
+    if (num_queues > 1) {
+        features |= 1u << VIRTIO_BLK_F_MQ;
+    }
+    vblk_writel(d, VIRTIO_PCI_GUEST_FEATURES, features);
+
+    d->num_queues = num_queues;
+    for (i = 0; i < num_queues; i++) {
+        vq_setup(d, i);
+    }
+
+    vblk_writeb(d, VIRTIO_PCI_STATUS,
+                VIRTIO_CONFIG_S_ACKNOWLEDGE | VIRTIO_CONFIG_S_DRIVER |
+                VIRTIO_CONFIG_S_DRIVER_OK);
+}
+
+/* Fill in the request header of a slot; the data descriptor direction
+ * follows the request type.
+ */
+static void vq_prepare(TestQueue *vq, unsigned int slot, uint32_t type,
+                       uint64_t sector)
+{
+    uint64_t desc = vq->desc + 16 * DESCS_PER_REQ * slot;
+    uint16_t flags = VRING_DESC_F_NEXT;
+
+    if (type == VIRTIO_BLK_T_IN) {
+        flags |= VRING_DESC_F_WRITE;
+    }
+    writew(desc + 28, flags);
+
+    writel(vq->hdr + 16 * slot, type);
+    writel(vq->hdr + 16 * slot + 4, 0);
+    writeq(vq->hdr + 16 * slot + 8, sector);
+    writeb(vq->status + slot, 0xff);
+}
+
+static void vq_submit(TestDevice *d, TestQueue *vq,
+                      const unsigned int *slots, unsigned int n)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        uint16_t idx = (vq->avail_idx + i) % vq->num;
+        writew(vq->avail + 4 + 2 * idx, DESCS_PER_REQ * slots[i]);
+    }
+    vq->avail_idx += n;
+    writew(vq->avail + 2, vq->avail_idx);
+
+    vblk_writew(d, VIRTIO_PCI_QUEUE_NOTIFY, vq->index);
+}
+
+/* Collect completed slots without blocking, returns their number */
+static unsigned int vq_reap(TestQueue *vq, unsigned int *slots)
+{
+    uint16_t used_idx = readw(vq->used + 2);
+    unsigned int n = 0;
+
+    while (vq->last_used_idx != used_idx) {
+        uint16_t idx = vq->last_used_idx % vq->num;
+        uint32_t id = readl(vq->used + 4 + 8 * idx);
+
+        g_assert_cmpint(id % DESCS_PER_REQ, ==, 0);
+        slots[n++] = id / DESCS_PER_REQ;
+        vq->last_used_idx++;
+    }
+    return n;
+}
+
+static void vq_wait(TestQueue *vq, unsigned int slot)
+{
+    gint64 deadline = g_get_monotonic_time() + USED_TIMEOUT_US;
+    unsigned int done;
+
+    while (vq_reap(vq, &done) == 0) {
+        g_assert(g_get_monotonic_time() < deadline);
+    }
+    g_assert_cmpint(done, ==, slot);
+    g_assert_cmpint(readb(vq->status + slot), ==, 0);
+}
+
+static void test_single_queue(void)
+{
+    TestDevice *d = vblk_start(1);
+    uint32_t features = vblk_readl(d, VIRTIO_PCI_HOST_FEATURES);
+
+    g_assert_cmphex(features & (1u << VIRTIO_BLK_F_MQ), ==, 0);
+
+    /* Only queue 0 exists */
+    vblk_writew(d, VIRTIO_PCI_QUEUE_SEL, 1);
+    g_assert_cmpint(vblk_readw(d, VIRTIO_PCI_QUEUE_NUM), ==, 0);
+
+    vblk_stop(d);
+}
+
+static void test_multi_queue(void)
+{
+    TestDevice *d = vblk_start(4);
+    uint32_t features = vblk_readl(d, VIRTIO_PCI_HOST_FEATURES);
+    uint8_t pattern[REQ_SIZE];
+    uint8_t buf[REQ_SIZE];
+    unsigned int slot = 0;
+    unsigned int i;
+
+    g_assert_cmphex(features & (1u << VIRTIO_BLK_F_MQ), !=, 0);
+    g_assert_cmpint(vblk_readw(d, VIRTIO_PCI_CONFIG +
+                               VIRTIO_BLK_CFG_NUM_QUEUES), ==, 4);
+
+    vblk_setup(d, 4);
+
+    /* Write through queue 1... */
+    memset(pattern, 0xa5, sizeof(pattern));
+    memwrite(d->vq[1].data, pattern, sizeof(pattern));
+    vq_prepare(&d->vq[1], slot, VIRTIO_BLK_T_OUT, 8);
+    vq_submit(d, &d->vq[1], &slot, 1);
+    vq_wait(&d->vq[1], slot);
+
+    /* ...and read it back through every queue */
+    for (i = 0; i < 4; i++) {
+        memset(buf, 0, sizeof(buf));
+        memwrite(d->vq[i].data, buf, sizeof(buf));
+        vq_prepare(&d->vq[i], slot, VIRTIO_BLK_T_IN, 8);
+        vq_submit(d, &d->vq[i], &slot, 1);
+    }
+    for (i = 0; i < 4; i++) {
+        vq_wait(&d->vq[i], slot);
+        memread(d->vq[i].data, buf, sizeof(buf));
+        g_assert(memcmp(buf, pattern, sizeof(buf)) == 0);
+    }
+
+    vblk_stop(d);
+}
+
+static int64_t get_rd_merged(void)
+{
+    QDict *response = qmp_reply("{ 'execute': 'query-blockstats' }");
+    const QListEntry *entry;
+    int64_t merged = -1;
+
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(response, "return"), entry) {
+        QDict *dev = qobject_to_qdict(qlist_entry_obj(entry));
+
+        if (!strcmp(qdict_get_str(dev, "device"), "drive0")) {
+            merged = qdict_get_int(qdict_get_qdict(dev, "stats"), "rd_merged");
+        }
+    }
+    QDECREF(response);
+
+    g_assert_cmpint(merged, >=, 0);
+    return merged;
+}
+
+/* Submit reads into all @slots with one kick and wait for them */
+static void vq_read_batch(TestDevice *d, TestQueue *vq,
+                          const uint64_t *sectors, unsigned int num_slots)
+{
+    unsigned int slots[8];
+    uint8_t buf[REQ_SIZE];
+    unsigned int done, n;
+    unsigned int i;
+
+    g_assert(num_slots <= ARRAY_SIZE(slots));
+    memset(buf, 0, sizeof(buf));
+    for (i = 0; i < num_slots; i++) {
+        memwrite(vq->data + REQ_SIZE * i, buf, sizeof(buf));
+        vq_prepare(vq, i, VIRTIO_BLK_T_IN, sectors[i]);
+        slots[i] = i;
+    }
+    vq_submit(d, vq, slots, num_slots);
+
+    for (done = 0; done < num_slots; done += n) {
+        gint64 deadline = g_get_monotonic_time() + USED_TIMEOUT_US;
+
+        while ((n = vq_reap(vq, slots)) == 0) {
+            g_assert(g_get_monotonic_time() < deadline);
+        }
+    }
+}
+
+/* Contiguous reads queued with one kick are merged by the device; every
+ * request must still get its own part of the data.  Reads with gaps
+ * between them are submitted one by one.
+ */
+static void test_read_merge(void)
+{
+    TestDevice *d = vblk_start(1);
+    TestQueue *vq;
+    uint64_t sectors[8];
+    uint8_t buf[REQ_SIZE];
+    int64_t merged;
+    unsigned int i;
+
+    vblk_setup(d, 1);
+    vq = &d->vq[0];
+
+    for (i = 0; i < ARRAY_SIZE(sectors); i++) {
+        memset(buf, i + 1, sizeof(buf));
+        memwrite(vq->data + REQ_SIZE * i, buf, sizeof(buf));
+        vq_prepare(vq, i, VIRTIO_BLK_T_OUT, 64 + i * (REQ_SIZE / 512));
+        vq_submit(d, vq, &i, 1);
+        vq_wait(vq, i);
+    }
+
+    g_assert_cmpint(get_rd_merged(), ==, 0);
+
+    for (i = 0; i < ARRAY_SIZE(sectors); i++) {
+        sectors[i] = 64 + i * (REQ_SIZE / 512);
+    }
+    vq_read_batch(d, vq, sectors, ARRAY_SIZE(sectors));
+
+    for (i = 0; i < ARRAY_SIZE(sectors); i++) {
+        g_assert_cmpint(readb(vq->status + i), ==, 0);
+        memread(vq->data + REQ_SIZE * i, buf, sizeof(buf));
+        g_assert_cmpint(buf[0], ==, i + 1);
+        g_assert_cmpint(buf[REQ_SIZE - 1], ==, i + 1);
+    }
+
+    merged = get_rd_merged();
+    g_assert_cmpint(merged, >, 0);
+
+    /* Every other block: nothing is contiguous */
+    for (i = 0; i < ARRAY_SIZE(sectors); i++) {
+        sectors[i] = 64 + 2 * i * (REQ_SIZE / 512);
+    }
+    vq_read_batch(d, vq, sectors, ARRAY_SIZE(sectors));
+
+    for (i = 0; i < ARRAY_SIZE(sectors); i++) {
+        g_assert_cmpint(readb(vq->status + i), ==, 0);
+        memread(vq->data + REQ_SIZE * i, buf, sizeof(buf));
+        g_assert_cmpint(buf[0], ==, i < 4 ? 2 * i + 1 : 0);
+    }
+
+    g_assert_cmpint(get_rd_merged(), ==, merged);
+
+    vblk_stop(d);
+}
+
+/* With moderation, completions only raise an interrupt once the timer
+ * expires or enough of them have accumulated.  qtest owns vm_clock, so
+ * the timer only fires when the test steps the clock.
+ */
+static void test_irq_moderation(void)
+{
+    TestDevice *d = vblk_start_opts(1, ",irq-max-usecs=1000,irq-max-frames=4");
+    TestQueue *vq;
+    unsigned int slots[4];
+    unsigned int done, n;
+    unsigned int i;
+
+    vblk_setup(d, 1);
+    vq = &d->vq[0];
+    vblk_readb(d, VIRTIO_PCI_ISR);
+
+    /* A single completion waits for the timer */
+    slots[0] = 0;
+    vq_prepare(vq, 0, VIRTIO_BLK_T_IN, 0);
+    vq_submit(d, vq, slots, 1);
+    vq_wait(vq, 0);
+    g_assert_cmpint(vblk_readb(d, VIRTIO_PCI_ISR), ==, 0);
+
+    clock_step(500 * 1000);
+    g_assert_cmpint(vblk_readb(d, VIRTIO_PCI_ISR), ==, 0);
+    clock_step(500 * 1000);
+    g_assert_cmpint(vblk_readb(d, VIRTIO_PCI_ISR), ==, 1);
+
+    /* The frame limit sends it right away */
+    for (i = 0; i < ARRAY_SIZE(slots); i++) {
+        vq_prepare(vq, i, VIRTIO_BLK_T_IN, i * 8);
+        slots[i] = i;
+    }
+    vq_submit(d, vq, slots, ARRAY_SIZE(slots));
+    for (done = 0; done < ARRAY_SIZE(slots); done += n) {
+        gint64 deadline = g_get_monotonic_time() + USED_TIMEOUT_US;
+
+        while ((n = vq_reap(vq, slots)) == 0) {
+            g_assert(g_get_monotonic_time() < deadline);
+        }
+    }
+    g_assert_cmpint(vblk_readb(d, VIRTIO_PCI_ISR), ==, 1);
+
+    vblk_stop(d);
+}
+
+/*
+ * IOPS benchmark: keep a fixed number of 4 KB reads in flight on every
+ * queue, like fio with iodepth=QUEUE_DEPTH and numjobs=num_queues.
+ */
+
+#define QUEUE_DEPTH     16
+#define PERF_REQUESTS   20000
+
+static void perf_iops_queues(unsigned int num_queues)
+{
+    TestDevice *d = vblk_start(num_queues);
+    unsigned int slots[QUEUE_DEPTH];
+    unsigned int completed = 0, submitted = 0;
+    uint64_t sectors = TEST_IMAGE_SIZE / 512;
+    double duration;
+    unsigned int i, j;
+
+    vblk_setup(d, num_queues);
+
+    g_test_timer_start();
+    for (i = 0; i < num_queues; i++) {
+        for (j = 0; j < QUEUE_DEPTH; j++) {
+            vq_prepare(&d->vq[i], j, VIRTIO_BLK_T_IN,
+                       g_random_int_range(0, sectors / 8) * 8);
+            slots[j] = j;
+        }
+        vq_submit(d, &d->vq[i], slots, QUEUE_DEPTH);
+        submitted += QUEUE_DEPTH;
+    }
+
+    while (completed < PERF_REQUESTS) {
+        for (i = 0; i < num_queues; i++) {
+            TestQueue *vq = &d->vq[i];
+            unsigned int n = vq_reap(vq, slots);
+
+            completed += n;
+            for (j = 0; j < n && submitted < PERF_REQUESTS; j++) {
+                vq_prepare(vq, slots[j], VIRTIO_BLK_T_IN,
+                           g_random_int_range(0, sectors / 8) * 8);
+                submitted++;
+            }
+            if (j > 0) {
+                vq_submit(d, vq, slots, j);
+            }
+        }
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("%u queue(s), iodepth %u: %u reads in %f s, %.0f IOPS\n",
+                   num_queues, QUEUE_DEPTH, completed, duration,
+                   completed / duration);
+
+    vblk_stop(d);
+}
+
+static void perf_iops(void)
+{
+    unsigned int num_queues;
+
+    for (num_queues = 1; num_queues <= MAX_QUEUES; num_queues *= 2) {
+        perf_iops_queues(num_queues);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *arch = qtest_get_arch();
+    int fd;
+    int ret;
+
+    /* Check architecture */
+    if (strcmp(arch, "i386") && strcmp(arch, "x86_64")) {
+        g_test_message("Skipping test for non-x86\n");
+        return 0;
+    }
+
+    /* Create a temporary raw image */
+    fd = mkstemp(tmp_path);
+    g_assert(fd >= 0);
+    ret = ftruncate(fd, TEST_IMAGE_SIZE);
+    g_assert(ret == 0);
+    close(fd);
+
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/virtio/blk/pci/single-queue", test_single_queue);
+    qtest_add_func("/virtio/blk/pci/multi-queue", test_multi_queue);
+    qtest_add_func("/virtio/blk/pci/read-merge", test_read_merge);
+    qtest_add_func("/virtio/blk/pci/irq-moderation", test_irq_moderation);
+    if (g_test_perf()) {
+        qtest_add_func("/virtio/blk/pci/perf/iops", perf_iops);
+    }
+
+    ret = g_test_run();
+
+    unlink(tmp_path);
+
+    return ret;
+}
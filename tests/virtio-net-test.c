@@ -0,0 +1,369 @@
+/*
+ * QTest testcase for virtio-net transmit batching
+ *
+ * The guest queues many packets with a single kick, so that the device hands
+ * them to the socket backend in batches: through sendmmsg() for datagram
+ * sockets, and with the backend stalling halfway for stream sockets.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <glib.h>
+
+#include "libqtest.h"
+#include "libqos/pci-pc.h"
+#include "libqos/malloc-pc.h"
+
+#include "qemu-common.h"
+#include "hw/pci/pci_regs.h"
+
+#define PCI_SLOT            4
+#define PCI_VENDOR_ID_REDHAT_QUMRANET   0x1af4
+#define PCI_DEVICE_ID_VIRTIO_NET        0x1000
+
+#define TX_QUEUE            1
+#define VNET_HDR_LEN        10
+/* Header, sequence number and payload; the payload buffer is shared */
+#define DESCS_PER_PKT       3
+#define PAYLOAD_MAX         60000
+
+#define TIMEOUT_US          (5 * 1000 * 1000)
+
+/* Legacy virtio-pci register layout, MSI-X disabled */
+enum {
+    VIRTIO_PCI_GUEST_FEATURES   = 0x04,
+    VIRTIO_PCI_QUEUE_PFN        = 0x08,
+    VIRTIO_PCI_QUEUE_NUM        = 0x0c,
+    VIRTIO_PCI_QUEUE_SEL        = 0x0e,
+    VIRTIO_PCI_QUEUE_NOTIFY     = 0x10,
+    VIRTIO_PCI_STATUS           = 0x12,
+};
+
+enum {
+    VIRTIO_CONFIG_S_ACKNOWLEDGE = 1,
+    VIRTIO_CONFIG_S_DRIVER      = 2,
+    VIRTIO_CONFIG_S_DRIVER_OK   = 4,
+};
+
+enum {
+    VRING_DESC_F_NEXT   = 1,
+};
+
+typedef struct {
+    QPCIDevice *dev;
+    void *addr;
+    uint16_t num;
+    uint64_t desc;
+    uint64_t avail;
+    uint64_t used;
+    uint16_t avail_idx;
+    unsigned int nslots;
+    uint64_t hdr;
+    uint64_t seq;
+    uint64_t payload;
+} TestDevice;
+
+static QPCIBus *pcibus;
+static QGuestAllocator *guest_malloc;
+
+static TestDevice *vnet_start(const char *netdev)
+{
+    TestDevice *d = g_new0(TestDevice, 1);
+    char *cmdline;
+
+    cmdline = g_strdup_printf("-netdev %s,id=net0 "
+                              "-device virtio-net-pci,netdev=net0,addr=%d.0",
+                              netdev, PCI_SLOT);
+    qtest_start(cmdline);
+    g_free(cmdline);
+
+    guest_malloc = pc_alloc_init();
+    if (!pcibus) {
+        pcibus = qpci_init_pc();
+    }
+
+    d->dev = qpci_device_find(pcibus, QPCI_DEVFN(PCI_SLOT, 0));
+    g_assert(d->dev != NULL);
+    g_assert_cmphex(qpci_config_readw(d->dev, PCI_VENDOR_ID), ==,
+                    PCI_VENDOR_ID_REDHAT_QUMRANET);
+    g_assert_cmphex(qpci_config_readw(d->dev, PCI_DEVICE_ID), ==,
+                    PCI_DEVICE_ID_VIRTIO_NET);
+
+    qpci_device_enable(d->dev);
+    d->addr = qpci_iomap(d->dev, 0);
+    g_assert(d->addr != NULL);
+
+    qpci_io_writeb(d->dev, d->addr + VIRTIO_PCI_STATUS, 0);
+    qpci_io_writeb(d->dev, d->addr + VIRTIO_PCI_STATUS,
+                   VIRTIO_CONFIG_S_ACKNOWLEDGE | VIRTIO_CONFIG_S_DRIVER);
+    return d;
+}
+
+static void vnet_stop(TestDevice *d)
+{
+    g_free(d->dev);
+    g_free(d);
+    qtest_end();
+}
+
+/* Set up the tx queue with a chain of DESCS_PER_PKT descriptors per slot;
+ * no features are negotiated and the rx queue is left alone.
+ */
+static void vnet_setup(TestDevice *d)
+{
+    size_t desc_size, avail_size, used_offset, ring_size;
+    uint8_t hdr[VNET_HDR_LEN] = { 0 };
+    uint8_t *payload;
+    void *zero;
+    unsigned int i;
+
+    qpci_io_writel(d->dev, d->addr + VIRTIO_PCI_GUEST_FEATURES, 0);
+
+    qpci_io_writew(d->dev, d->addr + VIRTIO_PCI_QUEUE_SEL, TX_QUEUE);
+    d->num = qpci_io_readw(d->dev, d->addr + VIRTIO_PCI_QUEUE_NUM);
+    g_assert_cmpint(d->num, >, 0);
+
+    desc_size = 16 * d->num;
+    avail_size = 6 + 2 * d->num;
+    used_offset = (desc_size + avail_size + 4095) & ~4095;
+    ring_size = used_offset + 6 + 8 * d->num;
+
+    d->desc = guest_alloc(guest_malloc, ring_size);
+    d->avail = d->desc + desc_size;
+    d->used = d->desc + used_offset;
+
+    zero = g_malloc0(ring_size);
+    memwrite(d->desc, zero, ring_size);
+    g_free(zero);
+
+    d->nslots = d->num / DESCS_PER_PKT;
+    d->hdr = guest_alloc(guest_malloc, VNET_HDR_LEN);
+    d->seq = guest_alloc(guest_malloc, 4 * d->nslots);
+    d->payload = guest_alloc(guest_malloc, PAYLOAD_MAX);
+
+    memwrite(d->hdr, hdr, sizeof(hdr));
+    payload = g_malloc(PAYLOAD_MAX);
+    for (i = 0; i < PAYLOAD_MAX; i++) {
+        payload[i] = i;
+    }
+    memwrite(d->payload, payload, PAYLOAD_MAX);
+    g_free(payload);
+
+    for (i = 0; i < d->nslots; i++) {
+        uint64_t desc = d->desc + 16 * DESCS_PER_PKT * i;
+        uint16_t head = DESCS_PER_PKT * i;
+
+        writeq(desc, d->hdr);
+        writel(desc + 8, VNET_HDR_LEN);
+        writew(desc + 12, VRING_DESC_F_NEXT);
+        writew(desc + 14, head + 1);
+
+        writeq(desc + 16, d->seq + 4 * i);
+        writel(desc + 24, 4);
+        writew(desc + 28, VRING_DESC_F_NEXT);
+        writew(desc + 30, head + 2);
+
+        writeq(desc + 32, d->payload);
+        writel(desc + 40, 0);
+        writew(desc + 44, 0);
+    }
+
+    qpci_io_writel(d->dev, d->addr + VIRTIO_PCI_QUEUE_PFN, d->desc >> 12);
+    qpci_io_writeb(d->dev, d->addr + VIRTIO_PCI_STATUS,
+                   VIRTIO_CONFIG_S_ACKNOWLEDGE | VIRTIO_CONFIG_S_DRIVER |
+                   VIRTIO_CONFIG_S_DRIVER_OK);
+}
+
+/* Queue packet @seq in slot @seq with @len payload bytes, without a kick */
+static void vnet_queue_packet(TestDevice *d, unsigned int seq, uint32_t len)
+{
+    uint64_t desc = d->desc + 16 * DESCS_PER_PKT * seq;
+    uint16_t idx = d->avail_idx % d->num;
+
+    writel(d->seq + 4 * seq, seq);
+    writel(desc + 40, len);
+    writew(d->avail + 4 + 2 * idx, DESCS_PER_PKT * seq);
+    d->avail_idx++;
+}
+
+static void vnet_kick(TestDevice *d)
+{
+    writew(d->avail + 2, d->avail_idx);
+    qpci_io_writew(d->dev, d->addr + VIRTIO_PCI_QUEUE_NOTIFY, TX_QUEUE);
+}
+
+/* Wait until all @n packets are used, and check that they are in order */
+static void vnet_wait_used(TestDevice *d, unsigned int n)
+{
+    gint64 deadline = g_get_monotonic_time() + TIMEOUT_US;
+    unsigned int i;
+
+    while (readw(d->used + 2) != n) {
+        g_assert(g_get_monotonic_time() < deadline);
+        g_usleep(1000);
+    }
+    for (i = 0; i < n; i++) {
+        g_assert_cmpint(readl(d->used + 4 + 8 * i), ==, DESCS_PER_PKT * i);
+    }
+}
+
+static int socket_local(int type, int *port)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t addrlen = sizeof(addr);
+    struct timeval tv = { .tv_sec = TIMEOUT_US / 1000000 };
+    int fd;
+
+    fd = socket(AF_INET, type, 0);
+    g_assert(fd >= 0);
+    g_assert(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0);
+    g_assert(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    g_assert(getsockname(fd, (struct sockaddr *)&addr, &addrlen) == 0);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static void recv_all(int fd, void *buf, size_t len)
+{
+    size_t off = 0;
+    ssize_t n;
+
+    while (off < len) {
+        n = recv(fd, (uint8_t *)buf + off, len - off, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        g_assert_cmpint(n, >, 0);
+        off += n;
+    }
+}
+
+static void check_packet(const uint8_t *pkt, size_t len, unsigned int seq,
+                         uint32_t payload_len)
+{
+    unsigned int i;
+
+    g_assert_cmpint(len, ==, 4 + payload_len);
+    g_assert_cmpint(ldl_le_p(pkt), ==, seq);
+    for (i = 0; i < payload_len; i++) {
+        if (pkt[4 + i] != (uint8_t)i) {
+            g_assert_cmpint(pkt[4 + i], ==, (uint8_t)i);
+        }
+    }
+}
+
+/* More packets than fit one batch, all going out through sendmmsg() */
+static void test_tx_batch_dgram(void)
+{
+    TestDevice *d;
+    char *netdev;
+    uint8_t buf[2048];
+    unsigned int i, n;
+    int fd, port;
+
+    fd = socket_local(SOCK_DGRAM, &port);
+    netdev = g_strdup_printf("socket,udp=127.0.0.1:%d,"
+                             "localaddr=127.0.0.1:0", port);
+    d = vnet_start(netdev);
+    g_free(netdev);
+    vnet_setup(d);
+
+    n = MIN(d->nslots, 50);
+    for (i = 0; i < n; i++) {
+        vnet_queue_packet(d, i, 60 + i);
+    }
+    vnet_kick(d);
+
+    for (i = 0; i < n; i++) {
+        ssize_t len = recv(fd, buf, sizeof(buf), 0);
+
+        g_assert_cmpint(len, >, 0);
+        check_packet(buf, len, i, 60 + i);
+    }
+    vnet_wait_used(d, n);
+
+    vnet_stop(d);
+    close(fd);
+}
+
+/* The stream backend stalls on a full socket.  The packet it was sending is
+ * completed later and the rest go back to the ring, so that nothing is lost
+ * or reordered once the test starts reading.
+ */
+static void test_tx_stall_stream(void)
+{
+    TestDevice *d;
+    char *netdev;
+    uint8_t *buf = g_malloc(4 + PAYLOAD_MAX);
+    int rcvbuf = 4096;
+    unsigned int i, n;
+    int lfd, fd, port;
+
+    lfd = socket_local(SOCK_STREAM, &port);
+    g_assert(setsockopt(lfd, SOL_SOCKET, SO_RCVBUF,
+                        &rcvbuf, sizeof(rcvbuf)) == 0);
+    g_assert(listen(lfd, 1) == 0);
+
+    netdev = g_strdup_printf("socket,connect=127.0.0.1:%d", port);
+    d = vnet_start(netdev);
+    g_free(netdev);
+    fd = accept(lfd, NULL, NULL);
+    g_assert(fd >= 0);
+    close(lfd);
+
+    vnet_setup(d);
+
+    /* Several megabytes, more than the socket buffers hold */
+    n = d->nslots;
+    for (i = 0; i < n; i++) {
+        vnet_queue_packet(d, i, PAYLOAD_MAX);
+    }
+    vnet_kick(d);
+
+    for (i = 0; i < n; i++) {
+        uint32_t len;
+
+        recv_all(fd, &len, sizeof(len));
+        len = ntohl(len);
+        g_assert_cmpint(len, <=, 4 + PAYLOAD_MAX);
+        recv_all(fd, buf, len);
+        check_packet(buf, len, i, PAYLOAD_MAX);
+    }
+    vnet_wait_used(d, n);
+
+    vnet_stop(d);
+    close(fd);
+    g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    const char *arch = qtest_get_arch();
+
+    /* Check architecture */
+    if (strcmp(arch, "i386") && strcmp(arch, "x86_64")) {
+        g_test_message("Skipping test for non-x86\n");
+        return 0;
+    }
+
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/virtio/net/pci/tx-batch-dgram", test_tx_batch_dgram);
+    qtest_add_func("/virtio/net/pci/tx-stall-stream", test_tx_stall_stream);
+
+    return g_test_run();
+}
@@ -42,8 +42,8 @@ struct ThreadPoolElement {
     void *arg;
 
     /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
-     * of state and ret are ordered with memory barriers.
+     * that, only the worker thread can write to it, and it does so with
+     * lock taken when the request is done.
      */
     enum ThreadState state;
     int ret;
@@ -51,8 +51,8 @@ struct ThreadPoolElement {
     /* Access to this list is protected by lock.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
-    /* Access to this list is protected by the global mutex.  */
-    QLIST_ENTRY(ThreadPoolElement) all;
+    /* On pool->completed (protected by lock), then on pool->dispatch */
+    QSIMPLEQ_ENTRY(ThreadPoolElement) done;
 };
 
 struct ThreadPool {
@@ -62,14 +62,17 @@ struct ThreadPool {
     QemuCond check_cancel;
     QemuCond worker_stopped;
     QemuSemaphore sem;
-    int max_threads;
     QEMUBH *new_thread_bh;
 
     /* The following variables are only accessed from one AioContext. */
-    QLIST_HEAD(, ThreadPoolElement) head;
+    QSIMPLEQ_HEAD(, ThreadPoolElement) dispatch;
+    int outstanding;
 
     /* The following variables are protected by lock.  */
     QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    QSIMPLEQ_HEAD(, ThreadPoolElement) completed;
+    int min_threads;
+    int max_threads;
     int cur_threads;
     int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
@@ -86,20 +89,30 @@ static void *worker_thread(void *opaque)
     pool->pending_threads--;
     do_spawn_thread(pool);
 
-    while (!pool->stopping) {
+    while (!pool->stopping && pool->cur_threads <= pool->max_threads) {
         ThreadPoolElement *req;
         int ret;
 
+        /* Threads above min_threads exit after 10 seconds of idleness */
         do {
             pool->idle_threads++;
             qemu_mutex_unlock(&pool->lock);
             ret = qemu_sem_timedwait(&pool->sem, 10000);
             qemu_mutex_lock(&pool->lock);
             pool->idle_threads--;
-        } while (ret == -1 && !QTAILQ_EMPTY(&pool->request_list));
+        } while (ret == -1 && (!QTAILQ_EMPTY(&pool->request_list) ||
+                               pool->cur_threads <= pool->min_threads));
         if (ret == -1 || pool->stopping) {
             break;
         }
+        if (pool->cur_threads > pool->max_threads) {
+            /* max_threads was lowered; leave the request to a thread that
+             * is within the limit.  cur_threads drops before the lock is
+             * released, so the chain of hand-offs ends.
+             */
+            qemu_sem_post(&pool->sem);
+            break;
+        }
 
         req = QTAILQ_FIRST(&pool->request_list);
         QTAILQ_REMOVE(&pool->request_list, req, reqs);
@@ -108,17 +121,20 @@ static void *worker_thread(void *opaque)
 
         ret = req->func(req->arg);
 
+        qemu_mutex_lock(&pool->lock);
         req->ret = ret;
-        /* Write ret before state.  */
-        smp_wmb();
         req->state = THREAD_DONE;
-
-        qemu_mutex_lock(&pool->lock);
         if (pool->pending_cancellations) {
             qemu_cond_broadcast(&pool->check_cancel);
         }
 
-        event_notifier_set(&pool->notifier);
+        /* One wakeup covers every request completed before the
+         * AioContext gets around to collecting them.
+         */
+        if (QSIMPLEQ_EMPTY(&pool->completed)) {
+            event_notifier_set(&pool->notifier);
+        }
+        QSIMPLEQ_INSERT_TAIL(&pool->completed, req, done);
     }
 
     pool->cur_threads--;
@@ -170,37 +186,36 @@ static void spawn_thread(ThreadPool *pool)
 static void event_notifier_ready(EventNotifier *notifier)
 {
     ThreadPool *pool = container_of(notifier, ThreadPool, notifier);
-    ThreadPoolElement *elem, *next;
+    ThreadPoolElement *elem;
 
     event_notifier_test_and_clear(notifier);
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_CANCELED && elem->state != THREAD_DONE) {
-            continue;
-        }
+
+    qemu_mutex_lock(&pool->lock);
+    QSIMPLEQ_CONCAT(&pool->dispatch, &pool->completed);
+    qemu_mutex_unlock(&pool->lock);
+
+    /* Callbacks may run a nested aio_poll(), which picks up where this
+     * loop left off because the list lives in the pool.
+     */
+    while ((elem = QSIMPLEQ_FIRST(&pool->dispatch))) {
+        QSIMPLEQ_REMOVE_HEAD(&pool->dispatch, done);
+        pool->outstanding--;
+
         if (elem->state == THREAD_DONE) {
             trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                        elem->ret);
+            if (elem->common.cb) {
+                elem->common.cb(elem->common.opaque, elem->ret);
+            }
         }
-        if (elem->state == THREAD_DONE && elem->common.cb) {
-            QLIST_REMOVE(elem, all);
-            /* Read state before ret.  */
-            smp_rmb();
-            elem->common.cb(elem->common.opaque, elem->ret);
-            qemu_aio_release(elem);
-            goto restart;
-        } else {
-            /* remove the request */
-            QLIST_REMOVE(elem, all);
-            qemu_aio_release(elem);
-        }
+        qemu_aio_release(elem);
     }
 }
 
 static int thread_pool_active(EventNotifier *notifier)
 {
     ThreadPool *pool = container_of(notifier, ThreadPool, notifier);
-    return !QLIST_EMPTY(&pool->head);
+    return pool->outstanding > 0;
 }
 
 static void thread_pool_cancel(BlockDriverAIOCB *acb)
@@ -220,7 +235,10 @@ static void thread_pool_cancel(BlockDriverAIOCB *acb)
         qemu_sem_timedwait(&pool->sem, 0) == 0) {
         QTAILQ_REMOVE(&pool->request_list, elem, reqs);
         elem->state = THREAD_CANCELED;
-        event_notifier_set(&pool->notifier);
+        if (QSIMPLEQ_EMPTY(&pool->completed)) {
+            event_notifier_set(&pool->notifier);
+        }
+        QSIMPLEQ_INSERT_TAIL(&pool->completed, elem, done);
     } else {
         pool->pending_cancellations++;
         while (elem->state != THREAD_CANCELED && elem->state != THREAD_DONE) {
@@ -248,7 +266,7 @@ BlockDriverAIOCB *thread_pool_submit_aio(ThreadPool *pool,
     req->state = THREAD_QUEUED;
     req->pool = pool;
 
-    QLIST_INSERT_HEAD(&pool->head, req, all);
+    pool->outstanding++;
 
     trace_thread_pool_submit(pool, req, arg);
 
@@ -303,11 +321,11 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     qemu_cond_init(&pool->check_cancel);
     qemu_cond_init(&pool->worker_stopped);
     qemu_sem_init(&pool->sem, 0);
-    pool->max_threads = 64;
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
-    QLIST_INIT(&pool->head);
+    QSIMPLEQ_INIT(&pool->dispatch);
     QTAILQ_INIT(&pool->request_list);
+    QSIMPLEQ_INIT(&pool->completed);
 
     aio_set_event_notifier(ctx, &pool->notifier, event_notifier_ready,
                            thread_pool_active);
@@ -317,16 +335,33 @@ ThreadPool *thread_pool_new(AioContext *ctx)
 {
     ThreadPool *pool = g_new(ThreadPool, 1);
     thread_pool_init_one(pool, ctx);
+    thread_pool_update_params(pool, pool->ctx);
     return pool;
 }
 
+void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
+{
+    qemu_mutex_lock(&pool->lock);
+    pool->max_threads = MAX(ctx->thread_pool_max, 1);
+    pool->min_threads = MIN(ctx->thread_pool_min, pool->max_threads);
+
+    /* Keep min_threads workers around, so that requests do not wait for
+     * a thread to be created.  Extra threads exit when they are done
+     * with their current request, or when they time out.
+     */
+    while (pool->cur_threads < pool->min_threads) {
+        spawn_thread(pool);
+    }
+    qemu_mutex_unlock(&pool->lock);
+}
+
 void thread_pool_free(ThreadPool *pool)
 {
     if (!pool) {
         return;
     }
 
-    assert(QLIST_EMPTY(&pool->head));
+    assert(pool->outstanding == 0);
 
     qemu_mutex_lock(&pool->lock);
 